@@ -0,0 +1,253 @@
+/*
+ * Incremental document benchmark. Opens a generated script of about 100K
+ * lines through the library in cythonic.h, then times edits of each kind at
+ * pseudo-random places: retyping a number, inserting and deleting a line,
+ * breaking and mending a statement, and opening a block comment that the
+ * next edit closes again. Every CHECK_EVERY edits, and after the last, the
+ * document's statements, diagnostics and tokens are compared with those of
+ * a document opened afresh from its current text.
+ *
+ * Build and run from src/:  make docbench
+ * Or by hand:
+ *   make lib && gcc -O2 -std=c11 -Isrc bench/docbench.c src/libcythonic.a -o docbench -pthread
+ *   ./docbench [lines] [edits per kind]
+ */
+
+#include "cythonic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_LINES 12
+#define CHECK_EVERY 50
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned long long random_state = 88172645463325252ULL;
+
+static int random_below(int limit) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (int)(random_state % (unsigned long long)limit);
+}
+
+// BLOCK_LINES lines per block, as in gen_workloads.py's size series
+static char* generate_source(int lines, size_t* out_length) {
+    int blocks = lines / BLOCK_LINES + 1;
+    size_t capacity = (size_t)blocks * 400 + 64;
+    char* source = malloc(capacity);
+    size_t length = (size_t)sprintf(source, "int total = 0;\n");
+    for (int i = 0; i < blocks; i++) {
+        int name = i % 256;
+        length += (size_t)sprintf(source + length,
+            "{\n"
+            "    int v%d = %d + %d * 3;\n"
+            "    double d%d = v%d * 1.5 - %d.25;\n"
+            "    str s%d = \"item %d\";\n"
+            "    if (v%d > 40 && d%d < 300.0) {\n"
+            "        v%d = v%d * 3 - (v%d %% 7);\n"
+            "    } else {\n"
+            "        v%d += %d;\n"
+            "    }\n"
+            "    /* running total of block %d */\n"
+            "    total = (total + v%d) %% 1000003;\n"
+            "}\n",
+            name, i % 97, i % 13, name, name, i % 7, name, i, name, name, name, name, name, name,
+            i % 5 + 1, i, name);
+    }
+    length += (size_t)sprintf(source + length, "print(total);\n");
+    *out_length = length;
+    return source;
+}
+
+static int compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    const char* name;
+    double* seconds;
+    int count;
+    long statements;     // Re-parsed over all edits
+    long lines;          // Re-lexed
+} Timing;
+
+static void record(Timing* timing, CythonicDocument* doc) {
+    CythonicEditStats stats;
+    cythonic_document_last_edit(doc, &stats);
+    timing->seconds[timing->count++] = stats.seconds;
+    timing->statements += stats.statements_reparsed;
+    timing->lines += stats.lines_relexed;
+}
+
+static void report(Timing* timing) {
+    if (!timing->count) return;
+    qsort(timing->seconds, timing->count, sizeof(double), compare);
+    printf("%-16s %6d edits  median %8.3f ms  p99 %8.3f ms  max %8.3f ms  %6.1f lines relexed  %6.1f statements reparsed\n",
+           timing->name, timing->count, timing->seconds[timing->count / 2] * 1e3,
+           timing->seconds[timing->count * 99 / 100] * 1e3, timing->seconds[timing->count - 1] * 1e3,
+           (double)timing->lines / timing->count, (double)timing->statements / timing->count);
+}
+
+// Statements, diagnostics and tokens of `doc` against a fresh parse of its text
+static int check(CythonicDocument* doc) {
+    size_t length;
+    char* text = cythonic_document_text(doc, &length);
+    CythonicDocument* fresh = cythonic_document_open(text, length);
+    free(text);
+    int mismatches = 0;
+
+    int count = cythonic_document_statement_count(doc);
+    if (count != cythonic_document_statement_count(fresh)) {
+        printf("  statements: %d, fresh %d\n", count, cythonic_document_statement_count(fresh));
+        mismatches++;
+    }
+    for (int i = 0; i < count && !mismatches; i++) {
+        CythonicStatement a, b;
+        cythonic_document_statement(doc, i, &a);
+        cythonic_document_statement(fresh, i, &b);
+        if (strcmp(a.kind, b.kind) || a.line != b.line || a.end_line != b.end_line) {
+            printf("  statement %d: %s %d-%d, fresh %s %d-%d\n", i, a.kind, a.line, a.end_line,
+                   b.kind, b.line, b.end_line);
+            mismatches++;
+        }
+    }
+
+    int errors = cythonic_document_diagnostics(doc, NULL, 0);
+    int fresh_errors = cythonic_document_diagnostics(fresh, NULL, 0);
+    if (errors != fresh_errors) {
+        printf("  diagnostics: %d, fresh %d\n", errors, fresh_errors);
+        mismatches++;
+    } else if (errors) {
+        CythonicDiagnostic* a = malloc(errors * sizeof(CythonicDiagnostic));
+        CythonicDiagnostic* b = malloc(errors * sizeof(CythonicDiagnostic));
+        cythonic_document_diagnostics(doc, a, errors);
+        cythonic_document_diagnostics(fresh, b, errors);
+        for (int i = 0; i < errors; i++) {
+            if (a[i].line != b[i].line || a[i].column != b[i].column || strcmp(a[i].message, b[i].message)) {
+                printf("  diagnostic %d: %d:%d %s, fresh %d:%d %s\n", i, a[i].line, a[i].column, a[i].message,
+                       b[i].line, b[i].column, b[i].message);
+                mismatches++;
+                break;
+            }
+        }
+        free(a);
+        free(b);
+    }
+
+    CythonicToken a[256], b[256];
+    for (int line = 1; line <= cythonic_document_line_count(doc); line++) {
+        int n = cythonic_document_tokens(doc, line, a, 256);
+        int m = cythonic_document_tokens(fresh, line, b, 256);
+        bool same = n == m;
+        for (int i = 0; same && i < n && i < 256; i++) {
+            same = a[i].type == b[i].type && a[i].column == b[i].column && a[i].length == b[i].length;
+        }
+        if (!same) {
+            printf("  tokens on line %d differ\n", line);
+            mismatches++;
+            break;
+        }
+    }
+    cythonic_document_close(fresh);
+    return mismatches;
+}
+
+// The first line at or after `line` holding `text`, and its column
+static int find(CythonicDocument* doc, int line, const char* text, int* column) {
+    size_t length;
+    char* all = cythonic_document_text(doc, &length);
+    int current = 1;
+    const char* p = all;
+    for (; current < line && (p = strchr(p, '\n')); current++) p++;
+    const char* hit = p ? strstr(p, text) : NULL;
+    if (hit) {
+        for (; p < hit; p++) current += *p == '\n';
+        const char* start = hit;
+        while (start > all && start[-1] != '\n') start--;
+        *column = (int)(hit - start) + 1;
+    }
+    free(all);
+    return hit ? current : 0;
+}
+
+int main(int argc, char** argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 100000;
+    int edits = argc > 2 ? atoi(argv[2]) : 200;
+    if (lines < 100) lines = 100;
+    if (edits < 1) edits = 1;
+    size_t length;
+    char* source = generate_source(lines, &length);
+
+    double start = now_seconds();
+    CythonicDocument* doc = cythonic_document_open(source, length);
+    printf("open: %d lines, %.2f MB, %d statements, %.1f ms\n", cythonic_document_line_count(doc),
+           length / 1e6, cythonic_document_statement_count(doc), (now_seconds() - start) * 1e3);
+    free(source);
+
+    Timing timings[] = {
+        { "retype number", NULL, 0, 0, 0 }, { "insert line", NULL, 0, 0, 0 }, { "delete line", NULL, 0, 0, 0 },
+        { "break statement", NULL, 0, 0, 0 }, { "mend statement", NULL, 0, 0, 0 },
+        { "open comment", NULL, 0, 0, 0 }, { "close comment", NULL, 0, 0, 0 },
+    };
+    int kinds = (int)(sizeof(timings) / sizeof(timings[0]));
+    for (int i = 0; i < kinds; i++) timings[i].seconds = malloc(edits * sizeof(double));
+
+    int mismatches = 0, done = 0;
+    for (int round = 0; round < edits; round++) {
+        int line_count = cythonic_document_line_count(doc);
+        int column;
+        // Line 2 + BLOCK_LINES * n opens a block; its next line is "    int vN = A + B * 3;"
+        int block = 2 + BLOCK_LINES * random_below((line_count - 3) / BLOCK_LINES);
+
+        // "+ B" becomes "+ B7", then back
+        int line = find(doc, block, " * 3;", &column);
+        if (line) {
+            cythonic_document_edit(doc, line, column, line, column, "7", 1);
+            record(&timings[0], doc);
+            cythonic_document_edit(doc, line, column, line, column + 1, "", 0);
+        }
+
+        // A statement on a line of its own, then gone again
+        const char* added = "    total = total + 1;\n";
+        cythonic_document_edit(doc, block + 1, 1, block + 1, 1, added, strlen(added));
+        record(&timings[1], doc);
+        cythonic_document_edit(doc, block + 1, 1, block + 2, 1, "", 0);
+        record(&timings[2], doc);
+
+        // Drop a ';' so the statement runs into the next, then put it back
+        line = find(doc, block, "1000003;", &column);
+        if (line) {
+            cythonic_document_edit(doc, line, column + 7, line, column + 8, "", 0);
+            record(&timings[3], doc);
+            cythonic_document_edit(doc, line, column + 7, line, column + 7, ";", 1);
+            record(&timings[4], doc);
+        }
+
+        // "/*" turns code into comment up to the block comment below it
+        cythonic_document_edit(doc, block + 1, 1, block + 1, 1, "/*", 2);
+        record(&timings[5], doc);
+        cythonic_document_edit(doc, block + 1, 1, block + 1, 3, "", 0);
+        record(&timings[6], doc);
+
+        if (++done % CHECK_EVERY == 0 || round == edits - 1) {
+            int found = check(doc);
+            if (found) printf("mismatch after %d rounds\n", done);
+            mismatches += found;
+        }
+    }
+
+    for (int i = 0; i < kinds; i++) report(&timings[i]);
+    printf("checked against fresh parses every %d rounds: %d mismatches\n", CHECK_EVERY, mismatches);
+    for (int i = 0; i < kinds; i++) free(timings[i].seconds);
+    cythonic_document_close(doc);
+    return mismatches ? 1 : 0;
+}
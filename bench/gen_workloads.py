@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Generates the benchmark workloads that `make bench` runs.
+
+    python3 gen_workloads.py [output directory]   (default: generated/)
+
+writes each script and a manifest.json listing them. Every workload records
+how many statements and loop tests it executes (`ops`), counted here as the
+script is written, so the runner can turn the run time into ops per second.
+
+Workloads:
+
+    size_10k .. size_10m   Straight-line blocks of declarations, arithmetic,
+                           conditions and strings at 10K to 10M tokens; the
+                           lexing and parsing rates should stay flat as they grow
+    nested_loops           for inside while, integer and double arithmetic
+    do_while               nested do-while with a countdown
+    string_heavy           appends, concatenation and comparison of strings
+    print_heavy            one print per iteration, numbers and text
+    deep_nesting           expressions nested through every precedence level
+                           (|| && == < as + * unary postfix), 64 parentheses deep
+
+The scripts are deterministic, so a baseline stays comparable.
+"""
+
+import json
+import os
+import sys
+
+BLOCK_TOKENS = 66     # Tokens in one size_block
+SIZES = [("size_10k", 10_000), ("size_100k", 100_000), ("size_1m", 1_000_000), ("size_10m", 10_000_000)]
+NAMES = 256           # Variable names the size series cycles through
+NESTING_DEPTH = 64
+
+
+class Script:
+    def __init__(self, title):
+        self.parts = ["// %s (generated by gen_workloads.py)\n\n" % title]
+        self.ops = 0
+
+    def line(self, text, ops=0):
+        self.parts.append(text + "\n")
+        self.ops += ops
+
+    def text(self):
+        return "".join(self.parts)
+
+
+def size_block(script, index):
+    # BLOCK_TOKENS tokens; exactly one branch of the if runs
+    name = index % NAMES
+    value = index % 97
+    script.line("{", 1)
+    script.line("    int v%d = %d + %d * 3;" % (name, value, index % 13), 1)
+    script.line("    double d%d = v%d * 1.5 - %d.25;" % (name, name, index % 7), 1)
+    script.line("    str s%d = \"item %d\";" % (name, index), 1)
+    script.line("    if (v%d > 40 && d%d < 300.0) {" % (name, name), 1)
+    script.line("        v%d = v%d * 3 - (v%d %% 7);" % (name, name, name), 1)
+    script.line("    } else {")
+    script.line("        v%d += %d;" % (name, index % 5 + 1))
+    script.line("    }")
+    script.line("    // running total of block %d" % index)
+    script.line("    total = (total + v%d) %% 1000003;" % name, 1)
+    script.line("}")
+
+
+def size_script(title, tokens):
+    script = Script("%s: about %d tokens of straight-line blocks" % (title, tokens))
+    script.line("int total = 0;", 1)
+    for index in range(tokens // BLOCK_TOKENS):
+        size_block(script, index)
+    script.line("print(total);", 1)
+    return script
+
+
+def nested_loops():
+    outer, inner = 3000, 1000
+    script = Script("nested_loops: for inside while, %d x %d iterations" % (outer, inner))
+    script.line("int i = 0;", 1)
+    script.line("int j = 0;", 1)
+    script.line("int sum = 0;", 1)
+    script.line("double acc = 0.0;", 1)
+    script.line("while (i < %d) {" % outer, outer + 1)
+    script.line("    for (j = 0; j < %d; j++) {" % inner, outer * (inner + 1))
+    script.line("        sum = (sum + i * j - (j % 7)) % 1000003;", outer * inner)
+    script.line("        acc = acc + j * 0.5;", outer * inner)
+    script.line("        if (acc > 100000.0) acc = acc - 100000.0;", outer * inner * 2)
+    script.line("    }")
+    script.line("    i++;", outer)
+    script.line("}")
+    script.line("print(sum);", 1)
+    script.line("print(acc);", 1)
+    return script
+
+
+def do_while():
+    outer, inner = 2000, 1500
+    script = Script("do_while: nested do-while, %d x %d iterations" % (outer, inner))
+    script.line("int i = %d;" % outer, 1)
+    script.line("int j = 0;", 1)
+    script.line("int hits = 0;", 1)
+    script.line("do {", outer)
+    script.line("    j = %d;" % inner, outer)
+    script.line("    do {", outer * inner)
+    script.line("        if ((i + j) % 3 == 0) hits++;", outer * inner * 2)
+    script.line("        j--;", outer * inner)
+    script.line("    } while (j > 0);")
+    script.line("    i--;", outer)
+    script.line("} while (i > 0);")
+    script.line("print(hits);", 1)
+    return script
+
+
+def string_heavy():
+    count = 300_000
+    script = Script("string_heavy: %d iterations of appends and comparisons" % count)
+    script.line("str text = \"\";", 1)
+    script.line("str word = \"\";", 1)
+    script.line("int same = 0;", 1)
+    script.line("int i = 0;", 1)
+    script.line("while (i < %d) {" % count, count + 1)
+    script.line("    word = \"w\" + i % 10;", count)
+    script.line("    if (word == \"w3\") same++;", count + count // 10)
+    script.line("    text += word;", count)
+    script.line("    i++;", count)
+    script.line("}")
+    script.line("print(same);", 1)
+    script.line("print(text == \"\");", 1)
+    return script
+
+
+def print_heavy():
+    count = 400_000
+    script = Script("print_heavy: %d iterations, two prints each" % count)
+    script.line("int i = 0;", 1)
+    script.line("while (i < %d) {" % count, count + 1)
+    script.line("    print(i * 7);", count)
+    script.line("    print(\"line\");", count)
+    script.line("    i++;", count)
+    script.line("}")
+    return script
+
+
+def nested_expression(depth, seed):
+    # One level per pass of the precedence chain, innermost first
+    levels = [
+        lambda e, n: "(%s || x < %d)" % (e, n),
+        lambda e, n: "(%s && x != %d)" % (e, n),
+        lambda e, n: "(%s == (x > %d))" % (e, n),
+        lambda e, n: "((%s as int) < %d)" % (e, n),
+        lambda e, n: "(%s + %d)" % (e, n),
+        lambda e, n: "(%s * %d %% 1000)" % (e, n + 1),
+        lambda e, n: "(-%s)" % e,
+        lambda e, n: "(x++ - %s)" % e,
+    ]
+    expr = "x"
+    for level in range(depth):
+        expr = levels[(level + seed) % len(levels)](expr, (level * 7 + seed) % 50)
+    return expr
+
+
+def deep_nesting():
+    lines = 2000
+    script = Script("deep_nesting: %d assignments nested %d parentheses deep" % (lines, NESTING_DEPTH))
+    script.line("int x = 1;", 1)
+    script.line("int y = 0;", 1)
+    for line in range(lines):
+        expr = nested_expression(NESTING_DEPTH, line)
+        script.line("y = %s;" % expr, 1)
+        script.line("x = y % 1000;", 1)
+    script.line("print(y);", 1)
+    return script
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), "generated")
+    os.makedirs(out, exist_ok=True)
+    workloads = [size_script(name, tokens) for name, tokens in SIZES]
+    names = [name for name, _ in SIZES]
+    for build in (nested_loops, do_while, string_heavy, print_heavy, deep_nesting):
+        workloads.append(build())
+        names.append(build.__name__)
+
+    manifest = []
+    for name, script in zip(names, workloads):
+        text = script.text()
+        path = os.path.join(out, name + ".cytho")
+        with open(path, "w") as f:
+            f.write(text)
+        kind = "size" if name.startswith("size_") else "kernel"
+        manifest.append({"name": name, "file": name + ".cytho", "kind": kind, "ops": script.ops,
+                         "bytes": len(text.encode())})
+        print("%-14s %10d bytes" % (name, len(text.encode())))
+    with open(os.path.join(out, "manifest.json"), "w") as f:
+        json.dump(manifest, f, indent=2)
+        f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
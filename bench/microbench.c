@@ -0,0 +1,366 @@
+/*
+ * Lexer microbenchmark. Includes the compiler without its main() and times
+ * lex_all over a source file, or over a generated script of about 8 MB that
+ * mixes indentation, long identifiers, comments, strings and numbers. It
+ * then times lex_all_parallel at 1-8 jobs, checking each result against the
+ * single pass, and keyword recognition on every word of that source,
+ * comparing the perfect-hash keyword_lookup with the 26-way trie the lexer
+ * used before. Last it parses the tokens, and walks them with the parser's
+ * cursor over the field-by-field TokenList and over the array of whole
+ * Tokens, copied three at a time, that the parser used before.
+ *
+ * Build and run both scanners from src/:  make microbench
+ * Or by hand:
+ *   gcc -O2 -std=c11 -DCYTHONIC_NO_MAIN bench/microbench.c -o microbench -pthread
+ *   ./microbench [source.cytho | -] [iterations]    (- or nothing: generated script)
+ */
+
+#include "../src/Cythonic.c"
+
+#include <time.h>
+
+#define GENERATED_SIZE (8 * 1024 * 1024)
+#define TRIE_MAX_STATES 200
+#define KEYWORD_ROUNDS 20
+#define CURSOR_ROUNDS 20
+
+// --- The previous keyword recognizer, kept as the baseline ---
+// One node per keyword prefix, each with a full 26-entry transition table.
+
+typedef struct {
+    int transitions[26];
+    bool is_accepting;
+    TokenType accepting_type;
+} TrieNode;
+
+typedef struct {
+    TrieNode nodes[TRIE_MAX_STATES];
+    int node_count;
+} KeywordTrie;
+
+static void trie_add(KeywordTrie* trie, const char* text, TokenType type) {
+    int state = 0;
+    for (int i = 0; text[i]; i++) {
+        int index = to_lower(text[i]) - 'a';
+        if (trie->nodes[state].transitions[index] == -1) {
+            int next = trie->node_count++;
+            trie->nodes[state].transitions[index] = next;
+            for (int j = 0; j < 26; j++) trie->nodes[next].transitions[j] = -1;
+            trie->nodes[next].is_accepting = false;
+        }
+        state = trie->nodes[state].transitions[index];
+    }
+    trie->nodes[state].is_accepting = true;
+    trie->nodes[state].accepting_type = type;
+}
+
+static KeywordTrie* trie_create(void) {
+    KeywordTrie* trie = calloc(1, sizeof(KeywordTrie));
+    trie->node_count = 1;
+    for (int i = 0; i < 26; i++) trie->nodes[0].transitions[i] = -1;
+    for (int slot = 0; slot < KEYWORD_SLOTS; slot++) {
+        if (KEYWORD_TABLE[slot].text) trie_add(trie, KEYWORD_TABLE[slot].text, KEYWORD_TABLE[slot].type);
+    }
+    return trie;
+}
+
+static int trie_move(KeywordTrie* trie, int state, char c) {
+    if (state < 0 || state >= trie->node_count) return -1;
+    int index = c - 'a';
+    if (index < 0 || index >= 26) return -1;
+    return trie->nodes[state].transitions[index];
+}
+
+// The lexer's old identifier path: an all-letters pre-scan, then a walk
+static TokenType trie_lookup(KeywordTrie* trie, const char* raw, int length) {
+    for (int i = 0; i < length; i++) if (!is_letter(raw[i])) return IDENTIFIER;
+    int state = 0;
+    for (int i = 0; i < length; i++) {
+        state = trie_move(trie, state, to_lower(raw[i]));
+        if (state == -1) return IDENTIFIER;
+    }
+    return trie->nodes[state].is_accepting ? trie->nodes[state].accepting_type : IDENTIFIER;
+}
+
+static TokenType hash_lookup(const char* raw, int length) {
+    const Keyword* keyword = keyword_lookup(raw, length);
+    return keyword ? keyword->type : IDENTIFIER;
+}
+
+// --- The previous parser cursor, kept as the baseline ---
+// Whole Tokens in one array; every step copies previous, current and next.
+
+typedef struct {
+    const Token* tokens;
+    int count;
+    int index;
+    Token previous;
+    Token current;
+    Token next;
+} TokenCursor;
+
+static void cursor_advance(TokenCursor* cursor) {
+    cursor->previous = cursor->current;
+    cursor->current = cursor->next;
+    if (cursor->current.type != TOKEN_EOF && cursor->index < cursor->count) {
+        cursor->next = cursor->tokens[cursor->index++];
+    } else {
+        cursor->next = eof_token;
+    }
+}
+
+static bool cursor_match(TokenCursor* cursor, TokenType type) {
+    if (cursor->current.type != type) return false;
+    cursor_advance(cursor);
+    return true;
+}
+
+// The statement dispatch's chain of tests, run on every token. Both cursors
+// take the same branches; the sum of the line numbers picked up along the
+// way is what a parser reads into its nodes.
+static long walk_tokens(TokenCursor* cursor) {
+    long sum = 0;
+    while (cursor->current.type != TOKEN_EOF) {
+        if (cursor_match(cursor, SEMICOLON) || cursor_match(cursor, LEFT_BRACE) ||
+            cursor_match(cursor, RIGHT_BRACE) || cursor_match(cursor, TYPE) ||
+            cursor_match(cursor, IDENTIFIER) || cursor_match(cursor, NUMBER)) {
+            sum += cursor->previous.line;
+        } else {
+            cursor_advance(cursor);
+        }
+    }
+    return sum;
+}
+
+static long walk_parser(Parser* parser) {
+    long sum = 0;
+    while (!check(parser, TOKEN_EOF)) {
+        if (match(parser, SEMICOLON) || match(parser, LEFT_BRACE) ||
+            match(parser, RIGHT_BRACE) || match(parser, TYPE) ||
+            match(parser, IDENTIFIER) || match(parser, NUMBER)) {
+            sum += token_pos(parser, parser->previous).line;
+        } else {
+            advance(parser);
+        }
+    }
+    return sum;
+}
+
+typedef struct {
+    const char* text;
+    int length;
+} Word;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char* read_source(const char* path, size_t* out_length) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = malloc(size + 1);
+    size_t length = fread(source, 1, size, file);
+    source[length] = '\0';
+    fclose(file);
+    *out_length = length;
+    return source;
+}
+
+static char* generate_source(size_t* out_length) {
+    char* source = malloc(GENERATED_SIZE + 256);
+    size_t length = 0;
+    for (int i = 0; length < GENERATED_SIZE; i++) {
+        length += sprintf(source + length,
+            "/* block %d: a longer comment that the scanner skips\n"
+            "   across two lines */\n"
+            "int accumulated_value_number_%d = %d + %d.25e+1 * 3;  // trailing note %d\n"
+            "if (accumulated_value_number_%d > %d) {\n"
+            "        set accumulated_value_number_%d = accumulated_value_number_%d - 1;\n"
+            "        print(\"the value of item %d is now: \", accumulated_value_number_%d);\n"
+            "}\n\n",
+            i, i, i, i % 97, i, i, i % 13, i, i, i, i);
+    }
+    *out_length = length;
+    return source;
+}
+
+int main(int argc, char** argv) {
+    size_t length = 0;
+    bool generated = argc < 2 || strcmp(argv[1], "-") == 0;
+    char* source = generated ? generate_source(&length) : read_source(argv[1], &length);
+    if (!source) {
+        fprintf(stderr, "Error: Cannot open file '%s'\n", argv[1]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (iterations < 1) iterations = 1;
+
+    double best = 0;
+    int token_count = 0;
+    Interner reference_strings;      // The single pass, to check the parallel runs against
+    interner_init(&reference_strings);
+    Arena reference_arena = {0};
+    TokenList reference = {0};
+    reference.arena = &reference_arena;
+    lex_all(lexer_create(source, &reference_strings, &reference_arena), &reference, NULL);
+
+    for (int run = 0; run < iterations; run++) {
+        // A fresh pool and arena per run, as in one compiler invocation
+        Interner strings;
+        interner_init(&strings);
+        Arena arena = {0};
+        TokenList tokens = {0};
+        tokens.arena = &arena;
+
+        double start = now_seconds();
+        lex_all(lexer_create(source, &strings, &arena), &tokens, NULL);
+        double elapsed = now_seconds() - start;
+
+        if (run == 0 || elapsed < best) best = elapsed;
+        token_count = tokens.count;
+        arena_free(&arena);
+        interner_free(&strings);
+    }
+
+    printf("lexer [%s]: %.2f MB, %d tokens, best of %d: %.2f ms, %.1f MB/s, %.1f Mtokens/s\n",
+           SCAN_NAME, length / 1e6, token_count, iterations, best * 1e3,
+           length / 1e6 / best, token_count / 1e6 / best);
+
+    int mismatches = 0;
+    double single = 0;
+    for (int jobs = 1; jobs <= 8; jobs *= 2) {
+        double jobs_best = 0;
+        for (int run = 0; run < iterations; run++) {
+            Interner strings;
+            interner_init(&strings);
+            Arena arena = {0};
+            TokenList tokens = {0};
+            tokens.arena = &arena;
+
+            double start = now_seconds();
+            lex_all_parallel(source, &strings, &arena, jobs, &tokens, NULL);
+            double elapsed = now_seconds() - start;
+            if (run == 0 || elapsed < jobs_best) jobs_best = elapsed;
+
+            if (run == 0) {
+                bool same = tokens.count == reference.count;
+                for (int i = 0; same && i < tokens.count; i++) {
+                    Token a = token_at(&tokens, i);
+                    Token b = token_at(&reference, i);
+                    same = a.type == b.type && a.offset == b.offset && a.length == b.length &&
+                           a.line == b.line && a.column == b.column &&
+                           strcmp(atom_text(&strings, a.atom), atom_text(&reference_strings, b.atom)) == 0;
+                }
+                if (!same) mismatches++;
+            }
+            arena_free(&arena);
+            interner_free(&strings);
+        }
+        if (jobs == 1) single = jobs_best;
+        printf("parallel -j %d: %.2f ms, %.1f MB/s, %.2fx\n",
+               jobs, jobs_best * 1e3, length / 1e6 / jobs_best, single / jobs_best);
+    }
+    arena_free(&reference_arena);
+    interner_free(&reference_strings);
+
+    // Every identifier-shaped word of the source, comments and strings included
+    int word_count = 0;
+    Word* words = malloc((length / 2 + 1) * sizeof(Word));
+    for (size_t i = 0; i < length;) {
+        if (!is_identifier_start(source[i])) { i++; continue; }
+        size_t end = scan_identifier(source, i, length);
+        words[word_count].text = source + i;
+        words[word_count].length = (int)(end - i);
+        word_count++;
+        i = end;
+    }
+
+    KeywordTrie* trie = trie_create();
+    for (int i = 0; i < word_count; i++) {
+        if (trie_lookup(trie, words[i].text, words[i].length) != hash_lookup(words[i].text, words[i].length)) mismatches++;
+    }
+
+    double trie_best = 0, hash_best = 0;
+    long checksum = 0;   // Keeps the lookups from being optimized away
+    for (int run = 0; run < KEYWORD_ROUNDS; run++) {
+        double start = now_seconds();
+        for (int i = 0; i < word_count; i++) checksum += trie_lookup(trie, words[i].text, words[i].length);
+        double trie_time = now_seconds() - start;
+
+        start = now_seconds();
+        for (int i = 0; i < word_count; i++) checksum += hash_lookup(words[i].text, words[i].length);
+        double hash_time = now_seconds() - start;
+
+        if (run == 0 || trie_time < trie_best) trie_best = trie_time;
+        if (run == 0 || hash_time < hash_best) hash_best = hash_time;
+    }
+    printf("keywords: %d words, trie %.2f ns/word, perfect hash %.2f ns/word (%.1fx), %d mismatches [%ld]\n",
+           word_count, trie_best * 1e9 / word_count, hash_best * 1e9 / word_count,
+           trie_best / hash_best, mismatches, checksum);
+
+    free(trie);
+    free(words);
+
+    // The parser's input: everything but comments
+    Interner names;
+    interner_init(&names);
+    Arena token_arena = {0};
+    TokenList parse_tokens = {0};
+    parse_tokens.arena = &token_arena;
+    lex_all(lexer_create(source, &names, &token_arena), NULL, &parse_tokens);
+    Token* whole = malloc((parse_tokens.count + 1) * sizeof(Token));
+    for (int i = 0; i < parse_tokens.count; i++) whole[i] = token_at(&parse_tokens, i);
+
+    double parse_best = 0;
+    for (int run = 0; run < iterations; run++) {
+        Arena ast = {0};
+        Diagnostics diag = {0};
+        diag.buffered = true;
+        double start = now_seconds();
+        Parser* parser = parser_create(&parse_tokens, &names, &ast);
+        parser->diagnostics = &diag;
+        parser_parse(parser);
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < parse_best) parse_best = elapsed;
+        diag_free(&diag);
+        arena_free(&ast);
+    }
+    printf("parser: %d tokens, best of %d: %.2f ms, %.1f Mtokens/s\n",
+           parse_tokens.count, iterations, parse_best * 1e3, parse_tokens.count / 1e6 / parse_best);
+
+    double aos_best = 0, soa_best = 0;
+    long aos_sum = 0, soa_sum = 0;
+    for (int run = 0; run < CURSOR_ROUNDS; run++) {
+        TokenCursor cursor = { whole, parse_tokens.count, 0, eof_token, eof_token, eof_token };
+        double start = now_seconds();
+        cursor.next = parse_tokens.count ? whole[cursor.index++] : eof_token;   // Prime, as parser_create did
+        cursor_advance(&cursor);
+        aos_sum = walk_tokens(&cursor);
+        double aos_time = now_seconds() - start;
+
+        Arena scratch = {0};
+        start = now_seconds();
+        Parser* parser = parser_create(&parse_tokens, &names, &scratch);
+        soa_sum = walk_parser(parser);
+        double soa_time = now_seconds() - start;
+        arena_free(&scratch);
+
+        if (run == 0 || aos_time < aos_best) aos_best = aos_time;
+        if (run == 0 || soa_time < soa_best) soa_best = soa_time;
+    }
+    if (aos_sum != soa_sum) mismatches++;
+    printf("cursor: Token array %.2f ns/token, field arrays %.2f ns/token (%.1fx), %s\n",
+           aos_best * 1e9 / parse_tokens.count, soa_best * 1e9 / parse_tokens.count,
+           aos_best / soa_best, aos_sum == soa_sum ? "same walk" : "MISMATCH");
+
+    free(whole);
+    arena_free(&token_arena);
+    interner_free(&names);
+    free(source);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Runs the generated workloads and compares them against a stored baseline.
+
+    python3 run_bench.py CYTHONIC WORKLOADS [BASELINE] [--runs N] [--write-baseline] [--quick]
+
+CYTHONIC is the compiler, WORKLOADS the directory gen_workloads.py wrote and
+BASELINE a JSON file of earlier results (default: baseline.json next to this
+script). Each workload runs --runs times (default 5) with --stats-json and
+keeps the best of each figure:
+
+    lex MB/s       source bytes over the lexing phase
+    parse Mtok/s   tokens over the parsing phase
+    run Mops/s     the workload's statements and loop tests over the run phase
+
+The size series runs on the tree-walker; the kernels run on the tree-walker,
+the VM and, on x86-64, the JIT. Each figure is shown with its change from the
+baseline, marked when it is more than THRESHOLD slower. The size series is
+then checked for linear scaling: lexing and parsing at the largest size
+should keep at least half their rate at 100K tokens. deep_nesting never
+loops, so the JIT has nothing to compile there; it is checked to run within
+THRESHOLD of the VM.
+
+--write-baseline stores this run as the new baseline; --quick skips the 10M
+token script.
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+
+THRESHOLD = 0.15
+METRICS = [("lex_mbps", "lex MB/s"), ("parse_mtps", "parse Mtok/s"), ("run_mops", "run Mops/s")]
+FLAGS = ["--no-symbol-table", "--no-parse-tree", "--stats-json"]
+
+
+def kernel_modes():
+    modes = [("tree", []), ("vm", ["--vm"])]
+    if platform.machine().lower() in ("x86_64", "amd64"):
+        modes.append(("jit", ["--jit"]))
+    return modes
+
+
+def run_once(cythonic, path, mode_flags):
+    stats_path = path + ".stats.json"
+    if os.path.exists(stats_path):
+        os.remove(stats_path)
+    subprocess.run([cythonic] + FLAGS + mode_flags + [path], stdin=subprocess.DEVNULL,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if not os.path.exists(stats_path):
+        return None
+    with open(stats_path) as f:
+        stats = json.load(f)
+    os.remove(stats_path)
+    return stats
+
+
+def rate(amount, milliseconds):
+    return amount / milliseconds / 1e3 if milliseconds and milliseconds > 0 else None
+
+
+def measure(cythonic, path, workload, mode_flags, runs):
+    best = {}
+    for _ in range(runs):
+        stats = run_once(cythonic, path, mode_flags)
+        if stats is None or stats["status"] != "ok":
+            return None
+        phases = stats["phases"]
+        figures = {
+            "lex_mbps": rate(stats["source_bytes"], phases.get("lex", {}).get("wall_ms")),
+            "parse_mtps": rate(stats["tokens"], phases.get("parse", {}).get("wall_ms")),
+            "run_mops": rate(workload["ops"], phases.get("run", {}).get("wall_ms")),
+        }
+        for key, value in figures.items():
+            if value is not None and (key not in best or value > best[key]):
+                best[key] = value
+    return best
+
+
+def change(value, base):
+    if value is None or not base:
+        return ""
+    delta = value / base - 1
+    mark = " !" if delta < -THRESHOLD else ""
+    return "%+.0f%%%s" % (delta * 100, mark)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Runs the generated workloads against a baseline.")
+    parser.add_argument("cythonic")
+    parser.add_argument("workloads")
+    parser.add_argument("baseline", nargs="?",
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json"))
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--write-baseline", action="store_true")
+    parser.add_argument("--quick", action="store_true")
+    args = parser.parse_args()
+    cythonic, workloads_dir, baseline_path = args.cythonic, args.workloads, args.baseline
+    runs, write_baseline, quick = max(1, args.runs), args.write_baseline, args.quick
+
+    with open(os.path.join(workloads_dir, "manifest.json")) as f:
+        manifest = json.load(f)
+    baseline = {}
+    if not write_baseline and os.path.exists(baseline_path):
+        with open(baseline_path) as f:
+            baseline = json.load(f).get("results", {})
+
+    print("%-14s %-5s" % ("workload", "mode") + "".join(" %13s %7s" % (label, "") for _, label in METRICS))
+    results = {}
+    regressions = 0
+    for workload in manifest:
+        if quick and workload["name"] == "size_10m":
+            continue
+        path = os.path.join(workloads_dir, workload["file"])
+        modes = [("tree", [])] if workload["kind"] == "size" else kernel_modes()
+        for mode, mode_flags in modes:
+            key = "%s/%s" % (workload["name"], mode)
+            best = measure(cythonic, path, workload, mode_flags, runs)
+            if best is None:
+                print("%-14s %-5s  failed" % (workload["name"], mode))
+                regressions += 1
+                continue
+            # Kernels are too short to time their lexing and parsing
+            if workload["kind"] != "size":
+                best = {"run_mops": best["run_mops"]}
+            results[key] = best
+            base = baseline.get(key, {})
+            row = "%-14s %-5s" % (workload["name"], mode)
+            for metric, _ in METRICS:
+                value = best.get(metric)
+                delta = change(value, base.get(metric))
+                regressions += delta.endswith("!")
+                row += " %13s %7s" % ("%.2f" % value if value is not None else "-", delta)
+            print(row)
+
+    sizes = [w["name"] + "/tree" for w in manifest if w["kind"] == "size" and w["name"] + "/tree" in results]
+    if "size_100k/tree" in results and len(sizes) > 1:
+        reference = results["size_100k/tree"]
+        largest = results[sizes[-1]]
+        for metric, label in METRICS[:2]:
+            ratio = largest[metric] / reference[metric]
+            verdict = "linear" if ratio >= 0.5 else "NOT LINEAR"
+            print("scaling: %s at %s is %.2fx that at size_100k (%s)" %
+                  (label, sizes[-1].split("/")[0], ratio, verdict))
+            regressions += ratio < 0.5
+    if "deep_nesting/jit" in results and "deep_nesting/vm" in results:
+        ratio = results["deep_nesting/jit"]["run_mops"] / results["deep_nesting/vm"]["run_mops"]
+        verdict = "ok" if ratio >= 1 - THRESHOLD else "SLOWER THAN THE VM"
+        print("jit: run Mops/s on deep_nesting is %.2fx the VM's (%s)" % (ratio, verdict))
+        regressions += ratio < 1 - THRESHOLD
+
+    if write_baseline:
+        results = {key: {metric: round(value, 3) for metric, value in figures.items()}
+                   for key, figures in results.items()}
+        with open(baseline_path, "w") as f:
+            json.dump({"machine": platform.platform(), "runs": runs, "results": results}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("Baseline written to: %s" % baseline_path)
+    elif not baseline:
+        print("No baseline at %s; make bench-baseline stores one." % baseline_path)
+    elif regressions:
+        print("%d figure(s) more than %.0f%% below the baseline or failed." % (regressions, THRESHOLD * 100))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,217 @@
+/*
+ * Fuzzing entry points. Includes the compiler without its main() and feeds it
+ * arbitrary bytes through LLVMFuzzerTestOneInput. Built with FUZZ_LEXER, an
+ * input goes through lexer_next_token alone, which must move forward on every
+ * call and return tokens that lie inside the source, in order, without
+ * overlapping. Otherwise the tokens are also parsed, which must consume every
+ * one of them, and a clean parse is resolved, optimized at -O2 and compiled
+ * to bytecode. Nothing is executed: a generated program may never stop.
+ *
+ * libFuzzer:
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -DCYTHONIC_NO_MAIN fuzz/fuzz_cythonic.c -o fuzz-parser
+ *   ./fuzz-parser -max_len=65536 corpus/ samples/
+ * AFL++, in persistent mode when the input comes on stdin:
+ *   afl-clang-fast -O2 -DCYTHONIC_NO_MAIN -DFUZZ_STANDALONE fuzz/fuzz_cythonic.c -o fuzz-parser -pthread
+ *   afl-fuzz -i samples -o findings -- ./fuzz-parser
+ *
+ * FUZZ_STANDALONE adds a main() that runs each file given, or stdin, once,
+ * which also replays a crashing input. With -n N it then runs N mutants of
+ * those files: bytes flipped, inserted, deleted and runs of them repeated.
+ * From src/, make fuzz builds both targets with the address and undefined
+ * behaviour sanitizers and runs them over the sample scripts and their
+ * mutants.
+ */
+
+#include "../src/Cythonic.c"
+
+#ifdef FUZZ_LEXER
+
+static void fuzz_check(bool holds, const char* what) {
+    if (!holds) {
+        fprintf(stderr, "fuzz: %s\n", what);
+        abort();
+    }
+}
+
+static void fuzz_one(const char* source, size_t length) {
+    Interner strings;
+    interner_init(&strings);
+    Arena arena = {0};
+    Lexer* lexer = lexer_create(source, &strings, &arena);
+    size_t end = 0;
+    int line = 1;
+    for (;;) {
+        int before = lexer->index;
+        Token token = lexer_next_token(lexer);
+        if (token.type == TOKEN_EOF) break;
+        fuzz_check(lexer->index > before, "lexer_next_token made no progress");
+        fuzz_check(token.type < TOKEN_EOF, "token type out of range");
+        fuzz_check(token.offset >= end, "token overlaps the one before");
+        fuzz_check((size_t)token.offset + token.length <= length, "token runs past the source");
+        fuzz_check(token.line >= line && token.column >= 1, "token position goes back");
+        end = (size_t)token.offset + token.length;
+        line = token.line;
+    }
+    fuzz_check(lexer_is_at_end(lexer), "lexer stopped before the end");
+    arena_free(&arena);
+    interner_free(&strings);
+}
+
+#else
+
+static void fuzz_one(const char* source, size_t length) {
+    (void)length;
+    Interner strings;
+    interner_init(&strings);
+    Arena token_arena = {0};
+    Arena ast = {0};
+    TokenList tokens = {0};
+    tokens.arena = &token_arena;
+    lex_all(lexer_create(source, &strings, &token_arena), NULL, &tokens);
+
+    Diagnostics diag = {0};
+    diag.buffered = true;
+    Parser* parser = parser_create(&tokens, &strings, &ast);
+    parser->diagnostics = &diag;
+    Program* program = parser_parse(parser);
+    if (parser->current != tokens.count) {
+        fprintf(stderr, "fuzz: the parser stopped at token %d of %d\n", parser->current, tokens.count);
+        abort();
+    }
+    if (!parser->had_error) {
+        resolve_program(program);
+        optimize_program(program, &ast, 2);
+        layout_frame(program);
+        Chunk chunk;
+        compile_program(program, &chunk);
+        chunk_free(&chunk);
+    }
+    diag_free(&diag);
+    arena_free(&ast);
+    arena_free(&token_arena);
+    interner_free(&strings);
+}
+
+#endif
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // The lexer reads up to the first NUL, as it does a source file
+    char* source = malloc(size + 1);
+    memcpy(source, data, size);
+    source[size] = '\0';
+    fuzz_one(source, strlen(source));
+    free(source);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#define FUZZ_MAX_INPUT (1 << 20)
+
+static unsigned long long random_state = 88172645463325252ULL;
+
+static size_t random_below(size_t limit) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (size_t)(random_state % (unsigned long long)limit);
+}
+
+static uint8_t* read_input(FILE* file, size_t* size) {
+    uint8_t* data = malloc(FUZZ_MAX_INPUT);
+    *size = fread(data, 1, FUZZ_MAX_INPUT, file);
+    return data;
+}
+
+// A copy of `seed` with a few random edits, in `out` of FUZZ_MAX_INPUT bytes
+static size_t mutate(const uint8_t* seed, size_t size, uint8_t* out) {
+    static const char pieces[] = "(){}[];,\"'/*+-!<=>&|\\\n ";
+    memcpy(out, seed, size);
+    int edits = 1 + (int)random_below(8);
+    for (int i = 0; i < edits; i++) {
+        size_t at = random_below(size + 1);
+        switch (random_below(4)) {
+        case 0:   // Flip a byte, or overwrite it with a piece of syntax
+            if (at < size) out[at] = random_below(2) ? out[at] ^ (uint8_t)(1u << random_below(8))
+                                                     : (uint8_t)pieces[random_below(sizeof(pieces) - 1)];
+            break;
+        case 1:   // Insert a piece of syntax
+            if (size < FUZZ_MAX_INPUT) {
+                memmove(out + at + 1, out + at, size - at);
+                out[at] = (uint8_t)pieces[random_below(sizeof(pieces) - 1)];
+                size++;
+            }
+            break;
+        case 2: { // Delete a run
+            size_t length = at < size ? 1 + random_below(size - at < 64 ? size - at : 64) : 0;
+            memmove(out + at, out + at + length, size - at - length);
+            size -= length;
+            break;
+        }
+        default: { // Repeat a short run many times, to build deep or long structures
+            size_t length = at < size ? 1 + random_below(size - at < 8 ? size - at : 8) : 0;
+            size_t times = 1 + random_below(2000);
+            if (length == 0 || size + length * times > FUZZ_MAX_INPUT) break;
+            memmove(out + at + length * times, out + at, size - at);
+            for (size_t k = 0; k < times; k++) memcpy(out + at + length * k, out + at + length * times, length);
+            size += length * times;
+            break;
+        }
+        }
+    }
+    return size;
+}
+
+int main(int argc, char** argv) {
+    long rounds = 0;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        rounds = strtol(argv[2], NULL, 10);
+        first = 3;
+    }
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+    // AFL++ persistent mode: a fresh input on stdin for every pass
+    if (argc <= first) {
+        uint8_t* data = malloc(FUZZ_MAX_INPUT);
+        while (__AFL_LOOP(10000)) {
+            ssize_t size = read(0, data, FUZZ_MAX_INPUT);
+            if (size >= 0) LLVMFuzzerTestOneInput(data, (size_t)size);
+        }
+        free(data);
+        return 0;
+    }
+#endif
+
+    int count = argc > first ? argc - first : 1;
+    uint8_t** seeds = malloc(count * sizeof(uint8_t*));
+    size_t* sizes = malloc(count * sizeof(size_t));
+    for (int i = 0; i < count; i++) {
+        FILE* file = argc > first ? fopen(argv[first + i], "rb") : stdin;
+        if (!file) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", argv[first + i]);
+            return 1;
+        }
+        seeds[i] = read_input(file, &sizes[i]);
+        if (file != stdin) fclose(file);
+    }
+
+    for (int i = 0; i < count; i++) LLVMFuzzerTestOneInput(seeds[i], sizes[i]);
+    uint8_t* mutant = malloc(FUZZ_MAX_INPUT);
+    for (long round = 0; round < rounds; round++) {
+        int seed = (int)random_below((size_t)count);
+        size_t size = mutate(seeds[seed], sizes[seed], mutant);
+        LLVMFuzzerTestOneInput(mutant, size);
+    }
+    printf("fuzz: %d inputs and %ld mutants, no failures\n", count, rounds);
+
+    free(mutant);
+    for (int i = 0; i < count; i++) free(seeds[i]);
+    free(seeds);
+    free(sizes);
+    return 0;
+}
+
+#endif
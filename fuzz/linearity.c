@@ -0,0 +1,192 @@
+/*
+ * Linear-time regression check. Builds inputs meant to make a parser go
+ * quadratic or run out of stack: parentheses, prefix operators and blocks
+ * nested as deep as the input is long, operator chains that build deep
+ * trees, unterminated strings and comments, junk where a class, struct,
+ * record or switch body expects members, long strings and random bytes,
+ * next to a well-formed script as the control. Each is built at a base size
+ * and at SCALE times that, and lexed, parsed and, when it parses cleanly,
+ * resolved, optimized at -O2 and compiled to bytecode, as in the fuzz
+ * target. The check fails if the time or the arena bytes per source byte at
+ * the larger size exceed MAX_RATIO times those at the base size, if the
+ * control or a flat operator chain, which is not nesting however long it
+ * is, fails to parse cleanly, or if a construct nested past the parser's
+ * cap reports "Nested too deeply." other than exactly once.
+ *
+ * Build and run from src/:  make linearity
+ * Or by hand:
+ *   gcc -O2 -std=c11 -DCYTHONIC_NO_MAIN fuzz/linearity.c -o linearity -pthread
+ *   ./linearity [base size in KB]
+ */
+
+#include "../src/Cythonic.c"
+
+#include <time.h>
+
+#define SCALE 8
+#define RUNS 3
+#define MAX_RATIO 3.0
+
+typedef struct {
+    const char* name;
+    const char* head;
+    const char* open;     // Repeated, then `middle`, then `close` as often as `open`
+    const char* middle;
+    const char* close;
+    const char* tail;
+    bool clean;           // Must parse without errors
+    bool deep;            // One construct past PARSE_MAX_DEPTH: one depth error, however deep
+} Shape;
+
+static const Shape shapes[] = {
+    { "control",        "int total = 0;\n",
+      "{ int v = 1 + 2 * 3; str s = \"item\"; if (v > 4 && total < 9) { v = v - 1; } total += v; }\n", "", "", "", true, false },
+    { "parentheses",    "print(", "(", "1", ")", ");\n", false, true },
+    { "not-chain",      "bool b = ", "!", "true", "", ";\n", false, true },
+    { "negations",      "int n = ", "-", "1", "", ";\n", false, true },
+    { "prefix-inc",     "int x = 0; int y = ", "++", "x", "", ";\n", false, true },
+    { "postfix-inc",    "int x = 0; int y = x", "++", "", "", ";\n", false, true },
+    { "plus-chain",     "int x = 1", " + 1", "", "", ";\n", true, false },
+    { "and-chain",      "bool b = true", " && true", "", "", ";\n", true, false },
+    { "mixed-chain",    "int y = 2; bool b = y", " * 3 - y / 2 % 5 + y < 4 == true && y >= 1 || y", "", "", " > 0;\n", true, false },
+    { "braces",         "", "{", "", "}", "", false, true },
+    { "while-nest",     "", "while (1) ", "print(1);\n", "", "", false, true },
+    { "else-if-chain",  "if (1) print(1);\n", "else if (1) print(1);\n", "", "", "", false, true },
+    { "open-strings",   "", "print(\"unterminated\n", "", "", "", false, false },
+    { "open-comment",   "/* ", "never closed ", "", "", "", false, false },
+    { "long-string",    "print(\"", "abcdefgh", "", "", "\");\n", false, false },
+    { "class-junk",     "class A { ", "5 ", "", "", "}\n", false, false },
+    { "struct-junk",    "struct A { ", "5 ", "", "", "}\n", false, false },
+    { "record-junk",    "record A { ", "5 ", "", "", "}\n", false, false },
+    { "switch-junk",    "switch (1) { ", "5 ", "", "", "}\n", false, false },
+    { "random-bytes",   NULL, NULL, NULL, NULL, NULL, false, false },
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned long long random_state = 88172645463325252ULL;
+
+static int random_below(int limit) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (int)(random_state % (unsigned long long)limit);
+}
+
+static void append(char* buffer, size_t* length, const char* text) {
+    size_t size = strlen(text);
+    memcpy(buffer + *length, text, size);
+    *length += size;
+}
+
+// About `size` bytes of the shape
+static char* generate(const Shape* shape, size_t size) {
+    char* source;
+    size_t length = 0;
+    if (!shape->open) {
+        static const char bytes[] = "abcxyz019 \n\t(){}[];,.\"'/*\\+-!<=>&|#@";
+        source = malloc(size + 1);
+        for (; length < size; length++) source[length] = bytes[random_below(sizeof(bytes) - 1)];
+        source[length] = '\0';
+        return source;
+    }
+    size_t unit = strlen(shape->open) + strlen(shape->close);
+    size_t times = size / unit + 1;
+    source = malloc(strlen(shape->head) + times * unit + strlen(shape->middle) + strlen(shape->tail) + 1);
+    append(source, &length, shape->head);
+    for (size_t i = 0; i < times; i++) append(source, &length, shape->open);
+    append(source, &length, shape->middle);
+    for (size_t i = 0; i < times; i++) append(source, &length, shape->close);
+    append(source, &length, shape->tail);
+    source[length] = '\0';
+    return source;
+}
+
+static size_t arena_bytes(const Arena* arena) {
+    size_t bytes = 0;
+    for (const ArenaBlock* block = arena->head; block; block = block->next) bytes += block->used;
+    return bytes;
+}
+
+typedef struct {
+    int tokens;
+    double seconds;      // Best of RUNS
+    size_t bytes;        // Token and tree arenas
+    bool clean;
+    int depth_errors;    // "Nested too deeply." reported
+} Measure;
+
+static Measure measure(const char* source) {
+    Measure best = {0};
+    for (int run = 0; run < RUNS; run++) {
+        Interner strings;
+        interner_init(&strings);
+        Arena token_arena = {0};
+        Arena ast = {0};
+        TokenList tokens = {0};
+        tokens.arena = &token_arena;
+        Diagnostics diag = {0};
+        diag.buffered = true;
+
+        double start = now_seconds();
+        lex_all(lexer_create(source, &strings, &token_arena), NULL, &tokens);
+        Parser* parser = parser_create(&tokens, &strings, &ast);
+        parser->diagnostics = &diag;
+        Program* program = parser_parse(parser);
+        if (!parser->had_error) {
+            resolve_program(program);
+            optimize_program(program, &ast, 2);
+            layout_frame(program);
+            Chunk chunk;
+            compile_program(program, &chunk);
+            chunk_free(&chunk);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (run == 0 || elapsed < best.seconds) best.seconds = elapsed;
+        best.tokens = tokens.count;
+        best.bytes = arena_bytes(&token_arena) + arena_bytes(&ast);
+        best.clean = !parser->had_error;
+        best.depth_errors = 0;
+        for (const char* at = diag.text; at && (at = strstr(at, "Nested too deeply.")); at++) best.depth_errors++;
+        diag_free(&diag);
+        arena_free(&ast);
+        arena_free(&token_arena);
+        interner_free(&strings);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t base = (argc > 1 ? (size_t)atoi(argv[1]) : 256) * 1024;
+    int failures = 0;
+    printf("%-14s %10s %10s %9s %9s %6s %9s %9s %6s\n", "shape", "tokens", "x8 tokens",
+           "ns/byte", "x8", "ratio", "mem/byte", "x8", "ratio");
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        char* small_source = generate(&shapes[i], base);
+        char* large_source = generate(&shapes[i], base * SCALE);
+        Measure small = measure(small_source);
+        Measure large = measure(large_source);
+        double small_size = (double)strlen(small_source), large_size = (double)strlen(large_source);
+        double small_ns = small.seconds * 1e9 / small_size, large_ns = large.seconds * 1e9 / large_size;
+        double small_bytes = small.bytes / small_size, large_bytes = large.bytes / large_size;
+        double time_ratio = large_ns / small_ns;
+        double byte_ratio = small.bytes ? large_bytes / small_bytes : 1.0;
+        bool ok = time_ratio <= MAX_RATIO && byte_ratio <= MAX_RATIO &&
+                  (!shapes[i].clean || (small.clean && large.clean)) &&
+                  (!shapes[i].deep || (small.depth_errors == 1 && large.depth_errors == 1));
+        printf("%-14s %10d %10d %9.2f %9.2f %5.2fx %9.2f %9.2f %5.2fx%s%s\n", shapes[i].name,
+               small.tokens, large.tokens, small_ns, large_ns, time_ratio, small_bytes, large_bytes, byte_ratio,
+               large.clean ? "" : "  (errors)", ok ? "" : "  FAIL");
+        if (!ok) failures++;
+        free(small_source);
+        free(large_source);
+    }
+    if (failures) printf("linearity: %d shapes grew faster than linearly or reported errors wrongly\n", failures);
+    else printf("linearity: every shape linear within %.0fx\n", MAX_RATIO);
+    return failures ? 1 : 0;
+}
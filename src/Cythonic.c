@@ -35,18 +35,24 @@
  *    Primary - Postfix - Unary - Factor - Term - Comparison - And - Or - Assignment
  * 
  * 6. STATEMENTS: Declarations, Assignments, Input, Output, If-Else, While,
- *    For, Blocks, Increment, Decrement
+ *    For, Do-While, Switch (switch, case, default, with fallthrough and
+ *    break), Blocks, Increment, Decrement
  * 
  * 7. LITERALS: Numbers (int, float, scientific), Strings, Characters, Booleans
  * 
  * RESERVED FOR FUTURE (Tokenized only): class, struct, enum, record, iface,
- *    nspace, use, this, base, pub, priv, prot, rdo, switch, case, default,
- *    foreach, do, new, bitwise operations
+ *    nspace, use, this, base, pub, priv, prot, rdo, foreach, new, bitwise
+ *    operations
  * 
- * COMPILER ARCHITECTURE: 200-state DFA Trie, longest-match tokenization,
+ * COMPILER ARCHITECTURE: Perfect-hash keyword table, longest-match tokenization,
  *    panic-mode error recovery, parse tree generation, symbol table tracking
  * 
- * USAGE: cythonic.exe source.cytho
+ * USAGE: cythonic.exe [--vm] [--jit] [--unbuffered] [--profile[-counts]] [--stats[-json]]
+ *            [--direct] [--no-symbol-table] [--cache] [--no-parse-tree] [--binary-trace]
+ *            [--print-trace] [-O[N]] [--max-tokens N] [-j N] source.cytho
+ *        cythonic.exe [options] a.cytho b.cytho ... | directory   (batch check)
+ *        cythonic.exe --server SOCKET [-j N] [options]             (warm compiler)
+ *        cythonic.exe --client SOCKET [--send-paths] [--shutdown] a.cytho ...
  * OUTPUT: source.cytho.symboltable.txt, source.cytho.parsetree.txt
  */
 
@@ -55,6 +61,601 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "cythonic.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#else
+#include <io.h>
+#endif
+
+// The lexer scans 32 bytes at a time with AVX2, 16 with SSE2 or NEON, and one
+// otherwise. -DCYTHONIC_NO_SIMD forces the bytewise scanner.
+#if defined(CYTHONIC_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define LEXER_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LEXER_SIMD_NEON 1
+#endif
+
+/* ============================================================================
+ * ARENA ALLOCATOR
+ * ============================================================================
+ * Bump-pointer allocator: objects are carved from large blocks and released
+ * together by arena_free, so individual nodes never need their own free().
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+    ArenaBlock* spare;   // Standard-size blocks that arena_reset emptied, handed out before new ones
+    int spare_count;
+} Arena;
+
+// Block bytes over every arena, for --stats. Blocks come and go rarely, so
+// counting them atomically costs nothing that shows.
+typedef struct {
+    _Atomic uint64_t allocated;  // Ever, reallocations counting their growth
+    _Atomic uint64_t live;
+    _Atomic uint64_t peak;       // Of live
+    _Atomic uint64_t blocks;     // Ever allocated
+} ArenaUsage;
+
+static ArenaUsage arena_usage;
+
+static void arena_count(size_t added, size_t removed) {
+    if (added) atomic_fetch_add_explicit(&arena_usage.allocated, added, memory_order_relaxed);
+    uint64_t live = atomic_fetch_add_explicit(&arena_usage.live, added - removed, memory_order_relaxed) + added - removed;
+    uint64_t peak = atomic_load_explicit(&arena_usage.peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak(&arena_usage.peak, &peak, live)) {}
+}
+
+// align must be a power of two
+static void* arena_alloc_aligned(Arena* arena, size_t size, size_t align) {
+    ArenaBlock* block = arena->head;
+    size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+    if ((!block || offset + size > block->size) && arena->spare && size <= ARENA_BLOCK_SIZE) {
+        block = arena->spare;
+        arena->spare = block->next;
+        arena->spare_count--;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+        offset = 0;
+    } else if (!block || offset + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        block->used = 0;
+        block->size = block_size;
+        block->next = arena->head;
+        arena->head = block;
+        offset = 0;
+        atomic_fetch_add_explicit(&arena_usage.blocks, 1, memory_order_relaxed);
+        arena_count(block_size, 0);
+    }
+    void* ptr = block->data + offset;
+    block->used = offset + size;
+    return ptr;
+}
+
+static void* arena_alloc(Arena* arena, size_t size) {
+    return arena_alloc_aligned(arena, size, 16);
+}
+
+// Resizes an arena allocation for growable arrays. The most recent allocation
+// is extended in place while its block has room, and an array that has a
+// block to itself is resized with realloc. Otherwise the contents move to
+// fresh space and the old copy is reclaimed with the rest of the arena; once
+// an array outgrows ARENA_BLOCK_SIZE it gets its own block, so large arrays
+// never leave dead copies behind.
+static void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    ArenaBlock* block = arena->head;
+    if (ptr && block && (char*)ptr + old_size == block->data + block->used &&
+        (size_t)((char*)ptr - block->data) + new_size <= block->size) {
+        block->used = (size_t)((char*)ptr - block->data) + new_size;
+        return ptr;
+    }
+    for (ArenaBlock** link = &arena->head; ptr && *link; link = &(*link)->next) {
+        ArenaBlock* own = *link;
+        if (own->data != ptr || own->used != old_size) continue;
+        size_t old_block_size = own->size;
+        own = realloc(own, sizeof(ArenaBlock) + new_size);
+        if (!own) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        arena_count(new_size > old_block_size ? new_size - old_block_size : 0,
+                    new_size < old_block_size ? old_block_size - new_size : 0);
+        own->used = own->size = new_size;
+        *link = own;
+        return own->data;
+    }
+    void* moved = arena_alloc(arena, new_size);
+    if (ptr) memcpy(moved, ptr, old_size);
+    return moved;
+}
+
+static void arena_free_blocks(ArenaBlock* block) {
+    while (block) {
+        ArenaBlock* next = block->next;
+        arena_count(0, block->size);
+        free(block);
+        block = next;
+    }
+}
+
+static void arena_free(Arena* arena) {
+    arena_free_blocks(arena->head);
+    arena_free_blocks(arena->spare);
+    memset(arena, 0, sizeof(Arena));
+}
+
+// Empties the arena for another round of the same work, as a server worker
+// does between requests. Up to ARENA_SPARE_LIMIT standard-size blocks stay
+// allocated for reuse; larger ones and the rest are freed.
+#define ARENA_SPARE_LIMIT 256
+
+static void arena_reset(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        if (block->size == ARENA_BLOCK_SIZE && arena->spare_count < ARENA_SPARE_LIMIT) {
+            block->next = arena->spare;
+            arena->spare = block;
+            arena->spare_count++;
+        } else {
+            arena_count(0, block->size);
+            free(block);
+        }
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+/* ============================================================================
+ * THREADS
+ * ============================================================================
+ * Just enough of a thread API to run one function in the background and wait
+ * for it: Win32 threads on Windows, POSIX threads elsewhere.
+ */
+
+#ifdef _WIN32
+#include <process.h>
+// Declared by hand: <windows.h> defines names (TokenType, CHAR, ...) that
+// collide with the lexer's.
+__declspec(dllimport) unsigned long __stdcall WaitForSingleObject(void* handle, unsigned long milliseconds);
+__declspec(dllimport) int __stdcall CloseHandle(void* handle);
+__declspec(dllimport) void __stdcall Sleep(unsigned long milliseconds);
+typedef void* Thread;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+#endif
+
+typedef struct {
+    void (*func)(void* arg);
+    void* arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static unsigned __stdcall thread_trampoline(void* param) {
+#else
+static void* thread_trampoline(void* param) {
+#endif
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+// Returns false if the thread could not be created; func has not run then.
+static bool thread_start(Thread* thread, void (*func)(void* arg), void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    start->func = func;
+    start->arg = arg;
+#ifdef _WIN32
+    *thread = (Thread)_beginthreadex(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (*thread) return true;
+#else
+    if (pthread_create(thread, NULL, thread_trampoline, start) == 0) return true;
+#endif
+    free(start);
+    return false;
+}
+
+static void thread_join(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, 0xFFFFFFFFul); // INFINITE
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// Strict C11 headers hide nanosleep; a timed wait that nothing signals does
+// the same.
+static void thread_sleep(long microseconds) {
+#ifdef _WIN32
+    Sleep((unsigned long)((microseconds + 999) / 1000));
+#else
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t never = PTHREAD_COND_INITIALIZER;
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += microseconds / 1000000;
+    until.tv_nsec += microseconds % 1000000 * 1000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&mutex);
+    while (pthread_cond_timedwait(&never, &mutex, &until) == 0) {}
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+// Seconds on the wall clock; monotonic where the C library has TIME_MONOTONIC
+static double wall_seconds(void) {
+    struct timespec ts;
+#ifdef TIME_MONOTONIC
+    timespec_get(&ts, TIME_MONOTONIC);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int cpu_count(void) {
+#ifdef _WIN32
+    const char* env = getenv("NUMBER_OF_PROCESSORS");
+    long count = env ? atol(env) : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? (int)count : 1;
+}
+
+// --- Work-Stealing Pool ---
+// Runs task(context, i) for every i in [0, count) on up to `workers` threads,
+// the caller included. Tasks are dealt out as one contiguous run per worker.
+// A worker takes its own tasks from the front of its run, and once that is
+// empty it steals from the back of the others'. A run is a single atomic word,
+// front << 32 | back, so taking and stealing are each one compare-and-swap.
+// No task is added once the pool starts, so a worker that finds every run
+// empty is done. A worker whose thread fails to start simply has its run
+// stolen.
+
+typedef struct {
+    _Atomic uint64_t range;
+} TaskRun;
+
+typedef struct {
+    void (*task)(void* context, int index);
+    void* context;
+    TaskRun* runs;
+    int workers;
+} TaskPool;
+
+typedef struct {
+    TaskPool* pool;
+    int self;
+} TaskWorker;
+
+static bool task_run_take(TaskRun* run, bool from_front, int* index) {
+    uint64_t range = atomic_load(&run->range);
+    for (;;) {
+        uint32_t front = (uint32_t)(range >> 32);
+        uint32_t back = (uint32_t)range;
+        if (front >= back) return false;
+        uint64_t next = from_front ? ((uint64_t)(front + 1) << 32 | back) : ((uint64_t)front << 32 | (back - 1));
+        if (atomic_compare_exchange_weak(&run->range, &range, next)) {
+            *index = (int)(from_front ? front : back - 1);
+            return true;
+        }
+    }
+}
+
+static void task_worker_run(void* arg) {
+    TaskWorker* worker = arg;
+    TaskPool* pool = worker->pool;
+    int index;
+    for (;;) {
+        bool found = task_run_take(&pool->runs[worker->self], true, &index);
+        for (int k = 1; !found && k < pool->workers; k++) {
+            found = task_run_take(&pool->runs[(worker->self + k) % pool->workers], false, &index);
+        }
+        if (!found) return;
+        pool->task(pool->context, index);
+    }
+}
+
+static void task_pool_run(int count, int workers, void (*task)(void* context, int index), void* context) {
+    if (workers > count) workers = count;
+    if (workers < 1) workers = 1;
+    TaskPool pool = { task, context, malloc(workers * sizeof(TaskRun)), workers };
+    TaskWorker* members = malloc(workers * sizeof(TaskWorker));
+    Thread* threads = malloc(workers * sizeof(Thread));
+    bool* started = calloc(workers, sizeof(bool));
+    for (int i = 0; i < workers; i++) {
+        uint64_t front = (uint64_t)count * i / workers;
+        uint64_t back = (uint64_t)count * (i + 1) / workers;
+        atomic_init(&pool.runs[i].range, front << 32 | back);
+        members[i].pool = &pool;
+        members[i].self = i;
+    }
+    for (int i = 1; i < workers; i++) started[i] = thread_start(&threads[i], task_worker_run, &members[i]);
+    task_worker_run(&members[0]);
+    for (int i = 1; i < workers; i++) {
+        if (started[i]) thread_join(threads[i]);
+    }
+    free(pool.runs);
+    free(members);
+    free(threads);
+    free(started);
+}
+
+/* ============================================================================
+ * DIAGNOSTICS
+ * ============================================================================
+ * Where one compilation's messages go. With no buffer, progress goes to
+ * stdout and errors to stderr as they happen. Batch mode gives every file a
+ * buffer instead, printed whole once all files are done, so files compiled
+ * side by side never interleave their output.
+ */
+
+typedef struct {
+    bool buffered;
+    char* text;
+    size_t length;
+    size_t capacity;
+    int errors;          // Messages sent through diag_error
+} Diagnostics;
+
+// Room for `needed` more bytes and a NUL
+static void diag_reserve(Diagnostics* diag, size_t needed) {
+    if (diag->length + needed + 1 <= diag->capacity) return;
+    size_t capacity = diag->capacity ? diag->capacity * 2 : 256;
+    while (capacity < diag->length + needed + 1) capacity *= 2;
+    diag->text = realloc(diag->text, capacity);
+    diag->capacity = capacity;
+}
+
+static void diag_vprintf(Diagnostics* diag, FILE* stream, const char* format, va_list args) {
+    if (!diag || !diag->buffered) {
+        vfprintf(stream, format, args);
+        return;
+    }
+    va_list measure;
+    va_copy(measure, args);
+    int needed = vsnprintf(NULL, 0, format, measure);
+    va_end(measure);
+    if (needed < 0) return;
+    diag_reserve(diag, needed);
+    vsnprintf(diag->text + diag->length, needed + 1, format, args);
+    diag->length += needed;
+}
+
+// Appends raw bytes to a buffered sink, as the server collects a program's output.
+static void diag_write(Diagnostics* diag, const char* data, size_t length) {
+    diag_reserve(diag, length);
+    memcpy(diag->text + diag->length, data, length);
+    diag->length += length;
+    diag->text[diag->length] = '\0';
+}
+
+static void diag_info(Diagnostics* diag, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    diag_vprintf(diag, stdout, format, args);
+    va_end(args);
+}
+
+static void diag_error(Diagnostics* diag, const char* format, ...) {
+    if (diag) diag->errors++;
+    va_list args;
+    va_start(args, format);
+    diag_vprintf(diag, stderr, format, args);
+    va_end(args);
+}
+
+static void diag_free(Diagnostics* diag) {
+    free(diag->text);
+    memset(diag, 0, sizeof(Diagnostics));
+}
+
+/* ============================================================================
+ * STRING INTERNING
+ * ============================================================================
+ * Every lexeme is stored once in a string pool and named by a dense integer
+ * Atom. Equal strings always get the same Atom, so identifier and keyword
+ * comparisons are integer comparisons, and the text pointer returned by
+ * atom_text stays valid until the pool is freed.
+ *
+ * Keywords and other words the parser looks for are pre-interned in a fixed
+ * order, so their Atoms are compile-time constants (ATOM_WHILE, ATOM_STR, ...)
+ * in every pool.
+ */
+
+#define PREDEFINED_ATOMS(X) \
+    X(EMPTY, "") \
+    X(AND, "and") X(ARGS, "args") X(ASYNC, "async") X(DYN, "dyn") X(GLOBAL, "global") \
+    X(INPUT, "input") X(LET, "let") X(NMOF, "nmof") X(NNULL, "nnull") X(OR, "or") \
+    X(PRINT, "print") X(REC, "rec") X(STC, "stc") X(STR, "str") X(THIS, "this") \
+    X(VAL, "val") X(VAR, "var") \
+    X(SWITCH, "switch") X(CASE, "case") X(DEFAULT, "default") X(BREAK, "break") \
+    X(NEXT, "next") X(DO, "do") X(AS, "as") X(CLASS, "class") X(STRUCT, "struct") \
+    X(ENUM, "enum") X(RECORD, "record") X(PUB, "pub") X(PRIV, "priv") X(PROT, "prot") \
+    X(REQ, "req") X(GET, "get") X(SET, "set") X(INIT, "init") \
+    X(BASE, "base") X(CONST, "const") X(ELSE, "else") X(FOR, "for") X(FOREACH, "foreach") \
+    X(IF, "if") X(IFACE, "iface") X(IN, "in") X(NEW, "new") X(NSPACE, "nspace") \
+    X(NULL, "null") X(RDO, "rdo") X(RETURN, "return") X(USE, "use") X(WHILE, "while") \
+    X(BOOL, "bool") X(CHAR, "char") X(DOUBLE, "double") X(INT, "int") X(VOID, "void") \
+    X(FALSE, "false") X(TRUE, "true") \
+    X(AT, "at") X(ITS, "its") X(THEN, "then")
+
+enum {
+#define X(name, text) ATOM_##name,
+    PREDEFINED_ATOMS(X)
+#undef X
+    ATOM_PREDEFINED_COUNT
+};
+
+typedef uint32_t Atom;
+
+typedef struct {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+} AtomEntry;
+
+typedef struct {
+    AtomEntry* atoms;    // Indexed by Atom
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* table;     // Open addressing; holds Atom + 1, 0 marks an empty slot
+    uint32_t table_capacity;
+    Arena storage;       // Atom text
+} Interner;
+
+static char to_lower(char c) {
+    if (c >= 'A' && c <= 'Z') return c + 32;
+    return c;
+}
+
+static uint32_t hash_bytes(const char* text, size_t length) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_bytes_lower(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)to_lower(text[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool equals_lower(const char* lower, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (lower[i] != to_lower(text[i])) return false;
+    }
+    return true;
+}
+
+static void interner_grow_table(Interner* pool) {
+    uint32_t capacity = pool->table_capacity ? pool->table_capacity * 2 : 256;
+    uint32_t* table = calloc(capacity, sizeof(uint32_t));
+    for (uint32_t atom = 0; atom < pool->count; atom++) {
+        uint32_t index = pool->atoms[atom].hash & (capacity - 1);
+        while (table[index]) index = (index + 1) & (capacity - 1);
+        table[index] = atom + 1;
+    }
+    free(pool->table);
+    pool->table = table;
+    pool->table_capacity = capacity;
+}
+
+typedef enum {
+    INTERN_COPY,         // A new string is copied into the pool
+    INTERN_BORROW,       // Not copied: text must be NUL-terminated at length and outlive the pool
+    INTERN_LOWER         // Interns the lowercase form; case is folded while hashing, not up front
+} InternMode;
+
+// `hash` must be what intern_text would compute: the hash of the stored form.
+static Atom intern_hashed(Interner* pool, const char* text, size_t length, uint32_t hash, InternMode mode) {
+    bool fold = mode == INTERN_LOWER;
+    uint32_t mask = pool->table_capacity - 1;
+    uint32_t index = hash & mask;
+    while (pool->table[index]) {
+        AtomEntry* entry = &pool->atoms[pool->table[index] - 1];
+        if (entry->hash == hash && entry->length == length &&
+            (fold ? equals_lower(entry->text, text, length) : memcmp(entry->text, text, length) == 0)) {
+            return pool->table[index] - 1;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // New string: copy it into the pool
+    if (pool->count >= pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 256;
+        pool->atoms = realloc(pool->atoms, pool->capacity * sizeof(AtomEntry));
+    }
+    if (mode != INTERN_BORROW) {
+        char* copy = arena_alloc_aligned(&pool->storage, length + 1, 1);
+        for (size_t i = 0; i < length; i++) copy[i] = fold ? to_lower(text[i]) : text[i];
+        copy[length] = '\0';
+        text = copy;
+    }
+    Atom atom = pool->count++;
+    pool->atoms[atom].text = text;
+    pool->atoms[atom].length = (uint32_t)length;
+    pool->atoms[atom].hash = hash;
+    pool->table[index] = atom + 1;
+    if (pool->count * 4 > pool->table_capacity * 3) interner_grow_table(pool);
+    return atom;
+}
+
+static Atom intern_text(Interner* pool, const char* text, size_t length, InternMode mode) {
+    uint32_t hash = mode == INTERN_LOWER ? hash_bytes_lower(text, length) : hash_bytes(text, length);
+    return intern_hashed(pool, text, length, hash, mode);
+}
+
+static Atom intern(Interner* pool, const char* text, size_t length) { return intern_text(pool, text, length, INTERN_COPY); }
+
+static Atom intern_cstr(Interner* pool, const char* text) { return intern(pool, text, strlen(text)); }
+
+static const char* atom_text(const Interner* pool, Atom atom) { return pool->atoms[atom].text; }
+
+static void interner_init(Interner* pool) {
+    memset(pool, 0, sizeof(Interner));
+    interner_grow_table(pool);
+#define X(name, text) intern_cstr(pool, text);
+    PREDEFINED_ATOMS(X)
+#undef X
+}
+
+static void interner_free(Interner* pool) {
+    free(pool->atoms);
+    free(pool->table);
+    arena_free(&pool->storage);
+    memset(pool, 0, sizeof(Interner));
+}
 
 /* ============================================================================
  * TOKEN DEFINITIONS
@@ -140,15 +741,20 @@ typedef enum {
     TOKEN_EOF          // End of file
 } TokenType;
 
+// Tokens own no strings, so copying or dropping a Token is free. The lexeme
+// is an Atom in the Interner the token was created with; the raw text is a
+// slice of the text buffer of the TokenList holding the token (for lexed
+// tokens, the source itself), read with token_raw.
 typedef struct {
     TokenType type;
-    char* lexeme;      // Normalized (lowercase for identifiers/keywords)
-    char* raw;         // Original text as written
+    Atom atom;         // Normalized lexeme (lowercase for identifiers/keywords); keywords compare against ATOM_* constants
+    uint32_t offset;   // Original text as written: text[offset, offset + length)
+    uint32_t length;
     int line;
     int column;
 } Token;
 
-const char* token_type_to_string(TokenType type) {
+static const char* token_type_to_string(TokenType type) {
     switch (type) {
         case KEYWORD: return "KEYWORD";
         case RESERVED_WORD: return "RESERVED_WORD";
@@ -295,23 +901,89 @@ static TokenType token_type_from_string(const char* str) {
  * SYMBOL TABLE INPUT READER
  * ============================================================================ */
 
-static Token create_token(TokenType type, const char* lexeme, const char* raw, int line, int col);
+static Token create_token(Interner* pool, TokenType type, const char* lexeme, size_t lexeme_length,
+                          size_t offset, size_t length, int line, int col);
+
+// Where a token's raw text lies in its list's text: [offset, offset + length)
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} TokenSpan;
 
 typedef struct {
-    Token* tokens;
+    int line;
+    int column;
+} TokenPos;
+
+// Tokens are stored field by field rather than token by token, so the
+// parser's check and match read one byte per token from `types` and touch
+// the other arrays only to build a node or report an error. `types` has one
+// more entry than there are tokens, always TOKEN_EOF, so a cursor finds the
+// end without a bounds test. The arrays are carved from the token arena of
+// the current run and freed with it once the parser is done, never one by one.
+typedef struct {
+    uint8_t* types;      // TokenType of each token, then TOKEN_EOF
+    Atom* atoms;
+    TokenPos* positions;
+    TokenSpan* spans;
     int count;
     int capacity;
+    Arena* arena;
+    const char* text;    // Raw text the tokens slice; must outlive the list
 } TokenList;
 
+_Static_assert(TOKEN_EOF <= UINT8_MAX, "token types must fit TokenList.types");
+
+// Handed out past the end of a list; its lexeme is the empty atom and its raw text empty.
+static const Token eof_token = { TOKEN_EOF, ATOM_EMPTY, 0, 0, 0, 0 };
+
+// Token `index` gathered back into one struct; eof_token at or past the end.
+static Token token_at(const TokenList* list, int index) {
+    if (index >= list->count) return eof_token;
+    Token token;
+    token.type = (TokenType)list->types[index];
+    token.atom = list->atoms[index];
+    token.offset = list->spans[index].offset;
+    token.length = list->spans[index].length;
+    token.line = list->positions[index].line;
+    token.column = list->positions[index].column;
+    return token;
+}
+
+// Raw text of a token, token->length bytes, not NUL-terminated.
+static const char* token_raw(const TokenList* list, const Token* token) {
+    return list->text + token->offset;
+}
+
+static void token_list_resize(TokenList* list, int capacity) {
+    size_t old = (size_t)list->capacity;
+    list->types = arena_grow(list->arena, list->types, old ? old + 1 : 0, (size_t)capacity + 1);
+    list->atoms = arena_grow(list->arena, list->atoms, old * sizeof(Atom), capacity * sizeof(Atom));
+    list->positions = arena_grow(list->arena, list->positions, old * sizeof(TokenPos), capacity * sizeof(TokenPos));
+    list->spans = arena_grow(list->arena, list->spans, old * sizeof(TokenSpan), capacity * sizeof(TokenSpan));
+    list->capacity = capacity;
+    list->types[list->count] = TOKEN_EOF;
+}
+
+// Makes room for `capacity` tokens in all; a NULL list is ignored.
+static void token_list_reserve(TokenList* list, int capacity) {
+    if (!list || list->capacity >= capacity) return;
+    token_list_resize(list, capacity);
+}
+
 static void token_list_add(TokenList* list, Token token) {
-    if (list->count >= list->capacity) {
-        list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
-        list->tokens = realloc(list->tokens, list->capacity * sizeof(Token));
-    }
-    list->tokens[list->count++] = token;
+    if (list->count >= list->capacity) token_list_resize(list, list->capacity < 256 ? 256 : list->capacity * 2);
+    int i = list->count++;
+    list->types[i] = (uint8_t)token.type;
+    list->types[i + 1] = TOKEN_EOF;
+    list->atoms[i] = token.atom;
+    list->positions[i].line = token.line;
+    list->positions[i].column = token.column;
+    list->spans[i].offset = token.offset;
+    list->spans[i].length = token.length;
 }
 
-static void unescape_string(const char* src, char* dest) {
+static size_t unescape_string(const char* src, char* dest) {
     int i = 0, j = 0;
     while (src[i]) {
         if (src[i] == '\\' && src[i+1]) {
@@ -328,17 +1000,20 @@ static void unescape_string(const char* src, char* dest) {
         i++;
     }
     dest[j] = '\0';
+    return j;
 }
 
-static TokenList read_tokens_from_symbol_table(const char* path) {
+static TokenList read_tokens_from_symbol_table(const char* path, Interner* pool, Arena* arena, Diagnostics* diag) {
     TokenList list = {0};
-    list.tokens = NULL;
-    list.count = 0;
-    list.capacity = 0;
+    list.arena = arena;
+    // The raw columns are copied into one buffer for the tokens to slice
+    char* text = NULL;
+    size_t text_length = 0;
+    size_t text_capacity = 0;
     
     FILE* file = fopen(path, "r");
     if (!file) {
-        printf("Error: Could not open symbol table file '%s'\n", path);
+        diag_info(diag, "Error: Could not open symbol table file '%s'\n", path);
         return list;
     }
 
@@ -383,19 +1058,23 @@ static TokenList read_tokens_from_symbol_table(const char* path) {
         TokenType type = token_type_from_string(type_str);
         
         if (type != COMMENT) { // FILTER COMMENTS from Parser Input
-             char* final_lexeme = malloc(strlen(lexeme_str) + 1);
-             unescape_string(lexeme_str, final_lexeme);
-             
-             char* final_raw = malloc(strlen(raw_str) + 1);
-             unescape_string(raw_str, final_raw);
-
-             Token token = create_token(type, final_lexeme, final_raw, line_num, col);
-             free(final_lexeme);
-             free(final_raw); // create_token duplicates them
-             token_list_add(&list, token);
+             // Unescaping never lengthens the text, so it can work in place
+             size_t lexeme_length = unescape_string(lexeme_str, lexeme_str);
+             size_t raw_length = unescape_string(raw_str, raw_str);
+             if (text_length + raw_length > text_capacity) {
+                 size_t capacity = text_capacity < 4096 ? 4096 : text_capacity * 2;
+                 while (capacity < text_length + raw_length) capacity *= 2;
+                 text = arena_grow(arena, text, text_capacity, capacity);
+                 text_capacity = capacity;
+             }
+             memcpy(text + text_length, raw_str, raw_length);
+             token_list_add(&list, create_token(pool, type, lexeme_str, lexeme_length,
+                                                text_length, raw_length, line_num, col));
+             text_length += raw_length;
         }
     }
     fclose(file);
+    list.text = text;
     return list;
 }
 
@@ -403,166 +1082,314 @@ static TokenList read_tokens_from_symbol_table(const char* path) {
  * LEXER IMPLEMENTATION
  * ============================================================================ */
 
-#define TRIE_MAX_STATES 200
 #define MAX_LEXEME_LENGTH 256
 #define IDENTIFIER_MAX_LENGTH 31
 
-typedef struct {
-    int transitions[26];
-    bool is_accepting;
-    TokenType accepting_type;
-} TrieNode;
-
-typedef struct {
-    TrieNode nodes[TRIE_MAX_STATES];
-    int node_count;
-} KeywordTrie;
-
 typedef struct {
     const char* source;
     int length;
     int index;
     int line;
     int column;
-    KeywordTrie* trie;
+    Interner* pool;      // Receives every token's text
 } Lexer;
 
-// --- Trie Functions ---
+// --- Keyword Recognition ---
+// A perfect hash over the keywords: length plus the first and last character
+// (case-folded) pick the only slot the word can be in, and one
+// case-insensitive compare confirms it. The table is static, so no lexer
+// builds anything at startup. To add a keyword, add it to gen_keywords.py
+// (and PREDEFINED_ATOMS) and regenerate the block below.
 
-static char to_lower(char c) {
-    if (c >= 'A' && c <= 'Z') return c + 32;
-    return c;
+typedef struct {
+    const char* text;    // Lowercase; NULL in an empty slot
+    int length;
+    TokenType type;
+    Atom atom;           // Keywords are predefined atoms, so a hit needs no interning
+} Keyword;
+
+// --- generated by gen_keywords.py ---
+#define KEYWORD_SLOTS 64
+#define KEYWORD_MAX_LENGTH 7
+static const uint8_t KEYWORD_FIRST[32] = {
+     0, 30, 44, 38, 18, 57, 29, 12,  0,  3,  0,  0, 36,  0, 56, 10,
+    51,  0,  9, 43, 53, 15, 50, 31,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+static const uint8_t KEYWORD_LAST[32] = {
+     0,  0, 46, 58, 11, 40, 26,  0, 23,  0,  0,  5,  2, 49,  4, 29,
+     0, 35, 45, 37, 60,  0,  5, 22,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+static const Keyword KEYWORD_TABLE[KEYWORD_SLOTS] = {
+    [ 0] = { "double", 6, TYPE, ATOM_DOUBLE },
+    [ 1] = { "void", 4, TYPE, ATOM_VOID },
+    [ 2] = { "int", 3, TYPE, ATOM_INT },
+    [ 3] = { "init", 4, INIT, ATOM_INIT },
+    [ 4] = { "input", 5, KEYWORD, ATOM_INPUT },
+    [ 5] = { "as", 2, AS, ATOM_AS },
+    [ 6] = { "rec", 3, KEYWORD, ATOM_REC },
+    [ 7] = { "args", 4, KEYWORD, ATOM_ARGS },
+    [ 8] = { "switch", 6, SWITCH, ATOM_SWITCH },
+    [ 9] = { "in", 2, RESERVED_WORD, ATOM_IN },
+    [10] = { "false", 5, BOOLEAN_LITERAL, ATOM_FALSE },
+    [11] = { "get", 3, GET, ATOM_GET },
+    [12] = { "while", 5, RESERVED_WORD, ATOM_WHILE },
+    [13] = { "for", 3, RESERVED_WORD, ATOM_FOR },
+    [16] = { "class", 5, CLASS, ATOM_CLASS },
+    [17] = { "new", 3, RESERVED_WORD, ATOM_NEW },
+    [18] = { "case", 4, CASE, ATOM_CASE },
+    [19] = { "return", 6, RESERVED_WORD, ATOM_RETURN },
+    [20] = { "global", 6, KEYWORD, ATOM_GLOBAL },
+    [21] = { "default", 7, DEFAULT, ATOM_DEFAULT },
+    [22] = { "nmof", 4, KEYWORD, ATOM_NMOF },
+    [23] = { "char", 4, TYPE, ATOM_CHAR },
+    [24] = { "base", 4, RESERVED_WORD, ATOM_BASE },
+    [25] = { "dyn", 3, KEYWORD, ATOM_DYN },
+    [26] = { "record", 6, RECORD, ATOM_RECORD },
+    [27] = { "str", 3, KEYWORD, ATOM_STR },
+    [28] = { "at", 2, NOISE_WORD, ATOM_AT },
+    [29] = { "async", 5, KEYWORD, ATOM_ASYNC },
+    [30] = { "this", 4, KEYWORD, ATOM_THIS },
+    [31] = { "if", 2, RESERVED_WORD, ATOM_IF },
+    [33] = { "true", 4, BOOLEAN_LITERAL, ATOM_TRUE },
+    [34] = { "var", 3, KEYWORD, ATOM_VAR },
+    [35] = { "let", 3, KEYWORD, ATOM_LET },
+    [36] = { "pub", 3, PUB, ATOM_PUB },
+    [37] = { "else", 4, RESERVED_WORD, ATOM_ELSE },
+    [38] = { "nspace", 6, RESERVED_WORD, ATOM_NSPACE },
+    [39] = { "const", 5, RESERVED_WORD, ATOM_CONST },
+    [40] = { "stc", 3, KEYWORD, ATOM_STC },
+    [41] = { "rdo", 3, RESERVED_WORD, ATOM_RDO },
+    [42] = { "set", 3, SET, ATOM_SET },
+    [43] = { "its", 3, NOISE_WORD, ATOM_ITS },
+    [44] = { "and", 3, KEYWORD, ATOM_AND },
+    [45] = { "struct", 6, STRUCT, ATOM_STRUCT },
+    [46] = { "enum", 4, ENUM, ATOM_ENUM },
+    [47] = { "req", 3, REQ, ATOM_REQ },
+    [48] = { "iface", 5, RESERVED_WORD, ATOM_IFACE },
+    [49] = { "do", 2, DO, ATOM_DO },
+    [50] = { "bool", 4, TYPE, ATOM_BOOL },
+    [51] = { "prot", 4, PROT, ATOM_PROT },
+    [52] = { "print", 5, KEYWORD, ATOM_PRINT },
+    [54] = { "break", 5, BREAK, ATOM_BREAK },
+    [55] = { "val", 3, KEYWORD, ATOM_VAL },
+    [56] = { "next", 4, NEXT, ATOM_NEXT },
+    [57] = { "or", 2, KEYWORD, ATOM_OR },
+    [58] = { "use", 3, RESERVED_WORD, ATOM_USE },
+    [59] = { "foreach", 7, RESERVED_WORD, ATOM_FOREACH },
+    [60] = { "priv", 4, PRIV, ATOM_PRIV },
+    [61] = { "then", 4, NOISE_WORD, ATOM_THEN },
+    [62] = { "null", 4, RESERVED_WORD, ATOM_NULL },
+    [63] = { "nnull", 5, KEYWORD, ATOM_NNULL },
+};
+// --- end of generated table ---
+
+// Returns the keyword spelled by text[0, length) in any case, or NULL.
+static const Keyword* keyword_lookup(const char* text, int length) {
+    if (length < 2 || length > KEYWORD_MAX_LENGTH) return NULL;
+    unsigned slot = (unsigned)length + KEYWORD_FIRST[(text[0] | 0x20) & 31] + KEYWORD_LAST[(text[length - 1] | 0x20) & 31];
+    const Keyword* keyword = &KEYWORD_TABLE[slot & (KEYWORD_SLOTS - 1)];
+    if (keyword->length != length) return NULL;
+    // Only 'A'-'Z' fold onto 'a'-'z' under | 0x20, and keywords are all letters
+    for (int i = 0; i < length; i++) {
+        if ((text[i] | 0x20) != keyword->text[i]) return NULL;
+    }
+    return keyword;
 }
 
-static KeywordTrie* trie_create() {
-    KeywordTrie* trie = malloc(sizeof(KeywordTrie));
-    trie->node_count = 1;
-    for (int i = 0; i < 26; i++) trie->nodes[0].transitions[i] = -1;
-    trie->nodes[0].is_accepting = false;
-    return trie;
-}
+// --- Lexer Helper Functions ---
 
-static void trie_add(KeywordTrie* trie, const char* text, TokenType type) {
-    int state = 0;
-    for (int i = 0; text[i]; i++) {
-        char lower = to_lower(text[i]);
-        int index = lower - 'a';
-        if (index < 0 || index >= 26) continue;
-        if (trie->nodes[state].transitions[index] == -1) {
-            int next = trie->node_count++;
-            trie->nodes[state].transitions[index] = next;
-            for (int j = 0; j < 26; j++) trie->nodes[next].transitions[j] = -1;
-            trie->nodes[next].is_accepting = false;
-        }
-        state = trie->nodes[state].transitions[index];
-    }
-    trie->nodes[state].is_accepting = true;
-    trie->nodes[state].accepting_type = type;
+static bool is_letter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+static bool is_identifier_start(char c) { return is_letter(c) || c == '_'; }
+static bool is_identifier_char(char c) { return is_letter(c) || is_digit(c) || c == '_'; }
+static bool is_line_char(char c) { return c != '\n'; }
+static bool is_string_char(char c) { return c != '"' && c != '\\' && c != '\n'; }
+static bool is_not_star(char c) { return c != '*'; }
+
+// --- Bulk Scanning ---
+// Each scanner returns the index of the first byte at or after `i` that ends
+// its run, or `length`. Whole blocks are classified at once while a block
+// fits before `length`; the tail is finished a byte at a time, so nothing is
+// read past the end of the source.
+//
+// A block classifier returns a bitmask of the bytes that stop the run,
+// SCAN_BITS_PER_BYTE bits per byte (NEON has no movemask; its narrowing shift
+// leaves four).
+
+#if LEXER_SIMD_AVX2
+#define SCAN_NAME "avx2"
+#define SCAN_WIDTH 32
+#define SCAN_BITS_PER_BYTE 1
+#define SCAN_ALL_BITS 0xFFFFFFFFull
+typedef __m256i ScanVec;
+static inline ScanVec scan_load(const char* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static inline ScanVec scan_eq(ScanVec v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+static inline ScanVec scan_or(ScanVec a, ScanVec b) { return _mm256_or_si256(a, b); }
+static inline ScanVec scan_fold(ScanVec v) { return _mm256_or_si256(v, _mm256_set1_epi8(0x20)); }
+static inline ScanVec scan_range(ScanVec v, char lo, char hi) {
+    // Unsigned lo <= v <= hi, as v == max(v, lo) && v == min(v, hi)
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(lo)), v),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(hi)), v));
 }
-
-static int trie_move(KeywordTrie* trie, int state, char c) {
-    if (state < 0 || state >= trie->node_count) return -1;
-    int index = c - 'a';
-    if (index < 0 || index >= 26) return -1;
-    return trie->nodes[state].transitions[index];
+static inline uint64_t scan_bits(ScanVec m) { return (uint32_t)_mm256_movemask_epi8(m); }
+#elif LEXER_SIMD_SSE2
+#define SCAN_NAME "sse2"
+#define SCAN_WIDTH 16
+#define SCAN_BITS_PER_BYTE 1
+#define SCAN_ALL_BITS 0xFFFFull
+typedef __m128i ScanVec;
+static inline ScanVec scan_load(const char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline ScanVec scan_eq(ScanVec v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+static inline ScanVec scan_or(ScanVec a, ScanVec b) { return _mm_or_si128(a, b); }
+static inline ScanVec scan_fold(ScanVec v) { return _mm_or_si128(v, _mm_set1_epi8(0x20)); }
+static inline ScanVec scan_range(ScanVec v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(lo)), v),
+                         _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(hi)), v));
+}
+static inline uint64_t scan_bits(ScanVec m) { return (uint32_t)_mm_movemask_epi8(m); }
+#elif LEXER_SIMD_NEON
+#define SCAN_NAME "neon"
+#define SCAN_WIDTH 16
+#define SCAN_BITS_PER_BYTE 4
+#define SCAN_ALL_BITS 0xFFFFFFFFFFFFFFFFull
+typedef uint8x16_t ScanVec;
+static inline ScanVec scan_load(const char* p) { return vld1q_u8((const uint8_t*)p); }
+static inline ScanVec scan_eq(ScanVec v, char c) { return vceqq_u8(v, vdupq_n_u8((uint8_t)c)); }
+static inline ScanVec scan_or(ScanVec a, ScanVec b) { return vorrq_u8(a, b); }
+static inline ScanVec scan_fold(ScanVec v) { return vorrq_u8(v, vdupq_n_u8(0x20)); }
+static inline ScanVec scan_range(ScanVec v, char lo, char hi) {
+    return vandq_u8(vcgeq_u8(v, vdupq_n_u8((uint8_t)lo)), vcleq_u8(v, vdupq_n_u8((uint8_t)hi)));
+}
+static inline uint64_t scan_bits(ScanVec m) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+#else
+#define SCAN_NAME "scalar"
+#define SCAN_WIDTH 0
+#endif
+
+static inline int scan_ctz(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1)) { bits >>= 1; n++; }
+    return n;
+#endif
 }
 
-static bool trie_try_get_type(KeywordTrie* trie, int state, TokenType* out_type) {
-    if (state >= 0 && state < trie->node_count && trie->nodes[state].is_accepting) {
-        *out_type = trie->nodes[state].accepting_type;
-        return true;
-    }
-    return false;
+#if SCAN_WIDTH
+static inline int scan_popcount(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(bits);
+#else
+    int n = 0;
+    for (; bits; bits &= bits - 1) n++;
+    return n;
+#endif
 }
 
-static KeywordTrie* initialize_keywords() {
-    KeywordTrie* trie = trie_create();
-    // Contextual Keywords
-    trie_add(trie, "and", KEYWORD); trie_add(trie, "args", KEYWORD); trie_add(trie, "async", KEYWORD);
-    trie_add(trie, "dyn", KEYWORD); trie_add(trie, "global", KEYWORD);
-    trie_add(trie, "input", KEYWORD); trie_add(trie, "let", KEYWORD);
-    trie_add(trie, "nmof", KEYWORD); trie_add(trie, "nnull", KEYWORD); trie_add(trie, "or", KEYWORD);
-    trie_add(trie, "print", KEYWORD); trie_add(trie, "rec", KEYWORD);
-    trie_add(trie, "stc", KEYWORD); trie_add(trie, "str", KEYWORD);
-    trie_add(trie, "this", KEYWORD);
-    trie_add(trie, "val", KEYWORD); trie_add(trie, "var", KEYWORD);
-
-    // New Token Mappings
-    trie_add(trie, "switch", SWITCH);
-    trie_add(trie, "case", CASE);
-    trie_add(trie, "default", DEFAULT);
-    trie_add(trie, "break", BREAK);
-    trie_add(trie, "next", NEXT);
-    trie_add(trie, "do", DO);
-    trie_add(trie, "as", AS);
-    trie_add(trie, "class", CLASS);
-    trie_add(trie, "struct", STRUCT);
-    trie_add(trie, "enum", ENUM);
-    trie_add(trie, "record", RECORD);
-    trie_add(trie, "pub", PUB);
-    trie_add(trie, "priv", PRIV);
-    trie_add(trie, "prot", PROT);
-    trie_add(trie, "req", REQ);
-    trie_add(trie, "get", GET);
-    trie_add(trie, "set", SET);
-    trie_add(trie, "init", INIT);
-
-    // Reserved Words
-    trie_add(trie, "base", RESERVED_WORD);
-    trie_add(trie, "const", RESERVED_WORD);
-    trie_add(trie, "else", RESERVED_WORD);
-    trie_add(trie, "for", RESERVED_WORD); trie_add(trie, "foreach", RESERVED_WORD);
-    trie_add(trie, "if", RESERVED_WORD); trie_add(trie, "iface", RESERVED_WORD); trie_add(trie, "in", RESERVED_WORD);
-    trie_add(trie, "new", RESERVED_WORD);
-    trie_add(trie, "nspace", RESERVED_WORD);
-    trie_add(trie, "null", RESERVED_WORD);
-    trie_add(trie, "rdo", RESERVED_WORD);
-    trie_add(trie, "return", RESERVED_WORD); trie_add(trie, "use", RESERVED_WORD); trie_add(trie, "while", RESERVED_WORD);
-    // Types (5 total) - Per PPL Project Proposal Group 8
-    trie_add(trie, "bool", TYPE); trie_add(trie, "char", TYPE); trie_add(trie, "double", TYPE);
-    trie_add(trie, "int", TYPE); trie_add(trie, "void", TYPE);
-    // Boolean Literals (2 total)
-    trie_add(trie, "false", BOOLEAN_LITERAL); trie_add(trie, "true", BOOLEAN_LITERAL);
-    // Noise Words
-    trie_add(trie, "at", NOISE_WORD); trie_add(trie, "its", NOISE_WORD); trie_add(trie, "then", NOISE_WORD);
-    return trie;
+static inline int scan_highest(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(bits);
+#else
+    int n = 63;
+    while (!(bits >> n)) n--;
+    return n;
+#endif
 }
 
-// --- Lexer Helper Functions ---
+static inline uint64_t stops_whitespace(ScanVec v) {
+    ScanVec ws = scan_or(scan_or(scan_eq(v, ' '), scan_eq(v, '\t')), scan_or(scan_eq(v, '\r'), scan_eq(v, '\n')));
+    return ~scan_bits(ws) & SCAN_ALL_BITS;
+}
+static inline uint64_t stops_identifier(ScanVec v) {
+    ScanVec ok = scan_or(scan_or(scan_range(scan_fold(v), 'a', 'z'), scan_range(v, '0', '9')), scan_eq(v, '_'));
+    return ~scan_bits(ok) & SCAN_ALL_BITS;
+}
+static inline uint64_t stops_digit(ScanVec v) { return ~scan_bits(scan_range(v, '0', '9')) & SCAN_ALL_BITS; }
+static inline uint64_t stops_line(ScanVec v) { return scan_bits(scan_eq(v, '\n')); }
+static inline uint64_t stops_string(ScanVec v) {
+    return scan_bits(scan_or(scan_or(scan_eq(v, '"'), scan_eq(v, '\\')), scan_eq(v, '\n')));
+}
+static inline uint64_t stops_star(ScanVec v) { return scan_bits(scan_eq(v, '*')); }
 
-static bool is_letter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
-static bool is_digit(char c) { return c >= '0' && c <= '9'; }
-static bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
-static bool is_identifier_start(char c) { return is_letter(c) || c == '_'; }
-static bool is_identifier_char(char c) { return is_letter(c) || is_digit(c) || c == '_'; }
+#define SCAN_BLOCKS(block_stops)                                                \
+    for (; i + SCAN_WIDTH <= length; i += SCAN_WIDTH) {                        \
+        uint64_t stops = block_stops(scan_load(s + i));                        \
+        if (stops) return i + scan_ctz(stops) / SCAN_BITS_PER_BYTE;            \
+    }
+#else
+#define SCAN_BLOCKS(block_stops)
+#endif
+
+#define DEFINE_SCANNER(name, block_stops, keeps)                                \
+    static size_t name(const char* s, size_t i, size_t length) {               \
+        SCAN_BLOCKS(block_stops)                                                \
+        while (i < length && keeps(s[i])) i++;                                  \
+        return i;                                                               \
+    }
 
-static char* str_duplicate(const char* str) {
-    if (!str) return NULL;
-    char* dup = malloc(strlen(str) + 1);
-    if (dup) strcpy(dup, str);
-    return dup;
+DEFINE_SCANNER(scan_whitespace, stops_whitespace, is_whitespace)
+DEFINE_SCANNER(scan_identifier, stops_identifier, is_identifier_char)
+DEFINE_SCANNER(scan_digits, stops_digit, is_digit)
+DEFINE_SCANNER(scan_line, stops_line, is_line_char)
+DEFINE_SCANNER(scan_string_body, stops_string, is_string_char)
+DEFINE_SCANNER(scan_to_star, stops_star, is_not_star)
+
+// Moves the lexer to `end` over a run known to hold no newline.
+static void lexer_skip_line_run(Lexer* lexer, size_t end) {
+    lexer->column += (int)(end - (size_t)lexer->index);
+    lexer->index = (int)end;
 }
 
-static char* str_to_lower(const char* str) {
-    if (!str) return NULL;
-    char* lower = malloc(strlen(str) + 1);
-    if (!lower) return NULL;
-    for (int i = 0; str[i]; i++) lower[i] = to_lower(str[i]);
-    lower[strlen(str)] = '\0';
-    return lower;
+// Moves the lexer to `end`, counting the newlines it passes in bulk.
+static void lexer_skip_to(Lexer* lexer, size_t end) {
+    const char* s = lexer->source;
+    size_t i = (size_t)lexer->index;
+    size_t line_start = 0;       // Index just past the last newline seen, if any
+    bool saw_newline = false;
+#if SCAN_WIDTH
+    for (; i + SCAN_WIDTH <= end; i += SCAN_WIDTH) {
+        uint64_t newlines = scan_bits(scan_eq(scan_load(s + i), '\n'));
+        if (!newlines) continue;
+        lexer->line += scan_popcount(newlines) / SCAN_BITS_PER_BYTE;
+        line_start = i + scan_highest(newlines) / SCAN_BITS_PER_BYTE + 1;
+        saw_newline = true;
+    }
+#endif
+    for (; i < end; i++) {
+        if (s[i] == '\n') {
+            lexer->line++;
+            line_start = i + 1;
+            saw_newline = true;
+        }
+    }
+    if (saw_newline) lexer->column = 1 + (int)(end - line_start);
+    else lexer->column += (int)(end - (size_t)lexer->index);
+    lexer->index = (int)end;
 }
 
-Lexer* lexer_create(const char* source) {
-    Lexer* lexer = malloc(sizeof(Lexer));
+// The lexer lives in `arena`; token text goes to `pool`.
+static Lexer* lexer_create(const char* source, Interner* pool, Arena* arena) {
+    Lexer* lexer = arena_alloc(arena, sizeof(Lexer));
     lexer->source = source;
     lexer->length = strlen(source);
     lexer->index = 0;
     lexer->line = 1;
     lexer->column = 1;
-    lexer->trie = initialize_keywords();
+    lexer->pool = pool;
     return lexer;
 }
 
+// Points the lexer at `index`, which is at `line`:`column` of the source.
+static void lexer_seek(Lexer* lexer, size_t index, int line, int column) {
+    lexer->index = (int)index;
+    lexer->line = line;
+    lexer->column = column;
+}
+
 static bool lexer_is_at_end(Lexer* lexer) { return lexer->index >= lexer->length; }
 
 static char lexer_peek(Lexer* lexer, int offset) {
@@ -585,11 +1412,24 @@ static void lexer_advance(Lexer* lexer) {
     }
 }
 
-static Token create_token(TokenType type, const char* lexeme, const char* raw, int line, int col) {
+static Token make_token(TokenType type, Atom atom, size_t offset, size_t length, int line, int col) {
+    Token token;
+    token.type = type;
+    token.atom = atom;
+    token.offset = (uint32_t)offset;
+    token.length = (uint32_t)length;
+    token.line = line;
+    token.column = col;
+    return token;
+}
+
+static Token create_token(Interner* pool, TokenType type, const char* lexeme, size_t lexeme_length,
+                          size_t offset, size_t length, int line, int col) {
     Token token;
     token.type = type;
-    token.lexeme = str_duplicate(lexeme);
-    token.raw = str_duplicate(raw);
+    token.atom = intern(pool, lexeme, lexeme_length);
+    token.offset = (uint32_t)offset;
+    token.length = (uint32_t)length;
     token.line = line;
     token.column = col;
     return token;
@@ -597,7 +1437,7 @@ static Token create_token(TokenType type, const char* lexeme, const char* raw, i
 
 // --- Lexing Logic ---
 
-Token lexer_next_token(Lexer* lexer) {
+static Token lexer_next_token(Lexer* lexer) {
     while (!lexer_is_at_end(lexer)) {
         int start_line = lexer->line;
         int start_col = lexer->column;
@@ -605,131 +1445,106 @@ Token lexer_next_token(Lexer* lexer) {
 
         // Skip whitespace
         if (is_whitespace(current)) {
-            lexer_advance(lexer);
+            lexer_skip_to(lexer, scan_whitespace(lexer->source, lexer->index, lexer->length));
             continue;
         }
 
         // Comments
         if (current == '/' && lexer_peek(lexer, 1) == '/') {
             int start = lexer->index;
-            lexer_advance(lexer); lexer_advance(lexer);
-            while (!lexer_is_at_end(lexer) && lexer_current(lexer) != '\n') lexer_advance(lexer);
+            lexer_skip_line_run(lexer, scan_line(lexer->source, lexer->index + 2, lexer->length));
             
             int length = lexer->index - start;
-            char* raw = malloc(length + 1);
-            strncpy(raw, &lexer->source[start], length); raw[length] = '\0';
-            char* lexeme = malloc(length - 1);
-            strncpy(lexeme, &lexer->source[start + 2], length - 2); lexeme[length - 2] = '\0';
-            
-            Token t = create_token(COMMENT, lexeme, raw, start_line, start_col);
-            free(raw); free(lexeme);
-            return t;
+            const char* raw = &lexer->source[start];
+            return create_token(lexer->pool, COMMENT, raw + 2, length - 2, start, length, start_line, start_col);
         }
         if (current == '/' && lexer_peek(lexer, 1) == '*') {
             int start = lexer->index;
-            lexer_advance(lexer); lexer_advance(lexer);
-            while (!lexer_is_at_end(lexer)) {
-                if (lexer_current(lexer) == '*' && lexer_peek(lexer, 1) == '/') {
-                    lexer_advance(lexer); lexer_advance(lexer);
+            int closer = 0; // Length of the closing */, absent when the comment runs to EOF
+            size_t end = lexer->index + 2;
+            for (;;) {
+                end = scan_to_star(lexer->source, end, lexer->length);
+                if (end >= (size_t)lexer->length) break;
+                if (lexer->source[end + 1] == '/') {
+                    end += 2;
+                    closer = 2;
                     break;
                 }
-                lexer_advance(lexer);
+                end++;
             }
+            lexer_skip_to(lexer, end);
             int length = lexer->index - start;
-            char* raw = malloc(length + 1);
-            strncpy(raw, &lexer->source[start], length); raw[length] = '\0';
-            char* lexeme = malloc(length - 3);
-            strncpy(lexeme, &lexer->source[start + 2], length - 4); lexeme[length - 4] = '\0';
-            
-            Token t = create_token(COMMENT, lexeme, raw, start_line, start_col);
-            free(raw); free(lexeme);
-            return t;
+            const char* raw = &lexer->source[start];
+            return create_token(lexer->pool, COMMENT, raw + 2, length - 2 - closer, start, length, start_line, start_col);
         }
 
         // Identifiers and Keywords
         if (is_identifier_start(current)) {
             int start = lexer->index;
-            while (!lexer_is_at_end(lexer) && is_identifier_char(lexer_current(lexer))) lexer_advance(lexer);
+            lexer_skip_line_run(lexer, scan_identifier(lexer->source, start, lexer->length));
             
             int length = lexer->index - start;
-            char* raw = malloc(length + 1);
-            strncpy(raw, &lexer->source[start], length); raw[length] = '\0';
+            const char* raw = &lexer->source[start];
             
-            TokenType type = IDENTIFIER;
-            bool all_letters = true;
-            for (int i = 0; i < length; i++) if (!is_letter(raw[i])) { all_letters = false; break; }
+            const Keyword* keyword = keyword_lookup(raw, length);
+            if (keyword) return make_token(keyword->type, keyword->atom, start, length, start_line, start_col);
             
-            if (all_letters) {
-                int state = 0;
-                int i = 0;
-                for (; i < length; i++) {
-                    state = trie_move(lexer->trie, state, to_lower(raw[i]));
-                    if (state == -1) break;
-                }
-                if (i == length) trie_try_get_type(lexer->trie, state, &type);
-            }
-            
-            char* lexeme = str_to_lower(raw);
-            if (type == IDENTIFIER && strlen(lexeme) > IDENTIFIER_MAX_LENGTH) lexeme[IDENTIFIER_MAX_LENGTH] = '\0';
-            
-            Token t = create_token(type, lexeme, raw, start_line, start_col);
-            free(raw); free(lexeme);
-            return t;
+            // The interner folds case itself, so the lowercase lexeme is never built here
+            int lexeme_length = length > IDENTIFIER_MAX_LENGTH ? IDENTIFIER_MAX_LENGTH : length;
+            Atom atom = intern_text(lexer->pool, raw, lexeme_length, INTERN_LOWER);
+            return make_token(IDENTIFIER, atom, start, length, start_line, start_col);
         }
 
         // Numbers
         if (is_digit(current) || (current == '.' && is_digit(lexer_peek(lexer, 1)))) {
             int start = lexer->index;
             if (current == '.') lexer_advance(lexer);
-            while (!lexer_is_at_end(lexer) && is_digit(lexer_current(lexer))) lexer_advance(lexer);
+            lexer_skip_line_run(lexer, scan_digits(lexer->source, lexer->index, lexer->length));
             if (current != '.' && !lexer_is_at_end(lexer) && lexer_current(lexer) == '.' && is_digit(lexer_peek(lexer, 1))) {
                 lexer_advance(lexer);
-                while (!lexer_is_at_end(lexer) && is_digit(lexer_current(lexer))) lexer_advance(lexer);
+                lexer_skip_line_run(lexer, scan_digits(lexer->source, lexer->index, lexer->length));
             }
             if (!lexer_is_at_end(lexer) && (lexer_current(lexer) == 'e' || lexer_current(lexer) == 'E')) {
                 lexer_advance(lexer);
                 if (!lexer_is_at_end(lexer) && (lexer_current(lexer) == '+' || lexer_current(lexer) == '-')) lexer_advance(lexer);
-                while (!lexer_is_at_end(lexer) && is_digit(lexer_current(lexer))) lexer_advance(lexer);
+                lexer_skip_line_run(lexer, scan_digits(lexer->source, lexer->index, lexer->length));
             }
             int length = lexer->index - start;
-            char* text = malloc(length + 1);
-            strncpy(text, &lexer->source[start], length); text[length] = '\0';
-            Token t = create_token(NUMBER, text, text, start_line, start_col);
-            free(text);
-            return t;
+            const char* text = &lexer->source[start];
+            return create_token(lexer->pool, NUMBER, text, length, start, length, start_line, start_col);
         }
 
         // String Literals
         if (current == '"') {
             int start = lexer->index;
             lexer_advance(lexer);
+            // The value keeps the first MAX_LEXEME_LENGTH - 1 characters; the
+            // literal itself still runs to its closing quote or the line's end
             char buffer[MAX_LEXEME_LENGTH];
             int buf_pos = 0;
             while (!lexer_is_at_end(lexer) && lexer_current(lexer) != '\n') {
+                // Copy the plain run up to the next quote, escape or newline in one go
+                size_t run = scan_string_body(lexer->source, lexer->index, lexer->length) - lexer->index;
+                if (run > 0) {
+                    size_t room = MAX_LEXEME_LENGTH - 1 - buf_pos;
+                    memcpy(buffer + buf_pos, lexer->source + lexer->index, run < room ? run : room);
+                    buf_pos += (int)(run < room ? run : room);
+                    lexer_skip_line_run(lexer, lexer->index + run);
+                    continue;
+                }
                 char c = lexer_current(lexer);
                 if (c == '"') { lexer_advance(lexer); break; }
-                else if (c == '\\' && !lexer_is_at_end(lexer)) {
-                    lexer_advance(lexer);
-                    char next = lexer_current(lexer);
-                    lexer_advance(lexer);
-                    switch (next) {
-                        case 'n': buffer[buf_pos++] = '\n'; break;
-                        case 't': buffer[buf_pos++] = '\t'; break;
-                        default: buffer[buf_pos++] = next; break;
-                    }
-                } else {
-                    buffer[buf_pos++] = c;
+                if (c == '\\') {
                     lexer_advance(lexer);
+                    c = lexer_current(lexer);
+                    if (c == 'n') c = '\n';
+                    else if (c == 't') c = '\t';
                 }
-                if (buf_pos >= MAX_LEXEME_LENGTH - 1) break;
+                lexer_advance(lexer);
+                if (buf_pos < MAX_LEXEME_LENGTH - 1) buffer[buf_pos++] = c;
             }
-            buffer[buf_pos] = '\0';
             int length = lexer->index - start;
-            char* raw = malloc(length + 1);
-            strncpy(raw, &lexer->source[start], length); raw[length] = '\0';
-            Token t = create_token(STRING_LITERAL, buffer, raw, start_line, start_col);
-            free(raw);
-            return t;
+            return create_token(lexer->pool, STRING_LITERAL, buffer, buf_pos, start, length, start_line, start_col);
         }
 
         // Char Literals
@@ -757,12 +1572,7 @@ Token lexer_next_token(Lexer* lexer) {
             }
             if (!lexer_is_at_end(lexer) && lexer_current(lexer) == '\'') lexer_advance(lexer);
             int length = lexer->index - start;
-            char* raw = malloc(length + 1);
-            strncpy(raw, &lexer->source[start], length); raw[length] = '\0';
-            char lexeme[2] = {value, '\0'};
-            Token t = create_token(CHAR_LITERAL, lexeme, raw, start_line, start_col);
-            free(raw);
-            return t;
+            return create_token(lexer->pool, CHAR_LITERAL, &value, value ? 1 : 0, start, length, start_line, start_col);
         }
 
         // Operators and Delimiters
@@ -813,1268 +1623,7890 @@ Token lexer_next_token(Lexer* lexer) {
             
             for (int i = 0; i < advance_count; i++) lexer_advance(lexer);
             int length = lexer->index - start;
-            char* text = malloc(length + 1);
-            strncpy(text, &lexer->source[start], length); text[length] = '\0';
-            Token t = create_token(type, text, text, start_line, start_col);
-            free(text);
-            return t;
+            const char* text = &lexer->source[start];
+            return create_token(lexer->pool, type, text, length, start, length, start_line, start_col);
         }
 
         // Invalid
-        char invalid_char[2] = {current, '\0'};
-        Token t = create_token(INVALID, invalid_char, invalid_char, start_line, start_col);
+        Token t = create_token(lexer->pool, INVALID, &current, 1, lexer->index, 1, start_line, start_col);
         lexer_advance(lexer);
         return t;
     }
     
-    return create_token(TOKEN_EOF, "", "", lexer->line, lexer->column);
+    return make_token(TOKEN_EOF, ATOM_EMPTY, lexer->index, 0, lexer->line, lexer->column);
 }
 
-/* ============================================================================
- * INTERPRETER / EVALUATOR DEFINITIONS
- * ============================================================================ */
-
-typedef enum { VAL_INT, VAL_DOUBLE, VAL_BOOL, VAL_STRING, VAL_CHAR, VAL_VOID, VAL_NULL } ValueType;
-
-typedef struct {
-    ValueType type;
-    union {
-        int int_val;
-        double double_val;
-        bool bool_val;
-        char* string_val;
-        char char_val;
-    } as;
-} Value;
-
-typedef struct Env {
-    char* name;
-    Value value;
-    bool is_const;
-    struct Env* next;
-} Env;
-
-static Value make_int(int v) { Value val; val.type = VAL_INT; val.as.int_val = v; return val; }
-static Value make_double(double v) { Value val; val.type = VAL_DOUBLE; val.as.double_val = v; return val; }
-static Value make_bool(bool v) { Value val; val.type = VAL_BOOL; val.as.bool_val = v; return val; }
-static Value make_string(const char* v) { 
-    Value val; val.type = VAL_STRING; 
-    val.as.string_val = malloc(strlen(v) + 1); 
-    strcpy(val.as.string_val, v); 
-    return val; 
+// Lexes the whole source in one pass. `symbols` receives every token for the
+// symbol table; `parse_tokens` receives everything but comments, which the
+// parser never sees. Either list may be NULL.
+static void lex_emit(TokenList* symbols, TokenList* parse_tokens, Token token) {
+    if (symbols) token_list_add(symbols, token);
+    if (parse_tokens && token.type != COMMENT) token_list_add(parse_tokens, token);
 }
-static Value make_char(char v) { Value val; val.type = VAL_CHAR; val.as.char_val = v; return val; }
-static Value make_void() { Value val; val.type = VAL_VOID; return val; }
-static Value make_null() { Value val; val.type = VAL_NULL; return val; }
 
-static void free_value(Value v) {
-    if (v.type == VAL_STRING && v.as.string_val) free(v.as.string_val);
+static void lex_all(Lexer* lexer, TokenList* symbols, TokenList* parse_tokens) {
+    if (symbols) symbols->text = lexer->source;
+    if (parse_tokens) parse_tokens->text = lexer->source;
+    Token token = lexer_next_token(lexer);
+    while (token.type != TOKEN_EOF) {
+        lex_emit(symbols, parse_tokens, token);
+        token = lexer_next_token(lexer);
+    }
 }
 
-static Env* env_create() { return NULL; }
+// --- Parallel Lexing ---
+// A large source is cut at line starts into one chunk per job, and each chunk
+// is lexed on its own thread with its own interner and arena. A line start is
+// nearly always a token boundary: only block comments and backslash-escaped
+// newlines in string or char literals span lines. A chunk's lexer runs past
+// its end until it reaches a token that starts at or after it, so a spanning
+// token is still lexed whole.
+//
+// Stitching walks the chunks in order. Each must have a token starting exactly
+// where the previous one stopped. Where it does not, the gap is re-lexed on
+// the calling thread until it and the chunk agree on a token start again;
+// the lexer keeps no state between tokens, so from that point on the chunk's
+// tokens are the ones a single pass would have produced. The output is
+// identical to lex_all's except for atom numbering.
+
+#define LEX_MIN_CHUNK (256 * 1024)
+#define LEX_MAX_JOBS 64
 
-static void env_define(Env** env, const char* name, Value value, bool is_const) {
-    Env* start = *env;
-    // Check if exists
-    Env* current = start;
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-            free_value(current->value);
-            current->value = value; // Overwrite definition (allows shadowing logic or re-use in simple scope)
-            current->is_const = is_const;
-            return;
+typedef struct {
+    const char* source;
+    size_t start;        // Always a line start
+    size_t end;
+    Interner pool;       // Seeded like every pool, so predefined atoms agree
+    Arena arena;
+    TokenList tokens;    // Every token starting in [start, end); lines count from 1 at start
+    size_t stop;         // First token at or after end (or the source length), and its position
+    int stop_line;
+    int stop_column;
+    int newlines;        // In [start, end)
+} LexChunk;
+
+static void lex_chunk_run(void* arg) {
+    LexChunk* chunk = arg;
+    interner_init(&chunk->pool);
+    chunk->tokens.arena = &chunk->arena;
+    chunk->tokens.text = chunk->source;
+
+    Lexer* lexer = lexer_create(chunk->source, &chunk->pool, &chunk->arena);
+    lexer_seek(lexer, chunk->start, 1, 1);
+    for (;;) {
+        Token token = lexer_next_token(lexer);
+        if (token.type == TOKEN_EOF || token.offset >= chunk->end) {
+            chunk->stop = token.offset;
+            chunk->stop_line = token.line;
+            chunk->stop_column = token.column;
+            break;
         }
-        current = current->next;
+        token_list_add(&chunk->tokens, token);
     }
-    // New
-    Env* node = malloc(sizeof(Env));
-    node->name = strdup(name);
-    node->value = value;
-    node->is_const = is_const;
-    node->next = *env;
-    *env = node;
-}
 
-static bool env_assign(Env* env, const char* name, Value value) {
-    while (env) {
-        if (strcmp(env->name, name) == 0) {
-            if (env->is_const) return false;
-            // Free old string if necessary
-            if (env->value.type == VAL_STRING) free(env->value.as.string_val);
-            env->value = value;
-            return true;
-        }
-        env = env->next;
+    const char* p = chunk->source + chunk->start;
+    const char* end = chunk->source + chunk->end;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        chunk->newlines++;
+        p++;
     }
-    return false;
 }
 
-static bool env_get(Env* env, const char* name, Value* out) {
-    while (env) {
-        if (strcmp(env->name, name) == 0) { // Simple linear search linear scope
-             // Deep copy value for usage
-             *out = env->value;
-             if (out->type == VAL_STRING) out->as.string_val = strdup(env->value.as.string_val);
-             return true;
-        }
-        env = env->next;
+// Index of the first token in `list` starting at or after `offset`.
+static int token_lower_bound(const TokenList* list, size_t offset) {
+    int low = 0, high = list->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (list->spans[mid].offset < offset) low = mid + 1;
+        else high = mid;
     }
-    return false;
+    return low;
 }
 
-static Value val_add(Value a, Value b) {
-    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(a.as.int_val + b.as.int_val);
-    if(a.type == VAL_DOUBLE || b.type == VAL_DOUBLE) {
-        double d1 = (a.type == VAL_INT) ? (double)a.as.int_val : a.as.double_val;
-        double d2 = (b.type == VAL_INT) ? (double)b.as.int_val : b.as.double_val;
-        return make_double(d1 + d2);
+// Moves chunk tokens [from, count) into the output, translating their atoms
+// and lines. Afterwards the next token is expected where the chunk stopped.
+static void lex_take_chunk(const LexChunk* chunk, int from, const Atom* remap, int line_base,
+                           TokenList* symbols, TokenList* parse_tokens,
+                           size_t* pos, int* line, int* column) {
+    for (int i = from; i < chunk->tokens.count; i++) {
+        Token token = token_at(&chunk->tokens, i);
+        token.atom = remap[token.atom];
+        token.line += line_base;
+        lex_emit(symbols, parse_tokens, token);
     }
-    if(a.type == VAL_STRING) {
-        // Concat
-        // TODO: Handle string concat
-    }
-    return make_int(0); 
-}
-static Value val_sub(Value a, Value b) {
-    double d1 = (a.type == VAL_INT) ? (double)a.as.int_val : a.as.double_val;
-    double d2 = (b.type == VAL_INT) ? (double)b.as.int_val : b.as.double_val;
-    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(a.as.int_val - b.as.int_val);
-    return make_double(d1 - d2);
-}
-static Value val_mul(Value a, Value b) {
-    double d1 = (a.type == VAL_INT) ? (double)a.as.int_val : a.as.double_val;
-    double d2 = (b.type == VAL_INT) ? (double)b.as.int_val : b.as.double_val;
-    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(a.as.int_val * b.as.int_val);
-    return make_double(d1 * d2);
-}
-static Value val_div(Value a, Value b) {
-    double d1 = (a.type == VAL_INT) ? (double)a.as.int_val : a.as.double_val;
-    double d2 = (b.type == VAL_INT) ? (double)b.as.int_val : b.as.double_val;
-    if(d2 == 0) return make_int(0); // Error
-    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(a.as.int_val / b.as.int_val);
-    return make_double(d1 / d2);
+    *pos = chunk->stop;
+    *line = chunk->stop_line + line_base;
+    *column = chunk->stop_column;
 }
 
-/* ============================================================================
- * PARSER IMPLEMENTATION
- * ============================================================================ */
+// Same result as lex_all over the whole source, using up to `jobs` threads.
+// Sources under two LEX_MIN_CHUNKs are lexed in one pass.
+static void lex_all_parallel(const char* source, Interner* pool, Arena* arena, int jobs,
+                             TokenList* symbols, TokenList* parse_tokens) {
+    size_t length = strlen(source);
+    int count = jobs < LEX_MAX_JOBS ? jobs : LEX_MAX_JOBS;
+    if ((size_t)count > length / LEX_MIN_CHUNK) count = (int)(length / LEX_MIN_CHUNK);
+    if (count <= 1) {
+        lex_all(lexer_create(source, pool, arena), symbols, parse_tokens);
+        return;
+    }
 
-typedef struct {
-    TokenList* token_list;
-    int current_index;
-    Token current_token;
-    Token next_token;
-    Token previous_token;
-    bool has_next_token;
-    bool had_error;
-    bool panic_mode;
-    int indent_level;
-    FILE* output_file;
-    
-    // Evaluator
-    Env* env;
-    bool executing;
-    bool trace_parse; // If true, write to output_file
-    char last_id[64];
-} Parser;
+    LexChunk* chunks = calloc(count, sizeof(LexChunk));
+    size_t start = 0;
+    for (int i = 0; i < count; i++) {
+        size_t end = length;
+        if (i < count - 1) {
+            // Round the even split up to the next line start
+            end = length / count * (i + 1);
+            if (end < start) end = start;
+            const char* newline = memchr(source + end, '\n', length - end);
+            end = newline ? (size_t)(newline - source) + 1 : length;
+        }
+        chunks[i].source = source;
+        chunks[i].start = start;
+        chunks[i].end = end;
+        start = end;
+    }
 
-static void advance(Parser* parser);
-static void statement(Parser* parser);
-static Value expression(Parser* parser);
+    // Chunk 0 runs here; a chunk whose thread cannot start runs here too
+    Thread threads[LEX_MAX_JOBS];
+    bool started[LEX_MAX_JOBS] = {false};
+    for (int i = 1; i < count; i++) started[i] = thread_start(&threads[i], lex_chunk_run, &chunks[i]);
+    lex_chunk_run(&chunks[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i]) thread_join(threads[i]);
+        else lex_chunk_run(&chunks[i]);
+    }
 
-static void print_indent(Parser* parser) {
-    if (!parser->output_file || !parser->trace_parse) return;
-    for (int i = 0; i < parser->indent_level; i++) fprintf(parser->output_file, "  ");
-}
+    // Size the output once; only re-lexed gaps can add to it
+    int total = 0;
+    for (int i = 0; i < count; i++) total += chunks[i].tokens.count;
+    token_list_reserve(symbols, total);
+    token_list_reserve(parse_tokens, total);
+
+    if (symbols) symbols->text = source;
+    if (parse_tokens) parse_tokens->text = source;
+    Lexer* relexer = NULL;
+    size_t pos = 0;          // Where the next output token starts
+    int line = 1, column = 1;
+    int line_base = 0;       // Lines before the current chunk
+    for (int c = 0; c < count; c++) {
+        LexChunk* chunk = &chunks[c];
+        int chunk_base = line_base;
+        line_base += chunk->newlines;
+        if (pos >= chunk->end) continue; // Covered by a token that spans the whole chunk
+
+        Atom* remap = malloc(chunk->pool.count * sizeof(Atom));
+        for (Atom a = 0; a < chunk->pool.count; a++) {
+            const AtomEntry* entry = &chunk->pool.atoms[a];
+            remap[a] = a < ATOM_PREDEFINED_COUNT ? a : intern_hashed(pool, entry->text, entry->length, entry->hash, INTERN_COPY);
+        }
 
-static void enter_node(Parser* parser, const char* name) {
-    if (parser->output_file && parser->trace_parse) {
-        print_indent(parser);
-        fprintf(parser->output_file, "Enter <%s>\n", name);
+        int j = token_lower_bound(&chunk->tokens, pos);
+        if (j < chunk->tokens.count && chunk->tokens.spans[j].offset == pos) {
+            lex_take_chunk(chunk, j, remap, chunk_base, symbols, parse_tokens, &pos, &line, &column);
+        } else {
+            // The previous chunk ended inside a token of this one: lex on until they agree
+            if (!relexer) relexer = lexer_create(source, pool, arena);
+            lexer_seek(relexer, pos, line, column);
+            for (;;) {
+                Token token = lexer_next_token(relexer);
+                if (token.type == TOKEN_EOF || token.offset >= chunk->end) {
+                    pos = token.offset;
+                    line = token.line;
+                    column = token.column;
+                    break;
+                }
+                while (j < chunk->tokens.count && chunk->tokens.spans[j].offset < token.offset) j++;
+                if (j < chunk->tokens.count && chunk->tokens.spans[j].offset == token.offset) {
+                    lex_take_chunk(chunk, j, remap, chunk_base, symbols, parse_tokens, &pos, &line, &column);
+                    break;
+                }
+                lex_emit(symbols, parse_tokens, token);
+            }
+        }
+        free(remap);
     }
-    parser->indent_level++;
-}
 
-static void exit_node(Parser* parser, const char* name) {
-    parser->indent_level--;
-    if (!parser->output_file || !parser->trace_parse) return;
-    print_indent(parser);
-    fprintf(parser->output_file, "Exit <%s>\n", name);
+    for (int i = 0; i < count; i++) {
+        interner_free(&chunks[i].pool);
+        arena_free(&chunks[i].arena);
+    }
+    free(chunks);
 }
 
-static void print_next_token(Parser* parser) {
+/* ============================================================================
+ * INTERPRETER / EVALUATOR DEFINITIONS
+ * ============================================================================ */
 
-}
+typedef enum { VAL_INT, VAL_DOUBLE, VAL_BOOL, VAL_STRING, VAL_CHAR, VAL_VOID, VAL_NULL } ValueType;
 
-Parser* parser_create(TokenList* token_list) {
-    Parser* parser = malloc(sizeof(Parser));
-    parser->token_list = token_list;
-    parser->current_index = 0;
-    parser->had_error = false;
-    parser->panic_mode = false;
-    parser->indent_level = 0;
-    parser->output_file = NULL;
-    
-    parser->env = NULL;
-    parser->executing = true;
-    parser->trace_parse = true;
+// Immutable, reference-counted string. Copying a string Value retains it and
+// dropping one releases it, so a read is a counter bump rather than a strdup.
+// Literals live in the AST arena with a negative count: they are never
+// retained, released or freed, and the constant pool shares them as-is.
+//
+// The one exception to immutability is string_append: a string nobody else
+// references may grow in place, into spare capacity that doubles as needed.
+#define STRING_IMMORTAL -1
 
-    parser->current_token.type = INVALID;
-    parser->current_token.lexeme = NULL;
-    parser->current_token.raw = NULL;
-    
-    parser->previous_token.type = INVALID;
-    parser->previous_token.lexeme = NULL;
-    parser->previous_token.raw = NULL;
-    
-    // Prime the pump
-    if (parser->token_list->count > 0) {
-        parser->next_token = parser->token_list->tokens[parser->current_index++];
-    } else {
-        parser->next_token = create_token(TOKEN_EOF, "", "", 0, 0);
+typedef struct {
+    int refcount;
+    uint32_t length;
+    uint32_t capacity;   // Bytes available for chars, excluding the NUL
+    char chars[];        // NUL-terminated
+} ObjString;
+
+static ObjString* string_alloc(size_t capacity) {
+    ObjString* str = malloc(sizeof(ObjString) + capacity + 1);
+    if (!str) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
     }
-    parser->has_next_token = true;
-    
-    advance(parser);
-    return parser;
+    str->refcount = 1;
+    str->length = 0;
+    str->capacity = (uint32_t)capacity;
+    str->chars[0] = '\0';
+    return str;
 }
 
-static void error_at(Parser* parser, Token* token, const char* message) {
-    if (parser->panic_mode) return;
-    parser->panic_mode = true;
-    parser->had_error = true;
-    fprintf(stderr, "[line %d:%d] Error", token->line, token->column);
-    if (token->type == TOKEN_EOF) fprintf(stderr, " at end");
-    else if (token->type != INVALID) fprintf(stderr, " at '%s'", token->raw);
-    fprintf(stderr, ": %s\n", message);
+static ObjString* string_new_immortal(Arena* arena, const char* text, size_t length) {
+    ObjString* str = arena_alloc(arena, sizeof(ObjString) + length + 1);
+    str->refcount = STRING_IMMORTAL;
+    str->length = (uint32_t)length;
+    str->capacity = (uint32_t)length;
+    memcpy(str->chars, text, length);
+    str->chars[length] = '\0';
+    return str;
 }
 
-static void error(Parser* parser, const char* message) {
-    error_at(parser, &parser->current_token, message);
+static void string_release(ObjString* str) {
+    if (str->refcount > 0 && --str->refcount == 0) free(str);
 }
 
-static void advance(Parser* parser) {
-    // Note: We do not free lexemes here because they are owned by TokenList
-    
-    parser->previous_token = parser->current_token;
-    parser->current_token = parser->next_token;
-    
-    if (parser->current_token.type != TOKEN_EOF) {
-        if (parser->current_index < parser->token_list->count) {
-            parser->next_token = parser->token_list->tokens[parser->current_index++];
-        } else {
-             // Create a dummy EOF token if we run out
-            parser->next_token = create_token(TOKEN_EOF, "", "", 0, 0);
-        }
-    } else {
-        // Keep returning EOF
-        parser->next_token = create_token(TOKEN_EOF, "", "", 0, 0);
-    }
-    
-    if (parser->output_file && parser->trace_parse) {
-        print_indent(parser);
-        fprintf(parser->output_file, "Next token is: %s Next lexeme is %s\n", 
-            token_type_to_string(parser->current_token.type), 
-            parser->current_token.lexeme ? parser->current_token.lexeme : "");
-    }
-}
+typedef struct {
+    ValueType type;
+    union {
+        int int_val;
+        double double_val;
+        bool bool_val;
+        ObjString* string_val;
+        char char_val;
+    } as;
+} Value;
 
-static bool check(Parser* parser, TokenType type) { return parser->current_token.type == type; }
+static Value make_int(int v) { Value val; val.type = VAL_INT; val.as.int_val = v; return val; }
+static Value make_double(double v) { Value val; val.type = VAL_DOUBLE; val.as.double_val = v; return val; }
+static Value make_bool(bool v) { Value val; val.type = VAL_BOOL; val.as.bool_val = v; return val; }
+static Value make_string(ObjString* str) { Value val; val.type = VAL_STRING; val.as.string_val = str; return val; }
+static Value make_char(char v) { Value val; val.type = VAL_CHAR; val.as.char_val = v; return val; }
+static Value make_void() { Value val; val.type = VAL_VOID; return val; }
+static Value make_null() { Value val; val.type = VAL_NULL; return val; }
 
-static bool match(Parser* parser, TokenType type) {
-    if (check(parser, type)) {
-        advance(parser);
-        return true;
-    }
-    return false;
+static void free_value(Value v) {
+    if (v.type == VAL_STRING) string_release(v.as.string_val);
 }
 
-static void consume(Parser* parser, TokenType type, const char* message) {
-    if (check(parser, type)) {
-        advance(parser);
-        return;
-    }
-    error(parser, message);
+// Takes another reference to a value that is about to live in a second place
+// (stack and slot).
+static Value value_retain(Value v) {
+    if (v.type == VAL_STRING && v.as.string_val->refcount > 0) v.as.string_val->refcount++;
+    return v;
 }
 
-static void synchronize(Parser* parser) {
-    parser->panic_mode = false;
-    while (parser->current_token.type != TOKEN_EOF) {
-        if (parser->current_token.type == SEMICOLON) {
-            advance(parser);
-            return;
-        }
-        switch (parser->current_token.type) {
-            case KEYWORD: case RESERVED_WORD: case TYPE: return;
-            default: ;
-        }
-        advance(parser);
+// Large enough for any value_text result (%f of DBL_MAX is 316 characters).
+#define VALUE_TEXT_MAX 400
+
+// --- Number Formatting ---
+// Hand-written replacements for snprintf's "%d" and "%f", which parse their
+// format and take the stream lock on every call. The output is the same
+// byte for byte: scripts have always printed doubles with six decimals, so
+// the double formatter rounds the exact binary value to a multiple of 1e-6,
+// ties to even, as glibc does, rather than switching to shortest round-trip
+// digits that would change what every script prints.
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes the digits of value backwards, ending just before `end`; returns
+// where they start.
+static char* format_digits(uint64_t value, char* end) {
+    while (value >= 100) {
+        const char* pair = &DIGIT_PAIRS[(value % 100) * 2];
+        value /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if (value >= 10) {
+        *--end = DIGIT_PAIRS[value * 2 + 1];
+        *--end = DIGIT_PAIRS[value * 2];
+    } else {
+        *--end = (char)('0' + value);
     }
+    return end;
 }
 
-// --- Grammar Rules ---
-
-static void block(Parser* parser) {
-    enter_node(parser, "Block");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) statement(parser);
-    consume(parser, RIGHT_BRACE, "Expect '}' after block.");
-    exit_node(parser, "Block");
+static size_t format_int(int value, char* buf) {
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* start = format_digits(value < 0 ? 0u - (uint32_t)value : (uint32_t)value, end);
+    if (value < 0) *--start = '-';
+    size_t length = (size_t)(end - start);
+    memcpy(buf, start, length);
+    buf[length] = '\0';
+    return length;
 }
 
-static Value primary(Parser* parser) {
-    enter_node(parser, "Primary");
-    if (match(parser, NUMBER)) { 
-        Value v;
-        if (strchr(parser->previous_token.lexeme, '.') || strchr(parser->previous_token.lexeme, 'e')) 
-             v = make_double(atof(parser->previous_token.lexeme));
-        else v = make_int(atoi(parser->previous_token.lexeme));
-        exit_node(parser, "Primary"); return v; 
-    }
-    if (match(parser, STRING_LITERAL)) { 
-        Value v = make_string(parser->previous_token.lexeme);
-        exit_node(parser, "Primary"); return v; 
-    }
-    if (match(parser, CHAR_LITERAL)) { 
-        Value v = make_char(parser->previous_token.lexeme[0]);
-        exit_node(parser, "Primary"); return v; 
-    }
-    if (match(parser, BOOLEAN_LITERAL)) { 
-        Value v = make_bool(strcmp(parser->previous_token.lexeme, "true") == 0);
-        exit_node(parser, "Primary"); return v; 
-    }
-    if (match(parser, IDENTIFIER)) {
-        strncpy(parser->last_id, parser->previous_token.lexeme, 63);
-        Value v = make_int(0);
-        if (parser->executing) {
-            if(!env_get(parser->env, parser->previous_token.lexeme, &v)) {
-                // Default 0
-            }
-        }
-        exit_node(parser, "Primary"); return v;
-    }
-    if (match(parser, KEYWORD)) {
-        strncpy(parser->last_id, parser->previous_token.lexeme, 63);
-        Value v = make_int(0);
-        if (parser->executing) env_get(parser->env, parser->previous_token.lexeme, &v); 
-        exit_node(parser, "Primary"); return v; 
+// "%f" of value, or 0 outside the integer path: infinities, NaN and
+// magnitudes from about 1.8e13 up are left to snprintf.
+static size_t format_fixed(double value, char* buf) {
+#ifdef __SIZEOF_INT128__
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int exponent = (int)((bits >> 52) & 0x7FF);
+    uint64_t mantissa = bits & ((1ull << 52) - 1);
+    if (exponent == 0x7FF) return 0;
+    if (exponent) mantissa |= 1ull << 52;
+    else exponent = 1;
+    exponent -= 1075;   // |value| = mantissa * 2^exponent
+
+    // Millionths, below 2^73 before the shift
+    unsigned __int128 scaled = (unsigned __int128)mantissa * 1000000u;
+    if (exponent >= 0) {
+        if (exponent > 54) return 0;
+        scaled <<= exponent;
+    } else if (exponent > -100) {
+        unsigned __int128 half = (unsigned __int128)1 << (-exponent - 1);
+        unsigned __int128 rest = scaled & ((half << 1) - 1);
+        scaled >>= -exponent;
+        if (rest > half || (rest == half && (scaled & 1))) scaled++;
+    } else {
+        scaled = 0;     // |value| < 2^-47, nowhere near half a millionth
     }
-    
-    if (match(parser, LEFT_PAREN)) {
-        Value v = expression(parser);
-        consume(parser, RIGHT_PAREN, "Expect ')' after expression.");
-        exit_node(parser, "Primary");
-        return v;
+    if (scaled >> 64) return 0;
+
+    uint64_t millionths = (uint64_t)scaled;
+    char digits[40];
+    char* end = digits + sizeof(digits);
+    uint32_t fraction = (uint32_t)(millionths % 1000000);
+    for (int i = 0; i < 6; i += 2, fraction /= 100) {
+        const char* pair = &DIGIT_PAIRS[(fraction % 100) * 2];
+        *--end = pair[1];
+        *--end = pair[0];
     }
-    error(parser, "Expect expression.");
-    exit_node(parser, "Primary");
-    return make_null();
+    *--end = '.';
+    char* start = format_digits(millionths / 1000000, end);
+    if (bits >> 63) *--start = '-';
+    size_t length = (size_t)(digits + sizeof(digits) - start);
+    memcpy(buf, start, length);
+    buf[length] = '\0';
+    return length;
+#else
+    (void)value;
+    (void)buf;
+    return 0;
+#endif
 }
 
-static Value postfix(Parser* parser) {
-    enter_node(parser, "Prefix/Postfix");
-    Value v = make_null();
-    if (match(parser, PLUS_PLUS)) {
-        v = postfix(parser);
-        if (parser->executing) {
-            v = val_add(v, make_int(1));
-            env_assign(parser->env, parser->last_id, v); 
-        }
-    } else if (match(parser, MINUS_MINUS)) {
-        v = postfix(parser);
-        if (parser->executing) {
-            v = val_sub(v, make_int(1));
-            env_assign(parser->env, parser->last_id, v);
-        }
-    } else {
-        v = primary(parser);
-        while (check(parser, PLUS_PLUS) || check(parser, MINUS_MINUS)) {
-            bool inc = check(parser, PLUS_PLUS);
-            advance(parser);
-            if (parser->executing) {
-                Value old = v;
-                Value new_val = inc ? val_add(v, make_int(1)) : val_sub(v, make_int(1));
-                env_assign(parser->env, parser->last_id, new_val);
-                v = old; 
-            }
-        }
+// Text of a value as print shows it. Points into the string itself for
+// strings, otherwise into buf (VALUE_TEXT_MAX bytes).
+static const char* value_text(Value v, char* buf, size_t* length) {
+    size_t n = 0;
+    switch (v.type) {
+        case VAL_STRING: *length = v.as.string_val->length; return v.as.string_val->chars;
+        case VAL_INT: n = format_int(v.as.int_val, buf); break;
+        case VAL_DOUBLE:
+            n = format_fixed(v.as.double_val, buf);
+            if (!n) n = (size_t)snprintf(buf, VALUE_TEXT_MAX, "%f", v.as.double_val);
+            break;
+        case VAL_BOOL: n = v.as.bool_val ? 4 : 5; memcpy(buf, v.as.bool_val ? "true" : "false", n + 1); break;
+        case VAL_CHAR: buf[0] = v.as.char_val; buf[1] = '\0'; n = 1; break;
+        default: n = 4; memcpy(buf, "null", 5); break;
     }
-    exit_node(parser, "Prefix/Postfix");
-    return v;
+    *length = n;
+    return buf;
 }
 
-static Value unary(Parser* parser) {
-    enter_node(parser, "Unary");
-    if (match(parser, NOT)) {
-        Value v = unary(parser);
-        if(parser->executing && v.type == VAL_BOOL) v.as.bool_val = !v.as.bool_val;
-        exit_node(parser, "Unary");
-        return v;
-    }
-    if (match(parser, MINUS)) {
-        Value v = unary(parser);
-        if(parser->executing) {
-             if (v.type == VAL_INT) v.as.int_val = -v.as.int_val;
-             else if (v.type == VAL_DOUBLE) v.as.double_val = -v.as.double_val;
-        }
-        exit_node(parser, "Unary");
-        return v;
-    }
-    Value v = postfix(parser);
-    exit_node(parser, "Unary");
-    return v;
+// a + b where either side is a string: the other side is converted as print would show it.
+static Value string_concat(Value a, Value b) {
+    char a_buf[VALUE_TEXT_MAX], b_buf[VALUE_TEXT_MAX];
+    size_t a_len, b_len;
+    const char* a_text = value_text(a, a_buf, &a_len);
+    const char* b_text = value_text(b, b_buf, &b_len);
+    ObjString* str = string_alloc(a_len + b_len);
+    memcpy(str->chars, a_text, a_len);
+    memcpy(str->chars + a_len, b_text, b_len);
+    str->length = (uint32_t)(a_len + b_len);
+    str->chars[str->length] = '\0';
+    return make_string(str);
 }
 
-static Value factor(Parser* parser) {
-    enter_node(parser, "Factor");
-    Value lhs = unary(parser);
-    while (check(parser, SLASH) || check(parser, STAR) || check(parser, PERCENT)) {
-        TokenType op = parser->current_token.type;
-        advance(parser);
-        Value rhs = unary(parser);
-        if(parser->executing) {
-            if(op == PLUS) lhs = val_add(lhs, rhs); 
-            if(op == STAR) lhs = val_mul(lhs, rhs);
-            if(op == SLASH) lhs = val_div(lhs, rhs);
-            if(op == PERCENT) {
-                 if (lhs.type == VAL_INT && rhs.type == VAL_INT) lhs = make_int(lhs.as.int_val % rhs.as.int_val);
-            }
+// `target += rhs` for a string target that holds the only reference to its
+// string: appends in place and returns true. Capacity at least doubles on
+// growth, so a loop of appends is amortized O(1) per appended byte instead of
+// copying the whole string each time. Returns false when a copy is needed.
+static bool string_append(Value* target, Value rhs) {
+    if (target->type != VAL_STRING || target->as.string_val->refcount != 1) return false;
+    char buf[VALUE_TEXT_MAX];
+    size_t length;
+    const char* text = value_text(rhs, buf, &length);
+    ObjString* str = target->as.string_val;
+    size_t needed = (size_t)str->length + length;
+    if (needed > str->capacity) {
+        size_t capacity = (size_t)str->capacity * 2;
+        if (capacity < needed) capacity = needed;
+        if (capacity < 16) capacity = 16;
+        str = realloc(str, sizeof(ObjString) + capacity + 1);
+        if (!str) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
         }
+        str->capacity = (uint32_t)capacity;
+        target->as.string_val = str;
     }
-    exit_node(parser, "Factor");
-    return lhs;
+    memcpy(str->chars + str->length, text, length);
+    str->length = (uint32_t)needed;
+    str->chars[needed] = '\0';
+    return true;
 }
 
-static Value term(Parser* parser) {
-    enter_node(parser, "Term");
-    Value lhs = factor(parser);
-    while (check(parser, MINUS) || check(parser, PLUS)) {
-        TokenType op = parser->current_token.type;
-        advance(parser);
-        Value rhs = factor(parser);
-        if(parser->executing) {
-            if(op == PLUS) lhs = val_add(lhs, rhs);
-            if(op == MINUS) lhs = val_sub(lhs, rhs);
-        }
+static double value_to_double(Value v) {
+    switch (v.type) {
+        case VAL_INT: return v.as.int_val;
+        case VAL_DOUBLE: return v.as.double_val;
+        case VAL_BOOL: return v.as.bool_val ? 1 : 0;
+        case VAL_CHAR: return (unsigned char)v.as.char_val;
+        default: return 0;
     }
-    exit_node(parser, "Term");
-    return lhs;
 }
 
-static Value type_conversion(Parser* parser) {
-    enter_node(parser, "TypeConversion");
-    Value v = term(parser);
-    while (match(parser, AS)) {
-        consume(parser, TYPE, "Expect type after 'as'.");
-        // Implementation of cast? For now skip.
-    }
-    exit_node(parser, "TypeConversion");
-    return v;
+// Int arithmetic wraps around, as the JIT's machine instructions do, instead
+// of overflowing into undefined behaviour. A zero divisor gives 0, and -1
+// negates, because INT_MIN / -1 and INT_MIN % -1 trap on x86.
+static inline int int_add(int a, int b) { return (int)((unsigned)a + (unsigned)b); }
+static inline int int_sub(int a, int b) { return (int)((unsigned)a - (unsigned)b); }
+static inline int int_mul(int a, int b) { return (int)((unsigned)a * (unsigned)b); }
+static inline int int_neg(int a) { return (int)(0u - (unsigned)a); }
+static inline int int_div(int a, int b) { return b == 0 ? 0 : b == -1 ? int_neg(a) : a / b; }
+static inline int int_mod(int a, int b) { return b == 0 || b == -1 ? 0 : a % b; }
+
+// Mixed operands are converted with value_to_double, so a bool or char counts
+// as 0/1 or its code rather than whatever bytes its union holds.
+static Value val_add(Value a, Value b) {
+    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(int_add(a.as.int_val, b.as.int_val));
+    if(a.type == VAL_STRING || b.type == VAL_STRING) return string_concat(a, b);
+    if(a.type == VAL_DOUBLE || b.type == VAL_DOUBLE) return make_double(value_to_double(a) + value_to_double(b));
+    return make_int(0); 
 }
-
-static Value comparison(Parser* parser) {
-    enter_node(parser, "Comparison");
-    Value lhs = type_conversion(parser);
-    while (check(parser, GREATER) || check(parser, GREATER_EQUAL) ||
-           check(parser, LESS) || check(parser, LESS_EQUAL)) {
-        TokenType op = parser->current_token.type;
-        advance(parser);
-        Value rhs = type_conversion(parser);
-        if (parser->executing) {
-             bool res = false;
-             // Naive comparison (assume int for simplicity or double)
-             double d1 = (lhs.type == VAL_INT) ? lhs.as.int_val : lhs.as.double_val;
-             double d2 = (rhs.type == VAL_INT) ? rhs.as.int_val : rhs.as.double_val;
-             if (op == GREATER) res = d1 > d2;
-             if (op == GREATER_EQUAL) res = d1 >= d2;
-             if (op == LESS) res = d1 < d2;
-             if (op == LESS_EQUAL) res = d1 <= d2;
-             lhs = make_bool(res);
-        }
-    }
-    exit_node(parser, "Comparison");
-    return lhs;
+static Value val_sub(Value a, Value b) {
+    double d1 = value_to_double(a);
+    double d2 = value_to_double(b);
+    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(int_sub(a.as.int_val, b.as.int_val));
+    return make_double(d1 - d2);
 }
-
-static Value equality(Parser* parser) {
-    enter_node(parser, "Equality");
-    Value lhs = comparison(parser);
-    while (check(parser, NOT_EQUAL) || check(parser, EQUAL_EQUAL)) {
-        TokenType op = parser->current_token.type;
-        advance(parser);
-        Value rhs = comparison(parser);
-        if (parser->executing) {
-             bool res = false;
-             if (lhs.type == VAL_INT && rhs.type == VAL_INT) {
-                 res = (lhs.as.int_val == rhs.as.int_val);
-             } else if (lhs.type == VAL_BOOL && rhs.type == VAL_BOOL) {
-                 res = (lhs.as.bool_val == rhs.as.bool_val);
-             } else {
-                 double d1 = (lhs.type == VAL_INT) ? lhs.as.int_val : lhs.as.double_val;
-                 double d2 = (rhs.type == VAL_INT) ? rhs.as.int_val : rhs.as.double_val;
-                 res = (d1 == d2);
-             }
-             if (op == NOT_EQUAL) res = !res;
-             lhs = make_bool(res);
-        }
+static Value val_mul(Value a, Value b) {
+    double d1 = value_to_double(a);
+    double d2 = value_to_double(b);
+    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(int_mul(a.as.int_val, b.as.int_val));
+    return make_double(d1 * d2);
+}
+static Value val_div(Value a, Value b) {
+    double d1 = value_to_double(a);
+    double d2 = value_to_double(b);
+    if(d2 == 0) return make_int(0); // Error
+    if(a.type == VAL_INT && b.type == VAL_INT) return make_int(int_div(a.as.int_val, b.as.int_val));
+    return make_double(d1 / d2);
+}
+static Value val_mod(Value a, Value b) {
+    if(a.type == VAL_INT && b.type == VAL_INT) {
+        return make_int(int_mod(a.as.int_val, b.as.int_val)); // 0 for a zero divisor
     }
-    exit_node(parser, "Equality");
-    return lhs;
+    return value_retain(a);
 }
 
-static Value logical_and(Parser* parser) {
-    enter_node(parser, "LogicalAnd");
-    Value lhs = equality(parser);
-    while (match(parser, AND_AND)) {
-        Value rhs = equality(parser);
-        if (parser->executing) {
-            bool b1 = (lhs.type == VAL_BOOL) ? lhs.as.bool_val : (lhs.as.int_val != 0);
-            bool b2 = (rhs.type == VAL_BOOL) ? rhs.as.bool_val : (rhs.as.int_val != 0);
-            lhs = make_bool(b1 && b2);
-        }
+static bool value_truthy(Value v) {
+    switch (v.type) {
+        case VAL_BOOL: return v.as.bool_val;
+        case VAL_INT: return v.as.int_val != 0;
+        case VAL_DOUBLE: return v.as.double_val != 0;
+        case VAL_CHAR: return v.as.char_val != '\0';
+        case VAL_STRING: return v.as.string_val != NULL;
+        default: return false;
     }
-    exit_node(parser, "LogicalAnd");
-    return lhs;
 }
 
-static Value logical_or(Parser* parser) {
-    enter_node(parser, "LogicalOr");
-    Value lhs = logical_and(parser);
-    while (match(parser, OR_OR)) {
-        Value rhs = logical_and(parser);
-        if (parser->executing) {
-            bool b1 = (lhs.type == VAL_BOOL) ? lhs.as.bool_val : (lhs.as.int_val != 0);
-            bool b2 = (rhs.type == VAL_BOOL) ? rhs.as.bool_val : (rhs.as.int_val != 0);
-            lhs = make_bool(b1 || b2);
-        }
+static bool value_equals(Value a, Value b) {
+    if (a.type == VAL_INT && b.type == VAL_INT) return a.as.int_val == b.as.int_val;
+    if (a.type == VAL_BOOL && b.type == VAL_BOOL) return a.as.bool_val == b.as.bool_val;
+    if (a.type == VAL_STRING && b.type == VAL_STRING) {
+        ObjString* x = a.as.string_val;
+        ObjString* y = b.as.string_val;
+        return x == y || (x->length == y->length && memcmp(x->chars, y->chars, x->length) == 0);
     }
-    exit_node(parser, "LogicalOr");
-    return lhs;
+    return value_to_double(a) == value_to_double(b);
 }
 
-static Value expression(Parser* parser) {
-    enter_node(parser, "Expression");
-    Value v = logical_or(parser);
-    exit_node(parser, "Expression");
-    return v;
+// --- Program Output ---
+// print appends to one large buffer rather than calling into stdio for each
+// value. The buffer goes out when it fills, when the program ends or reads
+// input (so a prompt is never stuck behind it), and after every line when
+// stdout is a terminal or --unbuffered asks for it.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    char data[OUTPUT_BUFFER_SIZE];
+    size_t length;
+    bool line_flush;     // Write each line as soon as it is complete
+    Diagnostics* capture; // Receives the output instead of stdout, for a server request
+} OutputBuffer;
+
+// One per thread, so each server worker runs a program of its own
+static _Thread_local OutputBuffer program_output;
+
+// Call before a run. Lines are flushed one by one when `unbuffered` is set
+// or stdout is a terminal.
+static void output_open(bool unbuffered) {
+#ifdef _WIN32
+    bool terminal = _isatty(1);
+#else
+    bool terminal = isatty(STDOUT_FILENO);
+#endif
+    program_output.length = 0;
+    program_output.line_flush = !program_output.capture && (unbuffered || terminal);
 }
 
-static void declaration_statement(Parser* parser) {
-    enter_node(parser, "DeclarationStatement");
-    if (match(parser, TYPE)) {}
-    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) {
-        advance(parser);
-    }
-    consume(parser, IDENTIFIER, "Expect variable name.");
-    char name[64];
-    strncpy(name, parser->previous_token.lexeme, 63);
-    
-    Value init = make_int(0);
-    if (match(parser, EQUAL)) init = expression(parser);
-    consume(parser, SEMICOLON, "Expect ';' after variable declaration.");
-    
-    if (parser->executing) env_define(&parser->env, name, init, false);
-    exit_node(parser, "DeclarationStatement");
+static void output_write(const char* data, size_t length) {
+    if (program_output.capture) diag_write(program_output.capture, data, length);
+    else fwrite(data, 1, length, stdout);
 }
 
-static void assignment_statement(Parser* parser) {
-    enter_node(parser, "AssignmentStatement");
-    char name[64];
-    strncpy(name, parser->previous_token.lexeme, 63);
+static void output_flush(void) {
+    if (program_output.length) output_write(program_output.data, program_output.length);
+    program_output.length = 0;
+    if (!program_output.capture) fflush(stdout);
+}
 
-    TokenType op = parser->current_token.type;
-    advance(parser); // consume =, +=, etc.
-    
-    Value rhs = expression(parser);
-    consume(parser, SEMICOLON, "Expect ';' after assignment.");
-    
-    if (parser->executing) {
-        if (op == EQUAL) {
-             env_assign(parser->env, name, rhs);
-        } else {
-             Value lhs;
-             if (env_get(parser->env, name, &lhs)) {
-                 if (op == PLUS_EQUAL) lhs = val_add(lhs, rhs);
-                 if (op == MINUS_EQUAL) lhs = val_sub(lhs, rhs);
-                 if (op == STAR_EQUAL) lhs = val_mul(lhs, rhs);
-                 if (op == SLASH_EQUAL) lhs = val_div(lhs, rhs);
-                 env_assign(parser->env, name, lhs);
-             }
-        }
+static void print_value(Value v) {
+    OutputBuffer* out = &program_output;
+    if (v.type == VAL_STRING && v.as.string_val->length >= OUTPUT_BUFFER_SIZE - out->length) {
+        // Too long to buffer: write it straight after what is pending
+        output_flush();
+        output_write(v.as.string_val->chars, v.as.string_val->length);
+    } else {
+        if (OUTPUT_BUFFER_SIZE - out->length <= VALUE_TEXT_MAX) output_flush();
+        size_t length;
+        const char* text = value_text(v, out->data + out->length, &length);
+        if (text != out->data + out->length) memcpy(out->data + out->length, text, length);
+        out->length += length;
     }
-    exit_node(parser, "AssignmentStatement");
+    out->data[out->length++] = '\n';
+    if (out->line_flush) output_flush();
 }
 
-static void input_statement(Parser* parser) {
-    enter_node(parser, "InputStatement");
-    consume(parser, LEFT_PAREN, "Expect '(' after 'input'.");
-    consume(parser, IDENTIFIER, "Expect variable name in input.");
-    char name[64];
-    strncpy(name, parser->previous_token.lexeme, 63);
-    consume(parser, RIGHT_PAREN, "Expect ')' after input variable.");
-    consume(parser, SEMICOLON, "Expect ';' after input statement.");
-    
-    if (parser->executing) {
-        int val;
-        printf("Enter value for %s: ", name);
-        if(scanf("%d", &val)) {
-            env_assign(parser->env, name, make_int(val));
+// --- Program Input ---
+// input() reads stdin through one reader instead of a scanf per call: a
+// regular file is mapped whole, anything else is read in large blocks, and
+// tokens are parsed where they lie. A token is a run of non-blank bytes,
+// converted to the target's declared type; an untyped target gets an int,
+// a double or a string, whichever the whole token reads as. The end of the
+// input, or a token that is no number for a numeric target, leaves the
+// target as it was. The prompt only appears when stdin is a terminal.
+
+#define INPUT_BLOCK_SIZE (64 * 1024)
+
+typedef struct {
+    char* data;
+    size_t length;       // Bytes in data
+    size_t position;     // Next unread byte
+    size_t capacity;     // Of the read buffer
+    bool opened;
+    bool mapped;         // data maps all of stdin, a regular file
+    bool at_end;         // Nothing more to read
+    bool terminal;
+} InputReader;
+
+static _Thread_local InputReader program_input;
+
+static void input_open(InputReader* in) {
+    memset(in, 0, sizeof(InputReader));
+    in->opened = true;
+#ifdef _WIN32
+    in->terminal = _isatty(0);
+#else
+    in->terminal = isatty(STDIN_FILENO);
+    struct stat st;
+    off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (!in->terminal && offset >= 0 && fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > offset) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (data != MAP_FAILED) {
+            in->data = data;
+            in->length = (size_t)st.st_size;
+            in->position = (size_t)offset;
+            in->mapped = in->at_end = true;
         }
     }
-    exit_node(parser, "InputStatement");
+#endif
 }
 
-static void output_statement(Parser* parser) {
-    enter_node(parser, "OutputStatement");
-    consume(parser, LEFT_PAREN, "Expect '(' after 'print'.");
-    Value v = expression(parser);
-    consume(parser, RIGHT_PAREN, "Expect ')' after print expression.");
-    consume(parser, SEMICOLON, "Expect ';' after print statement.");
-    
-    if (parser->executing) {
-        if (v.type == VAL_INT) printf("%d\n", v.as.int_val);
-        else if (v.type == VAL_DOUBLE) printf("%f\n", v.as.double_val);
-        else if (v.type == VAL_STRING) printf("%s\n", v.as.string_val);
-        else if (v.type == VAL_BOOL) printf("%s\n", v.as.bool_val ? "true" : "false");
-        else if (v.type == VAL_CHAR) printf("%c\n", v.as.char_val);
-        else printf("null\n");
-    }
-    exit_node(parser, "OutputStatement");
+// Has input() read `data` instead of stdin, as a server request's runs do
+static void input_open_text(const char* data, size_t length) {
+    InputReader* in = &program_input;
+    memset(in, 0, sizeof(InputReader));
+    in->opened = in->at_end = true;
+    in->data = malloc(length + 1);
+    if (length) memcpy(in->data, data, length);
+    in->length = in->capacity = length;
 }
 
-static void jump_to(Parser* parser, int token_index) {
-    parser->current_index = token_index;
-    if (parser->current_index < parser->token_list->count)
-        parser->next_token = parser->token_list->tokens[parser->current_index++];
+static void input_close(void) {
+    InputReader* in = &program_input;
+#ifndef _WIN32
+    if (in->mapped) munmap(in->data, in->length);
     else
-        parser->next_token = create_token(TOKEN_EOF, "", "", 0, 0);
-    advance(parser);
+#endif
+    free(in->data);
+    memset(in, 0, sizeof(InputReader));
 }
 
-static void while_statement(Parser* parser) {
-    enter_node(parser, "WhileStatement");
-    int loop_start = parser->current_index - 2; 
-    
-    if (check(parser, NOISE_WORD) && strcmp(parser->current_token.lexeme, "its") == 0) advance(parser);
-    consume(parser, LEFT_PAREN, "Expect '(' after 'while'.");
-    Value cond = expression(parser);
-    consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
-    
-    if (parser->executing) {
-        bool b = (cond.type == VAL_BOOL) ? cond.as.bool_val : (cond.as.int_val != 0);
-        while (b) {
-            statement(parser);
-            jump_to(parser, loop_start);
-            parser->trace_parse = false;
-            
-            // Re-eval condition
-            if (check(parser, NOISE_WORD)) advance(parser);
-            consume(parser, LEFT_PAREN, "msg");
-            cond = expression(parser);
-            consume(parser, RIGHT_PAREN, "msg");
-            b = (cond.type == VAL_BOOL) ? cond.as.bool_val : (cond.as.int_val != 0);
-        }
-        parser->executing = false;
-        statement(parser);
-        parser->executing = true;
-    } else {
-        statement(parser);
+// Moves the unread bytes to the front and reads more after them. False at
+// the end of the input.
+static bool input_fill(InputReader* in) {
+    if (in->at_end) return false;
+    if (in->position) memmove(in->data, in->data + in->position, in->length - in->position);
+    in->length -= in->position;
+    in->position = 0;
+    if (in->length == in->capacity) {
+        in->capacity = in->capacity ? in->capacity * 2 : INPUT_BLOCK_SIZE;
+        in->data = realloc(in->data, in->capacity);
+    }
+    for (;;) {
+#ifdef _WIN32
+        int n = _read(0, in->data + in->length, (unsigned)(in->capacity - in->length));
+#else
+        ssize_t n = read(STDIN_FILENO, in->data + in->length, in->capacity - in->length);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) {
+            in->at_end = true;
+            return false;
+        }
+        in->length += (size_t)n;
+        return true;
     }
-    
-    parser->trace_parse = true;
-    exit_node(parser, "WhileStatement");
 }
 
-static void for_statement(Parser* parser) {
-    enter_node(parser, "ForStatement");
-    consume(parser, LEFT_PAREN, "Expect '(' after 'for'.");
-    
-    if (match(parser, SEMICOLON)) {}
-    else if (match(parser, TYPE)) declaration_statement(parser);
-    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) {
-        advance(parser);
-        declaration_statement(parser);
+static bool input_token(InputReader* in, const char** text, size_t* length) {
+    for (;;) {
+        while (in->position < in->length && isspace((unsigned char)in->data[in->position])) in->position++;
+        if (in->position < in->length) break;
+        if (!input_fill(in)) return false;
     }
-    else if (match(parser, IDENTIFIER)) {
-         assignment_statement(parser); 
+    size_t end = in->position;
+    for (;;) {
+        while (end < in->length && !isspace((unsigned char)in->data[end])) end++;
+        if (end < in->length) break;
+        // The token runs to the end of what has been read so far
+        // and input_fill may move it to the front even when it reads nothing
+        size_t scanned = end - in->position;
+        bool more = input_fill(in);
+        end = in->position + scanned;
+        if (!more) break;
     }
-    else error(parser, "Expect variable declaration or assignment in for loop.");
-    
-    int cond_loc = parser->current_index - 2;
-    /* Debug */
-    /* printf("DEBUG: Cond loc: %d. Lexeme: %s\n", cond_loc, parser->token_list->tokens[cond_loc].lexeme); */ 
+    *text = in->data + in->position;
+    *length = end - in->position;
+    in->position = end;
+    return true;
+}
 
-    bool first_pass = true;
-    
-    while(1) { 
-        if (!first_pass) {
-             /* printf("Jumping to cond %d\n", cond_loc); */
-             jump_to(parser, cond_loc);
-             parser->trace_parse = false;
+// Leading integer of the token, as %d reads one, saturating outside int's
+// range. `used` is the length of the digits and sign; 0 if there are none.
+static int parse_int_prefix(const char* text, size_t length, size_t* used, bool* saturated) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < length && (text[i] == '+' || text[i] == '-')) negative = text[i++] == '-';
+    size_t digits = i;
+    int64_t value = 0;
+    *saturated = false;
+    for (; i < length && text[i] >= '0' && text[i] <= '9'; i++) {
+        if (value <= (int64_t)INT32_MAX + 1) value = value * 10 + (text[i] - '0');
+    }
+    *used = i > digits ? i : 0;
+    if (negative) value = -value;
+    if (value > INT32_MAX || value < INT32_MIN) {
+        *saturated = true;
+        return value > 0 ? INT32_MAX : INT32_MIN;
+    }
+    return (int)value;
+}
+
+// Leading double of the token, with strtod's syntax.
+static double parse_double_prefix(const char* text, size_t length, size_t* used) {
+    char small[64];
+    char* copy = length < sizeof(small) ? small : malloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    char* end;
+    double value = strtod(copy, &end);
+    *used = (size_t)(end - copy);
+    if (copy != small) free(copy);
+    return value;
+}
+
+// Prompts for `name` if stdin is a terminal and reads its next token as
+// `type`, the target's declared type (ATOM_EMPTY or var and the like when
+// untyped). False when nothing was read into *out.
+static bool input_value(const char* name, Atom type, Value* out) {
+    InputReader* in = &program_input;
+    if (!in->opened) input_open(in);
+    if (in->terminal) {
+        output_flush();
+        printf("Enter value for %s: ", name);
+        fflush(stdout);
+    }
+    const char* text;
+    size_t length, used;
+    bool saturated;
+    if (!input_token(in, &text, &length)) return false;
+    switch (type) {
+        case ATOM_INT: {
+            int value = parse_int_prefix(text, length, &used, &saturated);
+            if (!used) return false;
+            *out = make_int(value);
+            return true;
         }
-        
-        Value cond = make_bool(true);
-        if (!check(parser, SEMICOLON)) cond = expression(parser);
-        consume(parser, SEMICOLON, "Expect ';' after loop condition.");
-        
-        bool b = (cond.type == VAL_BOOL) ? cond.as.bool_val : (cond.as.int_val != 0);
-        if (!parser->executing) b = false; 
-        
-        int inc_loc = parser->current_index - 2;
-        
-        bool old_exec = parser->executing;
-        parser->executing = false;
-        if (!check(parser, RIGHT_PAREN)) {
-             expression(parser);
+        case ATOM_DOUBLE: {
+            double value = parse_double_prefix(text, length, &used);
+            if (!used) return false;
+            *out = make_double(value);
+            return true;
         }
-        consume(parser, RIGHT_PAREN, "Expect ')' after for clauses.");
-        parser->executing = old_exec;
-        
-        if (b) {
-            statement(parser); 
-            parser->trace_parse = false;
-            jump_to(parser, inc_loc);
-            parser->executing = true;
-            if (!check(parser, RIGHT_PAREN)) { 
-                expression(parser); 
-            }
-            first_pass = false;
-        } else {
-             if (parser->executing) { 
-                 parser->executing = false;
-                 statement(parser);
-                 parser->executing = true;
-             } else {
-                 statement(parser); 
-             }
-             break;
+        case ATOM_BOOL: {
+            if (length == 4 && memcmp(text, "true", 4) == 0) { *out = make_bool(true); return true; }
+            if (length == 5 && memcmp(text, "false", 5) == 0) { *out = make_bool(false); return true; }
+            int value = parse_int_prefix(text, length, &used, &saturated);
+            if (!used) return false;
+            *out = make_bool(value != 0);
+            return true;
+        }
+        case ATOM_CHAR:
+            *out = make_char(text[0]);
+            return true;
+        case ATOM_STR:
+            break;
+        default: {
+            int value = parse_int_prefix(text, length, &used, &saturated);
+            if (used == length && !saturated) { *out = make_int(value); return true; }
+            double d = parse_double_prefix(text, length, &used);
+            if (used == length) { *out = make_double(d); return true; }
+            break;
         }
     }
-    parser->trace_parse = true;
-    exit_node(parser, "ForStatement");
+    ObjString* str = string_alloc(length);
+    memcpy(str->chars, text, length);
+    str->chars[length] = '\0';
+    str->length = (uint32_t)length;
+    *out = make_string(str);
+    return true;
 }
 
-static void foreach_statement(Parser* parser) {
-    enter_node(parser, "ForeachStatement");
-    consume(parser, LEFT_PAREN, "Expect '(' after 'foreach'.");
-    if (match(parser, TYPE)) {}
-    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) advance(parser);
-    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "var") == 0) advance(parser);
-    else error(parser, "Expect type or 'var' in foreach.");
-    consume(parser, IDENTIFIER, "Expect variable name.");
-    if (check(parser, RESERVED_WORD) && strcmp(parser->current_token.lexeme, "in") == 0) {
+/* ============================================================================
+ * ABSTRACT SYNTAX TREE
+ * ============================================================================
+ * The parser builds this tree once; the evaluator walks it as many times as
+ * loops require. Nodes live in the parser's arena; names are Atoms and string
+ * literals borrow interned text, so the Interner must outlive the tree.
+ */
+
+typedef enum {
+    EXPR_LITERAL,      // Resolved constant (number, string, char, bool)
+    EXPR_VARIABLE,     // Identifier or contextual keyword reference
+    EXPR_UNARY,        // !e, -e
+    EXPR_BINARY,       // Arithmetic, comparison, equality
+    EXPR_LOGICAL,      // && and || (short-circuit)
+    EXPR_INCDEC        // ++e, --e, e++, e--
+} ExprKind;
+
+typedef struct Expr {
+    ExprKind kind;
+    int line;
+    int column;
+    union {
+        Value literal;
+        struct { Atom name; int slot; } variable;
+        struct { TokenType op; struct Expr* operand; } unary;
+        struct { TokenType op; struct Expr* left; struct Expr* right; } binary;
+        struct { TokenType op; bool prefix; Atom target; int slot; struct Expr* operand; } incdec; // ATOM_EMPTY: no target
+    } as;
+} Expr;
+
+// --- Operator Chains ---
+// `a + b + c` parses left-deep: the root's left operand is `a + b`. A flat
+// chain of operators is not nesting, so the parser puts no cap on its length,
+// and every walk over the tree follows left operands with a loop rather than
+// recursion. A walk that must finish the left operand before the operator
+// (evaluating, folding, typing, compiling) collects the chain with
+// chain_collect and works back up from its innermost operator. Only right
+// and unary operands recurse, and those are bounded by PARSE_MAX_DEPTH.
+
+static inline bool is_operator_node(const Expr* expr) {
+    return expr->kind == EXPR_BINARY || expr->kind == EXPR_LOGICAL;
+}
+
+#define CHAIN_INLINE 16
+
+typedef struct {
+    Expr** nodes;        // nodes[0] is the chain's root, nodes[count - 1] its innermost operator
+    int count;
+    int capacity;
+    Expr* inline_nodes[CHAIN_INLINE];
+} ExprChain;
+
+// Collects `expr` and the binary and logical nodes down its left operands;
+// returns the leftmost operand, the first that is neither.
+static Expr* chain_collect(ExprChain* chain, Expr* expr) {
+    chain->nodes = chain->inline_nodes;
+    chain->count = 0;
+    chain->capacity = CHAIN_INLINE;
+    for (; is_operator_node(expr); expr = expr->as.binary.left) {
+        if (chain->count == chain->capacity) {
+            chain->capacity *= 2;
+            if (chain->nodes == chain->inline_nodes) {
+                chain->nodes = malloc(chain->capacity * sizeof(Expr*));
+                memcpy(chain->nodes, chain->inline_nodes, sizeof(chain->inline_nodes));
+            } else {
+                chain->nodes = realloc(chain->nodes, chain->capacity * sizeof(Expr*));
+            }
+        }
+        chain->nodes[chain->count++] = expr;
+    }
+    return expr;
+}
+
+static void chain_free(ExprChain* chain) {
+    if (chain->nodes != chain->inline_nodes) free(chain->nodes);
+}
+
+typedef enum {
+    STMT_EXPRESSION,   // Increment/decrement or call used as a statement
+    STMT_DECLARATION,  // TYPE/var/const/dyn/let declarations
+    STMT_ASSIGNMENT,   // =, +=, -=, *=, /=, %= and set
+    STMT_INPUT,
+    STMT_OUTPUT,
+    STMT_IF,
+    STMT_WHILE,
+    STMT_FOR,
+    STMT_FOREACH,
+    STMT_DO_WHILE,
+    STMT_SWITCH,
+    STMT_BLOCK,
+    STMT_RETURN,
+    STMT_BREAK,
+    STMT_NEXT
+} StmtKind;
+
+typedef struct SwitchCase {
+    struct Expr* value;          // NULL for the default clause
+    struct Stmt* body;           // Statement list
+    struct SwitchCase* next;
+} SwitchCase;
+
+typedef struct Stmt {
+    StmtKind kind;
+    int line;
+    int column;
+    struct Stmt* next;           // Sibling in a statement list
+    union {
+        struct { Expr* expr; } expression;
+        struct { Atom name; int slot; Atom type; Expr* init; } declaration; // type: ATOM_INT etc., ATOM_EMPTY if untyped
+        struct { Atom name; int slot; TokenType op; Expr* value; } assignment;
+        struct { Atom name; int slot; Atom type; } input; // type: the target's declared type, from the resolver
+        struct { Expr* value; } output;
+        struct { Expr* condition; struct Stmt* then_branch; struct Stmt* else_branch; } if_stmt;
+        struct { Expr* condition; struct Stmt* body; } while_stmt;
+        struct { struct Stmt* init; Expr* condition; Expr* increment; struct Stmt* body; } for_stmt;
+        struct { Atom name; int slot; Expr* collection; struct Stmt* body; } foreach_stmt;
+        struct { struct Stmt* body; Expr* condition; } do_while;
+        struct { Expr* subject; SwitchCase* cases; struct SwitchTable* table; bool table_built; } switch_stmt; // table: the evaluator's, on first run
+        struct { struct Stmt* body; } block;
+        struct { Expr* value; } return_stmt;
+    } as;
+} Stmt;
+
+// A parsed script. slot_count is filled in by resolve_program.
+typedef struct {
+    Stmt* body;
+    int slot_count;
+    const Interner* names; // Text of every Atom in the tree
+} Program;
+
+// Appends statements to a singly linked list in source order.
+typedef struct {
+    Stmt* head;
+    Stmt* tail;
+} StmtList;
+
+static void stmt_list_append(StmtList* list, Stmt* stmt) {
+    if (!stmt) return;
+    stmt->next = NULL;
+    if (list->tail) list->tail->next = stmt;
+    else list->head = stmt;
+    list->tail = stmt;
+}
+
+/* ============================================================================
+ * PARSE TRACE
+ * ============================================================================
+ * The parser reports every rule it enters and leaves and every token it
+ * advances over. As text, that is source.cytho.parsetree.txt. As a binary
+ * trace (--binary-trace), it is source.cytho.parsetrace: a header and then
+ * one fixed-size event per line of the text tree, about a third of the
+ * size. --print-trace turns it back into the text tree later by re-lexing
+ * the source.
+ *
+ * Both formats go through one large buffer flushed with a single fwrite, so
+ * even a multi-megabyte tree costs a few hundred write calls rather than one
+ * or more fprintf per line.
+ */
+
+#define PARSE_RULES(X) \
+    X(PROGRAM, "Program") X(STATEMENT, "Statement") X(BLOCK, "Block") \
+    X(DECLARATION_STATEMENT, "DeclarationStatement") X(ASSIGNMENT_STATEMENT, "AssignmentStatement") \
+    X(INPUT_STATEMENT, "InputStatement") X(OUTPUT_STATEMENT, "OutputStatement") \
+    X(IF_STATEMENT, "IfStatement") X(WHILE_STATEMENT, "WhileStatement") X(FOR_STATEMENT, "ForStatement") \
+    X(FOREACH_STATEMENT, "ForeachStatement") X(DO_WHILE_STATEMENT, "DoWhileStatement") \
+    X(SWITCH_STATEMENT, "SwitchStatement") X(CASE_CLAUSE, "CaseClause") X(DEFAULT_CLAUSE, "DefaultClause") \
+    X(NEXT_STATEMENT, "NextStatement") X(RETURN_STATEMENT, "ReturnStatement") \
+    X(INCREMENT_STATEMENT, "IncrementStatement") X(LET_STATEMENT, "LetStatement") X(SET_STATEMENT, "SetStatement") \
+    X(ENUM_DECLARATION, "EnumDeclaration") X(STRUCT_DEFINITION, "StructDefinition") \
+    X(RECORD_DECLARATION, "RecordDeclaration") X(CLASS_DECLARATION, "ClassDeclaration") \
+    X(METHOD_DECLARATION, "MethodDeclaration") X(PROPERTY_DECLARATION, "PropertyDeclaration") \
+    X(FUNCTION_CALL, "FunctionCall") X(EXPRESSION, "Expression") X(LOGICAL_OR, "LogicalOr") \
+    X(LOGICAL_AND, "LogicalAnd") X(EQUALITY, "Equality") X(COMPARISON, "Comparison") \
+    X(TYPE_CONVERSION, "TypeConversion") X(TERM, "Term") X(FACTOR, "Factor") X(UNARY, "Unary") \
+    X(PREFIX_POSTFIX, "Prefix/Postfix") X(PRIMARY, "Primary")
+
+typedef enum {
+#define RULE_ENUM(id, name) RULE_##id,
+    PARSE_RULES(RULE_ENUM)
+#undef RULE_ENUM
+    RULE_COUNT
+} ParseRule;
+
+static const char* const RULE_NAMES[RULE_COUNT] = {
+#define RULE_NAME(id, name) name,
+    PARSE_RULES(RULE_NAME)
+#undef RULE_NAME
+};
+
+#define PARSE_TRACE_MAGIC "CYTHOTRC"
+#define PARSE_TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (256 * 1024)
+#define TRACE_FROM_SYMBOL_TABLE 1u   // The parser read its tokens back from the symbol table file
+
+typedef enum {
+    TRACE_ENTER,         // Entering `rule`
+    TRACE_EXIT,          // Leaving `rule`
+    TRACE_TOKEN          // Advancing to token `token`
+} TraceEvent;
+
+// Same layout rules as the token cache: native byte order, this machine only
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t token_count; // Parser tokens the trace indexes into
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint32_t flags;       // TRACE_FROM_SYMBOL_TABLE
+    uint32_t reserved;
+} ParseTraceHeader;
+
+typedef struct {
+    uint8_t event;       // TraceEvent
+    uint8_t rule;        // ParseRule, for ENTER and EXIT
+    uint16_t reserved;
+    uint32_t depth;      // Nesting level: the text tree indents two spaces per level
+    uint32_t token;      // Index into the parser's tokens; token_count means end of input
+} ParseTraceRecord;
+
+typedef struct {
+    FILE* file;
+    bool binary;
+    bool failed;         // A write failed; the rest of the trace is dropped
+    size_t length;
+    char buffer[TRACE_BUFFER_SIZE];
+} ParseTrace;
+
+static void trace_flush(ParseTrace* trace) {
+    if (trace->length && !trace->failed && fwrite(trace->buffer, 1, trace->length, trace->file) != trace->length) {
+        trace->failed = true;
+    }
+    trace->length = 0;
+}
+
+static void trace_write(ParseTrace* trace, const void* data, size_t length) {
+    if (trace->length + length > TRACE_BUFFER_SIZE) {
+        trace_flush(trace);
+        if (length > TRACE_BUFFER_SIZE) {
+            if (!trace->failed && fwrite(data, 1, length, trace->file) != length) trace->failed = true;
+            return;
+        }
+    }
+    memcpy(trace->buffer + trace->length, data, length);
+    trace->length += length;
+}
+
+static void trace_text(ParseTrace* trace, const char* text) { trace_write(trace, text, strlen(text)); }
+
+// Lines up to this deep are indented two spaces a level; deeper ones start
+// with their depth in brackets instead, so a text tree stays linear in the
+// tokens however deeply the input nests
+#define TRACE_MAX_INDENT 256
+
+static void trace_indent(ParseTrace* trace, int depth) {
+    static const char spaces[] = "                                                                ";
+    if (depth > TRACE_MAX_INDENT) {
+        char mark[16];
+        int length = snprintf(mark, sizeof(mark), "[%d] ", depth);
+        trace_write(trace, mark, (size_t)length);
+        return;
+    }
+    size_t width = (size_t)(depth > 0 ? depth : 0) * 2;
+    while (width > 0) {
+        size_t run = width < sizeof(spaces) - 1 ? width : sizeof(spaces) - 1;
+        trace_write(trace, spaces, run);
+        width -= run;
+    }
+}
+
+// The text tree's lines, shared by the parser and --print-trace
+static void trace_text_node(ParseTrace* trace, bool enter, ParseRule rule, int depth) {
+    trace_indent(trace, depth);
+    trace_text(trace, enter ? "Enter <" : "Exit <");
+    trace_text(trace, RULE_NAMES[rule]);
+    trace_write(trace, ">\n", 2);
+}
+
+static void trace_text_token(ParseTrace* trace, TokenType type, const char* lexeme, int depth) {
+    trace_indent(trace, depth);
+    trace_text(trace, "Next token is: ");
+    trace_text(trace, token_type_to_string(type));
+    trace_text(trace, " Next lexeme is ");
+    trace_text(trace, lexeme);
+    trace_write(trace, "\n", 1);
+}
+
+static void trace_record(ParseTrace* trace, TraceEvent event, int rule, int depth, int token) {
+    ParseTraceRecord record = { (uint8_t)event, (uint8_t)rule, 0, (uint32_t)depth, (uint32_t)token };
+    trace_write(trace, &record, sizeof(record));
+}
+
+// Takes ownership of `file`. A binary trace starts with a header naming the
+// source it was recorded from.
+static ParseTrace* trace_open(FILE* file, bool binary, int token_count, uint64_t source_hash, size_t source_length,
+                              uint32_t flags) {
+    ParseTrace* trace = malloc(sizeof(ParseTrace));
+    trace->file = file;
+    trace->binary = binary;
+    trace->failed = false;
+    trace->length = 0;
+    if (binary) {
+        ParseTraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PARSE_TRACE_MAGIC, sizeof(header.magic));
+        header.version = PARSE_TRACE_VERSION;
+        header.token_count = (uint32_t)token_count;
+        header.source_hash = source_hash;
+        header.source_length = source_length;
+        header.flags = flags;
+        trace_write(trace, &header, sizeof(header));
+    }
+    return trace;
+}
+
+// Flushes and closes the file. Returns false if any write failed.
+static bool trace_close(ParseTrace* trace) {
+    if (!trace) return true;
+    trace_flush(trace);
+    bool ok = !trace->failed;
+    if (trace->file != stdout && fclose(trace->file) != 0) ok = false;
+    free(trace);
+    return ok;
+}
+
+/* ============================================================================
+ * PARSER IMPLEMENTATION
+ * ============================================================================ */
+
+// The cursor is a pair of indices into the token list: advancing moves
+// them, and no token is copied until a node or a message needs it.
+typedef struct {
+    TokenList* token_list;
+    const uint8_t* types;  // token_list->types, ending in TOKEN_EOF: all that check and match read
+    const Interner* names; // Pool holding the text of token_list
+    int current;           // Index of the current token; token_list->count once input runs out
+    int previous;          // Index of the token consumed before it
+    bool had_error;
+    bool panic_mode;
+    int indent_level;
+    ParseTrace* trace;    // Parse tree output; NULL writes none
+    Arena* arena;     // Owns every AST node produced by this parser
+    Diagnostics* diagnostics; // Where errors and progress go; NULL prints directly
+    int recoveries;       // Times synchronize resumed after an error
+    int skipped_tokens;   // Passed over by those recoveries
+    bool ran_out;         // Wanted a token past the last one: more text could change the parse
+    int depth;            // Levels of nesting open, counted by nest()
+    bool too_deep;        // "Nested too deeply." reported; quiet until the next top-level statement
+} Parser;
+
+static Stmt* statement(Parser* parser);
+static Expr* expression(Parser* parser);
+
+static void enter_node(Parser* parser, ParseRule rule) {
+    ParseTrace* trace = parser->trace;
+    if (trace) {
+        if (trace->binary) trace_record(trace, TRACE_ENTER, rule, parser->indent_level, 0);
+        else trace_text_node(trace, true, rule, parser->indent_level);
+    }
+    parser->indent_level++;
+}
+
+static void exit_node(Parser* parser, ParseRule rule) {
+    parser->indent_level--;
+    ParseTrace* trace = parser->trace;
+    if (trace) {
+        if (trace->binary) trace_record(trace, TRACE_EXIT, rule, parser->indent_level, 0);
+        else trace_text_node(trace, false, rule, parser->indent_level);
+    }
+}
+
+// Lexeme of token `index`; the empty atom at the end
+static Atom token_atom(const Parser* parser, int index) {
+    return index < parser->token_list->count ? parser->token_list->atoms[index] : ATOM_EMPTY;
+}
+
+static TokenPos token_pos(const Parser* parser, int index) {
+    if (index < parser->token_list->count) return parser->token_list->positions[index];
+    TokenPos end = { eof_token.line, eof_token.column };
+    return end;
+}
+
+static void trace_token(Parser* parser) {
+    ParseTrace* trace = parser->trace;
+    if (!trace) return;
+    if (trace->binary) trace_record(trace, TRACE_TOKEN, 0, parser->indent_level, parser->current);
+    else trace_text_token(trace, (TokenType)parser->types[parser->current],
+                          atom_text(parser->names, token_atom(parser, parser->current)), parser->indent_level);
+}
+
+// An empty list's types: just the end
+static const uint8_t eof_types[1] = { TOKEN_EOF };
+
+// The parser itself lives in `arena` next to the tree it builds.
+static Parser* parser_create(TokenList* token_list, const Interner* names, Arena* arena) {
+    Parser* parser = arena_alloc(arena, sizeof(Parser));
+    parser->token_list = token_list;
+    parser->types = token_list->types ? token_list->types : eof_types;
+    parser->names = names;
+    parser->current = 0;
+    parser->previous = 0;
+    parser->had_error = false;
+    parser->panic_mode = false;
+    parser->recoveries = 0;
+    parser->skipped_tokens = 0;
+    parser->ran_out = false;
+    parser->depth = 0;
+    parser->too_deep = false;
+    parser->indent_level = 0;
+    parser->trace = NULL;
+    parser->diagnostics = NULL;
+    parser->arena = arena;
+    return parser;
+}
+
+static void error_at(Parser* parser, int index, const char* message) {
+    Token token = token_at(parser->token_list, index);
+    if (token.type == TOKEN_EOF) parser->ran_out = true;
+    if (parser->panic_mode) return;
+    parser->panic_mode = true;
+    parser->had_error = true;
+    if (token.type == TOKEN_EOF) {
+        diag_error(parser->diagnostics, "[line %d:%d] Error at end: %s\n", token.line, token.column, message);
+    } else if (token.type != INVALID) {
+        diag_error(parser->diagnostics, "[line %d:%d] Error at '%.*s': %s\n", token.line, token.column,
+                   (int)token.length, token_raw(parser->token_list, &token), message);
+    } else {
+        diag_error(parser->diagnostics, "[line %d:%d] Error: %s\n", token.line, token.column, message);
+    }
+}
+
+static void error(Parser* parser, const char* message) {
+    error_at(parser, parser->current, message);
+}
+
+// Moves to the next token; at the end the cursor stays on TOKEN_EOF.
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
+    if (parser->types[parser->current] != TOKEN_EOF) parser->current++;
+    trace_token(parser);
+}
+
+static bool check(Parser* parser, TokenType type) { return parser->types[parser->current] == type; }
+
+// Keyword tests compare interned atoms, never strings.
+static bool check_word(Parser* parser, TokenType type, Atom word) {
+    return check(parser, type) && parser->token_list->atoms[parser->current] == word;
+}
+
+// Type of the token after the current one, which must not be the end
+static TokenType peek_next(Parser* parser) {
+    return (TokenType)parser->types[parser->current + 1];
+}
+
+static bool match(Parser* parser, TokenType type) {
+    if (check(parser, type)) {
+        advance(parser);
+        return true;
+    }
+    return false;
+}
+
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (check(parser, type)) {
+        advance(parser);
+        return;
+    }
+    error(parser, message);
+}
+
+static void synchronize(Parser* parser) {
+    parser->panic_mode = false;
+    parser->recoveries++;
+    while (!check(parser, TOKEN_EOF)) {
+        if (check(parser, SEMICOLON)) {
+            advance(parser);
+            parser->skipped_tokens++;
+            return;
+        }
+        switch (parser->types[parser->current]) {
+            case KEYWORD: case RESERVED_WORD: case TYPE: return;
+            default: ;
+        }
+        advance(parser);
+        parser->skipped_tokens++;
+    }
+    parser->ran_out = true;
+}
+
+// --- Linear-Time Guarantees ---
+// Parsing takes time and memory linear in the tokens, whatever the input:
+//  - Every loop over a run of statements, members or cases consumes at least
+//    one token per pass. statement() always does unless the input is over,
+//    and the member loops skip a token when a pass matched nothing.
+//  - synchronize() and error paths only move forward.
+//  - Nesting is capped at PARSE_MAX_DEPTH. A statement, an expression, a
+//    prefix operator and each operator of a postfix chain opens a level,
+//    so the recursive walks that later phases make over the tree stay within
+//    the stack. A chain of binary operators is not nesting and opens none:
+//    those walks loop down its left operands (see Operator Chains). Past
+//    the cap, the rule reports an error, once, and skips the construct's
+//    tokens in one forward pass instead of recursing.
+
+#define PARSE_MAX_DEPTH 1000
+
+// Opens a level of nesting; false, after an error, when that would pass PARSE_MAX_DEPTH.
+// The error is reported once per top-level statement: the rest of an over-deep
+// construct fails quietly at the cap, and the next statement starts afresh.
+static bool nest(Parser* parser) {
+    if (parser->depth >= PARSE_MAX_DEPTH) {
+        if (!parser->too_deep) error(parser, "Nested too deeply.");
+        parser->too_deep = true;
+        return false;
+    }
+    if (parser->depth == 0) parser->too_deep = false;
+    parser->depth++;
+    return true;
+}
+
+// Passes over tokens too deep to parse, brackets balanced, so the constructs
+// around them still line up and parsing resumes without a panic. A statement
+// runs to its ';' or the '}' closing its last block, and on through any else
+// after that; an expression stops short of the ';', ',' or '{' after it. Neither takes
+// a closing bracket that belongs to an enclosing construct. A statement always
+// consumes a token, so the loop that asked for it moves on.
+static void skip_nested(Parser* parser, bool statement) {
+    int start = parser->current;
+    int open = 0;
+    while (!check(parser, TOKEN_EOF)) {
+        TokenType type = (TokenType)parser->types[parser->current];
+        bool closing = type == RIGHT_BRACE || type == RIGHT_PAREN || type == RIGHT_BRACKET;
+        if (open == 0 && !(statement && parser->current == start)) {
+            if (closing) break;
+            if (!statement && (type == SEMICOLON || type == COMMA || type == LEFT_BRACE)) break;
+        }
         advance(parser);
+        parser->skipped_tokens++;
+        if (type == LEFT_BRACE || type == LEFT_PAREN || type == LEFT_BRACKET) open++;
+        else if (closing && open > 0) open--;
+        // At the end of a statement, unless an if's else goes with it
+        if (statement && open == 0 && (type == SEMICOLON || type == RIGHT_BRACE) &&
+            !check_word(parser, RESERVED_WORD, ATOM_ELSE)) break;
+    }
+    if (check(parser, TOKEN_EOF)) parser->ran_out = true;
+    parser->panic_mode = false;
+    parser->recoveries++;
+}
+
+// --- AST Construction ---
+// Nodes take their position from a token index, usually parser->previous.
+
+static Expr* new_expr(Parser* parser, ExprKind kind, int at) {
+    Expr* expr = arena_alloc(parser->arena, sizeof(Expr));
+    memset(expr, 0, sizeof(Expr));
+    expr->kind = kind;
+    TokenPos pos = token_pos(parser, at);
+    expr->line = pos.line;
+    expr->column = pos.column;
+    return expr;
+}
+
+static Stmt* new_stmt(Parser* parser, StmtKind kind, int at) {
+    Stmt* stmt = arena_alloc(parser->arena, sizeof(Stmt));
+    memset(stmt, 0, sizeof(Stmt));
+    stmt->kind = kind;
+    TokenPos pos = token_pos(parser, at);
+    stmt->line = pos.line;
+    stmt->column = pos.column;
+    return stmt;
+}
+
+// Stands in for an expression that could not be parsed
+static Expr* error_expr(Parser* parser) {
+    Expr* e = new_expr(parser, EXPR_LITERAL, parser->current);
+    e->as.literal = make_null();
+    return e;
+}
+
+// Stands in for an expression past PARSE_MAX_DEPTH, whose tokens are skipped
+static Expr* skip_expr(Parser* parser) {
+    Expr* e = error_expr(parser);
+    skip_nested(parser, false);
+    return e;
+}
+
+static Expr* new_binary(Parser* parser, ExprKind kind, int op, Expr* left, Expr* right) {
+    Expr* expr = new_expr(parser, kind, op);
+    expr->as.binary.op = (TokenType)parser->types[op];
+    expr->as.binary.left = left;
+    expr->as.binary.right = right;
+    return expr;
+}
+
+static Expr* new_incdec(Parser* parser, int op, Expr* operand, bool prefix) {
+    Expr* expr = new_expr(parser, EXPR_INCDEC, op);
+    expr->as.incdec.op = (TokenType)parser->types[op];
+    expr->as.incdec.prefix = prefix;
+    expr->as.incdec.operand = operand;
+    // The updated value is written back to the variable the operand names
+    if (operand && operand->kind == EXPR_VARIABLE) expr->as.incdec.target = operand->as.variable.name;
+    else if (operand && operand->kind == EXPR_INCDEC) expr->as.incdec.target = operand->as.incdec.target;
+    return expr;
+}
+
+static Expr* new_variable(Parser* parser, int name) {
+    Expr* expr = new_expr(parser, EXPR_VARIABLE, name);
+    expr->as.variable.name = token_atom(parser, name);
+    return expr;
+}
+
+// --- Grammar Rules ---
+
+static Stmt* block(Parser* parser) {
+    enter_node(parser, RULE_BLOCK);
+    Stmt* stmt = new_stmt(parser, STMT_BLOCK, parser->previous);
+    StmtList body = {0};
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) stmt_list_append(&body, statement(parser));
+    consume(parser, RIGHT_BRACE, "Expect '}' after block.");
+    stmt->as.block.body = body.head;
+    exit_node(parser, RULE_BLOCK);
+    return stmt;
+}
+
+static Expr* primary(Parser* parser) {
+    enter_node(parser, RULE_PRIMARY);
+    if (match(parser, NUMBER)) {
+        Expr* e = new_expr(parser, EXPR_LITERAL, parser->previous);
+        const char* text = atom_text(parser->names, token_atom(parser, parser->previous));
+        if (strchr(text, '.') || strchr(text, 'e') || strchr(text, 'E'))
+             e->as.literal = make_double(atof(text));
+        else e->as.literal = make_int(atoi(text));
+        exit_node(parser, RULE_PRIMARY); return e;
+    }
+    if (match(parser, STRING_LITERAL)) {
+        Expr* e = new_expr(parser, EXPR_LITERAL, parser->previous);
+        const char* text = atom_text(parser->names, token_atom(parser, parser->previous));
+        e->as.literal = make_string(string_new_immortal(parser->arena, text, strlen(text)));
+        exit_node(parser, RULE_PRIMARY); return e;
+    }
+    if (match(parser, CHAR_LITERAL)) {
+        Expr* e = new_expr(parser, EXPR_LITERAL, parser->previous);
+        e->as.literal = make_char(atom_text(parser->names, token_atom(parser, parser->previous))[0]);
+        exit_node(parser, RULE_PRIMARY); return e;
+    }
+    if (match(parser, BOOLEAN_LITERAL)) {
+        Expr* e = new_expr(parser, EXPR_LITERAL, parser->previous);
+        e->as.literal = make_bool(token_atom(parser, parser->previous) == ATOM_TRUE);
+        exit_node(parser, RULE_PRIMARY); return e;
+    }
+    if (match(parser, IDENTIFIER) || match(parser, KEYWORD)) {
+        Expr* e = new_variable(parser, parser->previous);
+        exit_node(parser, RULE_PRIMARY); return e;
+    }
+
+    if (match(parser, LEFT_PAREN)) {
+        Expr* e = expression(parser);
+        consume(parser, RIGHT_PAREN, "Expect ')' after expression.");
+        exit_node(parser, RULE_PRIMARY);
+        return e;
+    }
+    error(parser, "Expect expression.");
+    Expr* e = error_expr(parser);
+    exit_node(parser, RULE_PRIMARY);
+    return e;
+}
+
+static Expr* postfix(Parser* parser) {
+    enter_node(parser, RULE_PREFIX_POSTFIX);
+    Expr* e;
+    int depth = parser->depth;
+    if (match(parser, PLUS_PLUS) || match(parser, MINUS_MINUS)) {
+        int op = parser->previous;
+        e = new_incdec(parser, op, nest(parser) ? postfix(parser) : skip_expr(parser), true);
     } else {
-        error(parser, "Expect 'in' after variable.");
+        e = primary(parser);
+        while ((check(parser, PLUS_PLUS) || check(parser, MINUS_MINUS)) && nest(parser)) {
+            int op = parser->current;
+            advance(parser);
+            e = new_incdec(parser, op, e, false);
+        }
+        if (check(parser, PLUS_PLUS) || check(parser, MINUS_MINUS)) skip_nested(parser, false);
+    }
+    parser->depth = depth;
+    exit_node(parser, RULE_PREFIX_POSTFIX);
+    return e;
+}
+
+static Expr* unary(Parser* parser) {
+    enter_node(parser, RULE_UNARY);
+    if (match(parser, NOT) || match(parser, MINUS)) {
+        int op = parser->previous;
+        Expr* e = new_expr(parser, EXPR_UNARY, op);
+        e->as.unary.op = (TokenType)parser->types[op];
+        if (nest(parser)) {
+            e->as.unary.operand = unary(parser);
+            parser->depth--;
+        } else {
+            e->as.unary.operand = skip_expr(parser);
+        }
+        exit_node(parser, RULE_UNARY);
+        return e;
+    }
+    Expr* e = postfix(parser);
+    exit_node(parser, RULE_UNARY);
+    return e;
+}
+
+static Expr* factor(Parser* parser) {
+    enter_node(parser, RULE_FACTOR);
+    Expr* lhs = unary(parser);
+    while (check(parser, SLASH) || check(parser, STAR) || check(parser, PERCENT)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = unary(parser);
+        lhs = new_binary(parser, EXPR_BINARY, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_FACTOR);
+    return lhs;
+}
+
+static Expr* term(Parser* parser) {
+    enter_node(parser, RULE_TERM);
+    Expr* lhs = factor(parser);
+    while (check(parser, MINUS) || check(parser, PLUS)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = factor(parser);
+        lhs = new_binary(parser, EXPR_BINARY, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_TERM);
+    return lhs;
+}
+
+static Expr* type_conversion(Parser* parser) {
+    enter_node(parser, RULE_TYPE_CONVERSION);
+    Expr* e = term(parser);
+    while (match(parser, AS)) {
+        consume(parser, TYPE, "Expect type after 'as'.");
+        // Implementation of cast? For now skip.
+    }
+    exit_node(parser, RULE_TYPE_CONVERSION);
+    return e;
+}
+
+static Expr* comparison(Parser* parser) {
+    enter_node(parser, RULE_COMPARISON);
+    Expr* lhs = type_conversion(parser);
+    while (check(parser, GREATER) || check(parser, GREATER_EQUAL) ||
+           check(parser, LESS) || check(parser, LESS_EQUAL)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = type_conversion(parser);
+        lhs = new_binary(parser, EXPR_BINARY, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_COMPARISON);
+    return lhs;
+}
+
+static Expr* equality(Parser* parser) {
+    enter_node(parser, RULE_EQUALITY);
+    Expr* lhs = comparison(parser);
+    while (check(parser, NOT_EQUAL) || check(parser, EQUAL_EQUAL)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = comparison(parser);
+        lhs = new_binary(parser, EXPR_BINARY, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_EQUALITY);
+    return lhs;
+}
+
+static Expr* logical_and(Parser* parser) {
+    enter_node(parser, RULE_LOGICAL_AND);
+    Expr* lhs = equality(parser);
+    while (check(parser, AND_AND)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = equality(parser);
+        lhs = new_binary(parser, EXPR_LOGICAL, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_LOGICAL_AND);
+    return lhs;
+}
+
+static Expr* logical_or(Parser* parser) {
+    enter_node(parser, RULE_LOGICAL_OR);
+    Expr* lhs = logical_and(parser);
+    while (check(parser, OR_OR)) {
+        int op = parser->current;
+        advance(parser);
+        Expr* rhs = logical_and(parser);
+        lhs = new_binary(parser, EXPR_LOGICAL, op, lhs, rhs);
+    }
+    exit_node(parser, RULE_LOGICAL_OR);
+    return lhs;
+}
+
+static Expr* expression(Parser* parser) {
+    if (!nest(parser)) return skip_expr(parser);
+    enter_node(parser, RULE_EXPRESSION);
+    Expr* e = logical_or(parser);
+    exit_node(parser, RULE_EXPRESSION);
+    parser->depth--;
+    return e;
+}
+
+static Stmt* declaration_statement(Parser* parser) {
+    enter_node(parser, RULE_DECLARATION_STATEMENT);
+    if (match(parser, TYPE)) {}
+    else if (check_word(parser, KEYWORD, ATOM_STR)) {
+        advance(parser);
+    }
+    // Callers usually consume the type or var/const/dyn themselves
+    TokenType keyword = (TokenType)parser->types[parser->previous];
+    Atom keyword_atom = token_atom(parser, parser->previous);
+    consume(parser, IDENTIFIER, "Expect variable name.");
+    Stmt* stmt = new_stmt(parser, STMT_DECLARATION, parser->previous);
+    stmt->as.declaration.name = token_atom(parser, parser->previous);
+    if (keyword == TYPE || (keyword == KEYWORD && keyword_atom == ATOM_STR)) {
+        stmt->as.declaration.type = keyword_atom;
+    }
+
+    if (match(parser, EQUAL)) stmt->as.declaration.init = expression(parser);
+    consume(parser, SEMICOLON, "Expect ';' after variable declaration.");
+    exit_node(parser, RULE_DECLARATION_STATEMENT);
+    return stmt;
+}
+
+static Stmt* assignment_statement(Parser* parser) {
+    enter_node(parser, RULE_ASSIGNMENT_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_ASSIGNMENT, parser->previous);
+    stmt->as.assignment.name = token_atom(parser, parser->previous);
+    stmt->as.assignment.op = (TokenType)parser->types[parser->current];
+    advance(parser); // consume =, +=, etc.
+
+    stmt->as.assignment.value = expression(parser);
+    consume(parser, SEMICOLON, "Expect ';' after assignment.");
+    exit_node(parser, RULE_ASSIGNMENT_STATEMENT);
+    return stmt;
+}
+
+static Stmt* input_statement(Parser* parser) {
+    enter_node(parser, RULE_INPUT_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_INPUT, parser->previous);
+    consume(parser, LEFT_PAREN, "Expect '(' after 'input'.");
+    consume(parser, IDENTIFIER, "Expect variable name in input.");
+    stmt->as.input.name = token_atom(parser, parser->previous);
+    consume(parser, RIGHT_PAREN, "Expect ')' after input variable.");
+    consume(parser, SEMICOLON, "Expect ';' after input statement.");
+    exit_node(parser, RULE_INPUT_STATEMENT);
+    return stmt;
+}
+
+static Stmt* output_statement(Parser* parser) {
+    enter_node(parser, RULE_OUTPUT_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_OUTPUT, parser->previous);
+    consume(parser, LEFT_PAREN, "Expect '(' after 'print'.");
+    stmt->as.output.value = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after print expression.");
+    consume(parser, SEMICOLON, "Expect ';' after print statement.");
+    exit_node(parser, RULE_OUTPUT_STATEMENT);
+    return stmt;
+}
+
+static Stmt* while_statement(Parser* parser) {
+    enter_node(parser, RULE_WHILE_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_WHILE, parser->previous);
+    if (check_word(parser, NOISE_WORD, ATOM_ITS)) advance(parser);
+    consume(parser, LEFT_PAREN, "Expect '(' after 'while'.");
+    stmt->as.while_stmt.condition = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
+    stmt->as.while_stmt.body = statement(parser);
+    exit_node(parser, RULE_WHILE_STATEMENT);
+    return stmt;
+}
+
+static Stmt* for_statement(Parser* parser) {
+    enter_node(parser, RULE_FOR_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_FOR, parser->previous);
+    consume(parser, LEFT_PAREN, "Expect '(' after 'for'.");
+
+    if (match(parser, SEMICOLON)) {}
+    else if (match(parser, TYPE)) stmt->as.for_stmt.init = declaration_statement(parser);
+    else if (check_word(parser, KEYWORD, ATOM_STR)) {
+        advance(parser);
+        stmt->as.for_stmt.init = declaration_statement(parser);
+    }
+    else if (match(parser, IDENTIFIER)) {
+         stmt->as.for_stmt.init = assignment_statement(parser);
+    }
+    else error(parser, "Expect variable declaration or assignment in for loop.");
+
+    if (!check(parser, SEMICOLON)) stmt->as.for_stmt.condition = expression(parser);
+    consume(parser, SEMICOLON, "Expect ';' after loop condition.");
+
+    if (!check(parser, RIGHT_PAREN)) stmt->as.for_stmt.increment = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    stmt->as.for_stmt.body = statement(parser);
+    exit_node(parser, RULE_FOR_STATEMENT);
+    return stmt;
+}
+
+static Stmt* foreach_statement(Parser* parser) {
+    enter_node(parser, RULE_FOREACH_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_FOREACH, parser->previous);
+    consume(parser, LEFT_PAREN, "Expect '(' after 'foreach'.");
+    if (match(parser, TYPE)) {}
+    else if (check_word(parser, KEYWORD, ATOM_STR)) advance(parser);
+    else if (check_word(parser, KEYWORD, ATOM_VAR)) advance(parser);
+    else error(parser, "Expect type or 'var' in foreach.");
+    consume(parser, IDENTIFIER, "Expect variable name.");
+    stmt->as.foreach_stmt.name = token_atom(parser, parser->previous);
+    if (check_word(parser, RESERVED_WORD, ATOM_IN)) {
+        advance(parser);
+    } else {
+        error(parser, "Expect 'in' after variable.");
+    }
+    stmt->as.foreach_stmt.collection = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after collection.");
+    stmt->as.foreach_stmt.body = statement(parser);
+    exit_node(parser, RULE_FOREACH_STATEMENT);
+    return stmt;
+}
+
+static Stmt* case_body(Parser* parser) {
+    StmtList body = {0};
+    while (!check(parser, CASE) && !check(parser, DEFAULT) && !check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        stmt_list_append(&body, statement(parser));
+    }
+    return body.head;
+}
+
+static Stmt* switch_statement(Parser* parser) {
+    enter_node(parser, RULE_SWITCH_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_SWITCH, parser->previous);
+    SwitchCase** tail = &stmt->as.switch_stmt.cases;
+    consume(parser, LEFT_PAREN, "Expect '(' after 'switch'.");
+    stmt->as.switch_stmt.subject = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after switch expression.");
+    consume(parser, LEFT_BRACE, "Expect '{' before switch cases.");
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        if (match(parser, CASE)) {
+            enter_node(parser, RULE_CASE_CLAUSE);
+            SwitchCase* clause = arena_alloc(parser->arena, sizeof(SwitchCase));
+            clause->value = expression(parser);
+            consume(parser, COLON, "Expect ':' after case expression.");
+            clause->body = case_body(parser);
+            clause->next = NULL;
+            *tail = clause; tail = &clause->next;
+            exit_node(parser, RULE_CASE_CLAUSE);
+        } else if (match(parser, DEFAULT)) {
+            enter_node(parser, RULE_DEFAULT_CLAUSE);
+            SwitchCase* clause = arena_alloc(parser->arena, sizeof(SwitchCase));
+            clause->value = NULL;
+            consume(parser, COLON, "Expect ':' after default.");
+            clause->body = case_body(parser);
+            clause->next = NULL;
+            *tail = clause; tail = &clause->next;
+            exit_node(parser, RULE_DEFAULT_CLAUSE);
+        } else {
+            error(parser, "Expect 'case' or 'default' inside switch.");
+            advance(parser);
+        }
+    }
+    consume(parser, RIGHT_BRACE, "Expect '}' after switch body.");
+    exit_node(parser, RULE_SWITCH_STATEMENT);
+    return stmt;
+}
+
+static Stmt* do_while_statement(Parser* parser) {
+    enter_node(parser, RULE_DO_WHILE_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_DO_WHILE, parser->previous);
+    consume(parser, LEFT_BRACE, "Expect '{' after 'do'.");
+
+    StmtList body = {0};
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) stmt_list_append(&body, statement(parser));
+    consume(parser, RIGHT_BRACE, "Expect '}' after block.");
+    stmt->as.do_while.body = body.head;
+
+    if (check_word(parser, RESERVED_WORD, ATOM_WHILE)) {
+        advance(parser);
+    } else {
+        error(parser, "Expect 'while' after do-block.");
+    }
+
+    consume(parser, LEFT_PAREN, "Expect '(' after 'while'.");
+    stmt->as.do_while.condition = expression(parser);
+    consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
+    consume(parser, SEMICOLON, "Expect ';' after do-while.");
+    exit_node(parser, RULE_DO_WHILE_STATEMENT);
+    return stmt;
+}
+
+static Stmt* next_statement(Parser* parser) {
+    enter_node(parser, RULE_NEXT_STATEMENT);
+    Stmt* stmt = new_stmt(parser, STMT_NEXT, parser->previous);
+    consume(parser, SEMICOLON, "Expect ';' after 'next'.");
+    exit_node(parser, RULE_NEXT_STATEMENT);
+    return stmt;
+}
+
+// Type declarations below are checked for syntax only; they have no runtime
+// effect, so they contribute no statements to the tree.
+
+static void enum_declaration(Parser* parser) {
+    enter_node(parser, RULE_ENUM_DECLARATION);
+    consume(parser, IDENTIFIER, "Expect enum name.");
+    consume(parser, LEFT_BRACE, "Expect '{' before enum members.");
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        consume(parser, IDENTIFIER, "Expect enum member name.");
+        if (match(parser, EQUAL)) {
+            expression(parser);
+        }
+        if (match(parser, COMMA)) {}
+        else break;
+    }
+    consume(parser, RIGHT_BRACE, "Expect '}' after enum members.");
+    exit_node(parser, RULE_ENUM_DECLARATION);
+}
+
+static void struct_declaration(Parser* parser) {
+    enter_node(parser, RULE_STRUCT_DEFINITION);
+    consume(parser, IDENTIFIER, "Expect struct name.");
+    consume(parser, LEFT_BRACE, "Expect '{' before struct members.");
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        int start = parser->current;
+        if (match(parser, TYPE)) {}
+        else if (check_word(parser, KEYWORD, ATOM_STR)) advance(parser);
+        else error(parser, "Expect type in struct member.");
+
+        consume(parser, IDENTIFIER, "Expect member name.");
+        consume(parser, SEMICOLON, "Expect ';' after member.");
+        if (parser->current == start) advance(parser);
+    }
+    consume(parser, RIGHT_BRACE, "Expect '}' after struct members.");
+    exit_node(parser, RULE_STRUCT_DEFINITION);
+}
+
+static void record_declaration(Parser* parser) {
+    enter_node(parser, RULE_RECORD_DECLARATION);
+    consume(parser, IDENTIFIER, "Expect record name.");
+    consume(parser, LEFT_BRACE, "Expect '{' before record members.");
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        int start = parser->current;
+        if (match(parser, REQ)) {}
+
+        if (match(parser, TYPE)) {}
+        else if (check_word(parser, KEYWORD, ATOM_STR)) advance(parser);
+        else error(parser, "Expect type in record member.");
+
+        consume(parser, IDENTIFIER, "Expect member name.");
+
+        if (match(parser, EQUAL)) {
+            expression(parser);
+        }
+
+        consume(parser, SEMICOLON, "Expect ';' after member.");
+        if (parser->current == start) advance(parser);
+    }
+    consume(parser, RIGHT_BRACE, "Expect '}' after record members.");
+    exit_node(parser, RULE_RECORD_DECLARATION);
+}
+
+static void class_declaration(Parser* parser) {
+    enter_node(parser, RULE_CLASS_DECLARATION);
+    consume(parser, IDENTIFIER, "Expect class name.");
+    consume(parser, LEFT_BRACE, "Expect '{' before class body.");
+    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        int start = parser->current;
+        if (match(parser, PUB) || match(parser, PRIV) || match(parser, PROT)) {}
+
+        // Handle optional 'rdo'
+        if (check_word(parser, RESERVED_WORD, ATOM_RDO)) {
+            advance(parser);
+        }
+
+        if (match(parser, TYPE)) {}
+        else if (check_word(parser, KEYWORD, ATOM_STR)) advance(parser);
+        else error(parser, "Expect type or void in class member.");
+
+        consume(parser, IDENTIFIER, "Expect member name.");
+
+        if (match(parser, LEFT_PAREN)) {
+            enter_node(parser, RULE_METHOD_DECLARATION);
+            if (!check(parser, RIGHT_PAREN)) {
+                do {
+                    if (match(parser, TYPE)) {}
+                    else if (check_word(parser, KEYWORD, ATOM_STR)) advance(parser);
+
+                    // Allow IDENTIFIER or KEYWORD (contextual) as argument name
+                    if (check(parser, IDENTIFIER) || check(parser, KEYWORD)) {
+                        advance(parser);
+                    } else {
+                        error(parser, "Expect argument name.");
+                    }
+                } while (match(parser, COMMA));
+            }
+            consume(parser, RIGHT_PAREN, "Expect ')' after arguments.");
+            consume(parser, LEFT_BRACE, "Expect '{' before method body.");
+            block(parser);
+            exit_node(parser, RULE_METHOD_DECLARATION);
+        } else if (match(parser, LEFT_BRACE)) {
+            enter_node(parser, RULE_PROPERTY_DECLARATION);
+            while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+                if (match(parser, GET) || match(parser, SET) || match(parser, INIT)) {
+                    // Accessor body: { ... } or ;
+                    if (match(parser, LEFT_BRACE)) {
+                        while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+                            statement(parser);
+                        }
+                        consume(parser, RIGHT_BRACE, "Expect '}' after accessor body.");
+                    } else {
+                        consume(parser, SEMICOLON, "Expect ';' after accessor (auto-implemented).");
+                    }
+                } else {
+                    error(parser, "Expect get, set, or init.");
+                    advance(parser);
+                }
+            }
+            consume(parser, RIGHT_BRACE, "Expect '}' after property body.");
+            exit_node(parser, RULE_PROPERTY_DECLARATION);
+        } else {
+            // Field Declaration
+            if (match(parser, EQUAL)) {
+                expression(parser);
+            }
+            consume(parser, SEMICOLON, "Expect ';' after field.");
+        }
+        if (parser->current == start) advance(parser);
+    }
+    consume(parser, RIGHT_BRACE, "Expect '}' after class body.");
+    exit_node(parser, RULE_CLASS_DECLARATION);
+}
+
+static Stmt* statement(Parser* parser) {
+    if (!nest(parser)) {
+        skip_nested(parser, true);
+        return NULL;
+    }
+    enter_node(parser, RULE_STATEMENT);
+    Stmt* stmt = NULL;
+    if (match(parser, PLUS_PLUS) || match(parser, MINUS_MINUS)) {
+        enter_node(parser, RULE_INCREMENT_STATEMENT);
+        int op = parser->previous;
+        consume(parser, IDENTIFIER, "Expect identifier after prefix operator.");
+        stmt = new_stmt(parser, STMT_EXPRESSION, op);
+        stmt->as.expression.expr = new_incdec(parser, op, new_variable(parser, parser->previous), true);
+        consume(parser, SEMICOLON, "Expect ';' after increment/decrement.");
+        exit_node(parser, RULE_INCREMENT_STATEMENT);
+    }
+    else if (match(parser, TYPE)) stmt = declaration_statement(parser);
+    else if (check_word(parser, KEYWORD, ATOM_STR)) {
+        advance(parser);
+        stmt = declaration_statement(parser);
+    }
+    else if (match(parser, SWITCH)) stmt = switch_statement(parser);
+    else if (match(parser, DO)) stmt = do_while_statement(parser);
+    else if (match(parser, NEXT)) stmt = next_statement(parser);
+    else if (match(parser, BREAK)) {
+        stmt = new_stmt(parser, STMT_BREAK, parser->previous);
+        consume(parser, SEMICOLON, "Expect ';' after break.");
+    }
+    else if (match(parser, CLASS)) class_declaration(parser);
+    else if (match(parser, STRUCT)) struct_declaration(parser);
+    else if (match(parser, ENUM)) enum_declaration(parser);
+    else if (match(parser, RECORD)) record_declaration(parser);
+    else if ((check(parser, PUB) || check(parser, PRIV)) && peek_next(parser) == RECORD) {
+        advance(parser);
+        advance(parser);
+        record_declaration(parser);
+    }
+    else if (check(parser, RESERVED_WORD) || check(parser, KEYWORD)) {
+        switch (token_atom(parser, parser->current)) {
+        case ATOM_WHILE: advance(parser); stmt = while_statement(parser); break;
+        case ATOM_FOR: advance(parser); stmt = for_statement(parser); break;
+        case ATOM_FOREACH: advance(parser); stmt = foreach_statement(parser); break;
+        case ATOM_IF: {
+            enter_node(parser, RULE_IF_STATEMENT);
+            stmt = new_stmt(parser, STMT_IF, parser->current);
+            advance(parser);
+            if (check_word(parser, NOISE_WORD, ATOM_AT)) advance(parser);
+            consume(parser, LEFT_PAREN, "Expect '(' after 'if'.");
+            stmt->as.if_stmt.condition = expression(parser);
+            consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
+            if (check_word(parser, NOISE_WORD, ATOM_THEN)) advance(parser);
+
+            stmt->as.if_stmt.then_branch = statement(parser);
+
+            if (check_word(parser, RESERVED_WORD, ATOM_ELSE)) {
+                advance(parser);
+                stmt->as.if_stmt.else_branch = statement(parser);
+            }
+            exit_node(parser, RULE_IF_STATEMENT);
+            break;
+        }
+        case ATOM_RETURN: {
+            enter_node(parser, RULE_RETURN_STATEMENT);
+            stmt = new_stmt(parser, STMT_RETURN, parser->current);
+            advance(parser);
+            if (!check(parser, SEMICOLON)) stmt->as.return_stmt.value = expression(parser);
+            consume(parser, SEMICOLON, "Expect ';' after return value.");
+            exit_node(parser, RULE_RETURN_STATEMENT);
+            break;
+        }
+        case ATOM_INPUT:
+            advance(parser);
+            stmt = input_statement(parser);
+            break;
+        case ATOM_PRINT:
+            advance(parser);
+            stmt = output_statement(parser);
+            break;
+        case ATOM_LET: {
+            enter_node(parser, RULE_LET_STATEMENT);
+            advance(parser);
+            consume(parser, IDENTIFIER, "Expect variable name after 'let'.");
+            stmt = new_stmt(parser, STMT_DECLARATION, parser->previous);
+            stmt->as.declaration.name = token_atom(parser, parser->previous);
+            consume(parser, EQUAL, "Expect '=' after variable name.");
+            stmt->as.declaration.init = expression(parser);
+            consume(parser, SEMICOLON, "Expect ';' after let statement.");
+            exit_node(parser, RULE_LET_STATEMENT);
+            break;
+        }
+        case ATOM_SET: {
+            enter_node(parser, RULE_SET_STATEMENT);
+            advance(parser);
+            consume(parser, IDENTIFIER, "Expect variable name after 'set'.");
+            stmt = new_stmt(parser, STMT_ASSIGNMENT, parser->previous);
+            stmt->as.assignment.name = token_atom(parser, parser->previous);
+            stmt->as.assignment.op = EQUAL;
+            consume(parser, EQUAL, "Expect '=' after variable name.");
+            stmt->as.assignment.value = expression(parser);
+            consume(parser, SEMICOLON, "Expect ';' after set statement.");
+            exit_node(parser, RULE_SET_STATEMENT);
+            break;
+        }
+        case ATOM_VAR:
+        case ATOM_CONST:
+        case ATOM_DYN:
+            advance(parser);
+            stmt = declaration_statement(parser);
+            break;
+        default:
+            error(parser, "Unexpected keyword at start of statement.");
+            advance(parser);
+            break;
+        }
+    } else if (match(parser, LEFT_BRACE)) {
+        stmt = block(parser);
+    } else if (match(parser, IDENTIFIER)) {
+        int name = parser->previous;
+        if (check(parser, EQUAL) || check(parser, PLUS_EQUAL) || check(parser, MINUS_EQUAL) ||
+            check(parser, STAR_EQUAL) || check(parser, SLASH_EQUAL) || check(parser, PERCENT_EQUAL)) {
+            stmt = assignment_statement(parser);
+        }
+        else if (check(parser, LEFT_PAREN)) {
+            enter_node(parser, RULE_FUNCTION_CALL);
+            stmt = new_stmt(parser, STMT_EXPRESSION, name);
+            consume(parser, LEFT_PAREN, "Expect '(' after function name.");
+            if (!check(parser, RIGHT_PAREN)) stmt->as.expression.expr = expression(parser);
+            consume(parser, RIGHT_PAREN, "Expect ')' after arguments.");
+            consume(parser, SEMICOLON, "Expect ';' after function call.");
+            exit_node(parser, RULE_FUNCTION_CALL);
+        } else if (check(parser, PLUS_PLUS) || check(parser, MINUS_MINUS)) {
+            enter_node(parser, RULE_INCREMENT_STATEMENT);
+            int op = parser->current;
+            advance(parser);
+            stmt = new_stmt(parser, STMT_EXPRESSION, name);
+            stmt->as.expression.expr = new_incdec(parser, op, new_variable(parser, name), false);
+            consume(parser, SEMICOLON, "Expect ';' after increment/decrement.");
+            exit_node(parser, RULE_INCREMENT_STATEMENT);
+        } else {
+            error(parser, "Unexpected identifier usage.");
+        }
+    } else {
+        if (!check(parser, TOKEN_EOF)) advance(parser);
+        else parser->ran_out = true;
+    }
+    if (parser->panic_mode) synchronize(parser);
+    exit_node(parser, RULE_STATEMENT);
+    parser->depth--;
+    return stmt;
+}
+
+static Program* parser_parse(Parser* parser) {
+    diag_info(parser->diagnostics, "Starting Syntax Analysis...\n");
+    enter_node(parser, RULE_PROGRAM);
+    StmtList body = {0};
+    while (!check(parser, TOKEN_EOF)) {
+        stmt_list_append(&body, statement(parser));
+    }
+    exit_node(parser, RULE_PROGRAM);
+    if (!parser->had_error) diag_info(parser->diagnostics, "Syntax Analysis Complete: No errors found.\n");
+    else diag_info(parser->diagnostics, "Syntax Analysis Complete: Errors found.\n");
+    Program* program = arena_alloc(parser->arena, sizeof(Program));
+    program->body = body.head;
+    program->slot_count = 0;
+    program->names = parser->names;
+    return program;
+}
+
+/* ============================================================================
+ * NAME RESOLUTION
+ * ============================================================================
+ * Binds every variable reference to a fixed frame slot before execution, so
+ * the evaluator and VM index an array instead of searching by name.
+ *
+ * Blocks, for-loops, foreach, do-while bodies and switch bodies open nested
+ * scopes; an inner declaration shadows the outer one until its scope closes.
+ * Re-declaring a name in the same scope reuses its slot. A name used before
+ * any visible declaration resolves to NO_BINDING: reads yield 0 and writes are
+ * dropped.
+ *
+ * Names are Atoms, so bindings sit in an array indexed by Atom: the Interner
+ * already did the hashing. Each entry is a stack of bindings (innermost
+ * first), so a lookup is one array read regardless of nesting depth or the
+ * number of variables in the script.
+ */
+
+#define NO_BINDING -1
+
+typedef struct Binding {
+    int slot;
+    int depth;
+    Atom type;           // Of the latest declaration, as in Stmt's declaration.type
+    int chain;           // Bindings of the name in open scopes, this one included
+    struct Binding* shadowed;
+} Binding;
+
+// For --stats. A lookup reads the innermost binding only; `chains` sums how
+// many bindings of the name were open then, the cost a chain of scopes
+// searched outward would pay.
+typedef struct {
+    int declarations;    // Bindings made; re-declarations reuse theirs
+    int lookups;
+    int unbound;         // Lookups that found no visible declaration
+    long chains;
+    int longest_chain;
+    int deepest_scope;
+} ResolveStats;
+
+typedef struct {
+    Binding** bindings;  // Indexed by Atom; NULL when no declaration is visible
+    uint32_t binding_count;
+    Atom* declared;      // Names declared in open scopes, innermost last
+    int declared_count;
+    int declared_capacity;
+    int depth;
+    int slot_count;
+    Arena arena;         // Bindings
+    ResolveStats stats;
+} Resolver;
+
+static Binding* resolver_binding(Resolver* r, Atom name) {
+    Binding* binding = name < r->binding_count ? r->bindings[name] : NULL;
+    r->stats.lookups++;
+    if (!binding) {
+        r->stats.unbound++;
+        return NULL;
+    }
+    r->stats.chains += binding->chain;
+    if (binding->chain > r->stats.longest_chain) r->stats.longest_chain = binding->chain;
+    return binding;
+}
+
+static int resolver_lookup(Resolver* r, Atom name) {
+    Binding* binding = resolver_binding(r, name);
+    return binding ? binding->slot : NO_BINDING;
+}
+
+static int resolver_declare(Resolver* r, Atom name, Atom type) {
+    Binding* current = r->bindings[name];
+    if (current && current->depth == r->depth) {
+        current->type = type;
+        return current->slot;
+    }
+
+    Binding* binding = arena_alloc(&r->arena, sizeof(Binding));
+    binding->slot = r->slot_count++;
+    binding->depth = r->depth;
+    binding->type = type;
+    binding->chain = current ? current->chain + 1 : 1;
+    binding->shadowed = current;
+    r->bindings[name] = binding;
+    r->stats.declarations++;
+
+    if (r->declared_count >= r->declared_capacity) {
+        r->declared_capacity = r->declared_capacity < 16 ? 16 : r->declared_capacity * 2;
+        r->declared = realloc(r->declared, r->declared_capacity * sizeof(Atom));
+    }
+    r->declared[r->declared_count++] = name;
+    return binding->slot;
+}
+
+static int resolver_begin_scope(Resolver* r) {
+    r->depth++;
+    if (r->depth > r->stats.deepest_scope) r->stats.deepest_scope = r->depth;
+    return r->declared_count;
+}
+
+static void resolver_end_scope(Resolver* r, int mark) {
+    while (r->declared_count > mark) {
+        Atom name = r->declared[--r->declared_count];
+        r->bindings[name] = r->bindings[name]->shadowed;
+    }
+    r->depth--;
+}
+
+static void resolve_expr(Resolver* r, Expr* expr);
+static void resolve_stmt(Resolver* r, Stmt* stmt);
+
+static void resolve_expr(Resolver* r, Expr* expr) {
+    if (!expr) return;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            break;
+        case EXPR_VARIABLE:
+            expr->as.variable.slot = resolver_lookup(r, expr->as.variable.name);
+            break;
+        case EXPR_UNARY:
+            resolve_expr(r, expr->as.unary.operand);
+            break;
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            for (; is_operator_node(expr); expr = expr->as.binary.left) resolve_expr(r, expr->as.binary.right);
+            resolve_expr(r, expr);
+            break;
+        case EXPR_INCDEC:
+            resolve_expr(r, expr->as.incdec.operand);
+            expr->as.incdec.slot = expr->as.incdec.target != ATOM_EMPTY ? resolver_lookup(r, expr->as.incdec.target) : NO_BINDING;
+            break;
+    }
+}
+
+static void resolve_list(Resolver* r, Stmt* stmt) {
+    for (; stmt; stmt = stmt->next) resolve_stmt(r, stmt);
+}
+
+static void resolve_scoped_list(Resolver* r, Stmt* stmt) {
+    int mark = resolver_begin_scope(r);
+    resolve_list(r, stmt);
+    resolver_end_scope(r, mark);
+}
+
+static void resolve_stmt(Resolver* r, Stmt* stmt) {
+    if (!stmt) return;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            resolve_expr(r, stmt->as.expression.expr);
+            break;
+        case STMT_DECLARATION:
+            // The initializer sees the previous binding, as in `int x = x;`
+            resolve_expr(r, stmt->as.declaration.init);
+            stmt->as.declaration.slot = resolver_declare(r, stmt->as.declaration.name, stmt->as.declaration.type);
+            break;
+        case STMT_ASSIGNMENT:
+            resolve_expr(r, stmt->as.assignment.value);
+            stmt->as.assignment.slot = resolver_lookup(r, stmt->as.assignment.name);
+            break;
+        case STMT_INPUT: {
+            Binding* binding = resolver_binding(r, stmt->as.input.name);
+            stmt->as.input.slot = binding ? binding->slot : NO_BINDING;
+            stmt->as.input.type = binding ? binding->type : ATOM_EMPTY;
+            break;
+        }
+        case STMT_OUTPUT:
+            resolve_expr(r, stmt->as.output.value);
+            break;
+        case STMT_IF:
+            resolve_expr(r, stmt->as.if_stmt.condition);
+            resolve_stmt(r, stmt->as.if_stmt.then_branch);
+            resolve_stmt(r, stmt->as.if_stmt.else_branch);
+            break;
+        case STMT_WHILE:
+            resolve_expr(r, stmt->as.while_stmt.condition);
+            resolve_stmt(r, stmt->as.while_stmt.body);
+            break;
+        case STMT_FOR: {
+            int mark = resolver_begin_scope(r);
+            resolve_stmt(r, stmt->as.for_stmt.init);
+            resolve_expr(r, stmt->as.for_stmt.condition);
+            resolve_expr(r, stmt->as.for_stmt.increment);
+            resolve_stmt(r, stmt->as.for_stmt.body);
+            resolver_end_scope(r, mark);
+            break;
+        }
+        case STMT_FOREACH: {
+            resolve_expr(r, stmt->as.foreach_stmt.collection);
+            int mark = resolver_begin_scope(r);
+            stmt->as.foreach_stmt.slot = resolver_declare(r, stmt->as.foreach_stmt.name, ATOM_EMPTY);
+            resolve_stmt(r, stmt->as.foreach_stmt.body);
+            resolver_end_scope(r, mark);
+            break;
+        }
+        case STMT_DO_WHILE:
+            resolve_scoped_list(r, stmt->as.do_while.body);
+            resolve_expr(r, stmt->as.do_while.condition);
+            break;
+        case STMT_SWITCH: {
+            resolve_expr(r, stmt->as.switch_stmt.subject);
+            int mark = resolver_begin_scope(r);
+            for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                resolve_expr(r, clause->value);
+                resolve_list(r, clause->body);
+            }
+            resolver_end_scope(r, mark);
+            break;
+        }
+        case STMT_BLOCK:
+            resolve_scoped_list(r, stmt->as.block.body);
+            break;
+        case STMT_RETURN:
+            resolve_expr(r, stmt->as.return_stmt.value);
+            break;
+        case STMT_BREAK:
+        case STMT_NEXT:
+            break;
+    }
+}
+
+static ResolveStats resolve_program(Program* program) {
+    Resolver r;
+    memset(&r, 0, sizeof(Resolver));
+    r.binding_count = program->names->count;
+    r.bindings = calloc(r.binding_count, sizeof(Binding*));
+    resolve_list(&r, program->body);
+    program->slot_count = r.slot_count;
+    free(r.bindings);
+    free(r.declared);
+    arena_free(&r.arena);
+    return r.stats;
+}
+
+/* ============================================================================
+ * PROFILER
+ * ============================================================================
+ * --profile samples where a script's time goes. A sampler thread wakes every
+ * PROFILE_INTERVAL_US and charges the tick to the line running then, which
+ * is that line's self time. A line's total time adds in the self time of
+ * every line nested in it: the tree says which statement encloses which. The
+ * evaluator publishes the line of each statement it starts; the VM takes the
+ * sample itself, at the first instruction after a tick (vm_run says how), so
+ * sampling costs the VM next to nothing.
+ *
+ * --profile-counts also counts, exactly: the evaluator every statement it
+ * starts, by line and by kind; the VM every instruction, by line, by opcode
+ * and by the opcode run before it. That slows the VM down severalfold.
+ *
+ * <source>.profile.txt lists the lines by self time, then by count, then the
+ * statement kinds or the opcodes and opcode pairs. <source>.folded.txt holds
+ * one `frame;frame;... samples` line per sampled line, as flamegraph.pl and
+ * speedscope read them. The frames are the script, then the statements
+ * enclosing the line, outermost first: `a.cytho;while@3;if@5;output@6`.
+ */
+
+#define PROFILE_INTERVAL_US 1000
+#define PROFILE_REPORT_LIMIT 20
+
+static const char* const STMT_KIND_NAMES[] = {
+    [STMT_EXPRESSION] = "expression", [STMT_DECLARATION] = "declaration", [STMT_ASSIGNMENT] = "assignment",
+    [STMT_INPUT] = "input", [STMT_OUTPUT] = "output", [STMT_IF] = "if", [STMT_WHILE] = "while",
+    [STMT_FOR] = "for", [STMT_FOREACH] = "foreach", [STMT_DO_WHILE] = "do", [STMT_SWITCH] = "switch",
+    [STMT_BLOCK] = "block", [STMT_RETURN] = "return", [STMT_BREAK] = "break", [STMT_NEXT] = "next",
+};
+
+#define STMT_KIND_COUNT (int)(sizeof(STMT_KIND_NAMES) / sizeof(STMT_KIND_NAMES[0]))
+
+typedef struct {
+    int line_count;              // Lines 0 .. line_count - 1; 0 is none
+    const Stmt** statements;     // First statement starting on each line
+    int* parents;                // Line of the statement enclosing that one, 0 at the top
+    uint64_t* counts;            // Statements or instructions run, per line
+    uint64_t* samples;           // Ticks spent on each line itself
+    uint64_t kinds[STMT_KIND_COUNT]; // Statements run, per kind
+    const char* const* opcode_names; // Set by the VM
+    int opcode_count;
+    uint64_t* opcodes;           // Instructions run, per opcode
+    uint64_t* pairs;             // [previous * opcode_count + opcode]
+    int previous_op;
+    bool counting;               // --profile-counts
+    void (*sample_next)(void);   // Set by the VM, which takes each sample at its next instruction
+    _Atomic int line;            // Running now, for the evaluator's samples
+    _Atomic bool sampling;
+    Thread sampler;
+    bool sampler_started;
+} Profile;
+
+static void profile_index(Profile* profile, const Stmt* stmt, int parent);
+
+static void profile_index_list(Profile* profile, const Stmt* stmt, int parent) {
+    for (; stmt; stmt = stmt->next) profile_index(profile, stmt, parent);
+}
+
+// Records the first statement on each line and the line enclosing it, which
+// is always an earlier one, so following parents ends at 0.
+static void profile_index(Profile* profile, const Stmt* stmt, int parent) {
+    if (!stmt) return;
+    int line = stmt->line;
+    if (line <= 0 || line >= profile->line_count) return;
+    if (!profile->statements[line]) {
+        profile->statements[line] = stmt;
+        profile->parents[line] = parent < line ? parent : 0;
+    }
+    switch (stmt->kind) {
+        case STMT_IF:
+            profile_index(profile, stmt->as.if_stmt.then_branch, line);
+            profile_index(profile, stmt->as.if_stmt.else_branch, line);
+            break;
+        case STMT_WHILE:
+            profile_index(profile, stmt->as.while_stmt.body, line);
+            break;
+        case STMT_FOR:
+            profile_index(profile, stmt->as.for_stmt.init, line);
+            profile_index(profile, stmt->as.for_stmt.body, line);
+            break;
+        case STMT_FOREACH:
+            profile_index(profile, stmt->as.foreach_stmt.body, line);
+            break;
+        case STMT_DO_WHILE:
+            profile_index_list(profile, stmt->as.do_while.body, line);
+            break;
+        case STMT_SWITCH:
+            for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                profile_index_list(profile, clause->body, line);
+            }
+            break;
+        case STMT_BLOCK:
+            profile_index_list(profile, stmt->as.block.body, line);
+            break;
+        default:
+            break;
+    }
+}
+
+// `line_count` bounds every line in the program, as the last token's line + 1 does.
+static Profile* profile_create(const Program* program, int line_count, bool counting) {
+    Profile* profile = calloc(1, sizeof(Profile));
+    profile->counting = counting;
+    profile->line_count = line_count > 1 ? line_count : 1;
+    profile->statements = calloc(profile->line_count, sizeof(Stmt*));
+    profile->parents = calloc(profile->line_count, sizeof(int));
+    profile->counts = calloc(profile->line_count, sizeof(uint64_t));
+    profile->samples = calloc(profile->line_count, sizeof(uint64_t));
+    atomic_init(&profile->line, 0);
+    atomic_init(&profile->sampling, false);
+    profile_index_list(profile, program->body, 0);
+    return profile;
+}
+
+// The VM's opcode tables, before it runs
+static void profile_track_opcodes(Profile* profile, const char* const* names, int count) {
+    profile->opcode_names = names;
+    profile->opcode_count = count;
+    if (!profile->counting) return;
+    profile->opcodes = calloc(count, sizeof(uint64_t));
+    profile->pairs = calloc((size_t)count * count, sizeof(uint64_t));
+}
+
+static void profile_free(Profile* profile) {
+    if (!profile) return;
+    free(profile->statements);
+    free(profile->parents);
+    free(profile->counts);
+    free(profile->samples);
+    free(profile->opcodes);
+    free(profile->pairs);
+    free(profile);
+}
+
+static void profile_sample(Profile* profile, int line) {
+    if (line > 0 && line < profile->line_count) profile->samples[line]++;
+}
+
+// The samples are only read once the sampler has been joined
+static void profile_sampler_run(void* arg) {
+    Profile* profile = arg;
+    while (atomic_load_explicit(&profile->sampling, memory_order_relaxed)) {
+        thread_sleep(PROFILE_INTERVAL_US);
+        if (profile->sample_next) profile->sample_next();
+        else profile_sample(profile, atomic_load_explicit(&profile->line, memory_order_relaxed));
+    }
+}
+
+// Engines start the sampler as they begin to run, and stop it when done
+static void profile_start(Profile* profile) {
+    atomic_store(&profile->sampling, true);
+    profile->sampler_started = thread_start(&profile->sampler, profile_sampler_run, profile);
+}
+
+static void profile_stop(Profile* profile) {
+    atomic_store(&profile->sampling, false);
+    if (profile->sampler_started) thread_join(profile->sampler);
+    profile->sampler_started = false;
+    atomic_store(&profile->line, 0);
+}
+
+// A statement starts; returns the line to restore once it is done, so that
+// a loop's own tests count against the loop and not its last statement.
+static int profile_enter(Profile* profile, const Stmt* stmt) {
+    int outer = atomic_load_explicit(&profile->line, memory_order_relaxed);
+    atomic_store_explicit(&profile->line, stmt->line, memory_order_relaxed);
+    if (profile->counting) {
+        if (stmt->line > 0 && stmt->line < profile->line_count) profile->counts[stmt->line]++;
+        profile->kinds[stmt->kind]++;
+    }
+    return outer;
+}
+
+static void profile_leave(Profile* profile, int outer) {
+    atomic_store_explicit(&profile->line, outer, memory_order_relaxed);
+}
+
+// --profile-counts in the VM
+static void profile_instruction(Profile* profile, int line, int op) {
+    if (line > 0 && line < profile->line_count) profile->counts[line]++;
+    profile->opcodes[op]++;
+    profile->pairs[profile->previous_op * profile->opcode_count + op]++;
+    profile->previous_op = op;
+}
+
+// --- Report ---
+
+typedef struct {
+    int line;
+    uint64_t self;
+    uint64_t total;
+    uint64_t count;
+} ProfileLine;
+
+static int compare_profile_lines(const void* a, const void* b) {
+    const ProfileLine* x = a;
+    const ProfileLine* y = b;
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->line - y->line;
+}
+
+static double profile_ms(uint64_t samples) {
+    return samples * (PROFILE_INTERVAL_US / 1000.0);
+}
+
+static double profile_percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void write_profile_frames(FILE* file, const Profile* profile, int line) {
+    if (profile->parents[line]) {
+        write_profile_frames(file, profile, profile->parents[line]);
+        fputc(';', file);
+    }
+    const Stmt* stmt = profile->statements[line];
+    fprintf(file, "%s@%d", stmt ? STMT_KIND_NAMES[stmt->kind] : "line", line);
+}
+
+// Writes the report and the folded stacks; false if either file cannot be
+// written.
+static bool write_profile(const Profile* profile, const char* script, const char* report_path, const char* folded_path) {
+    FILE* report = fopen(report_path, "w");
+    FILE* folded = fopen(folded_path, "w");
+    bool ok = report && folded;
+    if (!ok) {
+        if (report) fclose(report);
+        if (folded) fclose(folded);
+        return false;
+    }
+
+    uint64_t* totals = calloc(profile->line_count, sizeof(uint64_t));
+    uint64_t sample_total = 0, count_total = 0;
+    for (int line = 1; line < profile->line_count; line++) {
+        uint64_t samples = profile->samples[line];
+        sample_total += samples;
+        count_total += profile->counts[line];
+        for (int at = line; samples && at; at = profile->parents[at]) totals[at] += samples;
+    }
+    ProfileLine* lines = malloc(profile->line_count * sizeof(ProfileLine));
+    int line_count = 0;
+    for (int line = 1; line < profile->line_count; line++) {
+        if (!profile->counts[line] && !totals[line]) continue;
+        lines[line_count++] = (ProfileLine){ line, profile->samples[line], totals[line], profile->counts[line] };
+    }
+    qsort(lines, line_count, sizeof(ProfileLine), compare_profile_lines);
+
+    bool vm = profile->opcode_names != NULL;
+    const char* unit = vm ? "instructions" : "statements";
+    fprintf(report, "Profile of %s on the %s\n", script, vm ? "VM" : "tree-walking evaluator");
+    fprintf(report, "%llu samples, one every %d us (%.1f ms)", (unsigned long long)sample_total,
+            PROFILE_INTERVAL_US, profile_ms(sample_total));
+    if (profile->counting) fprintf(report, "; %llu %s run", (unsigned long long)count_total, unit);
+    fprintf(report, "\n\nHot lines\n%8s  %-12s %10s %7s %10s %7s",
+            "line", "statement", "self ms", "self %", "total ms", "total %");
+    if (profile->counting) fprintf(report, " %14s", unit);
+    fputc('\n', report);
+    for (int i = 0; i < line_count; i++) {
+        const ProfileLine* entry = &lines[i];
+        const Stmt* stmt = profile->statements[entry->line];
+        fprintf(report, "%8d  %-12s %10.1f %6.1f%% %10.1f %6.1f%%",
+                entry->line, stmt ? STMT_KIND_NAMES[stmt->kind] : "-",
+                profile_ms(entry->self), profile_percent(entry->self, sample_total),
+                profile_ms(entry->total), profile_percent(entry->total, sample_total));
+        if (profile->counting) fprintf(report, " %14llu", (unsigned long long)entry->count);
+        fputc('\n', report);
+    }
+
+    if (profile->counting && !vm) {
+        fprintf(report, "\nStatement kinds\n");
+        for (int kind = 0; kind < STMT_KIND_COUNT; kind++) {
+            if (!profile->kinds[kind]) continue;
+            fprintf(report, "  %-12s %14llu %6.1f%%\n", STMT_KIND_NAMES[kind],
+                    (unsigned long long)profile->kinds[kind], profile_percent(profile->kinds[kind], count_total));
+        }
+    } else if (profile->counting) {
+        fprintf(report, "\nOpcodes\n");
+        uint64_t* opcodes = malloc(profile->opcode_count * sizeof(uint64_t));
+        memcpy(opcodes, profile->opcodes, profile->opcode_count * sizeof(uint64_t));
+        for (;;) {
+            int best = 0;
+            for (int op = 1; op < profile->opcode_count; op++) if (opcodes[op] > opcodes[best]) best = op;
+            if (!opcodes[best]) break;
+            fprintf(report, "  %-14s %14llu %6.1f%%\n", profile->opcode_names[best],
+                    (unsigned long long)opcodes[best], profile_percent(opcodes[best], count_total));
+            opcodes[best] = 0;
+        }
+        free(opcodes);
+
+        // The first instruction's pair has no real predecessor
+        fprintf(report, "\nOpcode pairs, the %d most frequent\n", PROFILE_REPORT_LIMIT);
+        size_t pair_count = (size_t)profile->opcode_count * profile->opcode_count;
+        uint64_t* pairs = malloc(pair_count * sizeof(uint64_t));
+        memcpy(pairs, profile->pairs, pair_count * sizeof(uint64_t));
+        for (int rank = 0; rank < PROFILE_REPORT_LIMIT; rank++) {
+            size_t best = 0;
+            for (size_t i = 1; i < pair_count; i++) if (pairs[i] > pairs[best]) best = i;
+            if (!pairs[best]) break;
+            fprintf(report, "  %-14s %-14s %14llu %6.1f%%\n", profile->opcode_names[best / profile->opcode_count],
+                    profile->opcode_names[best % profile->opcode_count],
+                    (unsigned long long)pairs[best], profile_percent(pairs[best], count_total));
+            pairs[best] = 0;
+        }
+        free(pairs);
+    }
+
+    for (int line = 1; line < profile->line_count; line++) {
+        if (!profile->samples[line]) continue;
+        fprintf(folded, "%s;", script);
+        write_profile_frames(folded, profile, line);
+        fprintf(folded, " %llu\n", (unsigned long long)profile->samples[line]);
+    }
+
+    free(lines);
+    free(totals);
+    if (ferror(report)) ok = false;
+    if (ferror(folded)) ok = false;
+    if (fclose(report) != 0) ok = false;
+    if (fclose(folded) != 0) ok = false;
+    return ok;
+}
+
+/* ============================================================================
+ * TREE-WALKING EVALUATOR
+ * ============================================================================
+ * Executes the resolved AST. Values returned by eval_expr are owned by the
+ * caller; a frame slot takes ownership of the value stored into it.
+ */
+
+// --- Switch Tables ---
+// A switch whose cases are all int, char, bool or whole-number literals finds
+// its clause by key instead of trying case after case: by index when the keys
+// span a compact range, by binary search over the sorted keys otherwise. The
+// subject's key is its value_to_double, which is exactly what == compares the
+// two by, so 3.0 and '\x03' both pick case 3. A repeated key keeps its first
+// clause, as the case-by-case order would.
+
+#define SWITCH_TABLE_MIN 3        // Fewer cases are compared one by one
+#define SWITCH_DENSE_SPAN 16      // Any range this small is indexed directly...
+#define SWITCH_DENSE_RATIO 2      // ...and so is one at most this many slots per case
+#define SWITCH_NO_TARGET 0xFFFFFFFFu
+
+typedef struct SwitchTable {
+    int min;                 // Dense: the key of targets[0]
+    uint32_t span;           // Dense: entries in targets; 0 for a sparse table
+    uint32_t count;          // Sparse: entries in keys and targets
+    int* keys;               // Sparse: ascending
+    uint32_t* targets;       // Clause indices, SWITCH_NO_TARGET in holes; the VM makes them code offsets
+    uint32_t fallback;       // Taken without a match: the default clause, or SWITCH_NO_TARGET
+    SwitchCase** clauses;    // Every clause by index, default included
+} SwitchTable;
+
+typedef struct {
+    int key;
+    uint32_t clause;
+} SwitchEntry;
+
+static bool switch_key(Value v, int* key) {
+    if (v.type == VAL_INT) { *key = v.as.int_val; return true; }
+    double d = value_to_double(v);
+    if (!(d >= INT32_MIN && d <= INT32_MAX)) return false; // NaN too
+    *key = (int)d;
+    return *key == d;
+}
+
+static bool case_key(const Expr* value, int* key) {
+    if (value->kind == EXPR_UNARY && value->as.unary.op == MINUS) {
+        const Expr* operand = value->as.unary.operand;
+        if (operand->kind != EXPR_LITERAL || operand->as.literal.type != VAL_INT ||
+            operand->as.literal.as.int_val == INT32_MIN) return false;
+        *key = -operand->as.literal.as.int_val;
+        return true;
+    }
+    if (value->kind != EXPR_LITERAL || value->as.literal.type == VAL_STRING) return false;
+    return switch_key(value->as.literal, key);
+}
+
+static int compare_switch_entries(const void* a, const void* b) {
+    const SwitchEntry* x = a;
+    const SwitchEntry* y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->clause < y->clause ? -1 : x->clause > y->clause;
+}
+
+// NULL when some case is not a literal key or there are too few to bother.
+static SwitchTable* switch_table_build(const Stmt* stmt, Arena* arena) {
+    uint32_t clause_count = 0, case_count = 0;
+    int key, min = INT32_MAX, max = INT32_MIN;
+    for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+        clause_count++;
+        if (!clause->value) continue;
+        if (!case_key(clause->value, &key)) return NULL;
+        case_count++;
+        if (key < min) min = key;
+        if (key > max) max = key;
+    }
+    if (case_count < SWITCH_TABLE_MIN) return NULL;
+
+    SwitchTable* table = arena_alloc(arena, sizeof(SwitchTable));
+    memset(table, 0, sizeof(SwitchTable));
+    table->min = min;
+    table->fallback = SWITCH_NO_TARGET;
+    table->clauses = arena_alloc(arena, clause_count * sizeof(SwitchCase*));
+    SwitchEntry* entries = malloc(case_count * sizeof(SwitchEntry));
+    uint32_t index = 0, count = 0;
+    for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next, index++) {
+        table->clauses[index] = clause;
+        if (!clause->value) {
+            if (table->fallback == SWITCH_NO_TARGET) table->fallback = index;
+            continue;
+        }
+        case_key(clause->value, &entries[count].key);
+        entries[count++].clause = index;
+    }
+
+    int64_t span = (int64_t)max - min + 1;
+    if (span <= SWITCH_DENSE_SPAN || span <= (int64_t)case_count * SWITCH_DENSE_RATIO) {
+        table->span = (uint32_t)span;
+        table->targets = arena_alloc(arena, table->span * sizeof(uint32_t));
+        for (uint32_t i = 0; i < table->span; i++) table->targets[i] = SWITCH_NO_TARGET;
+        for (uint32_t i = 0; i < case_count; i++) {
+            uint32_t* target = &table->targets[(uint32_t)entries[i].key - (uint32_t)min];
+            if (*target == SWITCH_NO_TARGET) *target = entries[i].clause;
+        }
+    } else {
+        qsort(entries, case_count, sizeof(SwitchEntry), compare_switch_entries);
+        table->keys = arena_alloc(arena, case_count * sizeof(int));
+        table->targets = arena_alloc(arena, case_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < case_count; i++) {
+            if (table->count && table->keys[table->count - 1] == entries[i].key) continue;
+            table->keys[table->count] = entries[i].key;
+            table->targets[table->count++] = entries[i].clause;
+        }
+    }
+    free(entries);
+    return table;
+}
+
+static uint32_t switch_table_find(const SwitchTable* table, Value subject) {
+    int key;
+    if (!switch_key(subject, &key)) return table->fallback;
+    uint32_t target = SWITCH_NO_TARGET;
+    if (table->span) {
+        uint32_t index = (uint32_t)key - (uint32_t)table->min;
+        if (index < table->span) target = table->targets[index];
+    } else {
+        uint32_t low = 0, high = table->count;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            if (table->keys[middle] < key) low = middle + 1;
+            else high = middle;
+        }
+        if (low < table->count && table->keys[low] == key) target = table->targets[low];
+    }
+    return target != SWITCH_NO_TARGET ? target : table->fallback;
+}
+
+// --- Execution ---
+
+// A break or next still looking for the loop or switch it leaves. Statement
+// lists stop at it, and the construct it belongs to clears it.
+typedef enum {
+    FLOW_NORMAL,
+    FLOW_BREAK,
+    FLOW_NEXT
+} Flow;
+
+typedef struct {
+    Value* frame;        // One slot per resolved variable
+    const Interner* names;
+    Arena* arena;        // Switch tables, which live as long as the tree
+    Flow flow;
+    int loops;           // Enclosing loops: next is a no-op outside any
+    int switches;        // Enclosing switches: break is a no-op outside these and loops
+    Profile* profile;    // --profile, else NULL
+} Interpreter;
+
+static void store_slot(Interpreter* interp, int slot, Value value) {
+    if (slot == NO_BINDING) { free_value(value); return; }
+    free_value(interp->frame[slot]);
+    interp->frame[slot] = value;
+}
+
+static Value eval_expr(Interpreter* interp, Expr* expr);
+static void exec_stmt(Interpreter* interp, Stmt* stmt);
+
+static Value eval_binary(TokenType op, Value lhs, Value rhs) {
+    switch (op) {
+        case PLUS: return val_add(lhs, rhs);
+        case MINUS: return val_sub(lhs, rhs);
+        case STAR: return val_mul(lhs, rhs);
+        case SLASH: return val_div(lhs, rhs);
+        case PERCENT: return val_mod(lhs, rhs);
+        case GREATER: return make_bool(value_to_double(lhs) > value_to_double(rhs));
+        case GREATER_EQUAL: return make_bool(value_to_double(lhs) >= value_to_double(rhs));
+        case LESS: return make_bool(value_to_double(lhs) < value_to_double(rhs));
+        case LESS_EQUAL: return make_bool(value_to_double(lhs) <= value_to_double(rhs));
+        case EQUAL_EQUAL: return make_bool(value_equals(lhs, rhs));
+        case NOT_EQUAL: return make_bool(!value_equals(lhs, rhs));
+        default: return make_null();
+    }
+}
+
+// Three or more operators down the left operands. Shorter chains, the
+// usual `a * b + c`, recurse, which is cheaper than collecting them.
+static inline bool is_long_chain(const Expr* expr) {
+    const Expr* left = expr->as.binary.left;
+    return is_operator_node(left) && is_operator_node(left->as.binary.left);
+}
+
+// A long chain, from the innermost operator out. Separate from eval_expr so
+// that only chains carry an ExprChain on the stack.
+static Value eval_chain(Interpreter* interp, Expr* expr) {
+    ExprChain chain;
+    Value lhs = eval_expr(interp, chain_collect(&chain, expr));
+    for (int i = chain.count - 1; i >= 0; i--) {
+        Expr* node = chain.nodes[i];
+        if (node->kind == EXPR_LOGICAL) {
+            bool b = value_truthy(lhs);
+            free_value(lhs);
+            if (node->as.binary.op == OR_OR ? !b : b) {
+                Value rhs = eval_expr(interp, node->as.binary.right);
+                b = value_truthy(rhs);
+                free_value(rhs);
+            }
+            lhs = make_bool(b);
+        } else {
+            Value rhs = eval_expr(interp, node->as.binary.right);
+            Value result = eval_binary(node->as.binary.op, lhs, rhs);
+            free_value(lhs);
+            free_value(rhs);
+            lhs = result;
+        }
+    }
+    chain_free(&chain);
+    return lhs;
+}
+
+static Value eval_expr(Interpreter* interp, Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            return expr->as.literal;
+        case EXPR_VARIABLE:
+            if (expr->as.variable.slot == NO_BINDING) return make_int(0); // Default 0
+            return value_retain(interp->frame[expr->as.variable.slot]);
+        case EXPR_UNARY: {
+            Value v = eval_expr(interp, expr->as.unary.operand);
+            if (expr->as.unary.op == NOT) {
+                bool b = value_truthy(v);
+                free_value(v);
+                return make_bool(!b);
+            }
+            if (v.type == VAL_INT) v.as.int_val = int_neg(v.as.int_val);
+            else if (v.type == VAL_DOUBLE) v.as.double_val = -v.as.double_val;
+            return v;
+        }
+        case EXPR_BINARY: {
+            if (is_long_chain(expr)) return eval_chain(interp, expr);
+            Value lhs = eval_expr(interp, expr->as.binary.left);
+            Value rhs = eval_expr(interp, expr->as.binary.right);
+            Value result = eval_binary(expr->as.binary.op, lhs, rhs);
+            free_value(lhs);
+            free_value(rhs);
+            return result;
+        }
+        case EXPR_LOGICAL: {
+            if (is_long_chain(expr)) return eval_chain(interp, expr);
+            Value lhs = eval_expr(interp, expr->as.binary.left);
+            bool b = value_truthy(lhs);
+            free_value(lhs);
+            if (expr->as.binary.op == OR_OR ? b : !b) return make_bool(b);
+            Value rhs = eval_expr(interp, expr->as.binary.right);
+            b = value_truthy(rhs);
+            free_value(rhs);
+            return make_bool(b);
+        }
+        case EXPR_INCDEC: {
+            Value old = eval_expr(interp, expr->as.incdec.operand);
+            Value updated = (expr->as.incdec.op == PLUS_PLUS) ? val_add(old, make_int(1)) : val_sub(old, make_int(1));
+            if (expr->as.incdec.prefix) {
+                free_value(old);
+                store_slot(interp, expr->as.incdec.slot, value_retain(updated));
+                return updated;
+            }
+            store_slot(interp, expr->as.incdec.slot, updated);
+            return old;
+        }
+    }
+    return make_null();
+}
+
+static void exec_list(Interpreter* interp, Stmt* stmt) {
+    for (; stmt && interp->flow == FLOW_NORMAL; stmt = stmt->next) exec_stmt(interp, stmt);
+}
+
+// After a loop body: clears a pending next, and a pending break, which also
+// ends the loop.
+static bool loop_broken(Interpreter* interp) {
+    bool broken = interp->flow == FLOW_BREAK;
+    interp->flow = FLOW_NORMAL;
+    return broken;
+}
+
+// The clause a switch starts running at, or NULL. Without a table the cases
+// are evaluated in order up to the first that equals the subject.
+static SwitchCase* switch_match(Interpreter* interp, Stmt* stmt) {
+    if (!stmt->as.switch_stmt.table_built) {
+        stmt->as.switch_stmt.table = switch_table_build(stmt, interp->arena);
+        stmt->as.switch_stmt.table_built = true;
+    }
+    Value subject = eval_expr(interp, stmt->as.switch_stmt.subject);
+    const SwitchTable* table = stmt->as.switch_stmt.table;
+    SwitchCase* match = NULL;
+    if (table) {
+        uint32_t target = switch_table_find(table, subject);
+        if (target != SWITCH_NO_TARGET) match = table->clauses[target];
+    } else {
+        SwitchCase* fallback = NULL;
+        for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause && !match; clause = clause->next) {
+            if (!clause->value) {
+                if (!fallback) fallback = clause;
+                continue;
+            }
+            Value value = eval_expr(interp, clause->value);
+            if (value_equals(subject, value)) match = clause;
+            free_value(value);
+        }
+        if (!match) match = fallback;
+    }
+    free_value(subject);
+    return match;
+}
+
+static bool eval_condition(Interpreter* interp, Expr* expr) {
+    if (!expr) return true;
+    Value v = eval_expr(interp, expr);
+    bool b = value_truthy(v);
+    free_value(v);
+    return b;
+}
+
+static void exec_stmt(Interpreter* interp, Stmt* stmt) {
+    int outer = interp->profile ? profile_enter(interp->profile, stmt) : 0;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            if (stmt->as.expression.expr) free_value(eval_expr(interp, stmt->as.expression.expr));
+            break;
+        case STMT_DECLARATION: {
+            Value init = stmt->as.declaration.init ? eval_expr(interp, stmt->as.declaration.init) : make_int(0);
+            store_slot(interp, stmt->as.declaration.slot, init);
+            break;
+        }
+        case STMT_ASSIGNMENT: {
+            int slot = stmt->as.assignment.slot;
+            Value rhs = eval_expr(interp, stmt->as.assignment.value);
+            if (stmt->as.assignment.op == EQUAL) {
+                store_slot(interp, slot, rhs);
+                break;
+            }
+            if (slot != NO_BINDING && !(stmt->as.assignment.op == PLUS_EQUAL &&
+                                        string_append(&interp->frame[slot], rhs))) {
+                TokenType op = PLUS;
+                switch (stmt->as.assignment.op) {
+                    case MINUS_EQUAL: op = MINUS; break;
+                    case STAR_EQUAL: op = STAR; break;
+                    case SLASH_EQUAL: op = SLASH; break;
+                    case PERCENT_EQUAL: op = PERCENT; break;
+                    default: break;
+                }
+                store_slot(interp, slot, eval_binary(op, interp->frame[slot], rhs));
+            }
+            free_value(rhs);
+            break;
+        }
+        case STMT_INPUT: {
+            Value val;
+            if (input_value(atom_text(interp->names, stmt->as.input.name), stmt->as.input.type, &val)) {
+                store_slot(interp, stmt->as.input.slot, val);
+            }
+            break;
+        }
+        case STMT_OUTPUT: {
+            Value v = eval_expr(interp, stmt->as.output.value);
+            print_value(v);
+            free_value(v);
+            break;
+        }
+        case STMT_IF:
+            if (eval_condition(interp, stmt->as.if_stmt.condition)) {
+                if (stmt->as.if_stmt.then_branch) exec_stmt(interp, stmt->as.if_stmt.then_branch);
+            } else if (stmt->as.if_stmt.else_branch) {
+                exec_stmt(interp, stmt->as.if_stmt.else_branch);
+            }
+            break;
+        case STMT_WHILE:
+            interp->loops++;
+            while (eval_condition(interp, stmt->as.while_stmt.condition)) {
+                if (stmt->as.while_stmt.body) exec_stmt(interp, stmt->as.while_stmt.body);
+                if (loop_broken(interp)) break;
+            }
+            interp->loops--;
+            break;
+        case STMT_FOR:
+            if (stmt->as.for_stmt.init) exec_stmt(interp, stmt->as.for_stmt.init);
+            interp->loops++;
+            while (eval_condition(interp, stmt->as.for_stmt.condition)) {
+                if (stmt->as.for_stmt.body) exec_stmt(interp, stmt->as.for_stmt.body);
+                if (loop_broken(interp)) break;
+                if (stmt->as.for_stmt.increment) free_value(eval_expr(interp, stmt->as.for_stmt.increment));
+            }
+            interp->loops--;
+            break;
+        case STMT_FOREACH:
+            // No collection values exist yet, so the body never runs.
+            free_value(eval_expr(interp, stmt->as.foreach_stmt.collection));
+            break;
+        case STMT_DO_WHILE:
+            interp->loops++;
+            do {
+                exec_list(interp, stmt->as.do_while.body);
+                if (loop_broken(interp)) break;
+            } while (eval_condition(interp, stmt->as.do_while.condition));
+            interp->loops--;
+            break;
+        case STMT_SWITCH: {
+            // Runs from the matching clause on, falling through to the end
+            // unless a break stops it; a next belongs to the enclosing loop.
+            SwitchCase* clause = switch_match(interp, stmt);
+            interp->switches++;
+            for (; clause && interp->flow == FLOW_NORMAL; clause = clause->next) exec_list(interp, clause->body);
+            interp->switches--;
+            if (interp->flow == FLOW_BREAK) interp->flow = FLOW_NORMAL;
+            break;
+        }
+        case STMT_BLOCK:
+            exec_list(interp, stmt->as.block.body);
+            break;
+        case STMT_RETURN:
+            if (stmt->as.return_stmt.value) free_value(eval_expr(interp, stmt->as.return_stmt.value));
+            break;
+        case STMT_BREAK:
+            if (interp->loops || interp->switches) interp->flow = FLOW_BREAK;
+            break;
+        case STMT_NEXT:
+            if (interp->loops) interp->flow = FLOW_NEXT;
+            break;
+    }
+    if (interp->profile) profile_leave(interp->profile, outer);
+}
+
+// `arena` is the tree's own, for what the evaluator caches on its nodes.
+static void interpret(Program* program, Arena* arena, Profile* profile) {
+    Interpreter interp;
+    memset(&interp, 0, sizeof(Interpreter));
+    interp.names = program->names;
+    interp.arena = arena;
+    interp.profile = profile;
+    interp.frame = malloc((program->slot_count + 1) * sizeof(Value));
+    for (int i = 0; i < program->slot_count; i++) interp.frame[i] = make_int(0);
+    if (profile) profile_start(profile);
+    exec_list(&interp, program->body);
+    output_flush();
+    if (profile) profile_stop(profile);
+    input_close();
+    for (int i = 0; i < program->slot_count; i++) free_value(interp.frame[i]);
+    free(interp.frame);
+}
+
+/* ============================================================================
+ * OPTIMIZER
+ * ============================================================================
+ * Rewrites the resolved tree in place before it runs (-O1 and up):
+ *
+ *   - folds operators whose operands are all literals, through the same
+ *     val_* routines the evaluator uses, so a folded result is exactly what
+ *     running it would have produced; that includes a zero or -1 divisor,
+ *     so folding `INT_MIN / -1` wraps as the run would rather than trapping;
+ *   - prunes if/while/for/do-while whose condition is then a literal, and drops
+ *     blocks, expression statements and if statements left with no effect;
+ *   - drops empty counting loops, `for (int i = a; i < n; i++) {}`, which
+ *     provably terminate and touch nothing outside themselves.
+ *
+ * -O2 also propagates constants: a slot written exactly once, by a declaration
+ * that always runs before any read and whose initializer folds to a literal,
+ * has its reads replaced by that literal and the declaration removed. A
+ * declaration that may be skipped (the bare body of an if or loop, or a switch
+ * clause) never qualifies, because a read after it can then see the slot's
+ * initial 0.
+ *
+ * Folded strings are copied into the tree's arena as immortal literals.
+ */
+
+typedef struct {
+    Arena* arena;        // The tree's arena, for folded string literals
+    int level;
+    int* writes;         // Per slot: stores that may run; 2 for a declaration that may be skipped
+    Value* constants;    // Per slot, valid where known[slot]
+    bool* known;
+} Optimizer;
+
+static void note_write(Optimizer* o, int slot, int count) {
+    if (slot != NO_BINDING) o->writes[slot] += count;
+}
+
+static void count_expr_writes(Optimizer* o, Expr* expr) {
+    if (!expr) return;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            break;
+        case EXPR_UNARY:
+            count_expr_writes(o, expr->as.unary.operand);
+            break;
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            for (; is_operator_node(expr); expr = expr->as.binary.left) count_expr_writes(o, expr->as.binary.right);
+            count_expr_writes(o, expr);
+            break;
+        case EXPR_INCDEC:
+            count_expr_writes(o, expr->as.incdec.operand);
+            note_write(o, expr->as.incdec.slot, 1);
+            break;
+    }
+}
+
+static void count_stmt_writes(Optimizer* o, Stmt* stmt, bool always_runs);
+
+static void count_list_writes(Optimizer* o, Stmt* stmt, bool always_runs) {
+    for (; stmt; stmt = stmt->next) count_stmt_writes(o, stmt, always_runs);
+}
+
+// `always_runs` is false where the statement can be skipped while code after
+// it in the same scope still runs. Blocks, for-loops and do-while bodies open
+// their own scope, so their contents start out true again.
+static void count_stmt_writes(Optimizer* o, Stmt* stmt, bool always_runs) {
+    if (!stmt) return;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            count_expr_writes(o, stmt->as.expression.expr);
+            break;
+        case STMT_DECLARATION:
+            count_expr_writes(o, stmt->as.declaration.init);
+            note_write(o, stmt->as.declaration.slot, always_runs ? 1 : 2);
+            break;
+        case STMT_ASSIGNMENT:
+            count_expr_writes(o, stmt->as.assignment.value);
+            note_write(o, stmt->as.assignment.slot, 1);
+            break;
+        case STMT_INPUT:
+            note_write(o, stmt->as.input.slot, 1);
+            break;
+        case STMT_OUTPUT:
+            count_expr_writes(o, stmt->as.output.value);
+            break;
+        case STMT_IF:
+            count_expr_writes(o, stmt->as.if_stmt.condition);
+            count_stmt_writes(o, stmt->as.if_stmt.then_branch, false);
+            count_stmt_writes(o, stmt->as.if_stmt.else_branch, false);
+            break;
+        case STMT_WHILE:
+            count_expr_writes(o, stmt->as.while_stmt.condition);
+            count_stmt_writes(o, stmt->as.while_stmt.body, false);
+            break;
+        case STMT_FOR:
+            count_stmt_writes(o, stmt->as.for_stmt.init, true);
+            count_expr_writes(o, stmt->as.for_stmt.condition);
+            count_expr_writes(o, stmt->as.for_stmt.increment);
+            count_stmt_writes(o, stmt->as.for_stmt.body, false);
+            break;
+        case STMT_FOREACH:
+            count_expr_writes(o, stmt->as.foreach_stmt.collection);
+            note_write(o, stmt->as.foreach_stmt.slot, 2);
+            count_stmt_writes(o, stmt->as.foreach_stmt.body, false);
+            break;
+        case STMT_DO_WHILE:
+            count_list_writes(o, stmt->as.do_while.body, true);
+            count_expr_writes(o, stmt->as.do_while.condition);
+            break;
+        case STMT_SWITCH:
+            count_expr_writes(o, stmt->as.switch_stmt.subject);
+            for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                count_expr_writes(o, clause->value);
+                count_list_writes(o, clause->body, false);
+            }
+            break;
+        case STMT_BLOCK:
+            count_list_writes(o, stmt->as.block.body, true);
+            break;
+        case STMT_RETURN:
+            count_expr_writes(o, stmt->as.return_stmt.value);
+            break;
+        case STMT_BREAK:
+        case STMT_NEXT:
+            break;
+    }
+}
+
+static bool has_side_effects(const Expr* expr) {
+    if (!expr) return false;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            return false;
+        case EXPR_UNARY:
+            return has_side_effects(expr->as.unary.operand);
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            for (; is_operator_node(expr); expr = expr->as.binary.left) {
+                if (has_side_effects(expr->as.binary.right)) return true;
+            }
+            return has_side_effects(expr);
+        case EXPR_INCDEC:
+            return true;
+    }
+    return true;
+}
+
+static bool is_literal(const Expr* expr) { return expr && expr->kind == EXPR_LITERAL; }
+
+// Turns `expr` into a literal. A string the fold just allocated moves into
+// the arena so that, like every other literal, it is never released.
+static void set_literal(Optimizer* o, Expr* expr, Value value) {
+    if (value.type == VAL_STRING && value.as.string_val->refcount > 0) {
+        ObjString* str = value.as.string_val;
+        Value copy = make_string(string_new_immortal(o->arena, str->chars, str->length));
+        string_release(str);
+        value = copy;
+    }
+    expr->kind = EXPR_LITERAL;
+    expr->as.literal = value;
+}
+
+// Folds a binary or logical node whose operands are folded already.
+static void fold_operator(Optimizer* o, Expr* expr) {
+    Expr* left = expr->as.binary.left;
+    Expr* right = expr->as.binary.right;
+    if (expr->kind == EXPR_BINARY) {
+        if (is_literal(left) && is_literal(right)) {
+            set_literal(o, expr, eval_binary(expr->as.binary.op, left->as.literal, right->as.literal));
+        }
+        return;
+    }
+    if (!is_literal(left)) return;
+    bool b = value_truthy(left->as.literal);
+    if (expr->as.binary.op == OR_OR ? b : !b) set_literal(o, expr, make_bool(b));
+    else if (is_literal(right)) set_literal(o, expr, make_bool(value_truthy(right->as.literal)));
+}
+
+static void fold_expr(Optimizer* o, Expr* expr) {
+    if (!expr) return;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            break;
+        case EXPR_VARIABLE: {
+            if (o->level < 2) break;
+            int slot = expr->as.variable.slot;
+            if (slot == NO_BINDING) set_literal(o, expr, make_int(0)); // Reads of an unbound name yield 0
+            else if (o->known[slot]) set_literal(o, expr, o->constants[slot]);
+            break;
+        }
+        case EXPR_UNARY: {
+            Expr* operand = expr->as.unary.operand;
+            fold_expr(o, operand);
+            if (!is_literal(operand)) break;
+            Value v = operand->as.literal;
+            if (expr->as.unary.op == NOT) v = make_bool(!value_truthy(v));
+            else if (v.type == VAL_INT) v.as.int_val = int_neg(v.as.int_val);
+            else if (v.type == VAL_DOUBLE) v.as.double_val = -v.as.double_val;
+            set_literal(o, expr, v);
+            break;
+        }
+        case EXPR_BINARY:
+        case EXPR_LOGICAL: {
+            ExprChain chain;
+            fold_expr(o, chain_collect(&chain, expr));
+            for (int i = chain.count - 1; i >= 0; i--) {
+                fold_expr(o, chain.nodes[i]->as.binary.right);
+                fold_operator(o, chain.nodes[i]);
+            }
+            chain_free(&chain);
+            break;
+        }
+        case EXPR_INCDEC:
+            fold_expr(o, expr->as.incdec.operand);
+            break;
+    }
+}
+
+static Stmt* optimize_stmt(Optimizer* o, Stmt* stmt);
+
+static Stmt* optimize_list(Optimizer* o, Stmt* head) {
+    StmtList list = {0};
+    for (Stmt* stmt = head; stmt;) {
+        Stmt* next = stmt->next;
+        stmt_list_append(&list, optimize_stmt(o, stmt));
+        stmt = next;
+    }
+    return list.head;
+}
+
+static bool is_empty_stmt(const Stmt* stmt) {
+    return !stmt || (stmt->kind == STMT_BLOCK && !stmt->as.block.body);
+}
+
+// for (int i = a; i < n; i++) {} and its counting-down mirror, with a and n
+// int literals: runs a bounded number of times and changes only its own i.
+static bool is_dead_counting_loop(Optimizer* o, const Stmt* stmt) {
+    const Stmt* init = stmt->as.for_stmt.init;
+    const Expr* cond = stmt->as.for_stmt.condition;
+    const Expr* step = stmt->as.for_stmt.increment;
+    if (!is_empty_stmt(stmt->as.for_stmt.body) || !init || !cond || !step) return false;
+    if (init->kind != STMT_DECLARATION || !is_literal(init->as.declaration.init) ||
+        init->as.declaration.init->as.literal.type != VAL_INT) return false;
+    int slot = init->as.declaration.slot;
+    if (o->writes[slot] != 2) return false; // The declaration and the step, nothing else
+    if (step->kind != EXPR_INCDEC || step->as.incdec.slot != slot) return false;
+    if (step->as.incdec.operand->kind != EXPR_VARIABLE) return false;
+    if (cond->kind != EXPR_BINARY || cond->as.binary.left->kind != EXPR_VARIABLE ||
+        cond->as.binary.left->as.variable.slot != slot || !is_literal(cond->as.binary.right) ||
+        cond->as.binary.right->as.literal.type != VAL_INT) return false;
+    int bound = cond->as.binary.right->as.literal.as.int_val;
+    switch (cond->as.binary.op) {
+        case LESS: return step->as.incdec.op == PLUS_PLUS;
+        case LESS_EQUAL: return step->as.incdec.op == PLUS_PLUS && bound < INT32_MAX;
+        case GREATER: return step->as.incdec.op == MINUS_MINUS;
+        case GREATER_EQUAL: return step->as.incdec.op == MINUS_MINUS && bound > INT32_MIN;
+        default: return false;
+    }
+}
+
+static bool leaves_loop_list(const Stmt* stmt, bool in_switch);
+
+// Whether a break or next in `stmt` belongs to the loop around it. Inner
+// loops take their own, and a switch takes its breaks.
+static bool leaves_loop(const Stmt* stmt, bool in_switch) {
+    if (!stmt) return false;
+    switch (stmt->kind) {
+        case STMT_BREAK: return !in_switch;
+        case STMT_NEXT: return true;
+        case STMT_IF:
+            return leaves_loop(stmt->as.if_stmt.then_branch, in_switch) ||
+                   leaves_loop(stmt->as.if_stmt.else_branch, in_switch);
+        case STMT_BLOCK: return leaves_loop_list(stmt->as.block.body, in_switch);
+        case STMT_SWITCH:
+            for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                if (leaves_loop_list(clause->body, true)) return true;
+            }
+            return false;
+        default: return false;
+    }
+}
+
+static bool leaves_loop_list(const Stmt* stmt, bool in_switch) {
+    for (; stmt; stmt = stmt->next) {
+        if (leaves_loop(stmt, in_switch)) return true;
+    }
+    return false;
+}
+
+// Returns the statement to keep in place of `stmt`: itself, a replacement, or
+// NULL to drop it.
+static Stmt* optimize_stmt(Optimizer* o, Stmt* stmt) {
+    if (!stmt) return NULL;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            fold_expr(o, stmt->as.expression.expr);
+            return has_side_effects(stmt->as.expression.expr) ? stmt : NULL;
+        case STMT_DECLARATION: {
+            Expr* init = stmt->as.declaration.init;
+            int slot = stmt->as.declaration.slot;
+            fold_expr(o, init);
+            if (o->level >= 2 && o->writes[slot] == 1) {
+                o->known[slot] = true;
+                o->constants[slot] = init ? init->as.literal : make_int(0);
+                if (!init || is_literal(init)) return NULL;
+                o->known[slot] = false;
+            }
+            return stmt;
+        }
+        case STMT_ASSIGNMENT:
+            fold_expr(o, stmt->as.assignment.value);
+            return stmt;
+        case STMT_INPUT:
+            return stmt;
+        case STMT_OUTPUT:
+            fold_expr(o, stmt->as.output.value);
+            return stmt;
+        case STMT_IF: {
+            Expr* cond = stmt->as.if_stmt.condition;
+            fold_expr(o, cond);
+            stmt->as.if_stmt.then_branch = optimize_stmt(o, stmt->as.if_stmt.then_branch);
+            stmt->as.if_stmt.else_branch = optimize_stmt(o, stmt->as.if_stmt.else_branch);
+            if (is_literal(cond)) {
+                return value_truthy(cond->as.literal) ? stmt->as.if_stmt.then_branch : stmt->as.if_stmt.else_branch;
+            }
+            if (is_empty_stmt(stmt->as.if_stmt.then_branch) && is_empty_stmt(stmt->as.if_stmt.else_branch)) {
+                if (!has_side_effects(cond)) return NULL;
+                stmt->kind = STMT_EXPRESSION;
+                stmt->as.expression.expr = cond;
+            }
+            return stmt;
+        }
+        case STMT_WHILE: {
+            Expr* cond = stmt->as.while_stmt.condition;
+            fold_expr(o, cond);
+            stmt->as.while_stmt.body = optimize_stmt(o, stmt->as.while_stmt.body);
+            if (is_literal(cond) && !value_truthy(cond->as.literal)) return NULL;
+            return stmt;
+        }
+        case STMT_FOR: {
+            stmt->as.for_stmt.init = optimize_stmt(o, stmt->as.for_stmt.init);
+            Expr* cond = stmt->as.for_stmt.condition;
+            fold_expr(o, cond);
+            fold_expr(o, stmt->as.for_stmt.increment);
+            stmt->as.for_stmt.body = optimize_stmt(o, stmt->as.for_stmt.body);
+            if (is_literal(cond) && !value_truthy(cond->as.literal)) return stmt->as.for_stmt.init;
+            if (is_dead_counting_loop(o, stmt)) return NULL;
+            return stmt;
+        }
+        case STMT_FOREACH:
+            fold_expr(o, stmt->as.foreach_stmt.collection);
+            stmt->as.foreach_stmt.body = optimize_stmt(o, stmt->as.foreach_stmt.body);
+            return stmt;
+        case STMT_DO_WHILE: {
+            stmt->as.do_while.body = optimize_list(o, stmt->as.do_while.body);
+            Expr* cond = stmt->as.do_while.condition;
+            fold_expr(o, cond);
+            if (is_literal(cond) && !value_truthy(cond->as.literal) && !leaves_loop_list(stmt->as.do_while.body, false)) {
+                // The body runs exactly once
+                stmt->kind = STMT_BLOCK;
+                stmt->as.block.body = stmt->as.do_while.body;
+                return stmt->as.block.body ? stmt : NULL;
+            }
+            return stmt;
+        }
+        case STMT_SWITCH:
+            fold_expr(o, stmt->as.switch_stmt.subject);
+            for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                fold_expr(o, clause->value);
+                clause->body = optimize_list(o, clause->body);
+            }
+            return stmt;
+        case STMT_BLOCK:
+            stmt->as.block.body = optimize_list(o, stmt->as.block.body);
+            return stmt->as.block.body ? stmt : NULL;
+        case STMT_RETURN:
+            fold_expr(o, stmt->as.return_stmt.value);
+            return stmt;
+        case STMT_BREAK:
+        case STMT_NEXT:
+            return stmt;
+    }
+    return stmt;
+}
+
+static int count_expr_nodes(const Expr* expr) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            return 1;
+        case EXPR_UNARY:
+            return 1 + count_expr_nodes(expr->as.unary.operand);
+        case EXPR_BINARY:
+        case EXPR_LOGICAL: {
+            int count = 0;
+            for (; is_operator_node(expr); expr = expr->as.binary.left) count += 1 + count_expr_nodes(expr->as.binary.right);
+            return count + count_expr_nodes(expr);
+        }
+        case EXPR_INCDEC:
+            return 1 + count_expr_nodes(expr->as.incdec.operand);
+    }
+    return 1;
+}
+
+static int count_stmt_nodes(const Stmt* stmt);
+
+static int count_list_nodes(const Stmt* stmt) {
+    int count = 0;
+    for (; stmt; stmt = stmt->next) count += count_stmt_nodes(stmt);
+    return count;
+}
+
+static int count_stmt_nodes(const Stmt* stmt) {
+    if (!stmt) return 0;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION: return 1 + count_expr_nodes(stmt->as.expression.expr);
+        case STMT_DECLARATION: return 1 + count_expr_nodes(stmt->as.declaration.init);
+        case STMT_ASSIGNMENT: return 1 + count_expr_nodes(stmt->as.assignment.value);
+        case STMT_INPUT: return 1;
+        case STMT_OUTPUT: return 1 + count_expr_nodes(stmt->as.output.value);
+        case STMT_IF:
+            return 1 + count_expr_nodes(stmt->as.if_stmt.condition) +
+                   count_stmt_nodes(stmt->as.if_stmt.then_branch) + count_stmt_nodes(stmt->as.if_stmt.else_branch);
+        case STMT_WHILE:
+            return 1 + count_expr_nodes(stmt->as.while_stmt.condition) + count_stmt_nodes(stmt->as.while_stmt.body);
+        case STMT_FOR:
+            return 1 + count_stmt_nodes(stmt->as.for_stmt.init) + count_expr_nodes(stmt->as.for_stmt.condition) +
+                   count_expr_nodes(stmt->as.for_stmt.increment) + count_stmt_nodes(stmt->as.for_stmt.body);
+        case STMT_FOREACH:
+            return 1 + count_expr_nodes(stmt->as.foreach_stmt.collection) + count_stmt_nodes(stmt->as.foreach_stmt.body);
+        case STMT_DO_WHILE:
+            return 1 + count_list_nodes(stmt->as.do_while.body) + count_expr_nodes(stmt->as.do_while.condition);
+        case STMT_SWITCH: {
+            int count = 1 + count_expr_nodes(stmt->as.switch_stmt.subject);
+            for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                count += 1 + count_expr_nodes(clause->value) + count_list_nodes(clause->body);
+            }
+            return count;
+        }
+        case STMT_BLOCK: return 1 + count_list_nodes(stmt->as.block.body);
+        case STMT_RETURN: return 1 + count_expr_nodes(stmt->as.return_stmt.value);
+        case STMT_BREAK:
+        case STMT_NEXT:
+            return 1;
+    }
+    return 1;
+}
+
+typedef struct {
+    int nodes_before;
+    int nodes_after;
+} OptimizeStats;
+
+// Runs after resolve_program: propagation works on slots. `arena` is the one
+// the tree lives in.
+static OptimizeStats optimize_program(Program* program, Arena* arena, int level) {
+    OptimizeStats stats;
+    stats.nodes_before = count_list_nodes(program->body);
+    if (level > 0) {
+        Optimizer o;
+        o.arena = arena;
+        o.level = level;
+        o.writes = calloc(program->slot_count + 1, sizeof(int));
+        o.constants = calloc(program->slot_count + 1, sizeof(Value));
+        o.known = calloc(program->slot_count + 1, sizeof(bool));
+        count_list_writes(&o, program->body, true);
+        program->body = optimize_list(&o, program->body);
+        free(o.writes);
+        free(o.constants);
+        free(o.known);
+    }
+    stats.nodes_after = count_list_nodes(program->body);
+    return stats;
+}
+
+/* ============================================================================
+ * FRAME LAYOUT
+ * ============================================================================
+ * The resolver gives every variable a slot of its own, so the optimizer and
+ * the VM's type inference can take a slot to mean one variable. Before the
+ * script runs, layout_frame packs them into a frame used as a stack: a scope
+ * takes the slots above its parent's as it declares variables and gives them
+ * all back at its end by resetting the top. Sibling blocks and successive
+ * loops share slots, and the frame is only as large as the most variables
+ * live at once.
+ *
+ * Nothing runs when a scope ends. A declaration always stores to its slot,
+ * releasing whatever an earlier scope's variable left there, and the frame's
+ * contents are released in one pass when the script ends. So leaving a scope
+ * is free, and a loop body's locals cost one store per iteration, like any
+ * assignment.
+ *
+ * A declaration that may be skipped (the bare body of an if or loop, or a
+ * switch clause) keeps a slot to itself, above the stack, because a read after
+ * a skipped declaration must still see the slot's initial 0 or the variable's
+ * own earlier value. So does a variable used without a declaration left, one
+ * the optimizer propagated away.
+ */
+
+typedef struct {
+    int* place;          // Per resolver slot: its frame slot, counted from the pinned area's
+                         // start where pinned[slot]; NO_BINDING until placed
+    bool* pinned;
+    int top;             // First free slot of the stack
+    int stack_size;      // Most slots the stack held at once
+    int pinned_count;
+    bool rewrite;        // Second pass: every slot is placed; replace each by its frame slot
+} FrameLayout;
+
+static void layout_slot(FrameLayout* f, int* slot, bool own) {
+    if (*slot == NO_BINDING) return;
+    if (f->rewrite) {
+        *slot = f->place[*slot] + (f->pinned[*slot] ? f->stack_size : 0);
+        return;
+    }
+    if (f->place[*slot] != NO_BINDING) return;
+    if (own) {
+        f->pinned[*slot] = true;
+        f->place[*slot] = f->pinned_count++;
+    } else {
+        f->place[*slot] = f->top++;
+        if (f->top > f->stack_size) f->stack_size = f->top;
+    }
+}
+
+static void layout_expr(FrameLayout* f, Expr* expr) {
+    if (!expr) return;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            break;
+        case EXPR_VARIABLE:
+            layout_slot(f, &expr->as.variable.slot, true);
+            break;
+        case EXPR_UNARY:
+            layout_expr(f, expr->as.unary.operand);
+            break;
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            for (; is_operator_node(expr); expr = expr->as.binary.left) layout_expr(f, expr->as.binary.right);
+            layout_expr(f, expr);
+            break;
+        case EXPR_INCDEC:
+            layout_expr(f, expr->as.incdec.operand);
+            layout_slot(f, &expr->as.incdec.slot, true);
+            break;
+    }
+}
+
+static void layout_stmt(FrameLayout* f, Stmt* stmt, bool always_runs);
+
+// Scopes open and close where the resolver's do
+static void layout_list(FrameLayout* f, Stmt* stmt, bool always_runs) {
+    for (; stmt; stmt = stmt->next) layout_stmt(f, stmt, always_runs);
+}
+
+static void layout_scoped_list(FrameLayout* f, Stmt* stmt) {
+    int mark = f->top;
+    layout_list(f, stmt, true);
+    f->top = mark;
+}
+
+// `always_runs` as in count_stmt_writes
+static void layout_stmt(FrameLayout* f, Stmt* stmt, bool always_runs) {
+    if (!stmt) return;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            layout_expr(f, stmt->as.expression.expr);
+            break;
+        case STMT_DECLARATION:
+            layout_expr(f, stmt->as.declaration.init);
+            layout_slot(f, &stmt->as.declaration.slot, !always_runs);
+            break;
+        case STMT_ASSIGNMENT:
+            layout_expr(f, stmt->as.assignment.value);
+            layout_slot(f, &stmt->as.assignment.slot, true);
+            break;
+        case STMT_INPUT:
+            layout_slot(f, &stmt->as.input.slot, true);
+            break;
+        case STMT_OUTPUT:
+            layout_expr(f, stmt->as.output.value);
+            break;
+        case STMT_IF:
+            layout_expr(f, stmt->as.if_stmt.condition);
+            layout_stmt(f, stmt->as.if_stmt.then_branch, false);
+            layout_stmt(f, stmt->as.if_stmt.else_branch, false);
+            break;
+        case STMT_WHILE:
+            layout_expr(f, stmt->as.while_stmt.condition);
+            layout_stmt(f, stmt->as.while_stmt.body, false);
+            break;
+        case STMT_FOR: {
+            int mark = f->top;
+            layout_stmt(f, stmt->as.for_stmt.init, true);
+            layout_expr(f, stmt->as.for_stmt.condition);
+            layout_expr(f, stmt->as.for_stmt.increment);
+            layout_stmt(f, stmt->as.for_stmt.body, false);
+            f->top = mark;
+            break;
+        }
+        case STMT_FOREACH: {
+            layout_expr(f, stmt->as.foreach_stmt.collection);
+            int mark = f->top;
+            layout_slot(f, &stmt->as.foreach_stmt.slot, false);
+            layout_stmt(f, stmt->as.foreach_stmt.body, false);
+            f->top = mark;
+            break;
+        }
+        case STMT_DO_WHILE:
+            layout_scoped_list(f, stmt->as.do_while.body);
+            layout_expr(f, stmt->as.do_while.condition);
+            break;
+        case STMT_SWITCH: {
+            layout_expr(f, stmt->as.switch_stmt.subject);
+            int mark = f->top;
+            for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                layout_expr(f, clause->value);
+                layout_list(f, clause->body, false);
+            }
+            f->top = mark;
+            break;
+        }
+        case STMT_BLOCK:
+            layout_scoped_list(f, stmt->as.block.body);
+            break;
+        case STMT_RETURN:
+            layout_expr(f, stmt->as.return_stmt.value);
+            break;
+        case STMT_BREAK:
+        case STMT_NEXT:
+            break;
+    }
+}
+
+// Runs after resolve_program and optimize_program, before the script is
+// interpreted or compiled, once for each resolve_program; slot_count becomes
+// the frame's size. Skipping it leaves each variable in a slot of its own,
+// which also works.
+static void layout_frame(Program* program) {
+    FrameLayout f;
+    memset(&f, 0, sizeof(FrameLayout));
+    f.place = malloc((program->slot_count + 1) * sizeof(int));
+    f.pinned = calloc(program->slot_count + 1, sizeof(bool));
+    for (int i = 0; i < program->slot_count; i++) f.place[i] = NO_BINDING;
+    layout_list(&f, program->body, true);
+    f.rewrite = true;
+    layout_list(&f, program->body, true);
+    program->slot_count = f.stack_size + f.pinned_count;
+    free(f.place);
+    free(f.pinned);
+}
+
+/* ============================================================================
+ * BYTECODE DEFINITIONS
+ * ============================================================================
+ * Every instruction starts with one 32-bit word: the opcode in the low 8 bits
+ * and a 24-bit operand (slot, constant index or immediate) in the high bits.
+ * Jumps carry their absolute target in the following word.
+ *
+ * The superinstructions cover the sequences that dominate the opcode-pair
+ * counts of a -DCYTHONIC_PAIR_STATS build (`make pairstats`): LOAD DUP
+ * PUSH_INT ADD STORE POP for `i++;`, a comparison followed by JUMP_IF_FALSE,
+ * and the whole condition/increment/back-jump of a counted for loop.
+ */
+
+#define OPCODE_LIST(X) \
+    X(CONST)          /* push constants[A]                          */ \
+    X(PUSH_INT)       /* push signed 24-bit immediate A             */ \
+    X(LOAD)           /* push slots[A]                              */ \
+    X(STORE)          /* slots[A] = pop                             */ \
+    X(ADD_LOCAL)      /* slots[A] += pop; strings append in place   */ \
+    X(POP)            \
+    X(DUP)            \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) \
+    X(NEG) X(NOT) X(TO_BOOL) \
+    X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE) \
+    /* Both operands statically known: no type checks or refcounts  */ \
+    X(LOAD_N)         /* push slots[A], a number, bool or char      */ \
+    X(STORE_N)        /* slots[A] = pop, neither side a string      */ \
+    X(I2D)            /* sp[-A] = (double)sp[-A], an int            */ \
+    X(ADD_II) X(SUB_II) X(MUL_II) X(DIV_II) X(MOD_II) \
+    X(EQ_II) X(NE_II) X(LT_II) X(LE_II) X(GT_II) X(GE_II) \
+    X(ADD_DD) X(SUB_DD) X(MUL_DD) X(DIV_DD) \
+    X(EQ_DD) X(NE_DD) X(LT_DD) X(LE_DD) X(GT_DD) X(GE_DD) \
+    /* Superinstructions for the most frequent opcode sequences     */ \
+    X(INC_LOCAL)      /* slots[A] += next word, a signed immediate  */ \
+    X(EQ_JMP) X(NE_JMP) X(LT_JMP) X(LE_JMP) X(GT_JMP) X(GE_JMP) \
+                      /* pop b, a; jump unless a op b               */ \
+    X(FOR_RANGE)      /* jump to word 2 unless slots[A] < slots[word 1] */ \
+    X(FOR_RANGE_I)    /* jump to word 2 unless slots[A] < word 1    */ \
+    X(FOR_STEP)       /* slots[A]++; jump to word 2 if < slots[word 1] */ \
+    X(FOR_STEP_I)     /* slots[A]++; jump to word 2 if < word 1     */ \
+    X(JUMP)           /* ip = next word                             */ \
+    X(JUMP_IF_FALSE)  /* pop; jump when falsy                       */ \
+    X(JUMP_IF_TRUE)   /* pop; jump when truthy                      */ \
+    X(AND_JUMP)       /* top = bool(top); jump if false, else pop   */ \
+    X(OR_JUMP)        /* top = bool(top); jump if true, else pop    */ \
+    X(SWITCH_TABLE)   /* pop; jump to its target in switches[A]     */ \
+    X(PRINT)          /* print pop                                  */ \
+    X(INPUT)          /* read for the name atom A; next words: slot, declared type */ \
+    X(HALT)
+
+typedef enum {
+#define X(name) OP_##name,
+    OPCODE_LIST(X)
+#undef X
+    OP_COUNT
+} OpCode;
+
+static const char* const OPCODE_NAMES[OP_COUNT] = {
+#define X(name) #name,
+    OPCODE_LIST(X)
+#undef X
+};
+
+#define INSN(op, a) ((uint32_t)(op) | ((uint32_t)(a) << 8))
+#define INSN_OP(word) ((word) & 0xFF)
+#define INSN_A(word) ((word) >> 8)
+#define INSN_SA(word) ((int32_t)(word) >> 8)   // Sign-extended operand
+#define NO_SLOT 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t* code;
+    int* lines;          // Source line of each code word
+    int count;
+    int capacity;
+    Value* constants;
+    int const_count;
+    int const_capacity;
+    int slot_count;
+    int max_stack;
+    const Interner* names; // Text of INPUT's name atoms
+    SwitchTable** switches; // Targets are code offsets
+    int switch_count;
+    int switch_capacity;
+    Arena arena;         // The switch tables
+} Chunk;
+
+// Code words an instruction occupies, operand words included
+static int insn_words(OpCode op) {
+    switch (op) {
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_TRUE: case OP_AND_JUMP: case OP_OR_JUMP:
+        case OP_INC_LOCAL:
+        case OP_EQ_JMP: case OP_NE_JMP: case OP_LT_JMP: case OP_LE_JMP: case OP_GT_JMP: case OP_GE_JMP:
+            return 2;
+        case OP_INPUT: case OP_FOR_RANGE: case OP_FOR_RANGE_I: case OP_FOR_STEP: case OP_FOR_STEP_I:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+/* ============================================================================
+ * BYTECODE COMPILER
+ * ============================================================================
+ * Lowers the resolved AST into a Chunk. Frame slots come straight from the
+ * resolver, so LOAD/STORE operands are the same indices the evaluator uses.
+ * Arithmetic whose operand types are known statically compiles to the _II
+ * and _DD opcodes; everything else keeps the generic ones. A switch over
+ * literal cases is one SWITCH_TABLE; break and next are forward jumps.
+ */
+
+// --- Static Types ---
+// What the compiler can prove about each slot and expression before the
+// program runs, so arithmetic on known ints or doubles compiles to opcodes
+// that skip the VM's type checks. Nothing is coerced at run time: declared
+// types are claims the store analysis has to confirm. A slot's type is the
+// join of its declared type and of everything stored into it, found by
+// iterating to a fixed point; one store of another type makes it TYPE_ANY,
+// which keeps the generic, guarded opcodes. The rules below mirror val_*
+// exactly, including their int 0 results.
+
+typedef enum {
+    TYPE_NONE,           // Nothing stored yet (while inferring)
+    TYPE_INT,
+    TYPE_DOUBLE,
+    TYPE_BOOL,
+    TYPE_CHAR,
+    TYPE_STRING,
+    TYPE_ANY
+} StaticType;
+
+#define TYPE_PASS_LIMIT 16
+
+static StaticType type_join(StaticType a, StaticType b) {
+    if (a == TYPE_NONE) return b;
+    if (b == TYPE_NONE || a == b) return a;
+    return TYPE_ANY;
+}
+
+static bool type_is_number(StaticType t) { return t == TYPE_INT || t == TYPE_DOUBLE; }
+
+// Slots whose values are never strings need no reference counting
+static bool type_is_scalar(StaticType t) { return t >= TYPE_INT && t <= TYPE_CHAR; }
+
+static StaticType value_static_type(Value v) {
+    switch (v.type) {
+        case VAL_INT: return TYPE_INT;
+        case VAL_DOUBLE: return TYPE_DOUBLE;
+        case VAL_BOOL: return TYPE_BOOL;
+        case VAL_CHAR: return TYPE_CHAR;
+        case VAL_STRING: return TYPE_STRING;
+        default: return TYPE_ANY;
+    }
+}
+
+static StaticType declared_static_type(Atom type) {
+    switch (type) {
+        case ATOM_INT: return TYPE_INT;
+        case ATOM_DOUBLE: return TYPE_DOUBLE;
+        case ATOM_BOOL: return TYPE_BOOL;
+        case ATOM_CHAR: return TYPE_CHAR;
+        case ATOM_STR: return TYPE_STRING;
+        default: return TYPE_NONE; // var, const, dyn, let: whatever is stored
+    }
+}
+
+// Type of eval_binary(op, a, b). `right` may refine a division.
+static StaticType binary_static_type(TokenType op, StaticType a, StaticType b, const Expr* right) {
+    switch (op) {
+        case GREATER: case GREATER_EQUAL: case LESS: case LESS_EQUAL:
+        case EQUAL_EQUAL: case NOT_EQUAL:
+            return TYPE_BOOL;
+        default:
+            break;
+    }
+    if (a == TYPE_NONE || b == TYPE_NONE) return TYPE_NONE;
+    if (a == TYPE_ANY || b == TYPE_ANY) return TYPE_ANY;
+    switch (op) {
+        case PLUS:
+            if (a == TYPE_INT && b == TYPE_INT) return TYPE_INT;
+            if (a == TYPE_STRING || b == TYPE_STRING) return TYPE_STRING;
+            if (a == TYPE_DOUBLE || b == TYPE_DOUBLE) return TYPE_DOUBLE;
+            return TYPE_INT;
+        case MINUS:
+        case STAR:
+            return a == TYPE_INT && b == TYPE_INT ? TYPE_INT : TYPE_DOUBLE;
+        case SLASH:
+            // Dividing by zero yields int 0, so only a nonzero literal divisor pins a double
+            if (a == TYPE_INT && b == TYPE_INT) return TYPE_INT;
+            if (right && right->kind == EXPR_LITERAL && value_to_double(right->as.literal) != 0) return TYPE_DOUBLE;
+            return TYPE_ANY;
+        case PERCENT:
+            return a == TYPE_INT && b == TYPE_INT ? TYPE_INT : a;
+        default:
+            return TYPE_ANY;
+    }
+}
+
+static StaticType expr_static_type(const StaticType* slots, const Expr* expr) {
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            return value_static_type(expr->as.literal);
+        case EXPR_VARIABLE:
+            return expr->as.variable.slot == NO_BINDING ? TYPE_INT : slots[expr->as.variable.slot];
+        case EXPR_UNARY:
+            if (expr->as.unary.op == NOT) return TYPE_BOOL;
+            return expr_static_type(slots, expr->as.unary.operand); // Negation keeps the type
+        case EXPR_BINARY: {
+            ExprChain chain;
+            StaticType type = expr_static_type(slots, chain_collect(&chain, (Expr*)expr));
+            for (int i = chain.count - 1; i >= 0; i--) {
+                const Expr* node = chain.nodes[i];
+                if (node->kind == EXPR_LOGICAL) type = TYPE_BOOL;
+                else type = binary_static_type(node->as.binary.op, type, expr_static_type(slots, node->as.binary.right),
+                                               node->as.binary.right);
+            }
+            chain_free(&chain);
+            return type;
+        }
+        case EXPR_LOGICAL:
+            return TYPE_BOOL;
+        case EXPR_INCDEC: {
+            StaticType old = expr_static_type(slots, expr->as.incdec.operand);
+            if (!expr->as.incdec.prefix) return old;
+            return binary_static_type(expr->as.incdec.op == PLUS_PLUS ? PLUS : MINUS, old, TYPE_INT, NULL);
+        }
+    }
+    return TYPE_ANY;
+}
+
+typedef struct {
+    StaticType* slots;
+    bool changed;
+} TypeInference;
+
+static void infer_store(TypeInference* t, int slot, StaticType type) {
+    if (slot == NO_BINDING) return;
+    StaticType joined = type_join(t->slots[slot], type);
+    if (joined != t->slots[slot]) {
+        t->slots[slot] = joined;
+        t->changed = true;
+    }
+}
+
+static void infer_expr(TypeInference* t, const Expr* expr) {
+    if (!expr) return;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            break;
+        case EXPR_UNARY:
+            infer_expr(t, expr->as.unary.operand);
+            break;
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            for (; is_operator_node(expr); expr = expr->as.binary.left) infer_expr(t, expr->as.binary.right);
+            infer_expr(t, expr);
+            break;
+        case EXPR_INCDEC: {
+            infer_expr(t, expr->as.incdec.operand);
+            StaticType old = expr_static_type(t->slots, expr->as.incdec.operand);
+            infer_store(t, expr->as.incdec.slot,
+                        binary_static_type(expr->as.incdec.op == PLUS_PLUS ? PLUS : MINUS, old, TYPE_INT, NULL));
+            break;
+        }
+    }
+}
+
+static void infer_stmt(TypeInference* t, const Stmt* stmt, bool always_runs);
+
+static void infer_list(TypeInference* t, const Stmt* stmt, bool always_runs) {
+    for (; stmt; stmt = stmt->next) infer_stmt(t, stmt, always_runs);
+}
+
+// As in the optimizer, `always_runs` is false where a declaration can be
+// skipped while later reads still see its slot, which then holds the initial
+// int 0.
+static void infer_stmt(TypeInference* t, const Stmt* stmt, bool always_runs) {
+    if (!stmt) return;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            infer_expr(t, stmt->as.expression.expr);
+            break;
+        case STMT_DECLARATION: {
+            const Expr* init = stmt->as.declaration.init;
+            int slot = stmt->as.declaration.slot;
+            infer_expr(t, init);
+            infer_store(t, slot, declared_static_type(stmt->as.declaration.type));
+            infer_store(t, slot, init ? expr_static_type(t->slots, init) : TYPE_INT);
+            if (!always_runs) infer_store(t, slot, TYPE_INT);
+            break;
+        }
+        case STMT_ASSIGNMENT: {
+            int slot = stmt->as.assignment.slot;
+            const Expr* value = stmt->as.assignment.value;
+            infer_expr(t, value);
+            if (slot == NO_BINDING) break;
+            StaticType rhs = expr_static_type(t->slots, value);
+            TokenType op = stmt->as.assignment.op;
+            if (op == EQUAL) { infer_store(t, slot, rhs); break; }
+            TokenType binary = op == MINUS_EQUAL ? MINUS : op == STAR_EQUAL ? STAR :
+                               op == SLASH_EQUAL ? SLASH : op == PERCENT_EQUAL ? PERCENT : PLUS;
+            infer_store(t, slot, binary_static_type(binary, t->slots[slot], rhs, value));
+            break;
+        }
+        case STMT_INPUT: {
+            // An untyped target may read an int, a double or a string
+            StaticType type = declared_static_type(stmt->as.input.type);
+            infer_store(t, stmt->as.input.slot, type != TYPE_NONE ? type : TYPE_ANY);
+            break;
+        }
+        case STMT_OUTPUT:
+            infer_expr(t, stmt->as.output.value);
+            break;
+        case STMT_IF:
+            infer_expr(t, stmt->as.if_stmt.condition);
+            infer_stmt(t, stmt->as.if_stmt.then_branch, false);
+            infer_stmt(t, stmt->as.if_stmt.else_branch, false);
+            break;
+        case STMT_WHILE:
+            infer_expr(t, stmt->as.while_stmt.condition);
+            infer_stmt(t, stmt->as.while_stmt.body, false);
+            break;
+        case STMT_FOR:
+            infer_stmt(t, stmt->as.for_stmt.init, true);
+            infer_expr(t, stmt->as.for_stmt.condition);
+            infer_expr(t, stmt->as.for_stmt.increment);
+            infer_stmt(t, stmt->as.for_stmt.body, false);
+            break;
+        case STMT_FOREACH:
+            // The body never runs, so the loop variable keeps its initial 0
+            infer_expr(t, stmt->as.foreach_stmt.collection);
+            infer_store(t, stmt->as.foreach_stmt.slot, TYPE_INT);
+            infer_stmt(t, stmt->as.foreach_stmt.body, false);
+            break;
+        case STMT_DO_WHILE:
+            infer_list(t, stmt->as.do_while.body, true);
+            infer_expr(t, stmt->as.do_while.condition);
+            break;
+        case STMT_SWITCH:
+            infer_expr(t, stmt->as.switch_stmt.subject);
+            for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) {
+                infer_expr(t, clause->value);
+                infer_list(t, clause->body, false);
+            }
+            break;
+        case STMT_BLOCK:
+            infer_list(t, stmt->as.block.body, true);
+            break;
+        case STMT_RETURN:
+            infer_expr(t, stmt->as.return_stmt.value);
+            break;
+        case STMT_BREAK:
+        case STMT_NEXT:
+            break;
+    }
+}
+
+// One StaticType per slot; the caller frees it. Types only ever move up the
+// lattice, so this converges; past TYPE_PASS_LIMIT passes every slot gives up
+// to TYPE_ANY rather than iterate further.
+static StaticType* infer_slot_types(const Program* program) {
+    TypeInference t;
+    t.slots = calloc(program->slot_count + 1, sizeof(StaticType));
+    int pass = 0;
+    do {
+        t.changed = false;
+        infer_list(&t, program->body, true);
+    } while (t.changed && ++pass < TYPE_PASS_LIMIT);
+    for (int i = 0; i < program->slot_count; i++) {
+        if (t.changed || t.slots[i] == TYPE_NONE) t.slots[i] = TYPE_ANY;
+    }
+    return t.slots;
+}
+
+// Forward jumps from break or next statements, patched once the loop or
+// switch they leave knows where it ends or continues.
+typedef struct {
+    int* at;
+    int count;
+    int capacity;
+} JumpList;
+
+typedef struct BreakTarget {
+    struct BreakTarget* enclosing;
+    bool loop;           // Takes next as well as break
+    JumpList breaks;
+    JumpList nexts;
+} BreakTarget;
+
+typedef struct {
+    Chunk* chunk;
+    int depth;           // Current operand stack depth
+    const StaticType* slot_types;
+    BreakTarget* targets; // Innermost loop or switch
+} Compiler;
+
+static void emit_word(Compiler* c, uint32_t word, int line) {
+    Chunk* chunk = c->chunk;
+    if (chunk->count >= chunk->capacity) {
+        chunk->capacity = chunk->capacity < 64 ? 64 : chunk->capacity * 2;
+        chunk->code = realloc(chunk->code, chunk->capacity * sizeof(uint32_t));
+        chunk->lines = realloc(chunk->lines, chunk->capacity * sizeof(int));
+    }
+    chunk->code[chunk->count] = word;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
+}
+
+// Tracks the operand stack effect so the VM can size its stack up front.
+static void emit_op(Compiler* c, OpCode op, uint32_t a, int stack_effect, int line) {
+    emit_word(c, INSN(op, a), line);
+    c->depth += stack_effect;
+    if (c->depth > c->chunk->max_stack) c->chunk->max_stack = c->depth;
+}
+
+static int emit_jump(Compiler* c, OpCode op, int stack_effect, int line) {
+    emit_op(c, op, 0, stack_effect, line);
+    emit_word(c, 0, line);
+    return c->chunk->count - 1;
+}
+
+static void patch_jump(Compiler* c, int at) { c->chunk->code[at] = (uint32_t)c->chunk->count; }
+
+static void emit_loop(Compiler* c, OpCode op, int target, int stack_effect, int line) {
+    emit_op(c, op, 0, stack_effect, line);
+    emit_word(c, (uint32_t)target, line);
+}
+
+static void jump_list_add(JumpList* list, int at) {
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+        list->at = realloc(list->at, list->capacity * sizeof(int));
+    }
+    list->at[list->count++] = at;
+}
+
+// Points every jump in the list here and empties it.
+static void patch_jump_list(Compiler* c, JumpList* list) {
+    for (int i = 0; i < list->count; i++) patch_jump(c, list->at[i]);
+    free(list->at);
+    memset(list, 0, sizeof(JumpList));
+}
+
+static void begin_target(Compiler* c, BreakTarget* target, bool loop) {
+    memset(target, 0, sizeof(BreakTarget));
+    target->enclosing = c->targets;
+    target->loop = loop;
+    c->targets = target;
+}
+
+// Call where the construct's code ends: its breaks land here. A loop patches
+// its nexts itself, before its step or condition.
+static void end_target(Compiler* c, BreakTarget* target) {
+    patch_jump_list(c, &target->breaks);
+    c->targets = target->enclosing;
+}
+
+static uint32_t add_constant(Compiler* c, Value v) {
+    Chunk* chunk = c->chunk;
+    if (chunk->const_count >= chunk->const_capacity) {
+        chunk->const_capacity = chunk->const_capacity < 16 ? 16 : chunk->const_capacity * 2;
+        chunk->constants = realloc(chunk->constants, chunk->const_capacity * sizeof(Value));
+    }
+    chunk->constants[chunk->const_count] = v;
+    return (uint32_t)chunk->const_count++;
+}
+
+static void emit_constant(Compiler* c, Value v, int line) {
+    if (v.type == VAL_INT && v.as.int_val >= -(1 << 23) && v.as.int_val < (1 << 23)) {
+        emit_op(c, OP_PUSH_INT, (uint32_t)v.as.int_val & 0xFFFFFF, 1, line);
+    } else {
+        emit_op(c, OP_CONST, add_constant(c, v), 1, line);
+    }
+}
+
+static OpCode binary_opcode(TokenType op) {
+    switch (op) {
+        case PLUS: return OP_ADD;
+        case MINUS: return OP_SUB;
+        case STAR: return OP_MUL;
+        case SLASH: return OP_DIV;
+        case PERCENT: return OP_MOD;
+        case GREATER: return OP_GT;
+        case GREATER_EQUAL: return OP_GE;
+        case LESS: return OP_LT;
+        case LESS_EQUAL: return OP_LE;
+        case EQUAL_EQUAL: return OP_EQ;
+        case NOT_EQUAL: return OP_NE;
+        default: return OP_ADD;
+    }
+}
+
+// The _II or _DD form of a generic opcode, or OP_COUNT if there is none
+// (a double remainder keeps its left operand, which MOD already does).
+static OpCode specialized_opcode(OpCode op, bool doubles) {
+    switch (op) {
+        case OP_ADD: return doubles ? OP_ADD_DD : OP_ADD_II;
+        case OP_SUB: return doubles ? OP_SUB_DD : OP_SUB_II;
+        case OP_MUL: return doubles ? OP_MUL_DD : OP_MUL_II;
+        case OP_DIV: return doubles ? OP_DIV_DD : OP_DIV_II;
+        case OP_MOD: return doubles ? OP_COUNT : OP_MOD_II;
+        case OP_EQ: return doubles ? OP_EQ_DD : OP_EQ_II;
+        case OP_NE: return doubles ? OP_NE_DD : OP_NE_II;
+        case OP_LT: return doubles ? OP_LT_DD : OP_LT_II;
+        case OP_LE: return doubles ? OP_LE_DD : OP_LE_II;
+        case OP_GT: return doubles ? OP_GT_DD : OP_GT_II;
+        case OP_GE: return doubles ? OP_GE_DD : OP_GE_II;
+        default: return OP_COUNT;
+    }
+}
+
+// Emits `a op b` for the two values on top of the stack and returns the
+// result's type. An int meeting a double is widened first, as val_* would.
+static StaticType emit_binary(Compiler* c, TokenType op, StaticType a, StaticType b, const Expr* right, int line) {
+    OpCode generic = binary_opcode(op);
+    if (type_is_number(a) && type_is_number(b)) {
+        bool doubles = a == TYPE_DOUBLE || b == TYPE_DOUBLE;
+        OpCode code = specialized_opcode(generic, doubles);
+        if (code != OP_COUNT) {
+            if (a == TYPE_INT && doubles) emit_op(c, OP_I2D, 2, 0, line);
+            if (b == TYPE_INT && doubles) emit_op(c, OP_I2D, 1, 0, line);
+            generic = code;
+        }
+    }
+    emit_op(c, generic, 0, -1, line);
+    return binary_static_type(op, a, b, right);
+}
+
+static StaticType slot_type(const Compiler* c, int slot) {
+    return slot == NO_BINDING ? TYPE_INT : c->slot_types[slot];
+}
+
+static void emit_load(Compiler* c, int slot, int line) {
+    emit_op(c, type_is_scalar(slot_type(c, slot)) ? OP_LOAD_N : OP_LOAD, slot, 1, line);
+}
+
+static void emit_store(Compiler* c, int slot, int line) {
+    emit_op(c, type_is_scalar(slot_type(c, slot)) ? OP_STORE_N : OP_STORE, slot, -1, line);
+}
+
+static StaticType compile_expr(Compiler* c, Expr* expr);
+static void compile_stmt(Compiler* c, Stmt* stmt);
+
+// Returns the static type of the value left on the stack.
+static StaticType compile_expr(Compiler* c, Expr* expr) {
+    int line = expr->line;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            emit_constant(c, expr->as.literal, line);
+            return value_static_type(expr->as.literal);
+        case EXPR_VARIABLE: {
+            int slot = expr->as.variable.slot;
+            if (slot != NO_BINDING) emit_load(c, slot, line);
+            else emit_op(c, OP_PUSH_INT, 0, 1, line); // Default 0
+            return slot_type(c, slot);
+        }
+        case EXPR_UNARY: {
+            StaticType type = compile_expr(c, expr->as.unary.operand);
+            if (expr->as.unary.op == NOT) {
+                emit_op(c, OP_NOT, 0, 0, line);
+                return TYPE_BOOL;
+            }
+            emit_op(c, OP_NEG, 0, 0, line);
+            return type;
+        }
+        case EXPR_BINARY:
+        case EXPR_LOGICAL: {
+            ExprChain chain;
+            StaticType type = compile_expr(c, chain_collect(&chain, expr));
+            for (int i = chain.count - 1; i >= 0; i--) {
+                Expr* node = chain.nodes[i];
+                Expr* right = node->as.binary.right;
+                if (node->kind == EXPR_BINARY) {
+                    type = emit_binary(c, node->as.binary.op, type, compile_expr(c, right), right, node->line);
+                    continue;
+                }
+                int end = emit_jump(c, node->as.binary.op == OR_OR ? OP_OR_JUMP : OP_AND_JUMP, -1, node->line);
+                compile_expr(c, right);
+                emit_op(c, OP_TO_BOOL, 0, 0, node->line);
+                patch_jump(c, end);
+                type = TYPE_BOOL;
+            }
+            chain_free(&chain);
+            return type;
+        }
+        case EXPR_INCDEC: {
+            int slot = expr->as.incdec.slot;
+            TokenType op = expr->as.incdec.op == PLUS_PLUS ? PLUS : MINUS;
+            StaticType old = compile_expr(c, expr->as.incdec.operand);
+            StaticType updated = old;
+            if (slot == NO_BINDING) {
+                if (expr->as.incdec.prefix) {
+                    emit_op(c, OP_PUSH_INT, 1, 1, line);
+                    updated = emit_binary(c, op, old, TYPE_INT, NULL, line);
+                }
+            } else if (expr->as.incdec.prefix) {
+                emit_op(c, OP_PUSH_INT, 1, 1, line);
+                updated = emit_binary(c, op, old, TYPE_INT, NULL, line);
+                emit_op(c, OP_DUP, 0, 1, line);
+                emit_store(c, slot, line);
+            } else {
+                emit_op(c, OP_DUP, 0, 1, line);
+                emit_op(c, OP_PUSH_INT, 1, 1, line);
+                emit_binary(c, op, old, TYPE_INT, NULL, line);
+                emit_store(c, slot, line);
+            }
+            return expr->as.incdec.prefix ? updated : old;
+        }
+    }
+    return TYPE_ANY;
+}
+
+static void compile_list(Compiler* c, Stmt* stmt) {
+    for (; stmt; stmt = stmt->next) compile_stmt(c, stmt);
+}
+
+// Slot of `x++`, `++x`, `x--` or `--x` on a bound variable, else NO_BINDING
+static int incdec_local(const Expr* expr) {
+    if (expr->kind != EXPR_INCDEC || expr->as.incdec.slot == NO_BINDING) return NO_BINDING;
+    const Expr* operand = expr->as.incdec.operand;
+    if (operand->kind != EXPR_VARIABLE || operand->as.variable.slot != expr->as.incdec.slot) return NO_BINDING;
+    return expr->as.incdec.slot;
+}
+
+static void emit_inc_local(Compiler* c, int slot, int32_t delta, int line) {
+    emit_op(c, OP_INC_LOCAL, slot, 0, line);
+    emit_word(c, (uint32_t)delta, line);
+}
+
+static void compile_discard(Compiler* c, Expr* expr) {
+    if (!expr) return;
+    int slot = incdec_local(expr);
+    if (slot != NO_BINDING) {
+        emit_inc_local(c, slot, expr->as.incdec.op == PLUS_PLUS ? 1 : -1, expr->line);
+        return;
+    }
+    compile_expr(c, expr);
+    emit_op(c, OP_POP, 0, -1, expr->line);
+}
+
+static OpCode compare_jump_opcode(TokenType op) {
+    switch (op) {
+        case EQUAL_EQUAL: return OP_EQ_JMP;
+        case NOT_EQUAL: return OP_NE_JMP;
+        case LESS: return OP_LT_JMP;
+        case LESS_EQUAL: return OP_LE_JMP;
+        case GREATER: return OP_GT_JMP;
+        case GREATER_EQUAL: return OP_GE_JMP;
+        default: return OP_COUNT;
+    }
+}
+
+// Emits a jump taken when `condition` is false and returns it for patch_jump.
+// A comparison branches directly instead of pushing a bool first.
+static int compile_jump_if_false(Compiler* c, Expr* condition, int line) {
+    if (condition->kind == EXPR_BINARY) {
+        OpCode jump = compare_jump_opcode(condition->as.binary.op);
+        if (jump != OP_COUNT) {
+            compile_expr(c, condition->as.binary.left);
+            compile_expr(c, condition->as.binary.right);
+            return emit_jump(c, jump, -2, line);
+        }
+    }
+    compile_expr(c, condition);
+    return emit_jump(c, OP_JUMP_IF_FALSE, -1, line);
+}
+
+// `for (...; i < n; i++)` with i and n statically ints, n a literal or a
+// variable, compiles to FOR_RANGE before the body and FOR_STEP after it.
+// Both reread n, so the body may still change it or i.
+static bool counted_loop(const Compiler* c, const Stmt* stmt, int* slot, const Expr** limit) {
+    const Expr* condition = stmt->as.for_stmt.condition;
+    const Expr* increment = stmt->as.for_stmt.increment;
+    if (!condition || !increment || condition->kind != EXPR_BINARY || condition->as.binary.op != LESS) return false;
+    const Expr* left = condition->as.binary.left;
+    const Expr* right = condition->as.binary.right;
+    if (left->kind != EXPR_VARIABLE || left->as.variable.slot == NO_BINDING) return false;
+    int index = left->as.variable.slot;
+    if (slot_type(c, index) != TYPE_INT) return false;
+    if (incdec_local(increment) != index || increment->as.incdec.op != PLUS_PLUS) return false;
+    if (right->kind == EXPR_LITERAL) {
+        if (right->as.literal.type != VAL_INT) return false;
+    } else if (right->kind != EXPR_VARIABLE || right->as.variable.slot == NO_BINDING ||
+               slot_type(c, right->as.variable.slot) != TYPE_INT) {
+        return false;
+    }
+    *slot = index;
+    *limit = right;
+    return true;
+}
+
+static void emit_for_range(Compiler* c, bool step, int slot, const Expr* limit, uint32_t target, int line) {
+    if (limit->kind == EXPR_LITERAL) {
+        emit_op(c, step ? OP_FOR_STEP_I : OP_FOR_RANGE_I, slot, 0, line);
+        emit_word(c, (uint32_t)limit->as.literal.as.int_val, line);
+    } else {
+        emit_op(c, step ? OP_FOR_STEP : OP_FOR_RANGE, slot, 0, line);
+        emit_word(c, (uint32_t)limit->as.variable.slot, line);
+    }
+    emit_word(c, target, line);
+}
+
+static void compile_stmt(Compiler* c, Stmt* stmt);
+
+static uint32_t add_switch(Compiler* c, SwitchTable* table) {
+    Chunk* chunk = c->chunk;
+    if (chunk->switch_count >= chunk->switch_capacity) {
+        chunk->switch_capacity = chunk->switch_capacity < 4 ? 4 : chunk->switch_capacity * 2;
+        chunk->switches = realloc(chunk->switches, chunk->switch_capacity * sizeof(SwitchTable*));
+    }
+    chunk->switches[chunk->switch_count] = table;
+    return (uint32_t)chunk->switch_count++;
+}
+
+// Literal keys dispatch through one SWITCH_TABLE. Any other switch tests its
+// cases in order against the subject, left on the stack meanwhile: each match
+// jumps to a pad that pops it and goes on to the clause.
+static void compile_switch(Compiler* c, Stmt* stmt) {
+    int line = stmt->line;
+    int clause_count = 0;
+    for (const SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next) clause_count++;
+    int* entries = malloc((clause_count + 1) * sizeof(int)); // Per clause: a jump to patch, or its offset
+    compile_expr(c, stmt->as.switch_stmt.subject);
+
+    SwitchTable* table = switch_table_build(stmt, &c->chunk->arena);
+    int fallback_jump = -1;
+    if (table) {
+        emit_op(c, OP_SWITCH_TABLE, add_switch(c, table), -1, line);
+    } else {
+        int index = 0;
+        for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next, index++) {
+            entries[index] = -1;
+            if (!clause->value) continue;
+            emit_op(c, OP_DUP, 0, 1, line);
+            compile_expr(c, clause->value);
+            entries[index] = emit_jump(c, OP_NE_JMP, -2, line);
+        }
+        emit_op(c, OP_POP, 0, -1, line);
+        fallback_jump = emit_jump(c, OP_JUMP, 0, line);
+        for (index = 0; index < clause_count; index++) {
+            if (entries[index] < 0) continue;
+            patch_jump(c, entries[index]);
+            c->depth++; // Matched with the subject still pushed
+            emit_op(c, OP_POP, 0, -1, line);
+            entries[index] = emit_jump(c, OP_JUMP, 0, line);
+        }
+    }
+
+    BreakTarget target;
+    begin_target(c, &target, false);
+    int index = 0, fallback = -1;
+    for (SwitchCase* clause = stmt->as.switch_stmt.cases; clause; clause = clause->next, index++) {
+        if (!clause->value && fallback < 0) fallback = c->chunk->count;
+        if (table) entries[index] = c->chunk->count;
+        else if (entries[index] >= 0) patch_jump(c, entries[index]);
+        compile_list(c, clause->body);
+    }
+    end_target(c, &target);
+    if (fallback < 0) fallback = c->chunk->count;
+
+    if (table) {
+        uint32_t count = table->span ? table->span : table->count;
+        for (uint32_t i = 0; i < count; i++) {
+            if (table->targets[i] != SWITCH_NO_TARGET) table->targets[i] = (uint32_t)entries[table->targets[i]];
+        }
+        table->fallback = (uint32_t)fallback;
+    } else {
+        c->chunk->code[fallback_jump] = (uint32_t)fallback;
+    }
+    free(entries);
+}
+
+static void compile_stmt(Compiler* c, Stmt* stmt) {
+    int line = stmt->line;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION:
+            compile_discard(c, stmt->as.expression.expr);
+            break;
+        case STMT_DECLARATION: {
+            if (stmt->as.declaration.init) compile_expr(c, stmt->as.declaration.init);
+            else emit_op(c, OP_PUSH_INT, 0, 1, line);
+            emit_store(c, stmt->as.declaration.slot, line);
+            break;
+        }
+        case STMT_ASSIGNMENT: {
+            int slot = stmt->as.assignment.slot;
+            TokenType op = stmt->as.assignment.op;
+            if (slot == NO_BINDING) {
+                compile_discard(c, stmt->as.assignment.value);
+                break;
+            }
+            // A slot that may hold a string keeps ADD_LOCAL's in-place append
+            if (op == PLUS_EQUAL && !type_is_number(slot_type(c, slot))) {
+                compile_expr(c, stmt->as.assignment.value);
+                emit_op(c, OP_ADD_LOCAL, slot, -1, line);
+                break;
+            }
+            const Expr* value = stmt->as.assignment.value;
+            if ((op == PLUS_EQUAL || op == MINUS_EQUAL) && type_is_number(slot_type(c, slot)) &&
+                value->kind == EXPR_LITERAL && value->as.literal.type == VAL_INT &&
+                value->as.literal.as.int_val > -(1 << 23) && value->as.literal.as.int_val < (1 << 23)) {
+                int32_t delta = value->as.literal.as.int_val;
+                emit_inc_local(c, slot, op == PLUS_EQUAL ? delta : -delta, line);
+                break;
+            }
+            if (op == EQUAL) {
+                compile_expr(c, stmt->as.assignment.value);
+            } else {
+                emit_load(c, slot, line);
+                StaticType value = compile_expr(c, stmt->as.assignment.value);
+                TokenType binary = PLUS;
+                if (op == MINUS_EQUAL) binary = MINUS;
+                else if (op == STAR_EQUAL) binary = STAR;
+                else if (op == SLASH_EQUAL) binary = SLASH;
+                else if (op == PERCENT_EQUAL) binary = PERCENT;
+                emit_binary(c, binary, slot_type(c, slot), value, stmt->as.assignment.value, line);
+            }
+            emit_store(c, slot, line);
+            break;
+        }
+        case STMT_INPUT: {
+            int slot = stmt->as.input.slot;
+            emit_op(c, OP_INPUT, stmt->as.input.name, 0, line);
+            emit_word(c, slot != NO_BINDING ? (uint32_t)slot : NO_SLOT, line);
+            emit_word(c, stmt->as.input.type, line);
+            break;
+        }
+        case STMT_OUTPUT:
+            compile_expr(c, stmt->as.output.value);
+            emit_op(c, OP_PRINT, 0, -1, line);
+            break;
+        case STMT_IF: {
+            int else_jump = compile_jump_if_false(c, stmt->as.if_stmt.condition, line);
+            if (stmt->as.if_stmt.then_branch) compile_stmt(c, stmt->as.if_stmt.then_branch);
+            if (stmt->as.if_stmt.else_branch) {
+                int end_jump = emit_jump(c, OP_JUMP, 0, line);
+                patch_jump(c, else_jump);
+                compile_stmt(c, stmt->as.if_stmt.else_branch);
+                patch_jump(c, end_jump);
+            } else {
+                patch_jump(c, else_jump);
+            }
+            break;
+        }
+        case STMT_WHILE: {
+            // A next jumps forward to the one back edge, so the JIT sees a
+            // single loop rather than one per next
+            BreakTarget loop;
+            begin_target(c, &loop, true);
+            int top = c->chunk->count;
+            int exit_jump = compile_jump_if_false(c, stmt->as.while_stmt.condition, line);
+            if (stmt->as.while_stmt.body) compile_stmt(c, stmt->as.while_stmt.body);
+            patch_jump_list(c, &loop.nexts);
+            emit_loop(c, OP_JUMP, top, 0, line);
+            patch_jump(c, exit_jump);
+            end_target(c, &loop);
+            break;
+        }
+        case STMT_FOR: {
+            if (stmt->as.for_stmt.init) compile_stmt(c, stmt->as.for_stmt.init);
+            BreakTarget loop;
+            begin_target(c, &loop, true);
+            int slot;
+            const Expr* limit;
+            if (counted_loop(c, stmt, &slot, &limit)) {
+                emit_for_range(c, false, slot, limit, 0, line);
+                int exit_jump = c->chunk->count - 1;
+                int body = c->chunk->count;
+                if (stmt->as.for_stmt.body) compile_stmt(c, stmt->as.for_stmt.body);
+                patch_jump_list(c, &loop.nexts);
+                emit_for_range(c, true, slot, limit, (uint32_t)body, line);
+                patch_jump(c, exit_jump);
+                end_target(c, &loop);
+                break;
+            }
+            int top = c->chunk->count;
+            int exit_jump = -1;
+            if (stmt->as.for_stmt.condition) {
+                exit_jump = compile_jump_if_false(c, stmt->as.for_stmt.condition, line);
+            }
+            if (stmt->as.for_stmt.body) compile_stmt(c, stmt->as.for_stmt.body);
+            patch_jump_list(c, &loop.nexts);
+            compile_discard(c, stmt->as.for_stmt.increment);
+            emit_loop(c, OP_JUMP, top, 0, line);
+            if (exit_jump >= 0) patch_jump(c, exit_jump);
+            end_target(c, &loop);
+            break;
+        }
+        case STMT_FOREACH:
+            // No collection values exist yet, so the body never runs.
+            compile_discard(c, stmt->as.foreach_stmt.collection);
+            break;
+        case STMT_DO_WHILE: {
+            BreakTarget loop;
+            begin_target(c, &loop, true);
+            int top = c->chunk->count;
+            compile_list(c, stmt->as.do_while.body);
+            patch_jump_list(c, &loop.nexts);
+            compile_expr(c, stmt->as.do_while.condition);
+            emit_loop(c, OP_JUMP_IF_TRUE, top, -1, line);
+            end_target(c, &loop);
+            break;
+        }
+        case STMT_SWITCH:
+            compile_switch(c, stmt);
+            break;
+        case STMT_BLOCK:
+            compile_list(c, stmt->as.block.body);
+            break;
+        case STMT_RETURN:
+            compile_discard(c, stmt->as.return_stmt.value);
+            break;
+        case STMT_BREAK:
+            // Outside any loop or switch, as in the evaluator, it does nothing
+            if (c->targets) jump_list_add(&c->targets->breaks, emit_jump(c, OP_JUMP, 0, line));
+            break;
+        case STMT_NEXT: {
+            BreakTarget* loop = c->targets;
+            while (loop && !loop->loop) loop = loop->enclosing;
+            if (loop) jump_list_add(&loop->nexts, emit_jump(c, OP_JUMP, 0, line));
+            break;
+        }
+    }
+}
+
+static void compile_program(Program* program, Chunk* chunk) {
+    Compiler c;
+    memset(chunk, 0, sizeof(Chunk));
+    chunk->slot_count = program->slot_count;
+    chunk->names = program->names;
+    c.chunk = chunk;
+    c.depth = 0;
+    c.targets = NULL;
+    StaticType* slot_types = infer_slot_types(program);
+    c.slot_types = slot_types;
+    compile_list(&c, program->body);
+    emit_op(&c, OP_HALT, 0, 0, 0);
+    free(slot_types);
+}
+
+static void chunk_free(Chunk* chunk) {
+    free(chunk->code);
+    free(chunk->lines);
+    free(chunk->constants);
+    free(chunk->switches);
+    arena_free(&chunk->arena);
+    memset(chunk, 0, sizeof(Chunk));
+}
+
+/* ============================================================================
+ * BASELINE JIT
+ * ============================================================================
+ * --jit compiles hot loops to x86-64 machine code, one template per opcode.
+ * The VM counts the backward jumps taken to each loop header; at
+ * JIT_THRESHOLD the code from the header to that jump is compiled, and from
+ * then on back edges to the header run native code instead of dispatching.
+ *
+ * Native code works on the VM's own slots and operand stack, Value for Value,
+ * so it can hand control back at any instruction boundary by returning the
+ * bytecode offset to resume at. Jumps out of the loop do that, and so do
+ * opcodes without a template (PRINT, INPUT, anything touching strings).
+ * Opcodes the typing pass left generic get inline type guards: a failed
+ * guard deoptimizes to the interpreter at that instruction, and a loop that
+ * deoptimizes JIT_DEOPT_LIMIT times is left to the interpreter for good.
+ *
+ * Code is written into read-write pages that are made read-execute before
+ * they run; no page is ever both. If that mapping fails, or on other
+ * architectures and ABIs, --jit says so and the interpreter runs alone.
+ */
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64 1
+#else
+#define JIT_X86_64 0
+#endif
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000       // Back edges before a loop compiles; -DJIT_THRESHOLD=1 for testing
+#endif
+#define JIT_DEOPT_LIMIT 100
+#define JIT_DEOPT 0x80000000u    // Set in a returned offset when a guard failed
+
+// A compiled loop. Runs on slots and *sp, returns the offset to resume at.
+typedef uint32_t (*JitLoop)(Value* slots, Value** sp, const Value* constants);
+
+typedef struct {
+    JitLoop loop;        // NULL until compiled
+    void* memory;
+    size_t size;
+    uint32_t start;      // The loop header's offset, the map's key
+    uint32_t back_edges;
+    uint32_t deopts;
+    bool used;           // Holds a loop; the rest of the entry is zero until then
+    bool rejected;       // Failed to compile or deoptimized too often
+} JitHeader;
+
+// Loop headers by offset, open-addressed. An entry is made the first time a
+// back edge reaches its header, so code that never loops costs nothing.
+#define JIT_MAP_INITIAL 16
+
+typedef struct {
+    JitHeader* headers;
+    uint32_t capacity;   // A power of two
+    uint32_t count;
+} Jit;
+
+#if JIT_X86_64
+
+// --- x86-64 emitter ---
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, R12 = 12, R13 = 13, R14 = 14 };
+enum { XMM0 = 0, XMM1 = 1 };
+enum { CC_P = 0xA, CC_NP = 0xB, CC_E = 0x4, CC_NE = 0x5, CC_AE = 0x3, CC_A = 0x7,
+       CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+#define TYPE_AT ((int32_t)offsetof(Value, type))
+#define PAYLOAD_AT ((int32_t)offsetof(Value, as))
+#define STACK_AT(i) (-(int32_t)(i) * VALUE_SIZE)   // r12-relative; 1 is the top
+#define SLOT_AT(slot) ((int32_t)(slot) * VALUE_SIZE) // rbx-relative
+
+typedef enum {
+    FIXUP_BRANCH,        // Native code if the target is in the loop, else leave
+    FIXUP_EXIT,          // Leave: the interpreter runs the target instruction
+    FIXUP_GUARD          // Leave flagged JIT_DEOPT: a type guard failed
+} FixupKind;
+
+typedef struct {
+    size_t at;           // Position of the rel32
+    uint32_t target;     // Bytecode offset
+    FixupKind kind;
+} JitFixup;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+    int32_t* native;     // Per code word in the loop: native offset, or -1
+    uint32_t start, end; // The loop's bytecode range
+    JitFixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+} JitCompiler;
+
+static void x86_byte(JitCompiler* j, uint8_t byte) {
+    if (j->length >= j->capacity) {
+        j->capacity = j->capacity < 4096 ? 4096 : j->capacity * 2;
+        j->bytes = realloc(j->bytes, j->capacity);
+    }
+    j->bytes[j->length++] = byte;
+}
+
+static void x86_bytes(JitCompiler* j, const char* bytes, int count) {
+    for (int i = 0; i < count; i++) x86_byte(j, (uint8_t)bytes[i]);
+}
+
+static void x86_u32(JitCompiler* j, uint32_t value) {
+    for (int i = 0; i < 4; i++) x86_byte(j, (uint8_t)(value >> (8 * i)));
+}
+
+// [prefix] [REX] opcode ModRM [SIB] disp32, for `op reg, [base + disp]`.
+// The opcode is one to three bytes, most significant first.
+static void x86_mem(JitCompiler* j, uint8_t prefix, bool wide, uint32_t opcode, int reg, int base, int32_t disp) {
+    if (prefix) x86_byte(j, prefix);
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40) x86_byte(j, rex);
+    if (opcode > 0xFFFF) x86_byte(j, (uint8_t)(opcode >> 16));
+    if (opcode > 0xFF) x86_byte(j, (uint8_t)(opcode >> 8));
+    x86_byte(j, (uint8_t)opcode);
+    x86_byte(j, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == 4) x86_byte(j, 0x24);
+    x86_u32(j, (uint32_t)disp);
+}
+
+// Values are only ever written as two whole qwords (tag, payload): a later
+// qword or 16-byte load of a half written 4 bytes at a time could not be
+// forwarded from the store buffer and would stall. An int result in eax is
+// stored as rax, which 32-bit operations zero-extend.
+static void x86_load32(JitCompiler* j, int reg, int base, int32_t disp) { x86_mem(j, 0, false, 0x8B, reg, base, disp); }
+static void x86_load64(JitCompiler* j, int reg, int base, int32_t disp) { x86_mem(j, 0, true, 0x8B, reg, base, disp); }
+static void x86_store64(JitCompiler* j, int reg, int base, int32_t disp) { x86_mem(j, 0, true, 0x89, reg, base, disp); }
+
+static void x86_store_imm64(JitCompiler* j, int base, int32_t disp, uint32_t imm) {
+    x86_mem(j, 0, true, 0xC7, 0, base, disp);   // Sign-extended imm32
+    x86_u32(j, imm);
+}
+
+// 81 /7 id: cmp a dword in memory with an immediate
+static void x86_cmp_imm32(JitCompiler* j, int base, int32_t disp, uint32_t imm) {
+    x86_mem(j, 0, false, 0x81, 7, base, disp);
+    x86_u32(j, imm);
+}
+
+static void x86_copy_value(JitCompiler* j, int from, int32_t from_disp, int to, int32_t to_disp) {
+    x86_load64(j, RAX, from, from_disp);
+    x86_load64(j, RDX, from, from_disp + 8);
+    x86_store64(j, RAX, to, to_disp);
+    x86_store64(j, RDX, to, to_disp + 8);
+}
+
+static void x86_adjust_sp(JitCompiler* j, int values) {
+    x86_bytes(j, "\x49\x81\xC4", 3);   // add r12, imm32
+    x86_u32(j, (uint32_t)(values * VALUE_SIZE));
+}
+
+// Emits a jcc (or jmp when cc < 0) with an unpatched rel32; returns its position
+static size_t x86_jump(JitCompiler* j, int cc) {
+    if (cc < 0) x86_byte(j, 0xE9);
+    else { x86_byte(j, 0x0F); x86_byte(j, (uint8_t)(0x80 | cc)); }
+    x86_u32(j, 0);
+    return j->length - 4;
+}
+
+static void x86_patch(JitCompiler* j, size_t at, size_t target) {
+    uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(at + 4));
+    memcpy(j->bytes + at, &rel, 4);
+}
+
+static void x86_patch_here(JitCompiler* j, size_t at) { x86_patch(j, at, j->length); }
+
+static void jit_fixup(JitCompiler* j, size_t at, uint32_t target, FixupKind kind) {
+    if (j->fixup_count >= j->fixup_capacity) {
+        j->fixup_capacity = j->fixup_capacity < 32 ? 32 : j->fixup_capacity * 2;
+        j->fixups = realloc(j->fixups, j->fixup_capacity * sizeof(JitFixup));
+    }
+    j->fixups[j->fixup_count++] = (JitFixup){ at, target, kind };
+}
+
+// Jump to bytecode offset `target`: native code inside the loop, else an exit
+static void jit_branch(JitCompiler* j, int cc, uint32_t target) { jit_fixup(j, x86_jump(j, cc), target, FIXUP_BRANCH); }
+
+// Hand the instruction at `at` to the interpreter
+static void jit_exit(JitCompiler* j, uint32_t at) { jit_fixup(j, x86_jump(j, -1), at, FIXUP_EXIT); }
+
+// Deoptimize at `at` when cc holds
+static void jit_deopt_if(JitCompiler* j, int cc, uint32_t at) { jit_fixup(j, x86_jump(j, cc), at, FIXUP_GUARD); }
+
+static void jit_guard_type(JitCompiler* j, int base, int32_t disp, ValueType type, uint32_t at) {
+    x86_cmp_imm32(j, base, disp + TYPE_AT, type);
+    jit_deopt_if(j, CC_NE, at);
+}
+
+static void jit_guard_not_string(JitCompiler* j, int base, int32_t disp, uint32_t at) {
+    x86_cmp_imm32(j, base, disp + TYPE_AT, VAL_STRING);
+    jit_deopt_if(j, CC_E, at);
+}
+
+// eax = truthiness of the value at [base + disp], for bools and ints
+static void jit_truthy(JitCompiler* j, int base, int32_t disp, uint32_t at) {
+    x86_cmp_imm32(j, base, disp + TYPE_AT, VAL_BOOL);
+    size_t not_bool = x86_jump(j, CC_NE);
+    x86_mem(j, 0, false, 0x0FB6, RAX, base, disp + PAYLOAD_AT);   // movzx eax, byte
+    size_t done = x86_jump(j, -1);
+    x86_patch_here(j, not_bool);
+    jit_guard_type(j, base, disp, VAL_INT, at);
+    x86_load32(j, RAX, base, disp + PAYLOAD_AT);
+    x86_patch_here(j, done);
+}
+
+typedef enum { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE } JitCompare;
+
+// al = a <cmp> b for the two ints under the top of the stack
+static void jit_compare_ints(JitCompiler* j, JitCompare cmp) {
+    static const uint8_t CC[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+    x86_load32(j, RAX, R12, STACK_AT(2) + PAYLOAD_AT);
+    x86_mem(j, 0, false, 0x3B, RAX, R12, STACK_AT(1) + PAYLOAD_AT);  // cmp eax, b
+    x86_byte(j, 0x0F); x86_byte(j, (uint8_t)(0x90 | CC[cmp])); x86_byte(j, 0xC0);  // setcc al
+}
+
+// Same for two doubles. Every comparison with a NaN is false except !=.
+static void jit_compare_doubles(JitCompiler* j, JitCompare cmp) {
+    // ucomisd sets "above" only for ordered operands, so < and <= swap sides
+    bool swap = cmp == CMP_LT || cmp == CMP_LE;
+    x86_mem(j, 0xF2, false, 0x0F10, XMM0, R12, STACK_AT(swap ? 1 : 2) + PAYLOAD_AT);   // movsd
+    x86_mem(j, 0x66, false, 0x0F2E, XMM0, R12, STACK_AT(swap ? 2 : 1) + PAYLOAD_AT);   // ucomisd
+    switch (cmp) {
+        case CMP_EQ: x86_bytes(j, "\x0F\x94\xC0\x0F\x9B\xC1\x20\xC8", 8); break;  // sete al; setnp cl; and al, cl
+        case CMP_NE: x86_bytes(j, "\x0F\x95\xC0\x0F\x9A\xC1\x08\xC8", 8); break;  // setne al; setp cl; or al, cl
+        case CMP_LT: case CMP_GT: x86_bytes(j, "\x0F\x97\xC0", 3); break;         // seta al
+        case CMP_LE: case CMP_GE: x86_bytes(j, "\x0F\x93\xC0", 3); break;         // setae al
+    }
+}
+
+// al = a <cmp> b when both are ints or both doubles; anything else deoptimizes
+static void jit_compare_guarded(JitCompiler* j, JitCompare cmp, uint32_t at) {
+    x86_cmp_imm32(j, R12, STACK_AT(2) + TYPE_AT, VAL_INT);
+    size_t not_int = x86_jump(j, CC_NE);
+    jit_guard_type(j, R12, STACK_AT(1), VAL_INT, at);
+    jit_compare_ints(j, cmp);
+    size_t done = x86_jump(j, -1);
+    x86_patch_here(j, not_int);
+    jit_guard_type(j, R12, STACK_AT(2), VAL_DOUBLE, at);
+    jit_guard_type(j, R12, STACK_AT(1), VAL_DOUBLE, at);
+    jit_compare_doubles(j, cmp);
+    x86_patch_here(j, done);
+}
+
+static void jit_store_bool(JitCompiler* j) {
+    x86_bytes(j, "\x0F\xB6\xC0", 3);                                          // movzx eax, al
+    x86_store64(j, RAX, R12, STACK_AT(2) + PAYLOAD_AT);
+    x86_store_imm64(j, R12, STACK_AT(2) + TYPE_AT, VAL_BOOL);
+    x86_adjust_sp(j, -1);
+}
+
+// a = a op b on the two ints under the top; the caller pops b
+static void jit_int_arith(JitCompiler* j, OpCode op) {
+    int32_t a = STACK_AT(2) + PAYLOAD_AT, b = STACK_AT(1) + PAYLOAD_AT;
+    x86_load32(j, RAX, R12, a);
+    switch (op) {
+        case OP_ADD: x86_mem(j, 0, false, 0x03, RAX, R12, b); break;
+        case OP_SUB: x86_mem(j, 0, false, 0x2B, RAX, R12, b); break;
+        case OP_MUL: x86_mem(j, 0, false, 0x0FAF, RAX, R12, b); break;
+        default: {
+            // val_div and val_mod give 0 for a zero divisor; -1 is done by hand
+            // because idiv traps on INT_MIN / -1
+            x86_load32(j, RCX, R12, b);
+            x86_bytes(j, "\x85\xC9", 2);                         // test ecx, ecx
+            size_t zero = x86_jump(j, CC_E);
+            x86_bytes(j, "\x83\xF9\xFF", 3);                     // cmp ecx, -1
+            size_t minus_one = x86_jump(j, CC_E);
+            x86_bytes(j, "\x99\xF7\xF9", 3);                     // cdq; idiv ecx
+            if (op == OP_MOD) x86_bytes(j, "\x89\xD0", 2);        // mov eax, edx
+            size_t done = x86_jump(j, -1);
+            x86_patch_here(j, minus_one);
+            size_t negated = 0;
+            if (op == OP_DIV) {
+                x86_bytes(j, "\xF7\xD8", 2);                     // neg eax
+                negated = x86_jump(j, -1);
+            }
+            x86_patch_here(j, zero);
+            x86_bytes(j, "\x31\xC0", 2);                         // xor eax, eax: x % -1 is 0 too
+            x86_patch_here(j, done);
+            if (negated) x86_patch_here(j, negated);
+            break;
+        }
+    }
+    x86_store64(j, RAX, R12, a);
+}
+
+// Same for two doubles; MOD leaves a, as val_mod does
+static void jit_double_arith(JitCompiler* j, OpCode op) {
+    int32_t a = STACK_AT(2) + PAYLOAD_AT, b = STACK_AT(1) + PAYLOAD_AT;
+    static const uint32_t SSE[] = { [OP_ADD] = 0x0F58, [OP_SUB] = 0x0F5C, [OP_MUL] = 0x0F59, [OP_DIV] = 0x0F5E };
+    if (op == OP_MOD) return;
+    size_t zero_checked = 0, done = 0;
+    if (op == OP_DIV) {
+        // b == 0 gives int 0; a NaN divisor does not compare equal
+        x86_bytes(j, "\x66\x0F\x57\xC9", 4);                     // xorpd xmm1, xmm1
+        x86_mem(j, 0x66, false, 0x0F2E, XMM1, R12, b);             // ucomisd xmm1, b
+        size_t unordered = x86_jump(j, CC_P);
+        zero_checked = x86_jump(j, CC_NE);
+        x86_store_imm64(j, R12, STACK_AT(2) + TYPE_AT, VAL_INT);
+        x86_store_imm64(j, R12, a, 0);
+        done = x86_jump(j, -1);
+        x86_patch_here(j, unordered);
+    }
+    if (zero_checked) x86_patch_here(j, zero_checked);
+    x86_mem(j, 0xF2, false, 0x0F10, XMM0, R12, a);                 // movsd xmm0, a
+    x86_mem(j, 0xF2, false, SSE[op], XMM0, R12, b);                // op xmm0, b
+    x86_mem(j, 0xF2, false, 0x0F11, XMM0, R12, a);                 // movsd a, xmm0
+    if (done) x86_patch_here(j, done);
+}
+
+// Generic arithmetic: ints and doubles inline, mixed or other types deoptimize
+static void jit_arith_guarded(JitCompiler* j, OpCode op, uint32_t at) {
+    x86_cmp_imm32(j, R12, STACK_AT(2) + TYPE_AT, VAL_INT);
+    size_t not_int = x86_jump(j, CC_NE);
+    jit_guard_type(j, R12, STACK_AT(1), VAL_INT, at);
+    jit_int_arith(j, op);
+    size_t done = x86_jump(j, -1);
+    x86_patch_here(j, not_int);
+    jit_guard_type(j, R12, STACK_AT(2), VAL_DOUBLE, at);
+    jit_guard_type(j, R12, STACK_AT(1), VAL_DOUBLE, at);
+    jit_double_arith(j, op);
+    x86_patch_here(j, done);
+    x86_adjust_sp(j, -1);
+}
+
+static JitCompare compare_kind(OpCode op) {
+    switch (op) {
+        case OP_EQ: case OP_EQ_II: case OP_EQ_DD: case OP_EQ_JMP: return CMP_EQ;
+        case OP_NE: case OP_NE_II: case OP_NE_DD: case OP_NE_JMP: return CMP_NE;
+        case OP_LT: case OP_LT_II: case OP_LT_DD: case OP_LT_JMP: return CMP_LT;
+        case OP_LE: case OP_LE_II: case OP_LE_DD: case OP_LE_JMP: return CMP_LE;
+        case OP_GT: case OP_GT_II: case OP_GT_DD: case OP_GT_JMP: return CMP_GT;
+        default: return CMP_GE;
+    }
+}
+
+// One bytecode instruction. Anything without a template leaves for the
+// interpreter right there.
+static void jit_instruction(JitCompiler* j, const Chunk* chunk, uint32_t at) {
+    const uint32_t* word = chunk->code + at;
+    OpCode op = (OpCode)INSN_OP(*word);
+    uint32_t a = INSN_A(*word);
+    switch (op) {
+        case OP_PUSH_INT:
+            x86_store_imm64(j, R12, TYPE_AT, VAL_INT);
+            x86_store_imm64(j, R12, PAYLOAD_AT, (uint32_t)INSN_SA(*word));
+            x86_adjust_sp(j, 1);
+            break;
+        case OP_CONST:
+            if (chunk->constants[a].type == VAL_STRING) { jit_exit(j, at); break; }
+            x86_copy_value(j, R13, (int32_t)a * VALUE_SIZE, R12, 0);
+            x86_adjust_sp(j, 1);
+            break;
+        case OP_LOAD:
+            jit_guard_not_string(j, RBX, SLOT_AT(a), at);
+            // fall through
+        case OP_LOAD_N:
+            x86_copy_value(j, RBX, SLOT_AT(a), R12, 0);
+            x86_adjust_sp(j, 1);
+            break;
+        case OP_STORE:
+            jit_guard_not_string(j, RBX, SLOT_AT(a), at);
+            jit_guard_not_string(j, R12, STACK_AT(1), at);
+            // fall through
+        case OP_STORE_N:
+            x86_copy_value(j, R12, STACK_AT(1), RBX, SLOT_AT(a));
+            x86_adjust_sp(j, -1);
+            break;
+        case OP_POP:
+            jit_guard_not_string(j, R12, STACK_AT(1), at);
+            x86_adjust_sp(j, -1);
+            break;
+        case OP_DUP:
+            jit_guard_not_string(j, R12, STACK_AT(1), at);
+            x86_copy_value(j, R12, STACK_AT(1), R12, 0);
+            x86_adjust_sp(j, 1);
+            break;
+        case OP_I2D:
+            x86_mem(j, 0xF2, false, 0x0F2A, XMM0, R12, STACK_AT(a) + PAYLOAD_AT);   // cvtsi2sd
+            x86_mem(j, 0xF2, false, 0x0F11, XMM0, R12, STACK_AT(a) + PAYLOAD_AT);
+            x86_store_imm64(j, R12, STACK_AT(a) + TYPE_AT, VAL_DOUBLE);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            jit_arith_guarded(j, op, at);
+            break;
+        case OP_ADD_II: case OP_SUB_II: case OP_MUL_II: case OP_DIV_II: case OP_MOD_II:
+            jit_int_arith(j, (OpCode)(OP_ADD + (op - OP_ADD_II)));
+            x86_adjust_sp(j, -1);
+            break;
+        case OP_ADD_DD: case OP_SUB_DD: case OP_MUL_DD: case OP_DIV_DD:
+            jit_double_arith(j, (OpCode)(OP_ADD + (op - OP_ADD_DD)));
+            x86_adjust_sp(j, -1);
+            break;
+        case OP_NEG: {
+            // Ints and doubles change sign; every other value stays as it is
+            x86_cmp_imm32(j, R12, STACK_AT(1) + TYPE_AT, VAL_INT);
+            size_t not_int = x86_jump(j, CC_NE);
+            x86_load32(j, RAX, R12, STACK_AT(1) + PAYLOAD_AT);
+            x86_bytes(j, "\xF7\xD8", 2);                                        // neg eax
+            x86_store64(j, RAX, R12, STACK_AT(1) + PAYLOAD_AT);
+            size_t done = x86_jump(j, -1);
+            x86_patch_here(j, not_int);
+            x86_cmp_imm32(j, R12, STACK_AT(1) + TYPE_AT, VAL_DOUBLE);
+            size_t not_double = x86_jump(j, CC_NE);
+            x86_bytes(j, "\x48\xB8\x00\x00\x00\x00\x00\x00\x00\x80", 10);         // mov rax, sign bit
+            x86_mem(j, 0, true, 0x31, RAX, R12, STACK_AT(1) + PAYLOAD_AT);        // xor qword, rax
+            x86_patch_here(j, done);
+            x86_patch_here(j, not_double);
+            break;
+        }
+        case OP_NOT:
+        case OP_TO_BOOL:
+            jit_truthy(j, R12, STACK_AT(1), at);
+            x86_bytes(j, "\x85\xC0", 2);                                          // test eax, eax
+            x86_bytes(j, op == OP_NOT ? "\x0F\x94\xC0" : "\x0F\x95\xC0", 3);      // sete / setne al
+            x86_bytes(j, "\x0F\xB6\xC0", 3);                                  // movzx eax, al
+            x86_store64(j, RAX, R12, STACK_AT(1) + PAYLOAD_AT);
+            x86_store_imm64(j, R12, STACK_AT(1) + TYPE_AT, VAL_BOOL);
+            break;
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+            jit_compare_guarded(j, compare_kind(op), at);
+            jit_store_bool(j);
+            break;
+        case OP_EQ_II: case OP_NE_II: case OP_LT_II: case OP_LE_II: case OP_GT_II: case OP_GE_II:
+            jit_compare_ints(j, compare_kind(op));
+            jit_store_bool(j);
+            break;
+        case OP_EQ_DD: case OP_NE_DD: case OP_LT_DD: case OP_LE_DD: case OP_GT_DD: case OP_GE_DD:
+            jit_compare_doubles(j, compare_kind(op));
+            jit_store_bool(j);
+            break;
+        case OP_EQ_JMP: case OP_NE_JMP: case OP_LT_JMP: case OP_LE_JMP: case OP_GT_JMP: case OP_GE_JMP:
+            jit_compare_guarded(j, compare_kind(op), at);
+            x86_adjust_sp(j, -2);
+            x86_bytes(j, "\x84\xC0", 2);                                          // test al, al
+            jit_branch(j, CC_E, word[1]);
+            break;
+        case OP_JUMP:
+            jit_branch(j, -1, word[1]);
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            jit_truthy(j, R12, STACK_AT(1), at);
+            x86_adjust_sp(j, -1);
+            x86_bytes(j, "\x85\xC0", 2);
+            jit_branch(j, op == OP_JUMP_IF_FALSE ? CC_E : CC_NE, word[1]);
+            break;
+        case OP_AND_JUMP:
+        case OP_OR_JUMP: {
+            bool jump_when = op == OP_OR_JUMP;
+            jit_truthy(j, R12, STACK_AT(1), at);
+            x86_bytes(j, "\x85\xC0", 2);
+            size_t pop = x86_jump(j, jump_when ? CC_E : CC_NE);
+            x86_store_imm64(j, R12, STACK_AT(1) + TYPE_AT, VAL_BOOL);
+            x86_store_imm64(j, R12, STACK_AT(1) + PAYLOAD_AT, jump_when);
+            jit_branch(j, -1, word[1]);
+            x86_patch_here(j, pop);
+            x86_adjust_sp(j, -1);
+            break;
+        }
+        case OP_ADD_LOCAL:
+            jit_guard_type(j, RBX, SLOT_AT(a), VAL_INT, at);
+            jit_guard_type(j, R12, STACK_AT(1), VAL_INT, at);
+            x86_load32(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            x86_mem(j, 0, false, 0x03, RAX, R12, STACK_AT(1) + PAYLOAD_AT);      // add eax, top
+            x86_store64(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            x86_adjust_sp(j, -1);
+            break;
+        case OP_INC_LOCAL:
+            jit_guard_type(j, RBX, SLOT_AT(a), VAL_INT, at);
+            x86_load32(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            x86_byte(j, 0x05);                                                    // add eax, imm32
+            x86_u32(j, word[1]);
+            x86_store64(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            break;
+        case OP_FOR_RANGE:
+        case OP_FOR_RANGE_I:
+            x86_load32(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            if (op == OP_FOR_RANGE) x86_mem(j, 0, false, 0x3B, RAX, RBX, SLOT_AT(word[1]) + PAYLOAD_AT);
+            else { x86_byte(j, 0x3D); x86_u32(j, word[1]); }                     // cmp eax, imm32
+            jit_branch(j, CC_GE, word[2]);
+            break;
+        case OP_FOR_STEP:
+        case OP_FOR_STEP_I:
+            x86_load32(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            x86_bytes(j, "\x83\xC0\x01", 3);                                      // add eax, 1
+            x86_store64(j, RAX, RBX, SLOT_AT(a) + PAYLOAD_AT);
+            if (op == OP_FOR_STEP) x86_mem(j, 0, false, 0x3B, RAX, RBX, SLOT_AT(word[1]) + PAYLOAD_AT);
+            else { x86_byte(j, 0x3D); x86_u32(j, word[1]); }
+            jit_branch(j, CC_L, word[2]);
+            break;
+        default:
+            // PRINT, INPUT, SWITCH_TABLE, HALT: the interpreter runs them
+            jit_exit(j, at);
+            break;
+    }
+}
+
+// Fresh read-write pages; strict C11 headers hide MAP_ANONYMOUS
+static void* jit_map_pages(size_t size) {
+#ifdef MAP_ANONYMOUS
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) return MAP_FAILED;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return memory;
+#endif
+}
+
+// Compiles the loop [start, end) to fresh executable pages.
+static bool jit_compile(JitHeader* header, const Chunk* chunk, uint32_t start, uint32_t end) {
+    JitCompiler j;
+    memset(&j, 0, sizeof(j));
+    j.start = start;
+    j.end = end;
+    j.native = malloc((end - start) * sizeof(int32_t));
+    for (uint32_t i = 0; i < end - start; i++) j.native[i] = -1;
+
+    // push rbx, r12, r13, r14; rbx = slots, r14 = sp's address, r12 = sp, r13 = constants
+    x86_bytes(&j, "\x53\x41\x54\x41\x55\x41\x56", 7);
+    x86_bytes(&j, "\x48\x89\xFB\x49\x89\xF6\x4C\x8B\x26\x49\x89\xD5", 12);
+    for (uint32_t at = start; at < end; at += insn_words((OpCode)INSN_OP(chunk->code[at]))) {
+        j.native[at - start] = (int32_t)j.length;
+        jit_instruction(&j, chunk, at);
+    }
+    jit_branch(&j, -1, end);
+
+    // Every exit: eax = offset to resume at; write sp back and return
+    size_t epilogue = j.length;
+    x86_bytes(&j, "\x4D\x89\x26\x41\x5E\x41\x5D\x41\x5C\x5B\xC3", 11);
+    for (int i = 0; i < j.fixup_count; i++) {
+        JitFixup* fixup = &j.fixups[i];
+        bool inside = fixup->target >= start && fixup->target < end;
+        if (fixup->kind == FIXUP_BRANCH && inside && j.native[fixup->target - start] >= 0) {
+            x86_patch(&j, fixup->at, (size_t)j.native[fixup->target - start]);
+            continue;
+        }
+        x86_patch_here(&j, fixup->at);
+        x86_byte(&j, 0xB8);                                                      // mov eax, imm32
+        x86_u32(&j, fixup->target | (fixup->kind == FIXUP_GUARD ? JIT_DEOPT : 0));
+        x86_patch(&j, x86_jump(&j, -1), epilogue);
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (j.length + (size_t)page - 1) / (size_t)page * (size_t)page;
+    void* memory = jit_map_pages(size);
+    bool ok = memory != MAP_FAILED;
+    if (ok) {
+        memcpy(memory, j.bytes, j.length);
+        ok = mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+        if (!ok) munmap(memory, size);
+    }
+    if (ok) {
+        header->memory = memory;
+        header->size = size;
+        header->loop = (JitLoop)memory;
+    }
+    free(j.bytes);
+    free(j.native);
+    free(j.fixups);
+    return ok;
+}
+
+#endif // JIT_X86_64
+
+static Jit* jit_create(const Chunk* chunk) {
+    (void)chunk;
+#if JIT_X86_64
+    if (sizeof(ValueType) != 4) {
+        fprintf(stderr, "Note: --jit does not support this build's Value layout; running the interpreter\n");
+        return NULL;
+    }
+    Jit* jit = malloc(sizeof(Jit));
+    jit->capacity = JIT_MAP_INITIAL;
+    jit->count = 0;
+    jit->headers = calloc(jit->capacity, sizeof(JitHeader));
+    return jit;
+#else
+    fprintf(stderr, "Note: --jit needs x86-64 with the System V ABI; running the interpreter\n");
+    return NULL;
+#endif
+}
+
+static void jit_free(Jit* jit) {
+    if (!jit) return;
+#if JIT_X86_64
+    for (uint32_t i = 0; i < jit->capacity; i++) {
+        if (jit->headers[i].memory) munmap(jit->headers[i].memory, jit->headers[i].size);
+    }
+#endif
+    free(jit->headers);
+    free(jit);
+}
+
+static JitHeader* jit_probe(JitHeader* headers, uint32_t capacity, uint32_t start) {
+    uint32_t i = (start * 2654435761u) & (capacity - 1);
+    while (headers[i].used && headers[i].start != start) i = (i + 1) & (capacity - 1);
+    return &headers[i];
+}
+
+// The header of the loop starting at `start`, made on first use. Kept at
+// most three quarters full; pointers into the map last until the next insert.
+static JitHeader* jit_header(Jit* jit, uint32_t start) {
+    JitHeader* header = jit_probe(jit->headers, jit->capacity, start);
+    if (header->used) return header;
+    if ((jit->count + 1) * 4 > jit->capacity * 3) {
+        uint32_t capacity = jit->capacity * 2;
+        JitHeader* headers = calloc(capacity, sizeof(JitHeader));
+        for (uint32_t i = 0; i < jit->capacity; i++) {
+            if (jit->headers[i].used) *jit_probe(headers, capacity, jit->headers[i].start) = jit->headers[i];
+        }
+        free(jit->headers);
+        jit->headers = headers;
+        jit->capacity = capacity;
+        header = jit_probe(headers, capacity, start);
+    }
+    header->used = true;
+    header->start = start;
+    jit->count++;
+    return header;
+}
+
+// A backward jump from just before `end` to `target` was taken. Counts it,
+// compiles the loop once it is hot, and runs the native loop if there is one.
+// Returns where the interpreter continues.
+static const uint32_t* jit_back_edge(Jit* jit, const Chunk* chunk, const uint32_t* target, const uint32_t* end,
+                                     Value* slots, Value** sp) {
+    uint32_t start = (uint32_t)(target - chunk->code);
+    JitHeader* header = jit_header(jit, start);
+    if (!header->loop) {
+        if (header->rejected || ++header->back_edges < JIT_THRESHOLD) return target;
+#if JIT_X86_64
+        if (!jit_compile(header, chunk, start, (uint32_t)(end - chunk->code))) {
+            fprintf(stderr, "Note: --jit cannot map executable memory; running the interpreter\n");
+            header->rejected = true;
+            return target;
+        }
+#else
+        (void)end;
+        return target;
+#endif
+    }
+    uint32_t resume = header->loop(slots, sp, chunk->constants);
+    if (resume & JIT_DEOPT) {
+        resume &= ~JIT_DEOPT;
+        if (++header->deopts >= JIT_DEOPT_LIMIT) {
+            header->loop = NULL;
+            header->rejected = true;
+        }
+    }
+    return chunk->code + resume;
+}
+
+/* ============================================================================
+ * VIRTUAL MACHINE
+ * ============================================================================
+ * Stack machine over a Chunk. GCC and Clang dispatch through a table of label
+ * addresses (computed goto); other compilers fall back to a switch loop. With
+ * a Jit, backward jumps go through jit_back_edge.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// Built with -DCYTHONIC_PAIR_STATS, the VM counts every pair of consecutively
+// executed opcodes and prints the most frequent ones to stderr on exit: the
+// candidates for the next superinstruction.
+#ifdef CYTHONIC_PAIR_STATS
+#define PAIR_REPORT_LIMIT 20
+
+static uint64_t pair_counts[OP_COUNT][OP_COUNT];
+
+static void print_pair_stats(void) {
+    uint64_t total = 0;
+    for (int a = 0; a < OP_COUNT; a++) {
+        for (int b = 0; b < OP_COUNT; b++) total += pair_counts[a][b];
+    }
+    fprintf(stderr, "Opcode pairs: %llu executed\n", (unsigned long long)total);
+    for (int rank = 0; rank < PAIR_REPORT_LIMIT && total; rank++) {
+        int best_a = 0, best_b = 0;
+        for (int a = 0; a < OP_COUNT; a++) {
+            for (int b = 0; b < OP_COUNT; b++) {
+                if (pair_counts[a][b] > pair_counts[best_a][best_b]) { best_a = a; best_b = b; }
+            }
+        }
+        uint64_t count = pair_counts[best_a][best_b];
+        if (!count) break;
+        fprintf(stderr, "%12llu %5.1f%%  %s %s\n", (unsigned long long)count, 100.0 * count / total,
+                OPCODE_NAMES[best_a], OPCODE_NAMES[best_b]);
+        pair_counts[best_a][best_b] = 0;
+    }
+}
+
+#define COUNT_PAIR() do { pair_counts[previous_op][INSN_OP(insn)]++; previous_op = INSN_OP(insn); } while (0)
+#else
+#define COUNT_PAIR() ((void)0)
+#endif
+
+// Taken backward jumps: `target` is the loop header, `end` follows the jump
+#define VM_BACK_EDGE(target, end) \
+    (ip = (jit && (target) < ip) ? jit_back_edge(jit, chunk, (target), (end), slots, &sp) : (target))
+
+// Profiling. The computed-goto VM dispatches through whichever table
+// vm_dispatch holds, an atomic load that costs no measurable time. To take a
+// sample, the sampler thread swaps in a table whose every entry leads to
+// sample_hook; the next instruction lands there, charges its line and swaps
+// the usual table back. With --profile-counts the usual table is one whose
+// entries all lead to count_hook and on through profile_instruction. The
+// switch VM checks a flag before each instruction instead.
+#if VM_COMPUTED_GOTO
+static _Atomic(void**) vm_dispatch;
+static void** vm_sample_table;
+
+static void vm_sample_next(void) {
+    atomic_store_explicit(&vm_dispatch, vm_sample_table, memory_order_relaxed);
+}
+#else
+static _Atomic bool vm_sample_pending;
+
+static void vm_sample_next(void) {
+    atomic_store_explicit(&vm_sample_pending, true, memory_order_relaxed);
+}
+#endif
+
+static void vm_run(Chunk* chunk, bool use_jit, Profile* profile) {
+    Jit* jit = use_jit ? jit_create(chunk) : NULL;
+    Value* slots = malloc((chunk->slot_count + 1) * sizeof(Value));
+    for (int i = 0; i < chunk->slot_count; i++) slots[i] = make_int(0);
+    Value* stack = malloc((chunk->max_stack + 1) * sizeof(Value));
+    Value* sp = stack;
+    const uint32_t* code = chunk->code;
+    const uint32_t* ip = code;
+    uint32_t insn;
+#ifdef CYTHONIC_PAIR_STATS
+    uint32_t previous_op = OP_HALT;
+#endif
+
+
+#if VM_COMPUTED_GOTO
+    static void* dispatch_table[OP_COUNT] = {
+#define X(name) &&op_##name,
+        OPCODE_LIST(X)
+#undef X
+    };
+    static void* count_table[OP_COUNT] = {
+#define X(name) &&count_hook,
+        OPCODE_LIST(X)
+#undef X
+    };
+    static void* sample_table[OP_COUNT] = {
+#define X(name) &&sample_hook,
+        OPCODE_LIST(X)
+#undef X
+    };
+    void** usual_table = profile && profile->counting ? count_table : dispatch_table;
+    atomic_store(&vm_dispatch, usual_table);
+    vm_sample_table = sample_table;
+#define DISPATCH() do { \
+        insn = *ip++; \
+        COUNT_PAIR(); \
+        goto *atomic_load_explicit(&vm_dispatch, memory_order_relaxed)[INSN_OP(insn)]; \
+    } while (0)
+#define CASE(name) op_##name:
+#define NEXT() DISPATCH()
+#endif
+    if (profile) {
+        profile_track_opcodes(profile, OPCODE_NAMES, OP_COUNT);
+        profile->sample_next = vm_sample_next;
+        profile_start(profile);
+    }
+
+#if VM_COMPUTED_GOTO
+    DISPATCH();
+sample_hook:
+    profile_sample(profile, chunk->lines[ip - 1 - code]);
+    atomic_store_explicit(&vm_dispatch, usual_table, memory_order_relaxed);
+    goto *usual_table[INSN_OP(insn)];
+count_hook:
+    profile_instruction(profile, chunk->lines[ip - 1 - code], INSN_OP(insn));
+    goto *dispatch_table[INSN_OP(insn)];
+#else
+#define CASE(name) case OP_##name:
+#define NEXT() break
+    for (;;) {
+        insn = *ip++;
+        COUNT_PAIR();
+        if (profile) {
+            if (atomic_exchange_explicit(&vm_sample_pending, false, memory_order_relaxed)) {
+                profile_sample(profile, chunk->lines[ip - 1 - code]);
+            }
+            if (profile->counting) profile_instruction(profile, chunk->lines[ip - 1 - code], INSN_OP(insn));
+        }
+        switch (INSN_OP(insn)) {
+#endif
+
+    CASE(CONST) *sp++ = value_retain(chunk->constants[INSN_A(insn)]); NEXT();
+    CASE(PUSH_INT) *sp++ = make_int(INSN_SA(insn)); NEXT();
+    CASE(LOAD) *sp++ = value_retain(slots[INSN_A(insn)]); NEXT();
+    CASE(STORE) {
+        Value* slot = &slots[INSN_A(insn)];
+        free_value(*slot);
+        *slot = *--sp;
+        NEXT();
+    }
+    CASE(POP) free_value(*--sp); NEXT();
+    CASE(DUP) sp[0] = value_retain(sp[-1]); sp++; NEXT();
+
+#define VM_ARITH(int_expr, generic) { \
+        Value b = *--sp; Value a = sp[-1]; \
+        if (a.type == VAL_INT && b.type == VAL_INT) { sp[-1].as.int_val = (int_expr); } \
+        else { sp[-1] = generic(a, b); free_value(a); free_value(b); } \
+        NEXT(); }
+    CASE(ADD) VM_ARITH(int_add(a.as.int_val, b.as.int_val), val_add)
+    CASE(ADD_LOCAL) {
+        Value b = *--sp;
+        Value* a = &slots[INSN_A(insn)];
+        if (a->type == VAL_INT && b.type == VAL_INT) a->as.int_val = int_add(a->as.int_val, b.as.int_val);
+        else if (!string_append(a, b)) {
+            Value sum = val_add(*a, b);
+            free_value(*a);
+            *a = sum;
+        }
+        free_value(b);
+        NEXT();
+    }
+    CASE(SUB) VM_ARITH(int_sub(a.as.int_val, b.as.int_val), val_sub)
+    CASE(MUL) VM_ARITH(int_mul(a.as.int_val, b.as.int_val), val_mul)
+    CASE(DIV) {
+        Value b = *--sp; Value a = sp[-1];
+        sp[-1] = val_div(a, b); free_value(a); free_value(b);
+        NEXT();
+    }
+    CASE(MOD) {
+        Value b = *--sp; Value a = sp[-1];
+        sp[-1] = val_mod(a, b); free_value(a); free_value(b);
+        NEXT();
+    }
+#undef VM_ARITH
+
+    CASE(NEG)
+        if (sp[-1].type == VAL_INT) sp[-1].as.int_val = int_neg(sp[-1].as.int_val);
+        else if (sp[-1].type == VAL_DOUBLE) sp[-1].as.double_val = -sp[-1].as.double_val;
+        NEXT();
+    CASE(NOT) {
+        bool b = value_truthy(sp[-1]);
+        free_value(sp[-1]);
+        sp[-1] = make_bool(!b);
+        NEXT();
+    }
+    CASE(TO_BOOL) {
+        bool b = value_truthy(sp[-1]);
+        free_value(sp[-1]);
+        sp[-1] = make_bool(b);
+        NEXT();
+    }
+
+#define VM_COMPARE(int_cmp, generic_cmp) { \
+        Value b = *--sp; Value a = sp[-1]; \
+        bool r; \
+        if (a.type == VAL_INT && b.type == VAL_INT) r = (int_cmp); \
+        else { r = (generic_cmp); free_value(a); free_value(b); } \
+        sp[-1] = make_bool(r); \
+        NEXT(); }
+    CASE(EQ) VM_COMPARE(a.as.int_val == b.as.int_val, value_equals(a, b))
+    CASE(NE) VM_COMPARE(a.as.int_val != b.as.int_val, !value_equals(a, b))
+    CASE(LT) VM_COMPARE(a.as.int_val < b.as.int_val, value_to_double(a) < value_to_double(b))
+    CASE(LE) VM_COMPARE(a.as.int_val <= b.as.int_val, value_to_double(a) <= value_to_double(b))
+    CASE(GT) VM_COMPARE(a.as.int_val > b.as.int_val, value_to_double(a) > value_to_double(b))
+    CASE(GE) VM_COMPARE(a.as.int_val >= b.as.int_val, value_to_double(a) >= value_to_double(b))
+#undef VM_COMPARE
+
+    // Typed forms: the compiler proved both operand types, so no checks
+    CASE(LOAD_N) *sp++ = slots[INSN_A(insn)]; NEXT();
+    CASE(STORE_N) slots[INSN_A(insn)] = *--sp; NEXT();
+    CASE(I2D) {
+        Value* v = &sp[-(int)INSN_A(insn)];
+        *v = make_double(v->as.int_val);
+        NEXT();
+    }
+#define VM_INT_ARITH(fn) { sp--; sp[-1].as.int_val = fn(sp[-1].as.int_val, sp[0].as.int_val); NEXT(); }
+#define VM_DOUBLE_ARITH(op) { sp--; sp[-1].as.double_val = sp[-1].as.double_val op sp[0].as.double_val; NEXT(); }
+    CASE(ADD_II) VM_INT_ARITH(int_add)
+    CASE(SUB_II) VM_INT_ARITH(int_sub)
+    CASE(MUL_II) VM_INT_ARITH(int_mul)
+    CASE(DIV_II) VM_INT_ARITH(int_div)
+    CASE(MOD_II) VM_INT_ARITH(int_mod)
+    CASE(ADD_DD) VM_DOUBLE_ARITH(+)
+    CASE(SUB_DD) VM_DOUBLE_ARITH(-)
+    CASE(MUL_DD) VM_DOUBLE_ARITH(*)
+    CASE(DIV_DD)
+        sp--;
+        if (sp[0].as.double_val == 0) sp[-1] = make_int(0); // As val_div
+        else sp[-1].as.double_val /= sp[0].as.double_val;
+        NEXT();
+#undef VM_INT_ARITH
+#undef VM_DOUBLE_ARITH
+
+#define VM_TYPED_COMPARE(field, op) { sp--; sp[-1] = make_bool(sp[-1].as.field op sp[0].as.field); NEXT(); }
+    CASE(EQ_II) VM_TYPED_COMPARE(int_val, ==)
+    CASE(NE_II) VM_TYPED_COMPARE(int_val, !=)
+    CASE(LT_II) VM_TYPED_COMPARE(int_val, <)
+    CASE(LE_II) VM_TYPED_COMPARE(int_val, <=)
+    CASE(GT_II) VM_TYPED_COMPARE(int_val, >)
+    CASE(GE_II) VM_TYPED_COMPARE(int_val, >=)
+    CASE(EQ_DD) VM_TYPED_COMPARE(double_val, ==)
+    CASE(NE_DD) VM_TYPED_COMPARE(double_val, !=)
+    CASE(LT_DD) VM_TYPED_COMPARE(double_val, <)
+    CASE(LE_DD) VM_TYPED_COMPARE(double_val, <=)
+    CASE(GT_DD) VM_TYPED_COMPARE(double_val, >)
+    CASE(GE_DD) VM_TYPED_COMPARE(double_val, >=)
+#undef VM_TYPED_COMPARE
+
+    CASE(INC_LOCAL) {
+        Value* slot = &slots[INSN_A(insn)];
+        int32_t delta = (int32_t)*ip++;
+        if (slot->type == VAL_INT) slot->as.int_val = int_add(slot->as.int_val, delta);
+        else {
+            Value updated = delta > 0 ? val_add(*slot, make_int(delta)) : val_sub(*slot, make_int(-delta));
+            free_value(*slot);
+            *slot = updated;
+        }
+        NEXT();
+    }
+#define VM_COMPARE_JUMP(int_cmp, generic_cmp) { \
+        Value b = *--sp; Value a = *--sp; \
+        bool r; \
+        if (a.type == VAL_INT && b.type == VAL_INT) r = (int_cmp); \
+        else { r = (generic_cmp); free_value(a); free_value(b); } \
+        ip = r ? ip + 1 : code + *ip; \
+        NEXT(); }
+    CASE(EQ_JMP) VM_COMPARE_JUMP(a.as.int_val == b.as.int_val, value_equals(a, b))
+    CASE(NE_JMP) VM_COMPARE_JUMP(a.as.int_val != b.as.int_val, !value_equals(a, b))
+    CASE(LT_JMP) VM_COMPARE_JUMP(a.as.int_val < b.as.int_val, value_to_double(a) < value_to_double(b))
+    CASE(LE_JMP) VM_COMPARE_JUMP(a.as.int_val <= b.as.int_val, value_to_double(a) <= value_to_double(b))
+    CASE(GT_JMP) VM_COMPARE_JUMP(a.as.int_val > b.as.int_val, value_to_double(a) > value_to_double(b))
+    CASE(GE_JMP) VM_COMPARE_JUMP(a.as.int_val >= b.as.int_val, value_to_double(a) >= value_to_double(b))
+#undef VM_COMPARE_JUMP
+
+    // Counted loops; the compiler proved the counter and limit are ints
+    CASE(FOR_RANGE)
+        ip = slots[INSN_A(insn)].as.int_val < slots[ip[0]].as.int_val ? ip + 2 : code + ip[1];
+        NEXT();
+    CASE(FOR_RANGE_I)
+        ip = slots[INSN_A(insn)].as.int_val < (int32_t)ip[0] ? ip + 2 : code + ip[1];
+        NEXT();
+    CASE(FOR_STEP) {
+        int i = ++slots[INSN_A(insn)].as.int_val;
+        if (i < slots[ip[0]].as.int_val) VM_BACK_EDGE(code + ip[1], ip + 2);
+        else ip += 2;
+        NEXT();
+    }
+    CASE(FOR_STEP_I) {
+        int i = ++slots[INSN_A(insn)].as.int_val;
+        if (i < (int32_t)ip[0]) VM_BACK_EDGE(code + ip[1], ip + 2);
+        else ip += 2;
+        NEXT();
+    }
+
+    CASE(JUMP) VM_BACK_EDGE(code + *ip, ip + 1); NEXT();
+    CASE(JUMP_IF_FALSE) {
+        Value v = *--sp;
+        bool b = (v.type == VAL_BOOL) ? v.as.bool_val : value_truthy(v);
+        free_value(v);
+        ip = b ? ip + 1 : code + *ip;
+        NEXT();
+    }
+    CASE(JUMP_IF_TRUE) {
+        Value v = *--sp;
+        bool b = (v.type == VAL_BOOL) ? v.as.bool_val : value_truthy(v);
+        free_value(v);
+        if (b) VM_BACK_EDGE(code + *ip, ip + 1);
+        else ip++;
+        NEXT();
+    }
+    CASE(AND_JUMP) {
+        bool b = value_truthy(sp[-1]);
+        free_value(sp[-1]);
+        if (!b) { sp[-1] = make_bool(false); ip = code + *ip; }
+        else { sp--; ip++; }
+        NEXT();
+    }
+    CASE(OR_JUMP) {
+        bool b = value_truthy(sp[-1]);
+        free_value(sp[-1]);
+        if (b) { sp[-1] = make_bool(true); ip = code + *ip; }
+        else { sp--; ip++; }
+        NEXT();
+    }
+
+    CASE(SWITCH_TABLE) {
+        Value subject = *--sp;
+        ip = code + switch_table_find(chunk->switches[INSN_A(insn)], subject);
+        free_value(subject);
+        NEXT();
+    }
+
+    CASE(PRINT) {
+        Value v = *--sp;
+        print_value(v);
+        free_value(v);
+        NEXT();
+    }
+    CASE(INPUT) {
+        uint32_t slot = ip[0];
+        Value val;
+        if (input_value(atom_text(chunk->names, INSN_A(insn)), (Atom)ip[1], &val)) {
+            if (slot != NO_SLOT) {
+                free_value(slots[slot]);
+                slots[slot] = val;
+            } else {
+                free_value(val);
+            }
+        }
+        ip += 2;
+        NEXT();
+    }
+    CASE(HALT) goto done;
+
+#if !VM_COMPUTED_GOTO
+        }
+    }
+#endif
+#undef CASE
+#undef NEXT
+#undef DISPATCH
+
+done:
+    output_flush();
+    if (profile) profile_stop(profile);
+    input_close();
+    for (int i = 0; i < chunk->slot_count; i++) free_value(slots[i]);
+    free(slots);
+    free(stack);
+#ifdef CYTHONIC_PAIR_STATS
+    print_pair_stats();
+#endif
+    jit_free(jit);
+}
+#undef VM_BACK_EDGE
+
+/* ============================================================================
+ * SYMBOL TABLE OUTPUT
+ * ============================================================================ */
+
+static void escape_for_output(const char* source, size_t length, char* dest, size_t dest_size) {
+    size_t i = 0, j = 0;
+    while (i < length && j < dest_size - 1) {
+        char c = source[i++];
+        if (c == '\n') {
+            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 'n'; }
+        } else if (c == '\r') {
+            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 'r'; }
+        } else if (c == '\t') {
+            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 't'; }
+        } else {
+            dest[j++] = c;
+        }
+    }
+    dest[j] = '\0';
+}
+
+// Returns false if the file cannot be created.
+static bool write_symbol_table(const TokenList* tokens, const Interner* names, const char* output_path) {
+    FILE* file = fopen(output_path, "w");
+    if (!file) return false;
+    
+    fprintf(file, "CYTHONIC LEXICAL ANALYZER - SYMBOL TABLE\n");
+    fprintf(file, "========================================\n\n");
+    fprintf(file, "LINE | COL | TYPE              | LEXEME                        | RAW\n");
+    fprintf(file, "-----|-----|-------------------|-------------------------------|----------------------------------\n");
+    
+    char lexeme_buffer[1024];
+    char raw_buffer[1024];
+
+    for (int i = 0; i < tokens->count; i++) {
+        const Token token = token_at(tokens, i);
+        const AtomEntry* lexeme = &names->atoms[token.atom];
+        escape_for_output(lexeme->text, lexeme->length, lexeme_buffer, sizeof(lexeme_buffer));
+        escape_for_output(token_raw(tokens, &token), token.length, raw_buffer, sizeof(raw_buffer));
+
+        fprintf(file, "%4d | %3d | %-17s | %-29s | %s\n",
+                token.line,
+                token.column,
+                token_type_to_string(token.type),
+                lexeme_buffer,
+                raw_buffer);
+    }
+    
+    fprintf(file, "\nTotal tokens: %d\n", tokens->count);
+    fprintf(file, "END OF SYMBOL TABLE\n");
+    fclose(file);
+    return true;
+}
+
+// The symbol table can be written on a background thread while the program
+// parses and runs; the tokens, the source they slice and the interned text
+// are read-only by then.
+typedef struct {
+    const TokenList* tokens;
+    const Interner* names;
+    const char* path;
+    bool ok;
+    double seconds;      // Taken to write it
+} SymbolTableJob;
+
+static void symbol_table_job_run(void* arg) {
+    SymbolTableJob* job = arg;
+    double start = wall_seconds();
+    job->ok = write_symbol_table(job->tokens, job->names, job->path);
+    job->seconds = wall_seconds() - start;
+}
+
+/* ============================================================================
+ * TOKEN CACHE
+ * ============================================================================
+ * A binary snapshot of one source file's tokens, written next to it as
+ * <source>.cythotok. A later run whose source hashes the same maps the file
+ * and builds its TokenLists straight from it: no lexing, no symbol table
+ * parsing, and no string copies, since the interner borrows text from the
+ * mapping.
+ *
+ * Layout (native byte order; the cache is only meant for the machine that
+ * wrote it):
+ *   TokenCacheHeader
+ *   TokenCacheString[string_count]   distinct lexemes, as offsets into the blob
+ *   TokenCacheRecord[token_count]    every token, comments included
+ *   blob                             NUL-terminated lexeme text
+ *
+ * Raw text is not stored: like a lexed token, a cached one slices the source,
+ * which the hash has already matched.
+ */
+
+#define TOKEN_CACHE_MAGIC "CYTHOTOK"
+#define TOKEN_CACHE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t token_count;
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint32_t string_count;
+    uint32_t blob_size;
+} TokenCacheHeader;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} TokenCacheString;
+
+typedef struct {
+    uint32_t type;
+    uint32_t line;
+    uint32_t column;
+    uint32_t lexeme;     // Index into the string table
+    uint32_t raw_offset; // Raw text, as a slice of the source
+    uint32_t raw_length;
+} TokenCacheRecord;
+
+typedef struct {
+    const char* data;
+    size_t size;
+    bool mapped;         // Unmapped with munmap, otherwise freed
+} MappedFile;
+
+static uint64_t hash_source(const char* text, size_t length) {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a, 64-bit
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool map_file(const char* path, MappedFile* out) {
+    memset(out, 0, sizeof(MappedFile));
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    out->data = data;
+    out->size = (size_t)st.st_size;
+    out->mapped = true;
+    return true;
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = size > 0 ? malloc(size) : NULL;
+    if (!data || fread(data, 1, size, file) != (size_t)size) { free(data); fclose(file); return false; }
+    fclose(file);
+    out->data = data;
+    out->size = (size_t)size;
+    return true;
+#endif
+}
+
+static void unmap_file(MappedFile* file) {
+#ifndef _WIN32
+    if (file->mapped) munmap((void*)file->data, file->size);
+    else
+#endif
+    free((void*)file->data);
+    memset(file, 0, sizeof(MappedFile));
+}
+
+// Writes every token in `symbols` (comments included). Returns false on I/O failure.
+// The tokens must slice `source`, as they do straight out of the lexer.
+static bool write_token_cache(const TokenList* symbols, const Interner* pool, const char* source,
+                              size_t source_length, const char* path) {
+    // Number the distinct lexemes in first-use order; Atom -> string index + 1
+    uint32_t* index_of = calloc(pool->count + 1, sizeof(uint32_t));
+    TokenCacheRecord* records = malloc((symbols->count + 1) * sizeof(TokenCacheRecord));
+    Atom* strings = malloc((symbols->count + 1) * sizeof(Atom));
+    uint32_t string_count = 0;
+    uint32_t blob_size = 0;
+
+    for (int i = 0; i < symbols->count; i++) {
+        Atom atom = symbols->atoms[i];
+        if (!index_of[atom]) {
+            strings[string_count] = atom;
+            index_of[atom] = ++string_count;
+            blob_size += pool->atoms[atom].length + 1;
+        }
+        records[i].type = symbols->types[i];
+        records[i].line = (uint32_t)symbols->positions[i].line;
+        records[i].column = (uint32_t)symbols->positions[i].column;
+        records[i].lexeme = index_of[atom] - 1;
+        records[i].raw_offset = symbols->spans[i].offset;
+        records[i].raw_length = symbols->spans[i].length;
+    }
+
+    TokenCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TOKEN_CACHE_VERSION;
+    header.token_count = (uint32_t)symbols->count;
+    header.source_hash = hash_source(source, source_length);
+    header.source_length = source_length;
+    header.string_count = string_count;
+    header.blob_size = blob_size;
+
+    bool ok = false;
+    FILE* file = fopen(path, "wb");
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        uint32_t offset = 0;
+        for (uint32_t i = 0; ok && i < string_count; i++) {
+            TokenCacheString entry = { offset, pool->atoms[strings[i]].length };
+            ok = fwrite(&entry, sizeof(entry), 1, file) == 1;
+            offset += entry.length + 1;
+        }
+        if (ok && symbols->count > 0) {
+            ok = fwrite(records, sizeof(TokenCacheRecord), symbols->count, file) == (size_t)symbols->count;
+        }
+        for (uint32_t i = 0; ok && i < string_count; i++) {
+            const AtomEntry* entry = &pool->atoms[strings[i]];
+            ok = fwrite(entry->text, 1, entry->length + 1, file) == entry->length + 1;
+        }
+        if (fclose(file) != 0) ok = false;
+        if (!ok) remove(path);
+    }
+
+    free(index_of);
+    free(records);
+    free(strings);
+    return ok;
+}
+
+// Loads a cache written for exactly this source. On success the interner
+// borrows text from `file`, which must stay mapped until the pool is freed,
+// and the tokens slice `source`, which must outlive the lists.
+// `symbols` (may be NULL) gets every token, `parse_tokens` everything but comments.
+static bool load_token_cache(const char* path, const char* source, size_t source_length,
+                             Interner* pool, MappedFile* file, TokenList* symbols, TokenList* parse_tokens) {
+    if (!map_file(path, file)) return false;
+
+    const TokenCacheHeader* header = (const TokenCacheHeader*)file->data;
+    if (file->size < sizeof(TokenCacheHeader) ||
+        memcmp(header->magic, TOKEN_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TOKEN_CACHE_VERSION ||
+        header->source_length != source_length ||
+        header->source_hash != hash_source(source, source_length)) {
+        unmap_file(file);
+        return false;
     }
-    expression(parser);
-    consume(parser, RIGHT_PAREN, "Expect ')' after collection.");
-    statement(parser);
-    exit_node(parser, "ForeachStatement");
+    uint64_t expected = sizeof(TokenCacheHeader) +
+                        (uint64_t)header->string_count * sizeof(TokenCacheString) +
+                        (uint64_t)header->token_count * sizeof(TokenCacheRecord) +
+                        header->blob_size;
+    if (expected != file->size) { unmap_file(file); return false; }
+
+    const TokenCacheString* strings = (const TokenCacheString*)(header + 1);
+    const TokenCacheRecord* records = (const TokenCacheRecord*)(strings + header->string_count);
+    const char* blob = (const char*)(records + header->token_count);
+
+    // Validate everything before the interner starts pointing into the file
+    for (uint32_t i = 0; i < header->string_count; i++) {
+        uint64_t end = (uint64_t)strings[i].offset + strings[i].length;
+        if (end >= header->blob_size || blob[end] != '\0') { unmap_file(file); return false; }
+    }
+    for (uint32_t i = 0; i < header->token_count; i++) {
+        if (records[i].type >= TOKEN_EOF || records[i].lexeme >= header->string_count ||
+            (uint64_t)records[i].raw_offset + records[i].raw_length > source_length) {
+            unmap_file(file);
+            return false;
+        }
+    }
+
+    Atom* atoms = malloc((header->string_count + 1) * sizeof(Atom));
+    for (uint32_t i = 0; i < header->string_count; i++) {
+        atoms[i] = intern_text(pool, blob + strings[i].offset, strings[i].length, INTERN_BORROW);
+    }
+    if (symbols) symbols->text = source;
+    if (parse_tokens) parse_tokens->text = source;
+    for (uint32_t i = 0; i < header->token_count; i++) {
+        Token token = make_token((TokenType)records[i].type, atoms[records[i].lexeme],
+                                 records[i].raw_offset, records[i].raw_length,
+                                 (int)records[i].line, (int)records[i].column);
+        if (symbols) token_list_add(symbols, token);
+        if (parse_tokens && token.type != COMMENT) token_list_add(parse_tokens, token);
+    }
+    free(atoms);
+    return true;
 }
 
-static void switch_statement(Parser* parser) {
-    enter_node(parser, "SwitchStatement");
-    consume(parser, LEFT_PAREN, "Expect '(' after 'switch'.");
-    expression(parser);
-    consume(parser, RIGHT_PAREN, "Expect ')' after switch expression.");
-    consume(parser, LEFT_BRACE, "Expect '{' before switch cases.");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-        if (match(parser, CASE)) {
-            enter_node(parser, "CaseClause");
-            expression(parser);
-            consume(parser, COLON, "Expect ':' after case expression.");
-            while (!check(parser, CASE) && !check(parser, DEFAULT) && !check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-                statement(parser);
+/* ============================================================================
+ * INCREMENTAL DOCUMENTS
+ * ============================================================================
+ * The library behind cythonic.h. A document keeps its text as lines, each
+ * with the tokens that start on it, and its tree as one unit per top-level
+ * statement: the lines that statement's tokens span, its tree and its error
+ * messages. An edit replaces a run of lines, re-lexes from the first of them
+ * until a line starts outside every token both before and after the change,
+ * and re-parses only the units holding tokens that changed.
+ *
+ * Units below an edit keep their trees. `shift` records how far each has
+ * moved since it was parsed, and its tree is renumbered only when the script
+ * runs. Replaced trees stay in the arena until the document has parsed twice
+ * its own size into it, when a full parse starts a fresh one.
+ */
+
+#define DOC_SYNC_LINES 4          // Lines lexed past an edit on the first try; four times more per retry
+#define DOC_MIN_COMPACT 65536     // Tokens parsed before a full parse is worth reclaiming memory for
+
+typedef struct {
+    char* text;          // Without its newline; owned
+    int length;
+    Token* tokens;       // Tokens starting on this line, comments included; offsets from the line start
+    int token_count;
+    bool continued;      // Starts inside a token from an earlier line
+} DocLine;
+
+typedef struct {
+    int line;            // 1-based, numbered as when the unit was parsed; 0 at the end of the text
+    int column;
+    char* text;          // One compiler message, without its position or newline
+} DocMessage;
+
+typedef struct {
+    int first_line;      // 0-based lines the statement's tokens span, numbered as now
+    int last_line;
+    int shift;           // Lines the unit has moved since it was parsed
+    Stmt* stmt;          // NULL for type declarations and statements that failed to parse
+    DocMessage* messages;
+    int message_count;
+} DocUnit;
+
+struct CythonicDocument {
+    DocLine* lines;
+    int line_count;
+    int line_capacity;
+    DocUnit* units;      // In source order
+    int unit_count;
+    int unit_capacity;
+    Interner names;
+    Arena ast;           // Every unit's tree, and those re-parses replaced
+    long parsed_tokens;  // Parsed into `ast` since it was started
+    long token_count;    // Tokens the parser sees in the whole document
+    CythonicEditStats last;
+};
+
+static char* doc_copy(const char* text, size_t length) {
+    char* copy = malloc(length + 1);
+    if (length) memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static void doc_reserve_lines(CythonicDocument* doc, int count) {
+    if (doc->line_capacity >= count) return;
+    int capacity = doc->line_capacity < 64 ? 64 : doc->line_capacity;
+    while (capacity < count) capacity *= 2;
+    doc->lines = realloc(doc->lines, capacity * sizeof(DocLine));
+    doc->line_capacity = capacity;
+}
+
+static void doc_unit_free(DocUnit* unit) {
+    for (int i = 0; i < unit->message_count; i++) free(unit->messages[i].text);
+    free(unit->messages);
+}
+
+// Lexes from the start of line `from`, which begins outside any token, up to
+// the first line at or after `until` that begins outside every token both
+// now and as lexed before. Returns that line, or line_count when lexing ran
+// to the end. `fresh` receives the tokens of the lines in between, with
+// `line` set to their 0-based line and offsets from that line's start;
+// `continued` their new flags, indexed from `from`.
+static int doc_relex(CythonicDocument* doc, int from, int until, TokenList* fresh, bool** continued) {
+    int extra = DOC_SYNC_LINES;
+    for (;;) {
+        int end = extra >= doc->line_count - until ? doc->line_count : until + extra;
+        size_t size = 0;
+        for (int i = from; i < end; i++) size += doc->lines[i].length + 1;
+        char* window = malloc(size + 1);
+        size_t* starts = malloc((end - from + 1) * sizeof(size_t));
+        size_t at = 0;
+        for (int i = from; i < end; i++) {
+            starts[i - from] = at;
+            if (doc->lines[i].length) memcpy(window + at, doc->lines[i].text, doc->lines[i].length);
+            at += doc->lines[i].length;
+            if (i < doc->line_count - 1) window[at++] = '\n';
+        }
+        starts[end - from] = at;
+        window[at] = '\0';
+
+        Arena arena = {0};
+        TokenList tokens = {0};
+        tokens.arena = &arena;
+        lex_all(lexer_create(window, &doc->names, &arena), &tokens, NULL);
+
+        bool* flags = calloc(end - from, sizeof(bool));
+        int sync = end;
+        size_t reach = 0;            // End of the furthest-reaching token so far
+        int t = 0;
+        for (int i = from + 1; i < end; i++) {
+            size_t start = starts[i - from];
+            for (; t < tokens.count && tokens.spans[t].offset < start; t++) {
+                size_t token_end = tokens.spans[t].offset + tokens.spans[t].length;
+                if (token_end > reach) reach = token_end;
             }
-            exit_node(parser, "CaseClause");
-        } else if (match(parser, DEFAULT)) {
-            enter_node(parser, "DefaultClause");
-            consume(parser, COLON, "Expect ':' after default.");
-            while (!check(parser, CASE) && !check(parser, DEFAULT) && !check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-                statement(parser);
+            flags[i - from] = reach >= start;    // A token holding the newline before this line may grow into it
+            if (i >= until && !flags[i - from] && !doc->lines[i].continued) {
+                sync = i;
+                break;
+            }
+        }
+
+        if (sync < end || end == doc->line_count) {
+            for (int i = 0; i < tokens.count; i++) {
+                Token token = token_at(&tokens, i);
+                int line = from + token.line - 1;
+                if (line >= sync) break;
+                token.offset -= (uint32_t)starts[line - from];
+                token.line = line;
+                token_list_add(fresh, token);
             }
-            exit_node(parser, "DefaultClause");
+            *continued = flags;
         } else {
-            error(parser, "Expect 'case' or 'default' inside switch.");
-            advance(parser);
+            free(flags);
         }
+        arena_free(&arena);
+        free(starts);
+        free(window);
+        if (sync < end || end == doc->line_count) return sync;
+        extra *= 4;
     }
-    consume(parser, RIGHT_BRACE, "Expect '}' after switch body.");
-    exit_node(parser, "SwitchStatement");
 }
 
-static void do_while_statement(Parser* parser) {
-    enter_node(parser, "DoWhileStatement");
-    int loop_start = parser->current_index - 2;
-    consume(parser, LEFT_BRACE, "Expect '{' after 'do'.");
-    
-    bool first = true;
-    while(1) {
-        if (!first) {
-            jump_to(parser, loop_start);
-            consume(parser, LEFT_BRACE, "msg"); // Re-consume
-            parser->trace_parse = false;
+// Gives lines [from, sync) the tokens doc_relex found for them.
+static void doc_install(CythonicDocument* doc, int from, int sync, const TokenList* fresh, const bool* continued) {
+    int t = 0;
+    for (int i = from; i < sync; i++) {
+        DocLine* line = &doc->lines[i];
+        free(line->tokens);
+        line->tokens = NULL;
+        int first = t;
+        while (t < fresh->count && fresh->positions[t].line == i) t++;
+        line->token_count = t - first;
+        if (line->token_count) {
+            line->tokens = malloc(line->token_count * sizeof(Token));
+            for (int k = 0; k < line->token_count; k++) line->tokens[k] = token_at(fresh, first + k);
         }
-        
-        // Execute block
-        while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) statement(parser);
-        consume(parser, RIGHT_BRACE, "Expect '}' after block.");
-        
-        if (check(parser, RESERVED_WORD) && strcmp(parser->current_token.lexeme, "while") == 0) {
-            advance(parser);
-        } else {
-            error(parser, "Expect 'while' after do-block.");
+        if (i > from) line->continued = continued[i - from];
+    }
+}
+
+// First parser token on a line in [first, last], or NULL
+static const Token* doc_first_token(const CythonicDocument* doc, int first, int last) {
+    for (int i = first < 0 ? 0 : first; i <= last && i < doc->line_count; i++) {
+        const DocLine* line = &doc->lines[i];
+        for (int t = 0; t < line->token_count; t++) {
+            if (line->tokens[t].type != COMMENT) return &line->tokens[t];
         }
-        
-        consume(parser, LEFT_PAREN, "Expect '(' after 'while'.");
-        Value cond = expression(parser);
-        consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
-        consume(parser, SEMICOLON, "Expect ';' after do-while.");
-        
-        if (parser->executing) {
-            bool b = (cond.type == VAL_BOOL) ? cond.as.bool_val : (cond.as.int_val != 0);
-            if (!b) break;
-        } else {
+    }
+    return NULL;
+}
+
+// Last parser token on a line in [first, last], or NULL
+static const Token* doc_last_token(const CythonicDocument* doc, int first, int last) {
+    for (int i = last >= doc->line_count ? doc->line_count - 1 : last; i >= first && i >= 0; i--) {
+        const DocLine* line = &doc->lines[i];
+        for (int t = line->token_count - 1; t >= 0; t--) {
+            if (line->tokens[t].type != COMMENT) return &line->tokens[t];
+        }
+    }
+    return NULL;
+}
+
+// Whether a statement ending in `before` may go on into `after`: an if's
+// else, or a record's visibility ahead of the keyword.
+static bool doc_joins(const Token* before, const Token* after) {
+    if (!before || !after) return false;
+    if (after->type == RESERVED_WORD && after->atom == ATOM_ELSE) return true;
+    return (before->type == PUB || before->type == PRIV) && after->type == RECORD;
+}
+
+// Parses lines [first, last] as a run of top-level statements into `units`.
+// Returns whether the parser ran out of tokens, when the following lines may
+// belong to the last statement.
+static bool doc_parse_lines(CythonicDocument* doc, int first, int last, DocUnit** units, int* count, int* tokens) {
+    // The text runs on over lines the last tokens spill into, for messages quoting them
+    int text_last = last;
+    while (text_last + 1 < doc->line_count && doc->lines[text_last + 1].continued) text_last++;
+    Arena scratch = {0};
+    size_t size = 0;
+    for (int i = first; i <= text_last; i++) size += doc->lines[i].length + 1;
+    char* text = arena_alloc(&scratch, size + 1);
+    TokenList list = {0};
+    list.arena = &scratch;
+    list.text = text;
+    size_t at = 0;
+    for (int i = first; i <= text_last; i++) {
+        const DocLine* line = &doc->lines[i];
+        if (line->length) memcpy(text + at, line->text, line->length);
+        for (int t = 0; i <= last && t < line->token_count; t++) {
+            Token token = line->tokens[t];
+            if (token.type == COMMENT) continue;
+            token.offset += (uint32_t)at;
+            token.line = i + 1;
+            token_list_add(&list, token);
+        }
+        at += line->length;
+        text[at++] = '\n';
+    }
+    text[at] = '\0';
+
+    Diagnostics diag = {0};
+    diag.buffered = true;
+    Parser* parser = parser_create(&list, &doc->names, &doc->ast);
+    parser->diagnostics = &diag;
+    int capacity = 0;
+    *units = NULL;
+    *count = 0;
+    while (!check(parser, TOKEN_EOF)) {
+        DocUnit unit = {0};
+        unit.first_line = token_pos(parser, parser->current).line - 1;
+        size_t mark = diag.length;
+        unit.stmt = statement(parser);
+        unit.last_line = token_pos(parser, parser->previous).line - 1;
+        if (unit.last_line < unit.first_line) unit.last_line = unit.first_line;
+
+        // Each message the statement reported, "[line L:C] " split off. A
+        // message quoting a token can span lines, so one ends only where a
+        // line starts the next.
+        for (size_t i = mark; i < diag.length;) {
+            const char* line = diag.text + i;
+            size_t length = 0;
+            while (i + length < diag.length &&
+                   !(line[length] == '\n' && (i + length + 1 == diag.length ||
+                                              strncmp(line + length + 1, "[line ", 6) == 0))) length++;
+            DocMessage message = {0, 0, NULL};
+            int skip = 0;
+            if (sscanf(line, "[line %d:%d] %n", &message.line, &message.column, &skip) != 2 || !skip) skip = 0;
+            message.text = doc_copy(line + skip, length - skip);
+            unit.messages = realloc(unit.messages, (unit.message_count + 1) * sizeof(DocMessage));
+            unit.messages[unit.message_count++] = message;
+            i += length + 1;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            *units = realloc(*units, capacity * sizeof(DocUnit));
+        }
+        (*units)[(*count)++] = unit;
+    }
+    bool ran_out = parser->ran_out;
+    *tokens = list.count;
+    doc->parsed_tokens += list.count;
+    diag_free(&diag);
+    arena_free(&scratch);
+    return ran_out;
+}
+
+// Replaces units [u0, u1) with `units[0, count)`.
+static void doc_splice_units(CythonicDocument* doc, int u0, int u1, DocUnit* units, int count) {
+    for (int i = u0; i < u1; i++) doc_unit_free(&doc->units[i]);
+    int total = doc->unit_count - (u1 - u0) + count;
+    if (total > doc->unit_capacity) {
+        int capacity = doc->unit_capacity < 64 ? 64 : doc->unit_capacity;
+        while (capacity < total) capacity *= 2;
+        doc->units = realloc(doc->units, capacity * sizeof(DocUnit));
+        doc->unit_capacity = capacity;
+    }
+    if (doc->unit_count > u1) {
+        memmove(doc->units + u0 + count, doc->units + u1, (doc->unit_count - u1) * sizeof(DocUnit));
+    }
+    if (count) memcpy(doc->units + u0, units, count * sizeof(DocUnit));
+    doc->unit_count = total;
+}
+
+static void doc_parse_all(CythonicDocument* doc) {
+    doc_splice_units(doc, 0, doc->unit_count, NULL, 0);
+    arena_free(&doc->ast);
+    doc->parsed_tokens = 0;
+    DocUnit* units;
+    int count, tokens;
+    doc_parse_lines(doc, 0, doc->line_count - 1, &units, &count, &tokens);
+    doc_splice_units(doc, 0, 0, units, count);
+    free(units);
+    doc->last.full_parse = true;
+    doc->last.statements_reparsed = count;
+    doc->last.tokens_reparsed = tokens;
+}
+
+// Re-parses the units covering lines [first, last], and as many neighbours
+// as it takes for the result to match a parse of the whole document.
+static void doc_reparse(CythonicDocument* doc, int first, int last) {
+    int u0 = 0, u1 = doc->unit_count;
+    for (int lo = 0, hi = doc->unit_count; lo < hi;) {
+        int mid = lo + (hi - lo) / 2;
+        if (doc->units[mid].last_line < first) lo = u0 = mid + 1;
+        else hi = mid;
+    }
+    for (int lo = u0, hi = doc->unit_count; lo < hi;) {
+        int mid = lo + (hi - lo) / 2;
+        if (doc->units[mid].first_line <= last) lo = mid + 1;
+        else hi = u1 = mid;
+    }
+    if (u1 < u0) u1 = u0;
+
+    bool looked_back = false;
+    for (;;) {
+        // Take in units sharing a line with the range, and ones it may run
+        // into. The unit before it has also looked at its first token, to
+        // end an if without an else or to report an error there.
+        for (bool grew = true; grew;) {
+            grew = false;
+            if (u0 < u1) {
+                if (doc->units[u0].first_line < first) first = doc->units[u0].first_line;
+                if (doc->units[u1 - 1].last_line > last) last = doc->units[u1 - 1].last_line;
+            }
+            if (u0 > 0 && doc->units[u0 - 1].last_line >= first) { u0--; grew = true; continue; }
+            if (u1 < doc->unit_count && doc->units[u1].first_line <= last) { u1++; grew = true; continue; }
+            const Token* before = doc_last_token(doc, 0, first - 1);
+            const Token* start = doc_first_token(doc, first, last);
+            const Token* end = doc_last_token(doc, first, last);
+            const Token* after = doc_first_token(doc, last + 1, doc->line_count - 1);
+            if (u0 > 0 && doc_joins(before, start ? start : after)) { u0--; grew = true; continue; }
+            if (u1 < doc->unit_count && doc_joins(end ? end : before, after)) { u1++; grew = true; continue; }
+            if (!looked_back && u0 > 0) { u0--; grew = true; }
+            looked_back = true;
+        }
+
+        DocUnit* units;
+        int count, tokens;
+        bool ran_out = doc_parse_lines(doc, first, last, &units, &count, &tokens);
+        if (ran_out && u1 < doc->unit_count) {
+            for (int i = 0; i < count; i++) doc_unit_free(&units[i]);
+            free(units);
+            int more = u1 - u0 > 0 ? u1 - u0 : 1;
+            u1 = more >= doc->unit_count - u1 ? doc->unit_count : u1 + more;
+            continue;
+        }
+        doc_splice_units(doc, u0, u1, units, count);
+        free(units);
+        doc->last.statements_reparsed += count;
+        doc->last.tokens_reparsed += tokens;
+        return;
+    }
+}
+
+// --- Renumbering trees to the lines they have moved to ---
+
+static void doc_shift_expr(Expr* expr, int delta) {
+    if (!expr) return;
+    expr->line += delta;
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE: break;
+        case EXPR_UNARY: doc_shift_expr(expr->as.unary.operand, delta); break;
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+            doc_shift_expr(expr->as.binary.right, delta);
+            for (expr = expr->as.binary.left; is_operator_node(expr); expr = expr->as.binary.left) {
+                expr->line += delta;
+                doc_shift_expr(expr->as.binary.right, delta);
+            }
+            doc_shift_expr(expr, delta);
+            break;
+        case EXPR_INCDEC: doc_shift_expr(expr->as.incdec.operand, delta); break;
+    }
+}
+
+static void doc_shift_list(Stmt* stmt, int delta);
+
+static void doc_shift_stmt(Stmt* stmt, int delta) {
+    if (!stmt) return;
+    stmt->line += delta;
+    switch (stmt->kind) {
+        case STMT_EXPRESSION: doc_shift_expr(stmt->as.expression.expr, delta); break;
+        case STMT_DECLARATION: doc_shift_expr(stmt->as.declaration.init, delta); break;
+        case STMT_ASSIGNMENT: doc_shift_expr(stmt->as.assignment.value, delta); break;
+        case STMT_INPUT: break;
+        case STMT_OUTPUT: doc_shift_expr(stmt->as.output.value, delta); break;
+        case STMT_IF:
+            doc_shift_expr(stmt->as.if_stmt.condition, delta);
+            doc_shift_stmt(stmt->as.if_stmt.then_branch, delta);
+            doc_shift_stmt(stmt->as.if_stmt.else_branch, delta);
+            break;
+        case STMT_WHILE:
+            doc_shift_expr(stmt->as.while_stmt.condition, delta);
+            doc_shift_stmt(stmt->as.while_stmt.body, delta);
+            break;
+        case STMT_FOR:
+            doc_shift_stmt(stmt->as.for_stmt.init, delta);
+            doc_shift_expr(stmt->as.for_stmt.condition, delta);
+            doc_shift_expr(stmt->as.for_stmt.increment, delta);
+            doc_shift_stmt(stmt->as.for_stmt.body, delta);
+            break;
+        case STMT_FOREACH:
+            doc_shift_expr(stmt->as.foreach_stmt.collection, delta);
+            doc_shift_stmt(stmt->as.foreach_stmt.body, delta);
+            break;
+        case STMT_DO_WHILE:
+            doc_shift_stmt(stmt->as.do_while.body, delta);
+            doc_shift_expr(stmt->as.do_while.condition, delta);
             break;
+        case STMT_SWITCH:
+            doc_shift_expr(stmt->as.switch_stmt.subject, delta);
+            for (SwitchCase* c = stmt->as.switch_stmt.cases; c; c = c->next) {
+                doc_shift_expr(c->value, delta);
+                doc_shift_list(c->body, delta);
+            }
+            break;
+        case STMT_BLOCK: doc_shift_list(stmt->as.block.body, delta); break;
+        case STMT_RETURN: doc_shift_expr(stmt->as.return_stmt.value, delta); break;
+        case STMT_BREAK:
+        case STMT_NEXT: break;
+    }
+}
+
+static void doc_shift_list(Stmt* stmt, int delta) {
+    for (; stmt; stmt = stmt->next) doc_shift_stmt(stmt, delta);
+}
+
+// --- Public interface (cythonic.h) ---
+
+CythonicDocument* cythonic_document_open(const char* text, size_t length) {
+    CythonicDocument* doc = calloc(1, sizeof(CythonicDocument));
+    if (!doc) return NULL;
+    double start = wall_seconds();
+    interner_init(&doc->names);
+    if (!text) length = 0;
+
+    int count = 1;
+    for (size_t i = 0; i < length; i++) count += text[i] == '\n';
+    doc_reserve_lines(doc, count);
+    size_t line_start = 0;
+    for (size_t i = 0; i <= length; i++) {
+        if (i < length && text[i] != '\n') continue;
+        DocLine* line = &doc->lines[doc->line_count++];
+        memset(line, 0, sizeof(DocLine));
+        line->text = doc_copy(text + line_start, i - line_start);
+        line->length = (int)(i - line_start);
+        line_start = i + 1;
+    }
+
+    // Lexing towards line_count never finds a line to stop at
+    Arena arena = {0};
+    TokenList fresh = {0};
+    fresh.arena = &arena;
+    bool* continued = NULL;
+    doc_relex(doc, 0, doc->line_count, &fresh, &continued);
+    doc_install(doc, 0, doc->line_count, &fresh, continued);
+    for (int i = 0; i < fresh.count; i++) doc->token_count += fresh.types[i] != COMMENT;
+    doc->last.lines_relexed = doc->line_count;
+    doc->last.tokens_relexed = fresh.count;
+    free(continued);
+    arena_free(&arena);
+
+    doc_parse_all(doc);
+    doc->last.seconds = wall_seconds() - start;
+    return doc;
+}
+
+void cythonic_document_close(CythonicDocument* doc) {
+    if (!doc) return;
+    for (int i = 0; i < doc->line_count; i++) {
+        free(doc->lines[i].text);
+        free(doc->lines[i].tokens);
+    }
+    free(doc->lines);
+    for (int i = 0; i < doc->unit_count; i++) doc_unit_free(&doc->units[i]);
+    free(doc->units);
+    arena_free(&doc->ast);
+    interner_free(&doc->names);
+    free(doc);
+}
+
+// Whether two parser tokens are the same, the old one `delta` lines up
+static bool doc_same_token(const TokenList* old, int i, const TokenList* now, int j, int delta) {
+    return old->types[i] == now->types[j] && old->atoms[i] == now->atoms[j] &&
+           old->spans[i].length == now->spans[j].length && old->positions[i].column == now->positions[j].column &&
+           old->positions[i].line + delta == now->positions[j].line;
+}
+
+static void doc_collect(TokenList* list, const DocLine* line, int number) {
+    for (int t = 0; t < line->token_count; t++) {
+        if (line->tokens[t].type == COMMENT) continue;
+        Token token = line->tokens[t];
+        token.line = number;
+        token_list_add(list, token);
+    }
+}
+
+bool cythonic_document_edit(CythonicDocument* doc, int start_line, int start_column,
+                            int end_line, int end_column, const char* text, size_t length) {
+    if (!doc || start_line < 1 || start_line > end_line || end_line > doc->line_count) return false;
+    const DocLine* first = &doc->lines[start_line - 1];
+    const DocLine* last = &doc->lines[end_line - 1];
+    if (start_column < 1 || start_column > first->length + 1 || end_column < 1 || end_column > last->length + 1 ||
+        (start_line == end_line && end_column < start_column)) return false;
+    if (!text) length = 0;
+    double started = wall_seconds();
+    memset(&doc->last, 0, sizeof(CythonicEditStats));
+
+    // Lines a..b become the k lines of prefix + text + suffix
+    int a = start_line - 1, b = end_line - 1;
+    size_t prefix = start_column - 1, suffix = last->length - (end_column - 1);
+    char* joined = malloc(prefix + length + suffix + 1);
+    if (prefix) memcpy(joined, first->text, prefix);
+    if (length) memcpy(joined + prefix, text, length);
+    if (suffix) memcpy(joined + prefix + length, last->text + end_column - 1, suffix);
+    size_t joined_length = prefix + length + suffix;
+    int k = 1;
+    for (size_t i = 0; i < joined_length; i++) k += joined[i] == '\n';
+    int delta = k - (b - a + 1);
+
+    DocLine* removed = malloc((b - a + 1) * sizeof(DocLine));
+    memcpy(removed, doc->lines + a, (b - a + 1) * sizeof(DocLine));
+    bool continued = removed[0].continued;
+    doc_reserve_lines(doc, doc->line_count + delta);
+    memmove(doc->lines + a + k, doc->lines + b + 1, (doc->line_count - b - 1) * sizeof(DocLine));
+    doc->line_count += delta;
+    size_t line_start = 0;
+    for (int i = a; i < a + k; i++) {
+        const char* end = memchr(joined + line_start, '\n', joined_length - line_start);
+        size_t line_end = end ? (size_t)(end - joined) : joined_length;
+        DocLine* line = &doc->lines[i];
+        memset(line, 0, sizeof(DocLine));
+        line->text = doc_copy(joined + line_start, line_end - line_start);
+        line->length = (int)(line_end - line_start);
+        line_start = line_end + 1;
+    }
+    doc->lines[a].continued = continued;
+    free(joined);
+
+    // Units past the edit move with it; units within it span its new lines
+    if (delta) {
+        for (int i = doc->unit_count - 1; i >= 0 && doc->units[i].last_line >= a; i--) {
+            DocUnit* unit = &doc->units[i];
+            if (unit->first_line > b) {
+                unit->first_line += delta;
+                unit->last_line += delta;
+                unit->shift += delta;
+                continue;
+            }
+            if (unit->first_line > a) unit->first_line = a;
+            unit->last_line = unit->last_line > b ? unit->last_line + delta : a + k - 1;
         }
-        first = false;
     }
-    
-    parser->trace_parse = true;
-    exit_node(parser, "DoWhileStatement");
+
+    int from = a;
+    while (from > 0 && doc->lines[from].continued) from--;
+    Arena arena = {0};
+    TokenList fresh = {0};
+    fresh.arena = &arena;
+    bool* flags = NULL;
+    int sync = doc_relex(doc, from, a + k, &fresh, &flags);
+
+    // The parser's tokens over the re-lexed lines, before and after, each
+    // old one numbered as it was
+    TokenList before = {0}, after = {0};
+    before.arena = &arena;
+    after.arena = &arena;
+    for (int i = from; i < a; i++) doc_collect(&before, &doc->lines[i], i);
+    for (int i = a; i <= b; i++) doc_collect(&before, &removed[i - a], i);
+    for (int i = a + k; i < sync; i++) doc_collect(&before, &doc->lines[i], i - delta);
+    for (int i = 0; i < fresh.count; i++) {
+        if (fresh.types[i] != COMMENT) token_list_add(&after, token_at(&fresh, i));
+    }
+    int head = 0, tail = 0;
+    while (head < before.count && head < after.count &&
+           doc_same_token(&before, head, &after, head, 0)) head++;
+    while (tail < before.count - head && tail < after.count - head &&
+           doc_same_token(&before, before.count - 1 - tail, &after, after.count - 1 - tail, delta)) tail++;
+
+    // Lines, as numbered now, holding tokens that changed. A line count
+    // change also re-parses what spans the edit, whose later tokens moved.
+    int changed_first = INT32_MAX, changed_last = -1;
+    if (head < after.count - tail) {
+        changed_first = after.positions[head].line;
+        changed_last = after.positions[after.count - 1 - tail].line;
+    }
+    if (head < before.count - tail) {
+        int old_first = before.positions[head].line, old_last = before.positions[before.count - 1 - tail].line;
+        old_first = old_first < a ? old_first : old_first > b ? old_first + delta : a;
+        old_last = old_last < a ? old_last : old_last > b ? old_last + delta : a + k - 1;
+        if (old_first < changed_first) changed_first = old_first;
+        if (old_last > changed_last) changed_last = old_last;
+    }
+    if (delta) {
+        if (a < changed_first) changed_first = a;
+        if (a + k - 1 > changed_last) changed_last = a + k - 1;
+    }
+
+    doc_install(doc, from, sync, &fresh, flags);
+    for (int i = 0; i <= b - a; i++) {
+        free(removed[i].text);
+        free(removed[i].tokens);
+    }
+    free(removed);
+    free(flags);
+    doc->token_count += after.count - before.count;
+    doc->last.lines_relexed = sync - from;
+    doc->last.tokens_relexed = fresh.count;
+    arena_free(&arena);
+
+    if (doc->parsed_tokens > 2 * doc->token_count + DOC_MIN_COMPACT) doc_parse_all(doc);
+    else if (changed_last >= 0) doc_reparse(doc, changed_first, changed_last);
+    doc->last.seconds = wall_seconds() - started;
+    return true;
 }
 
-static void next_statement(Parser* parser) {
-    enter_node(parser, "NextStatement");
-    consume(parser, SEMICOLON, "Expect ';' after 'next'.");
-    exit_node(parser, "NextStatement");
+char* cythonic_document_text(const CythonicDocument* doc, size_t* length) {
+    size_t size = 0;
+    for (int i = 0; i < doc->line_count; i++) size += doc->lines[i].length + 1;
+    char* text = malloc(size);
+    size_t at = 0;
+    for (int i = 0; i < doc->line_count; i++) {
+        if (doc->lines[i].length) memcpy(text + at, doc->lines[i].text, doc->lines[i].length);
+        at += doc->lines[i].length;
+        if (i < doc->line_count - 1) text[at++] = '\n';
+    }
+    text[at] = '\0';
+    if (length) *length = at;
+    return text;
 }
 
-static void enum_declaration(Parser* parser) {
-    enter_node(parser, "EnumDeclaration");
-    consume(parser, IDENTIFIER, "Expect enum name.");
-    consume(parser, LEFT_BRACE, "Expect '{' before enum members.");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-        consume(parser, IDENTIFIER, "Expect enum member name.");
-        if (match(parser, EQUAL)) {
-            expression(parser);
+int cythonic_document_line_count(const CythonicDocument* doc) {
+    return doc->line_count;
+}
+
+int cythonic_document_tokens(const CythonicDocument* doc, int line, CythonicToken* out, int capacity) {
+    if (line < 1 || line > doc->line_count) return 0;
+    const DocLine* source = &doc->lines[line - 1];
+    for (int i = 0; i < source->token_count && i < capacity; i++) {
+        out[i].type = token_type_to_string(source->tokens[i].type);
+        out[i].line = line;
+        out[i].column = source->tokens[i].column;
+        out[i].length = (int)source->tokens[i].length;
+    }
+    return source->token_count;
+}
+
+int cythonic_document_statement_count(const CythonicDocument* doc) {
+    return doc->unit_count;
+}
+
+bool cythonic_document_statement(const CythonicDocument* doc, int index, CythonicStatement* out) {
+    if (index < 0 || index >= doc->unit_count) return false;
+    const DocUnit* unit = &doc->units[index];
+    out->kind = unit->stmt ? STMT_KIND_NAMES[unit->stmt->kind] : "other";
+    out->line = unit->first_line + 1;
+    out->end_line = unit->last_line + 1;
+    return true;
+}
+
+int cythonic_document_diagnostics(const CythonicDocument* doc, CythonicDiagnostic* out, int capacity) {
+    int count = 0;
+    for (int i = 0; i < doc->unit_count; i++) {
+        const DocUnit* unit = &doc->units[i];
+        for (int m = 0; m < unit->message_count; m++, count++) {
+            if (count >= capacity) continue;
+            const DocMessage* message = &unit->messages[m];
+            bool at_end = message->line == 0;
+            out[count].line = at_end ? doc->line_count : message->line + unit->shift;
+            out[count].column = at_end ? doc->lines[doc->line_count - 1].length + 1 : message->column;
+            out[count].message = message->text;
         }
-        if (match(parser, COMMA)) {} 
-        else break;
     }
-    consume(parser, RIGHT_BRACE, "Expect '}' after enum members.");
-    exit_node(parser, "EnumDeclaration");
+    return count;
 }
 
-static void struct_declaration(Parser* parser) {
-    enter_node(parser, "StructDefinition");
-    consume(parser, IDENTIFIER, "Expect struct name.");
-    consume(parser, LEFT_BRACE, "Expect '{' before struct members.");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-        if (match(parser, TYPE)) {}
-        else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) advance(parser);
-        else error(parser, "Expect type in struct member.");
-        
-        consume(parser, IDENTIFIER, "Expect member name.");
-        consume(parser, SEMICOLON, "Expect ';' after member.");
+void cythonic_document_last_edit(const CythonicDocument* doc, CythonicEditStats* out) {
+    *out = doc->last;
+}
+
+bool cythonic_document_run(CythonicDocument* doc, bool use_vm) {
+    StmtList body = {0};
+    for (int i = 0; i < doc->unit_count; i++) {
+        DocUnit* unit = &doc->units[i];
+        if (unit->message_count) return false;
+        if (unit->shift) {
+            doc_shift_stmt(unit->stmt, unit->shift);
+            unit->shift = 0;
+        }
+        stmt_list_append(&body, unit->stmt);
     }
-    consume(parser, RIGHT_BRACE, "Expect '}' after struct members.");
-    exit_node(parser, "StructDefinition");
+    Program program = { body.head, 0, &doc->names };
+    output_open(false);
+    resolve_program(&program);
+    layout_frame(&program);
+    if (use_vm) {
+        Chunk chunk;
+        compile_program(&program, &chunk);
+        vm_run(&chunk, false, NULL);
+        chunk_free(&chunk);
+    } else {
+        interpret(&program, &doc->ast, NULL);
+    }
+    return true;
 }
 
-static void record_declaration(Parser* parser) {
-    enter_node(parser, "RecordDeclaration");
-    consume(parser, IDENTIFIER, "Expect record name.");
-    consume(parser, LEFT_BRACE, "Expect '{' before record members.");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-        if (match(parser, REQ)) {}
-        
-        if (match(parser, TYPE)) {}
-        else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) advance(parser);
-        else error(parser, "Expect type in record member.");
-        
-        consume(parser, IDENTIFIER, "Expect member name.");
-        
-        if (match(parser, EQUAL)) {
-            expression(parser);
+/* ============================================================================
+ * MAIN
+ * ============================================================================
+ * Left out when built with -DCYTHONIC_NO_MAIN, so a benchmark or harness can
+ * include this file and drive the phases itself.
+ */
+
+#ifndef CYTHONIC_NO_MAIN
+
+typedef struct {
+    char** inputs;       // Source files, directories already expanded
+    int input_count;
+    bool batch;          // More than one input, or a directory: check every file on a pool
+    bool use_vm;         // --vm: run compiled bytecode instead of walking the AST
+    bool jit;            // --jit: compile hot VM loops to native code (implies --vm)
+    bool unbuffered;     // --unbuffered: write each printed line at once
+    bool profile;        // --profile: write <source>.profile.txt and <source>.folded.txt
+    bool profile_counts; // --profile-counts: count as well (implies --profile)
+    bool stats;          // --stats: print each phase's time and the compiler's counters
+    bool stats_json;     // --stats-json: write them to <source>.stats.json
+    bool direct;         // --direct: hand tokens to the parser in memory, not via the symbol table file
+    bool symbol_table;   // Cleared by --no-symbol-table (which implies --direct)
+    bool token_cache;    // --cache: reuse <source>.cythotok when the source is unchanged (implies --direct)
+    bool parse_tree;     // Cleared by --no-parse-tree
+    bool binary_trace;   // --binary-trace: write <source>.parsetrace instead of the text tree
+    bool print_trace;    // --print-trace: print <source>.parsetrace as text; nothing is compiled
+    int opt_level;       // -O[N]: optimize the tree before running it
+    int max_tokens;      // --max-tokens N: refuse to parse a source of more tokens; 0 for no limit
+    int jobs;            // -j N: lex on up to N threads, in batch mode compile N files at once,
+                         // or as a server serve N connections at once
+    const char* server;  // --server PATH: serve compile requests on this Unix socket
+    const char* client;  // --client PATH: have the server there compile and run the inputs
+    bool send_paths;     // --send-paths: with --client, send file names for the server to read
+    bool stop_server;    // --shutdown: with --client, stop the server once the inputs are done
+} Options;
+
+static void print_usage(const char* program) {
+    printf("Usage: %s [options] <source-file.cytho>...\n", program);
+    printf("       %s [options] <directory>\n", program);
+    printf("Options:\n");
+    printf("  --vm               Execute on the bytecode virtual machine\n");
+    printf("  --jit              Also compile hot loops to native code (x86-64; implies --vm)\n");
+    printf("  --unbuffered       Write each line the program prints at once, as on a\n");
+    printf("                     terminal, instead of buffering the output\n");
+    printf("  --profile          Sample the run's time by source line; writes the report\n");
+    printf("                     to <source>.profile.txt and folded stacks for flame\n");
+    printf("                     graphs to <source>.folded.txt (turns off --jit)\n");
+    printf("  --profile-counts   Also count the statements or instructions each line runs,\n");
+    printf("                     and on the VM each opcode and opcode pair (much slower)\n");
+    printf("  --stats            Print the wall and CPU time of each phase, the token rate,\n");
+    printf("                     memory use and the parser's and resolver's counters\n");
+    printf("  --stats-json       Write the same to <source>.stats.json\n");
+    printf("  --direct           Parse the lexer's tokens in memory; the symbol table\n");
+    printf("                     is written in the background\n");
+    printf("  --no-symbol-table  Do not write the symbol table (implies --direct)\n");
+    printf("  --cache            Load tokens from <source>.cythotok when the source is\n");
+    printf("                     unchanged, otherwise lex and write it (implies --direct)\n");
+    printf("  --no-parse-tree    Do not trace the parse at all\n");
+    printf("  --binary-trace     Write the parse as a compact binary trace,\n");
+    printf("                     <source>.parsetrace, instead of the text tree\n");
+    printf("  --print-trace      Print <source>.parsetrace as the text tree and exit\n");
+    printf("  -O[N]              Optimize before running: 1 folds constants and prunes\n");
+    printf("                     dead code, 2 also propagates constants (-O is -O1)\n");
+    printf("  --max-tokens N     Do not parse a source of more than N tokens\n");
+    printf("  -j N               Lex large sources on up to N threads (default 1); with\n");
+    printf("                     several files, compile N at once (default: all cores)\n");
+    printf("  --server SOCKET    Stay running and compile what clients send over the Unix\n");
+    printf("                     socket SOCKET, on -j workers (default: all cores)\n");
+    printf("  --client SOCKET    Have that server compile and run each file, printing its\n");
+    printf("                     output and messages; stdin goes to every file's input()\n");
+    printf("  --send-paths       With --client, send file names for the server to read,\n");
+    printf("                     under its own options, rather than the files' text\n");
+    printf("  --shutdown         With --client, stop the server afterwards\n");
+    printf("Several files, or every .cytho file in a directory, are lexed and parsed\n");
+    printf("side by side and summarized; they are not executed.\n");
+}
+
+static char* path_with_suffix(const char* path, const char* suffix) {
+    char* result = malloc(strlen(path) + strlen(suffix) + 1);
+    strcpy(result, path);
+    strcat(result, suffix);
+    return result;
+}
+
+static bool has_cytho_suffix(const char* path) {
+    const char* suffix = ".cytho";
+    size_t length = strlen(path);
+    size_t suffix_len = strlen(suffix);
+    return length >= suffix_len && strcmp(path + length - suffix_len, suffix) == 0;
+}
+
+static char* path_join(const char* directory, const char* name) {
+    size_t length = strlen(directory);
+    bool slash = length > 0 && (directory[length - 1] == '/' || directory[length - 1] == '\\');
+    char* path = malloc(length + strlen(name) + 2);
+    sprintf(path, slash ? "%s%s" : "%s/%s", directory, name);
+    return path;
+}
+
+static void add_input(Options* options, char* path, int* capacity) {
+    if (options->input_count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        options->inputs = realloc(options->inputs, *capacity * sizeof(char*));
+    }
+    options->inputs[options->input_count++] = path;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Adds every .cytho file directly inside `directory`, sorted by name
+static bool add_directory_inputs(Options* options, const char* directory, int* capacity) {
+    int first = options->input_count;
+#ifdef _WIN32
+    char* pattern = path_join(directory, "*.cytho");
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst(pattern, &entry);
+    free(pattern);
+    if (handle != -1) {
+        do {
+            if (!(entry.attrib & _A_SUBDIR) && has_cytho_suffix(entry.name)) {
+                add_input(options, path_join(directory, entry.name), capacity);
+            }
+        } while (_findnext(handle, &entry) == 0);
+        _findclose(handle);
+    }
+#else
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory '%s'\n", directory);
+        return false;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !has_cytho_suffix(entry->d_name)) continue;
+        char* path = path_join(directory, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) add_input(options, path, capacity);
+        else free(path);
+    }
+    closedir(dir);
+#endif
+    qsort(options->inputs + first, options->input_count - first, sizeof(char*), compare_paths);
+    return true;
+}
+
+static bool is_directory(const char* path) {
+    struct stat st;
+#ifdef _WIN32
+    return stat(path, &st) == 0 && (st.st_mode & _S_IFDIR);
+#else
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+static bool parse_options(int argc, char** argv, Options* options) {
+    memset(options, 0, sizeof(Options));
+    options->symbol_table = true;
+    options->parse_tree = true;
+    int capacity = 0;
+    int paths = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "-O", 2) == 0) {
+            // -O or -ON; levels above 2 are treated as 2
+            char* end;
+            long level = arg[2] ? strtol(arg + 2, &end, 10) : 1;
+            if (arg[2] && (*end != '\0' || level < 0)) {
+                fprintf(stderr, "Error: -O expects a level such as -O1 or -O2\n");
+                return false;
+            }
+            options->opt_level = level < 2 ? (int)level : 2;
         }
-        
-        consume(parser, SEMICOLON, "Expect ';' after member.");
+        else if (strncmp(arg, "-j", 2) == 0) {
+            // -j N or -jN
+            const char* count = arg[2] ? arg + 2 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            long jobs = strtol(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || jobs < 1) {
+                fprintf(stderr, "Error: -j expects a thread count of at least 1\n");
+                return false;
+            }
+            options->jobs = jobs < LEX_MAX_JOBS ? (int)jobs : LEX_MAX_JOBS;
+        }
+        else if (strcmp(arg, "--max-tokens") == 0) {
+            char* end;
+            long limit = i + 1 < argc ? strtol(argv[++i], &end, 10) : 0;
+            if (limit < 1 || limit > INT_MAX || *end != '\0') {
+                fprintf(stderr, "Error: --max-tokens expects a count of at least 1\n");
+                return false;
+            }
+            options->max_tokens = (int)limit;
+        }
+        else if (strcmp(arg, "--vm") == 0) options->use_vm = true;
+        else if (strcmp(arg, "--jit") == 0) options->use_vm = options->jit = true;
+        else if (strcmp(arg, "--unbuffered") == 0) options->unbuffered = true;
+        else if (strcmp(arg, "--profile") == 0) options->profile = true;
+        else if (strcmp(arg, "--profile-counts") == 0) options->profile = options->profile_counts = true;
+        else if (strcmp(arg, "--stats") == 0) options->stats = true;
+        else if (strcmp(arg, "--stats-json") == 0) options->stats_json = true;
+        else if (strcmp(arg, "--direct") == 0) options->direct = true;
+        else if (strcmp(arg, "--no-symbol-table") == 0) options->symbol_table = false, options->direct = true;
+        else if (strcmp(arg, "--cache") == 0) options->token_cache = true, options->direct = true;
+        else if (strcmp(arg, "--no-parse-tree") == 0) options->parse_tree = false;
+        else if (strcmp(arg, "--binary-trace") == 0) options->binary_trace = true;
+        else if (strcmp(arg, "--print-trace") == 0) options->print_trace = true;
+        else if (strcmp(arg, "--server") == 0 || strcmp(arg, "--client") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s expects a socket path\n", arg);
+                return false;
+            }
+            if (arg[2] == 's') options->server = argv[++i];
+            else options->client = argv[++i];
+        }
+        else if (strcmp(arg, "--send-paths") == 0) options->send_paths = true;
+        else if (strcmp(arg, "--shutdown") == 0) options->stop_server = true;
+        else if (arg[0] == '-' && arg[1] == '-') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            return false;
+        }
+        else if (is_directory(arg)) {
+            if (!add_directory_inputs(options, arg, &capacity)) return false;
+            options->batch = true;
+            paths++;
+        }
+        else {
+            add_input(options, path_with_suffix(arg, ""), &capacity);
+            paths++;
+        }
+    }
+    if (paths > 1) options->batch = true;
+    if (options->batch && options->input_count == 0) {
+        fprintf(stderr, "Error: No .cytho files found\n");
+        return false;
+    }
+    if (options->server && (paths > 0 || options->client)) {
+        fprintf(stderr, "Error: --server takes no source files; send them with --client\n");
+        return false;
+    }
+    return paths > 0 || options->server || (options->client && options->stop_server);
+}
+
+static void options_free(Options* options) {
+    for (int i = 0; i < options->input_count; i++) free(options->inputs[i]);
+    free(options->inputs);
+}
+
+// NUL-terminated; NULL if the file cannot be opened
+static char* read_source_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = malloc(file_size + 1);
+    size_t bytes_read = fread(source, 1, file_size, file);
+    source[bytes_read] = '\0';
+    fclose(file);
+    *length = bytes_read;
+    return source;
+}
+
+typedef enum {
+    COMPILE_OK,
+    COMPILE_SYNTAX_ERROR,  // Parsed, with errors
+    COMPILE_FAILED         // Not parsed at all: bad name, unreadable file or symbol table
+} CompileStatus;
+
+typedef struct {
+    CompileStatus status;
+    int tokens;          // Tokens handed to the parser
+} CompileResult;
+
+// Where compile_file gets what it would otherwise read and allocate itself
+typedef struct {
+    const char* text;    // The source, instead of reading the file; the name needs no .cytho suffix
+    size_t length;
+    Arena* token_arena;  // Arenas to reset and keep rather than free, instead of fresh ones
+    Arena* ast_arena;
+} CompileSource;
+
+// --- Compile Stats ---
+// --stats prints, and --stats-json writes to <source>.stats.json, the time
+// each phase took: on the wall clock, and in CPU time, the process's, so on
+// every thread. A symbol table written in the background has its wall time
+// only. Then the token rate, the parser's error recoveries and the
+// resolver's lookups, with the memory the process's arenas took, which in
+// batch mode covers every file so far.
+
+#define PHASE_LIST(X) \
+    X(READ, "read") \
+    X(LEX, "lex") \
+    X(SYMBOL_TABLE_WRITE, "symbol_table_write") \
+    X(SYMBOL_TABLE_READ, "symbol_table_read") \
+    X(PARSE, "parse") \
+    X(RESOLVE, "resolve") \
+    X(OPTIMIZE, "optimize") \
+    X(BYTECODE, "bytecode") \
+    X(RUN, "run")
+
+typedef enum {
+#define X(name, text) PHASE_##name,
+    PHASE_LIST(X)
+#undef X
+    PHASE_COUNT
+} Phase;
+
+static const char* const PHASE_NAMES[PHASE_COUNT] = {
+#define X(name, text) text,
+    PHASE_LIST(X)
+#undef X
+};
+
+typedef struct {
+    bool ran[PHASE_COUNT];
+    double wall[PHASE_COUNT];    // Seconds
+    double cpu[PHASE_COUNT];     // Seconds; negative when unmeasured
+    double wall_start;           // Of the phase being timed
+    clock_t cpu_start;
+    size_t source_bytes;
+    int tokens;
+    int recoveries;
+    int skipped_tokens;
+    ResolveStats resolve;
+    int variables;               // Slots the resolver handed out, one per variable
+    int frame_slots;             // What layout_frame packed them into
+} CompileStats;
+
+static void phase_begin(CompileStats* stats) {
+    stats->wall_start = wall_seconds();
+    stats->cpu_start = clock();
+}
+
+static void phase_end(CompileStats* stats, Phase phase) {
+    stats->ran[phase] = true;
+    stats->wall[phase] += wall_seconds() - stats->wall_start;
+    stats->cpu[phase] += (double)(clock() - stats->cpu_start) / CLOCKS_PER_SEC;
+}
+
+// Bytes, 0 where unknown
+static uint64_t peak_rss_bytes(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static void print_stats(Diagnostics* diag, const CompileStats* stats, const char* path) {
+    double wall_total = 0, cpu_total = 0;
+    diag_info(diag, "Stats for %s:\n  %-20s %12s %12s\n", path, "phase", "wall ms", "cpu ms");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (!stats->ran[phase]) continue;
+        wall_total += stats->wall[phase];
+        if (stats->cpu[phase] >= 0) {
+            cpu_total += stats->cpu[phase];
+            diag_info(diag, "  %-20s %12.3f %12.3f\n", PHASE_NAMES[phase], stats->wall[phase] * 1e3, stats->cpu[phase] * 1e3);
+        } else {
+            diag_info(diag, "  %-20s %12.3f %12s\n", PHASE_NAMES[phase], stats->wall[phase] * 1e3, "-");
+        }
+    }
+    diag_info(diag, "  %-20s %12.3f %12.3f\n", "total", wall_total * 1e3, cpu_total * 1e3);
+    double lex_seconds = stats->ran[PHASE_LEX] ? stats->wall[PHASE_LEX] : 0;
+    diag_info(diag, "  tokens: %d from %zu bytes, %.2f M tokens/s lexing\n", stats->tokens, stats->source_bytes,
+              lex_seconds > 0 ? stats->tokens / lex_seconds / 1e6 : 0.0);
+    diag_info(diag, "  arena memory: %.2f MB allocated in %llu blocks, peak %.2f MB live; peak RSS %.2f MB\n",
+              atomic_load(&arena_usage.allocated) / 1e6, (unsigned long long)atomic_load(&arena_usage.blocks),
+              atomic_load(&arena_usage.peak) / 1e6, peak_rss_bytes() / 1e6);
+    diag_info(diag, "  parser: %d error recoveries, %d tokens skipped\n", stats->recoveries, stats->skipped_tokens);
+    const ResolveStats* r = &stats->resolve;
+    diag_info(diag, "  resolver: %d lookups (%d unbound), average chain %.2f, longest %d; "
+              "%d declarations, scopes %d deep\n",
+              r->lookups, r->unbound, r->lookups > r->unbound ? (double)r->chains / (r->lookups - r->unbound) : 0.0,
+              r->longest_chain, r->declarations, r->deepest_scope);
+    diag_info(diag, "  frame: %d slots for %d variables\n", stats->frame_slots, stats->variables);
+}
+
+static void write_json_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(file, "\\%c", *p);
+        else if (*p < 0x20) fprintf(file, "\\u%04x", *p);
+        else fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+// The counters of print_stats as one JSON object, times in milliseconds
+static bool write_stats_json(const CompileStats* stats, const char* path, CompileStatus status, const char* json_path) {
+    FILE* file = fopen(json_path, "w");
+    if (!file) return false;
+    static const char* const STATUS_NAMES[] = { "ok", "syntax_error", "failed" };
+    fprintf(file, "{\n  \"file\": ");
+    write_json_string(file, path);
+    fprintf(file, ",\n  \"status\": \"%s\",\n  \"phases\": {", STATUS_NAMES[status]);
+    const char* separator = "\n";
+    double wall_total = 0;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (!stats->ran[phase]) continue;
+        wall_total += stats->wall[phase];
+        fprintf(file, "%s    \"%s\": { \"wall_ms\": %.6f, \"cpu_ms\": ", separator, PHASE_NAMES[phase], stats->wall[phase] * 1e3);
+        if (stats->cpu[phase] >= 0) fprintf(file, "%.6f }", stats->cpu[phase] * 1e3);
+        else fprintf(file, "null }");
+        separator = ",\n";
     }
-    consume(parser, RIGHT_BRACE, "Expect '}' after record members.");
-    exit_node(parser, "RecordDeclaration");
+    double lex_seconds = stats->ran[PHASE_LEX] ? stats->wall[PHASE_LEX] : 0;
+    const ResolveStats* r = &stats->resolve;
+    fprintf(file, "\n  },\n  \"wall_ms\": %.6f,\n", wall_total * 1e3);
+    fprintf(file, "  \"source_bytes\": %zu,\n  \"tokens\": %d,\n  \"tokens_per_second\": %.0f,\n",
+            stats->source_bytes, stats->tokens, lex_seconds > 0 ? stats->tokens / lex_seconds : 0.0);
+    fprintf(file, "  \"arena\": { \"allocated_bytes\": %llu, \"blocks\": %llu, \"peak_bytes\": %llu },\n",
+            (unsigned long long)atomic_load(&arena_usage.allocated), (unsigned long long)atomic_load(&arena_usage.blocks),
+            (unsigned long long)atomic_load(&arena_usage.peak));
+    fprintf(file, "  \"peak_rss_bytes\": %llu,\n", (unsigned long long)peak_rss_bytes());
+    fprintf(file, "  \"parser\": { \"recoveries\": %d, \"skipped_tokens\": %d },\n", stats->recoveries, stats->skipped_tokens);
+    fprintf(file, "  \"resolver\": { \"lookups\": %d, \"unbound\": %d, \"average_chain\": %.4f, \"longest_chain\": %d, "
+            "\"declarations\": %d, \"deepest_scope\": %d },\n",
+            r->lookups, r->unbound, r->lookups > r->unbound ? (double)r->chains / (r->lookups - r->unbound) : 0.0,
+            r->longest_chain, r->declarations, r->deepest_scope);
+    fprintf(file, "  \"frame\": { \"slots\": %d, \"variables\": %d }\n}\n", stats->frame_slots, stats->variables);
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    return ok;
 }
 
-static void class_declaration(Parser* parser) {
-    enter_node(parser, "ClassDeclaration");
-    consume(parser, IDENTIFIER, "Expect class name.");
-    consume(parser, LEFT_BRACE, "Expect '{' before class body.");
-    while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-        if (match(parser, PUB) || match(parser, PRIV) || match(parser, PROT)) {}
-        
-        // Handle optional 'rdo'
-        if (check(parser, RESERVED_WORD) && strcmp(parser->current_token.lexeme, "rdo") == 0) {
-            advance(parser);
-        }
+// Runs one source file through every phase. Messages go to `diag`, or straight
+// to stdout/stderr when it is NULL. `execute` is false in batch mode, where
+// files are only checked; symbol tables are then written on the calling
+// thread, since the pool already keeps every core busy. `from`, when not
+// NULL, supplies the source text or the arenas, as server requests do.
+static CompileResult compile_file(const Options* options, const char* input_path, bool execute, Diagnostics* diag,
+                                  const CompileSource* from) {
+    CompileResult result = { COMPILE_FAILED, 0 };
+    CompileStats stats = {0};
 
-        if (match(parser, TYPE)) {}
-        else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) advance(parser);
-        else error(parser, "Expect type or void in class member.");
-        
-        consume(parser, IDENTIFIER, "Expect member name.");
-        
-        if (match(parser, LEFT_PAREN)) {
-            enter_node(parser, "MethodDeclaration");
-            if (!check(parser, RIGHT_PAREN)) {
-                do {
-                    if (match(parser, TYPE)) {}
-                    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) advance(parser);
-                    
-                    // Allow IDENTIFIER or KEYWORD (contextual) as argument name
-                    if (check(parser, IDENTIFIER) || check(parser, KEYWORD)) {
-                        advance(parser);
-                    } else {
-                        error(parser, "Expect argument name.");
-                    }
-                } while (match(parser, COMMA));
-            }
-            consume(parser, RIGHT_PAREN, "Expect ')' after arguments.");
-            consume(parser, LEFT_BRACE, "Expect '{' before method body.");
-            block(parser);
-            exit_node(parser, "MethodDeclaration");
-        } else if (match(parser, LEFT_BRACE)) {
-            enter_node(parser, "PropertyDeclaration");
-            while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-                if (match(parser, GET) || match(parser, SET) || match(parser, INIT)) {
-                    // Accessor body: { ... } or ;
-                    if (match(parser, LEFT_BRACE)) {
-                        while (!check(parser, RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
-                            statement(parser);
-                        }
-                        consume(parser, RIGHT_BRACE, "Expect '}' after accessor body.");
-                    } else {
-                        consume(parser, SEMICOLON, "Expect ';' after accessor (auto-implemented).");
-                    }
+    // 1. File Extension Check
+    if (!(from && from->text) && !has_cytho_suffix(input_path)) {
+        diag_error(diag, "Error: Invalid file type. Expected '.cytho' extension.\n");
+        return result;
+    }
+
+    // Read source file
+    size_t bytes_read = 0;
+    char* source;
+    phase_begin(&stats);
+    if (from && from->text) {
+        bytes_read = from->length;
+        source = malloc(bytes_read + 1);
+        memcpy(source, from->text, bytes_read);
+        source[bytes_read] = '\0';
+    } else {
+        source = read_source_file(input_path, &bytes_read);
+    }
+    phase_end(&stats, PHASE_READ);
+    stats.source_bytes = source ? bytes_read : 0;
+    if (!source) {
+        diag_error(diag, "Error: Cannot open file '%s'\n", input_path);
+        return result;
+    }
+
+    // 2. Lexical Analysis -> Generate Symbol Table File
+    char* symbol_table_path = path_with_suffix(input_path, ".symboltable.txt");
+    char* token_cache_path = path_with_suffix(input_path, ".cythotok");
+    char* parse_tree_path = path_with_suffix(input_path, options->binary_trace ? ".parsetrace" : ".parsetree.txt");
+    // A binary trace names its source; the hash must be taken before the source is dropped
+    uint64_t source_hash = options->parse_tree && options->binary_trace ? hash_source(source, bytes_read) : 0;
+    int lex_jobs = execute && options->jobs ? options->jobs : 1;
+
+    // One pool serves both passes, so re-reading the table re-uses the lexer's strings
+    Interner strings;
+    interner_init(&strings);
+    // Phase arenas: tokens die after parsing, the tree after execution. Warm
+    // ones, from a server worker, are reset rather than freed.
+    Arena local_token_arena = {0};
+    Arena local_ast_arena = {0};
+    bool warm = from && from->token_arena;
+    Arena* token_arena = warm ? from->token_arena : &local_token_arena;
+    Arena* ast_arena = warm ? from->ast_arena : &local_ast_arena;
+    TokenList symbols = {0};
+    TokenList tokens = {0};
+    symbols.arena = token_arena;
+    tokens.arena = token_arena;
+    Thread symbol_table_thread;
+    bool symbol_table_async = false;
+    SymbolTableJob symbol_table_job = { &symbols, &strings, symbol_table_path, true, 0 };
+    MappedFile token_cache = {0}; // Backs interned text after a cache hit
+
+    if (!options->direct) {
+        phase_begin(&stats);
+        lex_all_parallel(source, &strings, token_arena, lex_jobs, &symbols, NULL);
+        phase_end(&stats, PHASE_LEX);
+        phase_begin(&stats);
+        bool written = write_symbol_table(&symbols, &strings, symbol_table_path);
+        phase_end(&stats, PHASE_SYMBOL_TABLE_WRITE);
+        if (!written) {
+            diag_error(diag, "Error: Cannot create symbol table file '%s'\n", symbol_table_path);
+        }
+        diag_info(diag, "Lexical Analysis Complete. Symbol table written to: %s\n", symbol_table_path);
+    } else {
+        TokenList* want_symbols = options->symbol_table || options->token_cache ? &symbols : NULL;
+        phase_begin(&stats);
+        if (options->token_cache &&
+            load_token_cache(token_cache_path, source, bytes_read, &strings, &token_cache, want_symbols, &tokens)) {
+            diag_info(diag, "Token cache hit: %s (%d tokens)\n", token_cache_path, tokens.count);
+        } else {
+            lex_all_parallel(source, &strings, token_arena, lex_jobs, want_symbols, &tokens);
+            diag_info(diag, "Lexical Analysis Complete. %d tokens passed to the parser.\n", tokens.count);
+            if (options->token_cache) {
+                if (write_token_cache(&symbols, &strings, source, bytes_read, token_cache_path)) {
+                    diag_info(diag, "Token cache written to: %s\n", token_cache_path);
                 } else {
-                    error(parser, "Expect get, set, or init.");
-                    advance(parser);
+                    diag_error(diag, "Error: Cannot write token cache '%s'\n", token_cache_path);
                 }
             }
-            consume(parser, RIGHT_BRACE, "Expect '}' after property body.");
-            exit_node(parser, "PropertyDeclaration");
-        } else {
-            // Field Declaration
-            if (match(parser, EQUAL)) {
-                expression(parser);
+        }
+        phase_end(&stats, PHASE_LEX);
+        if (options->symbol_table) {
+            symbol_table_async = execute && thread_start(&symbol_table_thread, symbol_table_job_run, &symbol_table_job);
+            if (!symbol_table_async) {
+                phase_begin(&stats);
+                symbol_table_job_run(&symbol_table_job);
+                phase_end(&stats, PHASE_SYMBOL_TABLE_WRITE);
             }
-            consume(parser, SEMICOLON, "Expect ';' after field.");
+            diag_info(diag, "Writing symbol table to: %s\n", symbol_table_path);
         }
     }
-    consume(parser, RIGHT_BRACE, "Expect '}' after class body.");
-    exit_node(parser, "ClassDeclaration");
-}
 
-static void statement(Parser* parser) {
-    enter_node(parser, "Statement");
-    if (match(parser, PLUS_PLUS) || match(parser, MINUS_MINUS)) {
-        enter_node(parser, "IncrementStatement");
-        TokenType op = parser->previous_token.type;
-        consume(parser, IDENTIFIER, "Expect identifier after prefix operator.");
-        char name[64];
-        strncpy(name, parser->previous_token.lexeme, 63);
-        
-        if (parser->executing) {
-            Value v;
-            if (env_get(parser->env, name, &v)) {
-                if(op == PLUS_PLUS) v = val_add(v, make_int(1));
-                else v = val_sub(v, make_int(1));
-                env_assign(parser->env, name, v);
-            }
+    // Lexed and cached tokens slice `source`, so it lives as long as they do
+
+    // 3. Syntax Analysis -> Read Token Stream from Symbol Table
+    // Requirement: "Input: must be read one by one from the symbol table"
+    bool parse = true;
+    if (!options->direct) {
+        // The lexer's list is done with; drop it before reading the table back.
+        // The tokens read from the table slice their own copy of the raw text.
+        if (warm) arena_reset(token_arena);
+        else arena_free(token_arena);
+        free(source);
+        source = NULL;
+        phase_begin(&stats);
+        tokens = read_tokens_from_symbol_table(symbol_table_path, &strings, token_arena, diag);
+        phase_end(&stats, PHASE_SYMBOL_TABLE_READ);
+        if (tokens.count == 0 && tokens.types == NULL) {
+            diag_error(diag, "Error: Failed to read tokens from symbol table or empty file.\n");
+            parse = false;
+        } else {
+            diag_info(diag, "Read %d tokens from symbol table.\n", tokens.count);
         }
-        consume(parser, SEMICOLON, "Expect ';' after increment/decrement.");
-        exit_node(parser, "IncrementStatement");
-    }
-    else if (match(parser, TYPE)) declaration_statement(parser);
-    else if (check(parser, KEYWORD) && strcmp(parser->current_token.lexeme, "str") == 0) {
-        advance(parser);
-        declaration_statement(parser);
     }
-    else if (match(parser, SWITCH)) switch_statement(parser);
-    else if (match(parser, DO)) do_while_statement(parser);
-    else if (match(parser, NEXT)) next_statement(parser);
-    else if (match(parser, BREAK)) { consume(parser, SEMICOLON, "Expect ';' after break."); }
-    else if (match(parser, CLASS)) class_declaration(parser);
-    else if (match(parser, STRUCT)) struct_declaration(parser);
-    else if (match(parser, ENUM)) enum_declaration(parser);
-    else if (match(parser, RECORD)) record_declaration(parser);
-    else if ((check(parser, PUB) || check(parser, PRIV)) && parser->next_token.type == RECORD) {
-        advance(parser); 
-        advance(parser); 
-        record_declaration(parser);
+    if (parse && options->max_tokens && tokens.count > options->max_tokens) {
+        diag_error(diag, "Error: %d tokens is more than --max-tokens allows (%d).\n",
+                   tokens.count, options->max_tokens);
+        parse = false;
     }
-    else if (check(parser, RESERVED_WORD) || check(parser, KEYWORD)) {
-        if (strcmp(parser->current_token.lexeme, "while") == 0) { advance(parser); while_statement(parser); }
-        else if (strcmp(parser->current_token.lexeme, "for") == 0) { advance(parser); for_statement(parser); }
-        else if (strcmp(parser->current_token.lexeme, "foreach") == 0) { advance(parser); foreach_statement(parser); }
-        else if (strcmp(parser->current_token.lexeme, "if") == 0) {
-            enter_node(parser, "IfStatement");
-            advance(parser);
-            if (check(parser, NOISE_WORD) && strcmp(parser->current_token.lexeme, "at") == 0) advance(parser);
-            consume(parser, LEFT_PAREN, "Expect '(' after 'if'.");
-            Value cond = expression(parser);
-            consume(parser, RIGHT_PAREN, "Expect ')' after condition.");
-            if (check(parser, NOISE_WORD) && strcmp(parser->current_token.lexeme, "then") == 0) advance(parser);
-            
-            bool parent_exec = parser->executing;
-            bool b = (cond.type == VAL_BOOL) ? cond.as.bool_val : (cond.as.int_val != 0);
-            
-            parser->executing = parent_exec && b;
-            statement(parser);
-            parser->executing = parent_exec; 
-            
-            if (check(parser, RESERVED_WORD) && strcmp(parser->current_token.lexeme, "else") == 0) {
-                advance(parser);
-                parser->executing = parent_exec && !b;
-                statement(parser);
-                parser->executing = parent_exec;
+
+    // 4. Generate Parse Tree
+    if (parse) {
+        ParseTrace* trace = NULL;
+        if (options->parse_tree) {
+            FILE* output_file = fopen(parse_tree_path, options->binary_trace ? "wb" : "w");
+            if (!output_file) diag_error(diag, "Error: Cannot create output file '%s'\n", parse_tree_path);
+            else {
+                diag_info(diag, "Writing parse tree to: %s\n", parse_tree_path);
+                trace = trace_open(output_file, options->binary_trace, tokens.count, source_hash, bytes_read,
+                                   options->direct ? 0 : TRACE_FROM_SYMBOL_TABLE);
             }
-            exit_node(parser, "IfStatement");
-        } else if (strcmp(parser->current_token.lexeme, "return") == 0) {
-            enter_node(parser, "ReturnStatement");
-            advance(parser);
-            if (!check(parser, SEMICOLON)) expression(parser);
-            consume(parser, SEMICOLON, "Expect ';' after return value.");
-            exit_node(parser, "ReturnStatement");
-        } else if (strcmp(parser->current_token.lexeme, "input") == 0) {
-            advance(parser);
-            input_statement(parser);
-        } else if (strcmp(parser->current_token.lexeme, "print") == 0) {
-            advance(parser);
-            output_statement(parser);
-        } else if (strcmp(parser->current_token.lexeme, "let") == 0) {
-            enter_node(parser, "LetStatement");
-            advance(parser);
-            consume(parser, IDENTIFIER, "Expect variable name after 'let'.");
-            char name[64];
-            strncpy(name, parser->previous_token.lexeme, 63);
-            consume(parser, EQUAL, "Expect '=' after variable name.");
-            Value init = expression(parser);
-            consume(parser, SEMICOLON, "Expect ';' after let statement.");
-            if (parser->executing) env_define(&parser->env, name, init, false);
-            exit_node(parser, "LetStatement");
-        } else if (strcmp(parser->current_token.lexeme, "set") == 0) {
-            enter_node(parser, "SetStatement");
-            advance(parser);
-            consume(parser, IDENTIFIER, "Expect variable name after 'set'.");
-            char name[64];
-            strncpy(name, parser->previous_token.lexeme, 63);
-            consume(parser, EQUAL, "Expect '=' after variable name.");
-            Value rhs = expression(parser);
-            consume(parser, SEMICOLON, "Expect ';' after set statement.");
-            if (parser->executing) env_assign(parser->env, name, rhs);
-            exit_node(parser, "SetStatement");
-        } else if (strcmp(parser->current_token.lexeme, "var") == 0 || 
-                   strcmp(parser->current_token.lexeme, "const") == 0 ||
-                   strcmp(parser->current_token.lexeme, "dyn") == 0) {
-            advance(parser);
-            declaration_statement(parser);
-        } else {
-            error(parser, "Unexpected keyword at start of statement.");
-            advance(parser);
         }
-    } else if (match(parser, LEFT_BRACE)) {
-        block(parser);
-    } else if (match(parser, IDENTIFIER)) {
-        char name[64];
-        strncpy(name, parser->previous_token.lexeme, 63);
-        if (check(parser, EQUAL) || check(parser, PLUS_EQUAL) || check(parser, MINUS_EQUAL) ||
-            check(parser, STAR_EQUAL) || check(parser, SLASH_EQUAL) || check(parser, PERCENT_EQUAL)) {
-            assignment_statement(parser);
+
+        // Run Parser with Token List
+        phase_begin(&stats);
+        Parser* parser = parser_create(&tokens, &strings, ast_arena);
+        parser->trace = trace;
+        parser->diagnostics = diag;
+
+        Program* program = parser_parse(parser);
+        bool traced = trace_close(trace);
+        phase_end(&stats, PHASE_PARSE);
+        if (!traced) diag_error(diag, "Error: Cannot write parse tree '%s'\n", parse_tree_path);
+        result.status = parser->had_error ? COMPILE_SYNTAX_ERROR : COMPILE_OK;
+        result.tokens = tokens.count;
+        stats.tokens = tokens.count;
+        stats.recoveries = parser->recoveries;
+        stats.skipped_tokens = parser->skipped_tokens;
+        int line_count = tokens.count ? tokens.positions[tokens.count - 1].line + 1 : 1;
+
+        // The tree holds atoms and its own literals, so the tokens can go now
+        // unless the symbol table is still being written from them
+        if (!symbol_table_async) {
+            if (warm) arena_reset(token_arena);
+            else arena_free(token_arena);
+            free(source);
+            source = NULL;
         }
-        else if (check(parser, LEFT_PAREN)) {
-            enter_node(parser, "FunctionCall");
-            consume(parser, LEFT_PAREN, "Expect '(' after function name.");
-            if (!check(parser, RIGHT_PAREN)) expression(parser);
-            consume(parser, RIGHT_PAREN, "Expect ')' after arguments.");
-            consume(parser, SEMICOLON, "Expect ';' after function call.");
-            exit_node(parser, "FunctionCall");
-        } else if (check(parser, PLUS_PLUS) || check(parser, MINUS_MINUS)) {
-            enter_node(parser, "IncrementStatement");
-            TokenType op = parser->current_token.type;
-            advance(parser);
-            if (parser->executing) {
-                Value v;
-                if(env_get(parser->env, name, &v)) {
-                     Value new_val = (op == PLUS_PLUS) ? val_add(v, make_int(1)) : val_sub(v, make_int(1));
-                     env_assign(parser->env, name, new_val);
+
+        // 5. Resolve names and execute the tree (only if it parsed cleanly)
+        if (execute && !parser->had_error) {
+            output_open(options->unbuffered);
+            phase_begin(&stats);
+            stats.resolve = resolve_program(program);
+            phase_end(&stats, PHASE_RESOLVE);
+            if (options->opt_level > 0) {
+                phase_begin(&stats);
+                OptimizeStats optimized = optimize_program(program, ast_arena, options->opt_level);
+                phase_end(&stats, PHASE_OPTIMIZE);
+                diag_info(diag, "Optimized (-O%d): %d tree nodes -> %d\n",
+                          options->opt_level, optimized.nodes_before, optimized.nodes_after);
+            }
+            stats.variables = program->slot_count;
+            layout_frame(program);
+            stats.frame_slots = program->slot_count;
+            Profile* profile = options->profile ? profile_create(program, line_count, options->profile_counts) : NULL;
+            if (options->use_vm) {
+                Chunk chunk;
+                phase_begin(&stats);
+                compile_program(program, &chunk);
+                phase_end(&stats, PHASE_BYTECODE);
+                phase_begin(&stats);
+                vm_run(&chunk, options->jit && !profile, profile);
+                phase_end(&stats, PHASE_RUN);
+                chunk_free(&chunk);
+            } else {
+                phase_begin(&stats);
+                interpret(program, ast_arena, profile);
+                phase_end(&stats, PHASE_RUN);
+            }
+            if (profile) {
+                char* report_path = path_with_suffix(input_path, ".profile.txt");
+                char* folded_path = path_with_suffix(input_path, ".folded.txt");
+                if (write_profile(profile, input_path, report_path, folded_path)) {
+                    diag_info(diag, "Profile written to: %s and %s\n", report_path, folded_path);
+                } else {
+                    diag_error(diag, "Error: Cannot write profile '%s'\n", report_path);
                 }
+                free(report_path);
+                free(folded_path);
+                profile_free(profile);
             }
-            consume(parser, SEMICOLON, "Expect ';' after increment/decrement.");
-            exit_node(parser, "IncrementStatement");
+        }
+    }
+
+    // Cleanup
+    if (symbol_table_async) {
+        thread_join(symbol_table_thread);
+        stats.ran[PHASE_SYMBOL_TABLE_WRITE] = true;
+        stats.wall[PHASE_SYMBOL_TABLE_WRITE] = symbol_table_job.seconds;
+        stats.cpu[PHASE_SYMBOL_TABLE_WRITE] = -1;
+    }
+    if (!symbol_table_job.ok) diag_error(diag, "Error: Cannot create symbol table file '%s'\n", symbol_table_path);
+    if (options->stats) print_stats(diag, &stats, input_path);
+    if (options->stats_json) {
+        char* json_path = path_with_suffix(input_path, ".stats.json");
+        if (write_stats_json(&stats, input_path, result.status, json_path)) {
+            diag_info(diag, "Stats written to: %s\n", json_path);
         } else {
-            error(parser, "Unexpected identifier usage.");
+            diag_error(diag, "Error: Cannot write stats '%s'\n", json_path);
         }
+        free(json_path);
+    }
+    if (warm) {
+        arena_reset(token_arena);
+        arena_reset(ast_arena);
     } else {
-        if (parser->current_token.type != TOKEN_EOF) advance(parser);
+        arena_free(token_arena);
+        arena_free(ast_arena);
     }
-    if (parser->panic_mode) synchronize(parser);
-    exit_node(parser, "Statement");
+    free(source);
+    interner_free(&strings);
+    unmap_file(&token_cache);
+    free(symbol_table_path);
+    free(token_cache_path);
+    free(parse_tree_path);
+    return result;
 }
 
-void parser_parse(Parser* parser) {
-    printf("Starting Syntax Analysis...\n");
-    enter_node(parser, "Program");
-    while (parser->current_token.type != TOKEN_EOF) {
-        statement(parser);
+// --print-trace: replays <source>.parsetrace as the text tree on stdout. The
+// tokens are rebuilt the way the traced run got them, by lexing the source or
+// reading back its symbol table, and must match the trace's count.
+static bool print_parse_trace(const char* input_path) {
+    char* trace_path = path_with_suffix(input_path, ".parsetrace");
+    char* symbol_table_path = path_with_suffix(input_path, ".symboltable.txt");
+    size_t source_length = 0;
+    char* source = read_source_file(input_path, &source_length);
+    MappedFile file = {0};
+    Interner strings;
+    interner_init(&strings);
+    Arena arena = {0};
+    TokenList tokens = {0};
+    tokens.arena = &arena;
+    bool ok = false;
+
+    const ParseTraceHeader* header = NULL;
+    if (!source) fprintf(stderr, "Error: Cannot open file '%s'\n", input_path);
+    else if (!map_file(trace_path, &file)) fprintf(stderr, "Error: Cannot open parse trace '%s'\n", trace_path);
+    else {
+        header = (const ParseTraceHeader*)file.data;
+        if (file.size < sizeof(ParseTraceHeader) ||
+            memcmp(header->magic, PARSE_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != PARSE_TRACE_VERSION ||
+            (file.size - sizeof(ParseTraceHeader)) % sizeof(ParseTraceRecord) != 0) {
+            fprintf(stderr, "Error: '%s' is not a parse trace\n", trace_path);
+            header = NULL;
+        } else if (header->source_length != source_length ||
+                   header->source_hash != hash_source(source, source_length)) {
+            fprintf(stderr, "Error: '%s' was recorded from a different version of '%s'\n", trace_path, input_path);
+            header = NULL;
+        }
+    }
+    if (header) {
+        if (header->flags & TRACE_FROM_SYMBOL_TABLE) {
+            tokens = read_tokens_from_symbol_table(symbol_table_path, &strings, &arena, NULL);
+        } else {
+            lex_all(lexer_create(source, &strings, &arena), NULL, &tokens);
+        }
+        if ((uint32_t)tokens.count != header->token_count) {
+            fprintf(stderr, "Error: The tokens of '%s' no longer match the trace\n", input_path);
+            header = NULL;
+        }
     }
-    exit_node(parser, "Program");
-    if (!parser->had_error) printf("Syntax Analysis Complete: No errors found.\n");
-    else printf("Syntax Analysis Complete: Errors found.\n");
+    if (header) {
+        const ParseTraceRecord* records = (const ParseTraceRecord*)(header + 1);
+        size_t count = (file.size - sizeof(ParseTraceHeader)) / sizeof(ParseTraceRecord);
+        ParseTrace* out = trace_open(stdout, false, 0, 0, 0, 0);
+        ok = true;
+        for (size_t i = 0; ok && i < count; i++) {
+            const ParseTraceRecord* record = &records[i];
+            if (record->event == TRACE_TOKEN && record->token <= (uint32_t)tokens.count) {
+                Token token = token_at(&tokens, (int)record->token);
+                trace_text_token(out, token.type, atom_text(&strings, token.atom), (int)record->depth);
+            } else if ((record->event == TRACE_ENTER || record->event == TRACE_EXIT) && record->rule < RULE_COUNT) {
+                trace_text_node(out, record->event == TRACE_ENTER, (ParseRule)record->rule, (int)record->depth);
+            } else {
+                fprintf(stderr, "Error: Corrupt event %zu in '%s'\n", i, trace_path);
+                ok = false;
+            }
+        }
+        if (!trace_close(out)) ok = false;
+    }
+
+    arena_free(&arena);
+    interner_free(&strings);
+    unmap_file(&file);
+    free(source);
+    free(trace_path);
+    free(symbol_table_path);
+    return ok;
 }
 
-/* ============================================================================
- * SYMBOL TABLE OUTPUT
- * ============================================================================ */
+// --- Batch Mode ---
+// Each file is one task on the work-stealing pool, with its own interner,
+// arenas and buffered diagnostics; the keyword table and everything else
+// read-only is shared. Output is printed in input order once all are done.
 
-static void escape_for_output(const char* source, char* dest, size_t dest_size) {
-    size_t i = 0, j = 0;
-    while (source[i] && j < dest_size - 1) {
-        char c = source[i++];
-        if (c == '\n') {
-            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 'n'; }
-        } else if (c == '\r') {
-            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 'r'; }
-        } else if (c == '\t') {
-            if (j < dest_size - 2) { dest[j++] = '\\'; dest[j++] = 't'; }
-        } else {
-            dest[j++] = c;
+typedef struct {
+    const Options* options;
+    Diagnostics* diagnostics;
+    CompileResult* results;
+} BatchJob;
+
+static void batch_task(void* context, int index) {
+    BatchJob* job = context;
+    job->diagnostics[index].buffered = true;
+    job->results[index] = compile_file(job->options, job->options->inputs[index], false, &job->diagnostics[index], NULL);
+}
+
+static int compile_batch(const Options* options) {
+    int count = options->input_count;
+    int workers = options->jobs ? options->jobs : cpu_count();
+    if (workers > count) workers = count;
+    BatchJob job = { options, calloc(count, sizeof(Diagnostics)), calloc(count, sizeof(CompileResult)) };
+
+    double start = wall_seconds();
+    task_pool_run(count, workers, batch_task, &job);
+    double elapsed = wall_seconds() - start;
+
+    int clean = 0, syntax_errors = 0, failed = 0, errors = 0;
+    long total_tokens = 0;
+    for (int i = 0; i < count; i++) {
+        Diagnostics* diag = &job.diagnostics[i];
+        printf("== %s ==\n", options->inputs[i]);
+        if (diag->length) fwrite(diag->text, 1, diag->length, stdout);
+        switch (job.results[i].status) {
+            case COMPILE_OK: clean++; break;
+            case COMPILE_SYNTAX_ERROR: syntax_errors++; break;
+            case COMPILE_FAILED: failed++; break;
         }
+        errors += diag->errors;
+        total_tokens += job.results[i].tokens;
+        diag_free(diag);
     }
-    dest[j] = '\0';
+    printf("Batch complete: %d files on %d worker%s in %.3f s: %d clean, %d with syntax errors, "
+           "%d failed (%d errors), %ld tokens\n",
+           count, workers, workers == 1 ? "" : "s", elapsed, clean, syntax_errors, failed, errors, total_tokens);
+
+    free(job.diagnostics);
+    free(job.results);
+    return clean == count ? 0 : 1;
 }
 
-static void write_symbol_table(Lexer* lexer, const char* output_path) {
-    FILE* file = fopen(output_path, "w");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot create symbol table file '%s'\n", output_path);
-        return;
-    }
-    
-    fprintf(file, "CYTHONIC LEXICAL ANALYZER - SYMBOL TABLE\n");
-    fprintf(file, "========================================\n\n");
-    fprintf(file, "LINE | COL | TYPE              | LEXEME                        | RAW\n");
-    fprintf(file, "-----|-----|-------------------|-------------------------------|----------------------------------\n");
-    
-    char lexeme_buffer[1024];
-    char raw_buffer[1024];
-    int count = 0;
+// --- Compile Server ---
+// --server PATH listens on a Unix domain socket, so a stream of short scripts
+// costs one process start instead of one each. Worker threads, -j of them
+// (default: all cores), take turns accepting connections and serve each
+// one's requests in order, with arenas kept warm from one request to the
+// next. --client is the other end.
+//
+// Every message is a frame: a little-endian u32 size, then that many bytes.
+//   request:  u8 kind ('S' source text, 'P' a path the server reads, 'Q' stop
+//             the server), u8 SERVER_* flags, u8 -O level, u8 0,
+//             u32 name size, u32 input size, name, input, source ('S' only)
+//   response: u8 CompileStatus or SERVER_BAD_REQUEST, u8 0 x 3, u32 tokens,
+//             u32 output size, the program's output, then the messages
+// A source request compiles in memory under `name`, writing no files. A path
+// request compiles the file as the server's own command line would, symbol
+// table, parse tree and cache included. Either way `input` is what input()
+// reads, and --profile is left off: its sampler is process-wide.
+
+#define SERVER_RUN 1         // Execute, if it parses cleanly
+#define SERVER_VM 2
+#define SERVER_JIT 4
+#define SERVER_STATS 8
+#define SERVER_BAD_REQUEST 3
+#define SERVER_REQUEST_HEADER 12
+#define SERVER_RESPONSE_HEADER 12
+#define SERVER_MAX_REQUEST (64u << 20)   // Source text; a worker allocates it before a byte arrives
+#define SERVER_MAX_RESPONSE (1u << 30)  // Program output, read by a client from its own server
+
+#ifndef _WIN32
 
-    Token token = lexer_next_token(lexer);
-    while (token.type != TOKEN_EOF) {
-        escape_for_output(token.lexeme, lexeme_buffer, sizeof(lexeme_buffer));
-        escape_for_output(token.raw, raw_buffer, sizeof(raw_buffer));
+typedef struct {
+    const Options* options;   // The server's command line: what path requests compile with
+    int listener;
+    atomic_bool stopping;     // Set by a 'Q' request
+} Server;
 
-        fprintf(file, "%4d | %3d | %-17s | %-29s | %s\n",
-                token.line,
-                token.column,
-                token_type_to_string(token.type),
-                lexeme_buffer,
-                raw_buffer);
-        
-        if (token.lexeme) free(token.lexeme);
-        if (token.raw) free(token.raw);
-        
-        count++;
-        token = lexer_next_token(lexer);
+static uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(unsigned char* p, uint32_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+static bool read_fully(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
     }
-    if (token.lexeme) free(token.lexeme);
-    if (token.raw) free(token.raw);
-    
-    fprintf(file, "\nTotal tokens: %d\n", count);
-    fprintf(file, "END OF SYMBOL TABLE\n");
-    fclose(file);
+    return true;
 }
 
-/* ============================================================================
- * MAIN
- * ============================================================================ */
+static bool write_fully(int fd, const void* data, size_t length) {
+    const char* p = data;
+    while (length) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("Usage: %s <source-file.cytho>\n", argv[0]);
-        return 1;
+// A malloc'd frame body, NUL-terminated; NULL at the end of the stream, on a size over
+// `limit`, or when the body cannot be allocated
+static unsigned char* read_frame(int fd, uint32_t limit, uint32_t* size) {
+    unsigned char header[4];
+    if (!read_fully(fd, header, 4)) return NULL;
+    *size = get_u32(header);
+    if (*size > limit) return NULL;
+    unsigned char* body = malloc((size_t)*size + 1);
+    if (!body) return NULL;
+    if (!read_fully(fd, body, *size)) {
+        free(body);
+        return NULL;
     }
+    body[*size] = '\0';
+    return body;
+}
 
-    const char* suffix = ".cytho";
-    size_t input_len = strlen(argv[1]);
-    size_t suffix_len = strlen(suffix);
-    
-    // 1. File Extension Check
-    if (input_len < suffix_len || strcmp(argv[1] + input_len - suffix_len, suffix) != 0) {
-        fprintf(stderr, "Error: Invalid file type. Expected '.cytho' extension.\n");
-        return 1;
+static bool write_frame(int fd, const unsigned char* header, size_t header_size,
+                        const char* first, size_t first_size, const char* second, size_t second_size) {
+    unsigned char size[4];
+    put_u32(size, (uint32_t)(header_size + first_size + second_size));
+    return write_fully(fd, size, 4) && write_fully(fd, header, header_size) &&
+           write_fully(fd, first, first_size) && write_fully(fd, second, second_size);
+}
+
+static int unix_socket(const char* path, struct sockaddr_un* address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+        return -1;
     }
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) fprintf(stderr, "Error: Cannot create a socket: %s\n", strerror(errno));
+    return fd;
+}
 
-    // Read source file
-    FILE* file = fopen(argv[1], "r");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file '%s'\n", argv[1]);
-        return 1;
+// Serves one request from `client`; false once the connection is done with
+static bool server_serve(Server* server, int client, Arena* token_arena, Arena* ast_arena) {
+    uint32_t size;
+    unsigned char* request = read_frame(client, SERVER_MAX_REQUEST, &size);
+    if (!request) return false;
+    unsigned char response[SERVER_RESPONSE_HEADER] = { SERVER_BAD_REQUEST };
+    Diagnostics output = { true, NULL, 0, 0, 0 };
+    Diagnostics diag = { true, NULL, 0, 0, 0 };
+
+    uint32_t name_size = size >= SERVER_REQUEST_HEADER ? get_u32(request + 4) : 0;
+    uint32_t input_size = size >= SERVER_REQUEST_HEADER ? get_u32(request + 8) : 0;
+    bool valid = size >= SERVER_REQUEST_HEADER && name_size <= size - SERVER_REQUEST_HEADER &&
+                 input_size <= size - SERVER_REQUEST_HEADER - name_size;
+    char kind = valid ? (char)request[0] : 0;
+    if (kind == 'Q') {
+        atomic_store(&server->stopping, true);
+        shutdown(server->listener, SHUT_RDWR);
+        response[0] = COMPILE_OK;
+    } else if ((kind == 'S' || kind == 'P') && name_size > 0) {
+        unsigned flags = request[1];
+        char* name = malloc(name_size + 1);
+        memcpy(name, request + SERVER_REQUEST_HEADER, name_size);
+        name[name_size] = '\0';
+        const char* input = (const char*)request + SERVER_REQUEST_HEADER + name_size;
+        const char* text = input + input_size;
+
+        Options options = *server->options;
+        options.use_vm = (flags & (SERVER_VM | SERVER_JIT)) != 0;
+        options.jit = (flags & SERVER_JIT) != 0;
+        options.stats = (flags & SERVER_STATS) != 0;
+        options.opt_level = request[2] < 2 ? request[2] : 2;
+        options.profile = options.profile_counts = false;
+        options.unbuffered = false;
+        options.jobs = 0;     // The workers already use every core
+        if (kind == 'S') {
+            options.direct = true;
+            options.symbol_table = options.token_cache = options.parse_tree = false;
+            options.stats_json = false;
+        }
+        CompileSource from = { kind == 'S' ? text : NULL, (size_t)(request + size - (const unsigned char*)text),
+                               token_arena, ast_arena };
+
+        program_output.capture = &output;
+        input_open_text(input, input_size);
+        CompileResult result = compile_file(&options, name, (flags & SERVER_RUN) != 0, &diag, &from);
+        input_close();
+        program_output.capture = NULL;
+        response[0] = (unsigned char)result.status;
+        put_u32(response + 4, (uint32_t)result.tokens);
+        free(name);
     }
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char* source = malloc(file_size + 1);
-    size_t bytes_read = fread(source, 1, file_size, file);
-    source[bytes_read] = '\0';
-    fclose(file);
+    put_u32(response + 8, (uint32_t)output.length);
+    bool sent = write_frame(client, response, SERVER_RESPONSE_HEADER, output.text, output.length,
+                            diag.text, diag.length);
+    diag_free(&output);
+    diag_free(&diag);
+    free(request);
+    return sent && kind != 'Q' && response[0] != SERVER_BAD_REQUEST;
+}
 
-    // 2. Lexical Analysis -> Generate Symbol Table File
-    char symbol_table_path[256];
-    strncpy(symbol_table_path, argv[1], input_len);
-    symbol_table_path[input_len] = '\0';
-    strcat(symbol_table_path, ".symboltable.txt");
-    
-    Lexer* lexer_for_table = lexer_create(source);
-    write_symbol_table(lexer_for_table, symbol_table_path);
-    printf("Lexical Analysis Complete. Symbol table written to: %s\n", symbol_table_path);
-    
-    // Check if symbol table valid
-    // ...
+static void server_worker(void* arg) {
+    Server* server = arg;
+    Arena token_arena = {0};
+    Arena ast_arena = {0};
+    while (!atomic_load(&server->stopping)) {
+        int client = accept(server->listener, NULL, NULL);
+        if (client < 0) {
+            if (atomic_load(&server->stopping)) break;
+            // Out of descriptors, say: give the other connections time to finish
+            if (errno != EINTR && errno != ECONNABORTED) thread_sleep(10000);
+            continue;
+        }
+        while (server_serve(server, client, &token_arena, &ast_arena)) {}
+        close(client);
+    }
+    arena_free(&token_arena);
+    arena_free(&ast_arena);
+}
 
-    // Cleanup Lexer
-    free(lexer_for_table->trie);
-    free(lexer_for_table);
-    free(source); // Source no longer needed after Lexing phase
+static int run_server(const Options* options) {
+    struct sockaddr_un address;
+    int listener = unix_socket(options->server, &address);
+    if (listener < 0) return 1;
+    // A socket left behind by a server that did not shut down cleanly is
+    // replaced; one with a server still behind it is not
+    struct stat st;
+    if (stat(options->server, &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            fprintf(stderr, "Error: A server is already listening on '%s'\n", options->server);
+            close(listener);
+            return 1;
+        }
+        unlink(options->server);
+    }
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "Error: Cannot listen on '%s': %s\n", options->server, strerror(errno));
+        close(listener);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);   // A client gone mid-response fails the write instead
+
+    Server server = { options, listener, false };
+    int workers = options->jobs ? options->jobs : cpu_count();
+    Thread* threads = malloc(workers * sizeof(Thread));
+    int started = 0;
+    while (started < workers && thread_start(&threads[started], server_worker, &server)) started++;
+    printf("Serving on %s with %d worker%s\n", options->server, started, started == 1 ? "" : "s");
+    fflush(stdout);
+    if (started == 0) server_worker(&server);
+    for (int i = 0; i < started; i++) thread_join(threads[i]);
+    free(threads);
+    close(listener);
+    unlink(options->server);
+    return 0;
+}
 
-    // 3. Syntax Analysis -> Read Token Stream from Symbol Table
-    // Requirement: "Input: must be read one by one from the symbol table"
-    TokenList tokens = read_tokens_from_symbol_table(symbol_table_path);
-    if (tokens.count == 0 && tokens.tokens == NULL) {
-        fprintf(stderr, "Error: Failed to read tokens from symbol table or empty file.\n");
+// Sends each input to the server at --client and prints what comes back: the
+// program's output on stdout, messages on stderr. Standard input, unless it
+// is a terminal, is read once and given to every script.
+static int run_client(const Options* options) {
+    struct sockaddr_un address;
+    int fd = unix_socket(options->client, &address);
+    if (fd < 0) return 1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Cannot connect to '%s': %s\n", options->client, strerror(errno));
+        close(fd);
         return 1;
     }
-    printf("Read %d tokens from symbol table.\n", tokens.count);
+    signal(SIGPIPE, SIG_IGN);
 
-    // 4. Generate Parse Tree
-    char parse_tree_path[256];
-    strncpy(parse_tree_path, argv[1], input_len);
-    parse_tree_path[input_len] = '\0';
-    strcat(parse_tree_path, ".parsetree.txt");
-    
-    FILE* output_file = fopen(parse_tree_path, "w");
-    if (!output_file) fprintf(stderr, "Error: Cannot create output file '%s'\n", parse_tree_path);
-    else printf("Writing parse tree to: %s\n", parse_tree_path);
+    Diagnostics input = { true, NULL, 0, 0, 0 };
+    if (options->input_count && !isatty(STDIN_FILENO)) {
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) diag_write(&input, buffer, n);
+    }
+    unsigned flags = SERVER_RUN | (options->use_vm ? SERVER_VM : 0) | (options->jit ? SERVER_JIT : 0) |
+                     (options->stats ? SERVER_STATS : 0);
+    int status = 0;
+    for (int i = 0; i <= options->input_count; i++) {
+        const char* name = i < options->input_count ? options->inputs[i] : "";
+        if (i == options->input_count && !options->stop_server) break;
+        char kind = i == options->input_count ? 'Q' : options->send_paths ? 'P' : 'S';
+        size_t text_size = 0;
+        char* text = NULL;
+        if (kind == 'S' && !(text = read_source_file(name, &text_size))) {
+            fprintf(stderr, "Error: Cannot open file '%s'\n", name);
+            status = 1;
+            continue;
+        }
+        unsigned char header[SERVER_REQUEST_HEADER] = { (unsigned char)kind, (unsigned char)flags,
+                                                        (unsigned char)options->opt_level };
+        put_u32(header + 4, (uint32_t)strlen(name));
+        put_u32(header + 8, kind == 'Q' ? 0 : (uint32_t)input.length);
+        unsigned char size[4];
+        put_u32(size, (uint32_t)(SERVER_REQUEST_HEADER + strlen(name) + (kind == 'Q' ? 0 : input.length) + text_size));
+        bool sent = write_fully(fd, size, 4) && write_fully(fd, header, SERVER_REQUEST_HEADER) &&
+                    write_fully(fd, name, strlen(name)) &&
+                    write_fully(fd, input.text, kind == 'Q' ? 0 : input.length) && write_fully(fd, text, text_size);
+        free(text);
+        uint32_t response_size;
+        unsigned char* response = sent ? read_frame(fd, SERVER_MAX_RESPONSE, &response_size) : NULL;
+        if (!response || response_size < SERVER_RESPONSE_HEADER ||
+            get_u32(response + 8) > response_size - SERVER_RESPONSE_HEADER) {
+            fprintf(stderr, "Error: No response from '%s' for '%s'\n", options->client, name);
+            free(response);
+            status = 1;
+            break;
+        }
+        uint32_t output_size = get_u32(response + 8);
+        const unsigned char* output = response + SERVER_RESPONSE_HEADER;
+        fwrite(output, 1, output_size, stdout);
+        fflush(stdout);
+        fwrite(output + output_size, 1, response_size - SERVER_RESPONSE_HEADER - output_size, stderr);
+        if (response[0] == COMPILE_FAILED) status = 1;
+        if (response[0] == SERVER_BAD_REQUEST) {
+            fprintf(stderr, "Error: '%s' rejected the request for '%s'\n", options->client, name);
+            status = 1;
+        }
+        free(response);
+    }
+    diag_free(&input);
+    close(fd);
+    return status;
+}
 
-    // Run Parser with Token List
-    Parser* parser = parser_create(&tokens);
-    parser->output_file = output_file;
-    
-    parser_parse(parser);
+#else
 
-    // Cleanup
-    if (output_file) fclose(output_file);
-    free(parser);
+static int run_server(const Options* options) {
+    (void)options;
+    fprintf(stderr, "Error: --server needs Unix domain sockets, which this build lacks\n");
+    return 1;
+}
 
-    return 0;
+static int run_client(const Options* options) {
+    (void)options;
+    fprintf(stderr, "Error: --client needs Unix domain sockets, which this build lacks\n");
+    return 1;
+}
+
+#endif
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        options_free(&options);
+        return 1;
+    }
+    int status = 0;
+    if (options.print_trace) {
+        for (int i = 0; i < options.input_count; i++) {
+            if (!print_parse_trace(options.inputs[i])) status = 1;
+        }
+    }
+    else if (options.server) status = run_server(&options);
+    else if (options.client) status = run_client(&options);
+    else if (options.batch) status = compile_batch(&options);
+    else status = compile_file(&options, options.inputs[0], true, NULL, NULL).status == COMPILE_FAILED ? 1 : 0;
+    options_free(&options);
+    return status;
 }
+
+#endif // CYTHONIC_NO_MAIN
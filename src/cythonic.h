@@ -0,0 +1,102 @@
+/*
+ * CYTHONIC LIBRARY
+ * ================
+ *
+ * Keeps a script's tokens and syntax tree in memory for an editor, so each
+ * change costs work proportional to the edit rather than to the file. Build
+ * with `make lib` in src/ and link libcythonic.a (plus -pthread).
+ *
+ * A document is opened once from its text. Edits then name the range they
+ * replace, in 1-based lines and byte columns with the end exclusive, like a
+ * text editor's selection. The document re-lexes from the start of the first
+ * edited line until lexing lines up with the old tokens again. Only block
+ * comments and strings with escaped newlines carry from one line into the
+ * next, so that is nearly always the line after the edit. It then re-parses
+ * only the top-level statements whose tokens changed. Statements, tokens and
+ * diagnostics read back afterwards reflect the document's current text.
+ *
+ * Syntax errors are recovered from within the re-parsed statements. A change
+ * that opens or closes a construct (an `if` waiting for its body, a missing
+ * `}`) widens the re-parse until the result matches parsing the whole file.
+ *
+ * None of these functions are thread-safe on one document; separate
+ * documents may be used from separate threads. Text is copied on the way in.
+ * Pointers read back (token types, statement kinds, messages) stay valid
+ * until the next edit or cythonic_document_close.
+ */
+
+#ifndef CYTHONIC_H
+#define CYTHONIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct CythonicDocument CythonicDocument;
+
+typedef struct {
+    const char* type;    // As in the symbol table: "IDENTIFIER", "NUMBER", "COMMENT", ...
+    int line;            // 1-based
+    int column;          // 1-based, in bytes
+    int length;          // In bytes; a block comment may run onto later lines
+} CythonicToken;
+
+typedef struct {
+    const char* kind;    // "if", "while", "declaration", ...; "other" for type declarations and failed statements
+    int line;            // First line of the statement
+    int end_line;        // Last line
+} CythonicStatement;
+
+typedef struct {
+    int line;            // 1-based; errors at the end of the text report the last line
+    int column;
+    const char* message; // The compiler's message without its position: "Error at ';': ..."
+} CythonicDiagnostic;
+
+// What the last open or edit did
+typedef struct {
+    int lines_relexed;
+    int tokens_relexed;
+    int statements_reparsed;  // Top-level statements parsed again
+    int tokens_reparsed;
+    bool full_parse;          // The whole text was parsed (on open, or to reclaim memory)
+    double seconds;
+} CythonicEditStats;
+
+// `text` need not be NUL-terminated. NULL if out of memory.
+CythonicDocument* cythonic_document_open(const char* text, size_t length);
+void cythonic_document_close(CythonicDocument* doc);
+
+// Replaces [start_line:start_column, end_line:end_column) with `text`.
+// False, changing nothing, if the range is outside the document.
+bool cythonic_document_edit(CythonicDocument* doc, int start_line, int start_column,
+                            int end_line, int end_column, const char* text, size_t length);
+
+// The current text, NUL-terminated, in a buffer the caller frees.
+char* cythonic_document_text(const CythonicDocument* doc, size_t* length);
+int cythonic_document_line_count(const CythonicDocument* doc);
+
+// Tokens starting on `line`. Fills up to `capacity` and returns how many there are.
+int cythonic_document_tokens(const CythonicDocument* doc, int line, CythonicToken* out, int capacity);
+
+// Top-level statements in source order
+int cythonic_document_statement_count(const CythonicDocument* doc);
+bool cythonic_document_statement(const CythonicDocument* doc, int index, CythonicStatement* out);
+
+// Syntax errors in source order. Fills up to `capacity` and returns how many there are.
+int cythonic_document_diagnostics(const CythonicDocument* doc, CythonicDiagnostic* out, int capacity);
+
+void cythonic_document_last_edit(const CythonicDocument* doc, CythonicEditStats* out);
+
+// Resolves and runs the script as it stands, on the VM or the tree-walker.
+// Output goes to stdout. False if it has syntax errors.
+bool cythonic_document_run(CythonicDocument* doc, bool use_vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CYTHONIC_H
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Generates the keyword hash table in Cythonic.c.
+
+    python3 gen_keywords.py
+
+and paste the output over the generated block in the LEXER section. A
+keyword's slot is
+
+    (length + KEYWORD_FIRST[fold(first)] + KEYWORD_LAST[fold(last)]) & (KEYWORD_SLOTS - 1)
+
+where fold(c) = (c | 0x20) & 31, so case never changes the slot. The search
+assigns association values one character at a time, most used first, and
+backtracks as soon as two keywords share a slot; with 60 keywords it finds
+a collision-free 64-slot table.
+"""
+
+import random
+
+KEYWORDS = [
+    # Contextual keywords
+    ("and", "KEYWORD"), ("args", "KEYWORD"), ("async", "KEYWORD"), ("dyn", "KEYWORD"),
+    ("global", "KEYWORD"), ("input", "KEYWORD"), ("let", "KEYWORD"), ("nmof", "KEYWORD"),
+    ("nnull", "KEYWORD"), ("or", "KEYWORD"), ("print", "KEYWORD"), ("rec", "KEYWORD"),
+    ("stc", "KEYWORD"), ("str", "KEYWORD"), ("this", "KEYWORD"), ("val", "KEYWORD"),
+    ("var", "KEYWORD"),
+    # Tokens of their own
+    ("switch", "SWITCH"), ("case", "CASE"), ("default", "DEFAULT"), ("break", "BREAK"),
+    ("next", "NEXT"), ("do", "DO"), ("as", "AS"), ("class", "CLASS"), ("struct", "STRUCT"),
+    ("enum", "ENUM"), ("record", "RECORD"), ("pub", "PUB"), ("priv", "PRIV"), ("prot", "PROT"),
+    ("req", "REQ"), ("get", "GET"), ("set", "SET"), ("init", "INIT"),
+    # Reserved words
+    ("base", "RESERVED_WORD"), ("const", "RESERVED_WORD"), ("else", "RESERVED_WORD"),
+    ("for", "RESERVED_WORD"), ("foreach", "RESERVED_WORD"), ("if", "RESERVED_WORD"),
+    ("iface", "RESERVED_WORD"), ("in", "RESERVED_WORD"), ("new", "RESERVED_WORD"),
+    ("nspace", "RESERVED_WORD"), ("null", "RESERVED_WORD"), ("rdo", "RESERVED_WORD"),
+    ("return", "RESERVED_WORD"), ("use", "RESERVED_WORD"), ("while", "RESERVED_WORD"),
+    # Types
+    ("bool", "TYPE"), ("char", "TYPE"), ("double", "TYPE"), ("int", "TYPE"), ("void", "TYPE"),
+    # Boolean literals
+    ("false", "BOOLEAN_LITERAL"), ("true", "BOOLEAN_LITERAL"),
+    # Noise words
+    ("at", "NOISE_WORD"), ("its", "NOISE_WORD"), ("then", "NOISE_WORD"),
+]
+
+
+def fold(c):
+    return (ord(c) | 0x20) & 31
+
+
+def slot_of(text, first, last, size):
+    return (len(text) + first[fold(text[0])] + last[fold(text[-1])]) & (size - 1)
+
+
+def attempt(size, rng, budget=20000):
+    # Characters 0-31 index KEYWORD_FIRST, 32-63 KEYWORD_LAST
+    keys = [(len(t), fold(t[0]), 32 + fold(t[-1])) for t, _ in KEYWORDS]
+    uses = {}
+    for _, f, l in keys:
+        uses[f] = uses.get(f, 0) + 1
+        uses[l] = uses.get(l, 0) + 1
+    order = sorted(uses, key=lambda c: (-uses[c], rng.random()))
+    position = {c: i for i, c in enumerate(order)}
+    # A keyword's slot is known once the later of its two characters is set
+    ready = [[] for _ in order]
+    for key in keys:
+        ready[max(position[key[1]], position[key[2]])].append(key)
+
+    asso = [0] * 64
+    taken = set()
+    steps = [0]
+
+    def assign(i):
+        steps[0] += 1
+        if steps[0] > budget:
+            return False
+        if i == len(order):
+            return True
+        values = list(range(size))
+        rng.shuffle(values)
+        for value in values:
+            asso[order[i]] = value
+            slots = [(n + asso[f] + asso[l]) & (size - 1) for n, f, l in ready[i]]
+            if len(set(slots)) == len(slots) and not taken.intersection(slots):
+                taken.update(slots)
+                if assign(i + 1):
+                    return True
+                taken.difference_update(slots)
+        return False
+
+    return (asso[:32], asso[32:]) if assign(0) else None
+
+
+def search(size, rng, attempts=200):
+    for _ in range(attempts):
+        found = attempt(size, rng)
+        if found:
+            return found
+    return None
+
+
+def main():
+    rng = random.Random(1)
+    size = 64
+    found = search(size, rng)
+    while found is None:
+        size *= 2
+        found = search(size, rng)
+    first, last = found
+    slots = {slot_of(text, first, last, size): text for text, _ in KEYWORDS}
+    assert len(slots) == len(KEYWORDS)
+    kind = {text: kind for text, kind in KEYWORDS}
+
+    print("// --- generated by gen_keywords.py ---")
+    print("#define KEYWORD_SLOTS %d" % size)
+    print("#define KEYWORD_MAX_LENGTH %d" % max(len(t) for t, _ in KEYWORDS))
+    for name, table in (("KEYWORD_FIRST", first), ("KEYWORD_LAST", last)):
+        print("static const uint8_t %s[32] = {" % name)
+        for row in range(0, 32, 16):
+            print("    " + ", ".join("%2d" % v for v in table[row:row + 16]) + ",")
+        print("};")
+    print("static const Keyword KEYWORD_TABLE[KEYWORD_SLOTS] = {")
+    for slot in range(size):
+        text = slots.get(slot)
+        if text is None:
+            continue
+        print('    [%2d] = { "%s", %d, %s, ATOM_%s },' % (slot, text, len(text), kind[text], text.upper()))
+    print("};")
+    print("// --- end of generated table ---")
+
+
+if __name__ == "__main__":
+    main()